@@ -0,0 +1,429 @@
+#include "assembler.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <charconv>
+
+namespace {
+
+constexpr size_t kMaxOperands = 3;
+
+struct Mnemonic {
+  std::string_view name;
+  InstructionOp instruction_op;
+  size_t operand_num;
+};
+
+constexpr Mnemonic kMnemonics[] = {
+    {"lw", InstructionOp::LOAD, 3},   {"sw", InstructionOp::STORE, 3},
+    {"addi", InstructionOp::ADDI, 3}, {"subi", InstructionOp::SUBI, 3},
+    {"add", InstructionOp::ADD, 3},   {"sub", InstructionOp::SUB, 3},
+    {"mul", InstructionOp::MUL, 3},   {"div", InstructionOp::DIV, 3},
+    {"beqz", InstructionOp::BEQZ, 2}, {"bnez", InstructionOp::BNEZ, 2},
+};
+
+struct Token {
+  std::string_view text;
+  size_t line;
+  size_t column;
+};
+
+// branch target, resolved once all labels are known
+struct LabelFixup {
+  uint32_t inst_idx;
+  uint64_t label_hash;
+  Token label;
+};
+
+// Open-addressing hash table from name to value. Keys are views into the
+// source, and the stored hash avoids touching them on most probes, which
+// matters for programs with hundreds of thousands of labels.
+template <typename Value> class NameTable {
+public:
+  struct Slot {
+    uint64_t hash;
+    std::string_view name;
+    Value value;
+    bool used;
+  };
+
+  // return the slot of name, and whether it has just been added
+  std::pair<Slot *, bool> FindOrInsert(std::string_view name) {
+    if ((used_num_ + 1) * 2 > slots_.size()) {
+      Grow();
+    }
+    uint64_t hash = Hash(name);
+    Slot *slot = Probe(hash, name);
+    if (slot->used) {
+      return {slot, false};
+    }
+    *slot = {hash, name, Value{}, true};
+    ++used_num_;
+    return {slot, true};
+  }
+
+  // return nullptr if name is absent
+  const Slot *Find(std::string_view name) const {
+    return Find(Hash(name), name);
+  }
+  const Slot *Find(uint64_t hash, std::string_view name) const {
+    if (slots_.empty()) {
+      return nullptr;
+    }
+    const Slot *slot = const_cast<NameTable *>(this)->Probe(hash, name);
+    return slot->used ? slot : nullptr;
+  }
+
+  // hint that the slot for hash will be probed soon
+  void Prefetch(uint64_t hash) const {
+    if (!slots_.empty()) {
+      __builtin_prefetch(&slots_[hash & (slots_.size() - 1)]);
+    }
+  }
+
+  static uint64_t Hash(std::string_view name) {
+    uint64_t hash = 14695981039346656037ull; // FNV-1a
+    for (char ch : name) {
+      hash = (hash ^ static_cast<unsigned char>(ch)) * 1099511628211ull;
+    }
+    return hash;
+  }
+
+  template <typename Visitor> void ForEach(Visitor visitor) const {
+    for (const Slot &slot : slots_) {
+      if (slot.used) {
+        visitor(slot.name, slot.value);
+      }
+    }
+  }
+
+private:
+  Slot *Probe(uint64_t hash, std::string_view name) {
+    size_t mask = slots_.size() - 1;
+    for (size_t slot_idx = hash & mask;; slot_idx = (slot_idx + 1) & mask) {
+      Slot &slot = slots_[slot_idx];
+      if (!slot.used || (slot.hash == hash && slot.name == name)) {
+        return &slot;
+      }
+    }
+  }
+
+  void Grow() {
+    std::vector<Slot> old_slots(std::max<size_t>(64, slots_.size() * 2));
+    old_slots.swap(slots_);
+    for (const Slot &old_slot : old_slots) {
+      if (old_slot.used) {
+        *Probe(old_slot.hash, old_slot.name) = old_slot;
+      }
+    }
+  }
+
+  std::vector<Slot> slots_;
+  size_t used_num_{0};
+};
+
+class AssemblerImpl {
+public:
+  AssemblerImpl(std::string_view source, Program &program,
+                AssemblerError &error)
+      : source_(source), program_(program), error_(error) {}
+
+  bool Run();
+
+private:
+  bool Fail(const Token &token, std::string message) {
+    error_.line = token.line;
+    error_.column = token.column;
+    error_.message = std::move(message);
+    return false;
+  }
+
+  // skip blanks and comments; newlines only if cross_lines
+  void SkipSpace(bool cross_lines) {
+    while (pos_ < source_.size()) {
+      char ch = source_[pos_];
+      if (ch == '\n') {
+        if (!cross_lines) {
+          return;
+        }
+        ++line_;
+        line_start_ = ++pos_;
+      } else if (ch == ' ' || ch == '\t' || ch == '\r') {
+        ++pos_;
+      } else if (ch == '#') {
+        while (pos_ < source_.size() && source_[pos_] != '\n') {
+          ++pos_;
+        }
+      } else {
+        return;
+      }
+    }
+  }
+
+  // next token up to white space, a comment or, if stop_at_comma, a comma
+  Token NextToken(bool stop_at_comma) {
+    size_t begin = pos_;
+    while (pos_ < source_.size()) {
+      char ch = source_[pos_];
+      if (ch == ' ' || ch == '\t' || ch == '\r' || ch == '\n' || ch == '#' ||
+          (stop_at_comma && ch == ',')) {
+        break;
+      }
+      ++pos_;
+    }
+    return {source_.substr(begin, pos_ - begin), line_, begin - line_start_ + 1};
+  }
+
+  bool AtLineEnd() {
+    SkipSpace(false);
+    return pos_ >= source_.size() || source_[pos_] == '\n';
+  }
+
+  template <typename T> static bool ParseInteger(std::string_view text, T &value) {
+    const char *begin = text.data();
+    const char *end = text.data() + text.size();
+    if (begin != end && *begin == '+') {
+      ++begin;
+    }
+    auto [ptr, ec] = std::from_chars(begin, end, value);
+    return ec == std::errc() && ptr == end && begin != end;
+  }
+
+  bool ParseRegister(const Token &token, size_t &reg) {
+    if (token.text.size() < 2 || (token.text[0] != 'r' && token.text[0] != 'R') ||
+        !ParseInteger(token.text.substr(1), reg) || reg >= 32) {
+      return Fail(token, "expected a register r0..r31, found '" +
+                             std::string(token.text) + "'");
+    }
+    return true;
+  }
+
+  bool ParseData(const Token &symbol);
+  bool ParseInstruction(const Token &op_token);
+
+  std::string_view source_;
+  Program &program_;
+  AssemblerError &error_;
+  size_t pos_{0};
+  size_t line_{1};
+  size_t line_start_{0};
+  NameTable<size_t> symbols_;
+  NameTable<uint32_t> labels_;
+  std::vector<LabelFixup> fixups_;
+};
+
+bool AssemblerImpl::ParseData(const Token &symbol) {
+  if (symbol.text.size() < 2 || symbol.text.back() != ':') {
+    return Fail(symbol, "expected 'symbol:' in .data, found '" +
+                            std::string(symbol.text) + "'");
+  }
+  std::string_view name = symbol.text.substr(0, symbol.text.size() - 1);
+  auto [slot, inserted] = symbols_.FindOrInsert(name);
+  if (!inserted) {
+    return Fail(symbol, "data symbol '" + std::string(name) +
+                            "' is already defined");
+  }
+  slot->value = program_.init_memory.size();
+  SkipSpace(true);
+  Token value = NextToken(false);
+  long word;
+  if (!ParseInteger(value.text, word)) {
+    return Fail(value, "expected an integer value for '" + std::string(name) +
+                           "', found '" + std::string(value.text) + "'");
+  }
+  program_.init_memory.push_back(word);
+  return true;
+}
+
+bool AssemblerImpl::ParseInstruction(const Token &op_token) {
+  const Mnemonic *mnemonic = nullptr;
+  for (const Mnemonic &candidate : kMnemonics) {
+    if (candidate.name == op_token.text) {
+      mnemonic = &candidate;
+      break;
+    }
+  }
+  if (mnemonic == nullptr) {
+    return Fail(op_token,
+                "unknown instruction '" + std::string(op_token.text) + "'");
+  }
+  Token operands[kMaxOperands];
+  for (size_t opnd_idx = 0; opnd_idx < mnemonic->operand_num; ++opnd_idx) {
+    if (opnd_idx > 0) {
+      SkipSpace(false);
+      if (pos_ >= source_.size() || source_[pos_] != ',') {
+        return Fail(NextToken(true), "expected ',' before operand " +
+                                         std::to_string(opnd_idx + 1) +
+                                         " of " + std::string(op_token.text));
+      }
+      ++pos_;
+    }
+    SkipSpace(false);
+    operands[opnd_idx] = NextToken(true);
+    if (operands[opnd_idx].text.empty()) {
+      return Fail(operands[opnd_idx],
+                  std::string(op_token.text) + " expects " +
+                      std::to_string(mnemonic->operand_num) + " operands");
+    }
+  }
+  if (!AtLineEnd()) {
+    return Fail(NextToken(false), "unexpected text after " +
+                                      std::string(op_token.text) + " operands");
+  }
+
+  uint32_t inst_idx = program_.instructions.size();
+  size_t rd, rs;
+  if (!ParseRegister(operands[0], rd)) {
+    return false;
+  }
+  switch (mnemonic->instruction_op) {
+  case InstructionOp::LOAD:
+  case InstructionOp::STORE: {
+    if (!ParseRegister(operands[1], rs)) {
+      return false;
+    }
+    int offset;
+    if (const auto *symbol = symbols_.Find(operands[2].text)) {
+      offset = symbol->value;
+    } else if (!ParseInteger(operands[2].text, offset)) {
+      return Fail(operands[2], "unknown data symbol '" +
+                                   std::string(operands[2].text) + "'");
+    }
+    program_.instructions.emplace_back(mnemonic->instruction_op, rd, rs,
+                                       offset);
+    break;
+  }
+  case InstructionOp::ADDI:
+  case InstructionOp::SUBI: {
+    int imm;
+    if (!ParseRegister(operands[1], rs)) {
+      return false;
+    }
+    if (!ParseInteger(operands[2].text, imm)) {
+      return Fail(operands[2], "expected an integer immediate, found '" +
+                                   std::string(operands[2].text) + "'");
+    }
+    program_.instructions.emplace_back(mnemonic->instruction_op, rd, rs, imm);
+    break;
+  }
+  case InstructionOp::ADD:
+  case InstructionOp::SUB:
+  case InstructionOp::MUL:
+  case InstructionOp::DIV: {
+    size_t rt;
+    if (!ParseRegister(operands[1], rs) || !ParseRegister(operands[2], rt)) {
+      return false;
+    }
+    program_.instructions.emplace_back(mnemonic->instruction_op, rd, rs, rt);
+    break;
+  }
+  case InstructionOp::BEQZ:
+  case InstructionOp::BNEZ: {
+    fixups_.push_back(
+        {inst_idx, NameTable<uint32_t>::Hash(operands[1].text), operands[1]});
+    program_.instructions.emplace_back(mnemonic->instruction_op, rd, -1, -1);
+    break;
+  }
+  }
+
+  if (mnemonic->operand_num == 2) {
+    program_.instruction_text.Append({op_token.text, "\t", operands[0].text,
+                                      ",", operands[1].text});
+  } else {
+    program_.instruction_text.Append({op_token.text, "\t", operands[0].text,
+                                      ",", operands[1].text, ",",
+                                      operands[2].text});
+  }
+  return true;
+}
+
+bool AssemblerImpl::Run() {
+  program_ = Program{};
+  // upper bounds: at most one instruction per line, and the text of an
+  // instruction is never longer than its source; untouched capacity costs
+  // no physical memory
+  size_t line_num = std::count(source_.begin(), source_.end(), '\n') + 1;
+  program_.instructions.reserve(line_num);
+  program_.instruction_text.Reserve(line_num, source_.size());
+  bool in_data = false;
+  for (SkipSpace(true); pos_ < source_.size(); SkipSpace(true)) {
+    Token token = NextToken(false);
+    if (token.text == ".data" || token.text == ".text") {
+      in_data = token.text == ".data";
+    } else if (in_data) {
+      if (!ParseData(token)) {
+        return false;
+      }
+    } else if (token.text.back() == ':') {
+      std::string_view name = token.text.substr(0, token.text.size() - 1);
+      auto [label, inserted] = labels_.FindOrInsert(name);
+      if (name.empty() || !inserted) {
+        return Fail(token, "label '" + std::string(name) +
+                               "' is empty or already defined");
+      }
+      label->value = program_.instructions.size();
+    } else if (!ParseInstruction(token)) {
+      return false;
+    }
+  }
+  // the table is much larger than the cache for big programs, so look a
+  // few fix-ups ahead
+  constexpr size_t kPrefetchDistance = 8;
+  for (size_t fixup_idx = 0; fixup_idx < fixups_.size(); ++fixup_idx) {
+    if (fixup_idx + kPrefetchDistance < fixups_.size()) {
+      labels_.Prefetch(fixups_[fixup_idx + kPrefetchDistance].label_hash);
+    }
+    const LabelFixup &fixup = fixups_[fixup_idx];
+    const auto *label = labels_.Find(fixup.label_hash, fixup.label.text);
+    if (label == nullptr) {
+      return Fail(fixup.label,
+                  "undefined label '" + std::string(fixup.label.text) + "'");
+    }
+    program_.instructions[fixup.inst_idx].rs_or_label_ = label->value;
+  }
+  symbols_.ForEach([this](std::string_view name, size_t address) {
+    program_.symbol_to_memory.emplace(name, address);
+  });
+  labels_.ForEach([this](std::string_view name, uint32_t inst_idx) {
+    program_.label_to_inst_idx.emplace(name, inst_idx);
+  });
+  return true;
+}
+
+} // namespace
+
+bool Assemble(std::string_view source, Program &program,
+              AssemblerError &error) {
+  return AssemblerImpl(source, program, error).Run();
+}
+
+bool AssembleFile(const char *path, Program &program, AssemblerError &error) {
+  int fd = open(path, O_RDONLY);
+  struct stat source_stat;
+  if (fd < 0 || fstat(fd, &source_stat) != 0) {
+    if (fd >= 0) {
+      close(fd);
+    }
+    error = {0, 0, "cannot open " + std::string(path)};
+    return false;
+  }
+  size_t size = source_stat.st_size;
+  if (size == 0) {
+    close(fd);
+    return Assemble(std::string_view(), program, error);
+  }
+  void *data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    error = {0, 0, "cannot map " + std::string(path)};
+    return false;
+  }
+  bool assembled = Assemble(
+      std::string_view(static_cast<const char *>(data), size), program, error);
+  munmap(data, size);
+  return assembled;
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include "instruction.h"
+
+// Assembler for the simulator's MIPS subset, built as its own library.
+//
+// Source format:
+//   .data
+//   Symbol:  value        one data word per symbol, in address order
+//   .text
+//   label:                labels may share a line with an instruction
+//   op  operand,operand   see instruction.h for the operands of each op
+// Tokens are separated by white space, operands by commas; '#' starts a
+// comment running to the end of the line. lw/sw take a data symbol or an
+// integer as offset, branch labels may be defined after their use.
+
+struct AssemblerError {
+  size_t line{0};   // 1-based, 0 if not tied to a source position
+  size_t column{0}; // 1-based
+  std::string message;
+};
+
+// Assemble source into program in one scan plus one label fix-up pass. The
+// instruction text is interned in one arena and no copy of source is kept.
+// Return false and describe the first problem in error.
+bool Assemble(std::string_view source, Program &program,
+              AssemblerError &error);
+
+// memory-map the file at path and assemble it
+bool AssembleFile(const char *path, Program &program, AssemblerError &error);
@@ -0,0 +1,348 @@
+// Throughput benchmark: generate the synthetic workload suite, run each
+// workload under every engine configuration and report host nanoseconds per
+// simulated cycle and per retired instruction. Always built optimized, see
+// CMakeLists.txt. With --baseline, a run slower than a previous CSV by more
+// than --tolerance percent fails, so regressions of the simulator's own
+// speed show up.
+
+#include "assembler.h"
+#include "command_line.h"
+#include "lockstep.h"
+#include "simulator.h"
+#include "workload.h"
+
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <sstream>
+
+struct EngineConfig {
+  const char *name;
+  bool functional;
+  bool forwarding;
+  bool cache_and_predictor; // 256-word L1 and 2-bit predictor
+  bool history;
+  bool profile; // per-instruction statistics
+  size_t lanes;  // > 0: LockstepBatch over this many copies of the data
+  bool interpret; // functional engine without block translation
+  size_t issue_width; // in-order pipeline issuing this many per cycle
+  bool ooo;       // the out-of-order core of tomasulo.h, default config
+};
+
+static const EngineConfig kEngines[] = {
+    {"interpreter", true, false, false, false, false, 0, true, 1, false},
+    {"functional", true, false, false, false, false, 0, false, 1, false},
+    {"lockstep x64", true, false, false, false, false, 64, false, 1, false},
+    {"pipeline", false, false, false, false, false, 0, false, 1, false},
+    {"forwarding", false, true, false, false, false, 0, false, 1, false},
+    {"forwarding+cache+2bit", false, true, true, false, false, 0, false, 1,
+     false},
+    {"forwarding+history", false, true, false, true, false, 0, false, 1,
+     false},
+    {"forwarding+profile", false, true, false, false, true, 0, false, 1,
+     false},
+    {"forwarding+issue 2", false, true, false, false, false, 0, false, 2,
+     false},
+    {"ooo", false, false, false, false, false, 0, false, 1, true},
+};
+
+struct BenchmarkOptions {
+  size_t scale{1};
+  size_t repeat{3};
+  std::string filter;
+  const char *emit_dir{nullptr};
+  bool csv{false};
+  const char *output_path{nullptr};
+  const char *baseline_path{nullptr};
+  double tolerance{10.0};
+};
+
+struct BenchmarkResult {
+  std::string workload;
+  std::string engine;
+  size_t cycles;
+  size_t instructions;
+  double seconds; // best of the repetitions
+};
+
+static void PrintBenchmarkUsage() {
+  std::cerr
+      << "Usage: ./Benchmark [options]\n"
+      << "  --scale <n>          multiply the outer loop iterations of every "
+         "workload (default: 1)\n"
+      << "  --repeat <n>         report the best of n runs (default: 3)\n"
+      << "  --filter <text>      only workloads whose name contains text\n"
+      << "  --emit <dir>         also write the generated programs to "
+         "dir/<workload>.S\n"
+      << "  --csv                print CSV instead of a table\n"
+      << "  --output <file>      write the report to a file\n"
+      << "  --baseline <csv>     compare ns/instruction with a previous CSV "
+         "report and fail on regressions\n"
+      << "  --tolerance <pct>    allowed slowdown against the baseline "
+         "(default: 10)\n";
+}
+
+static void ExitWithUsage(const std::string &message) {
+  std::cerr << message << '\n';
+  PrintBenchmarkUsage();
+  exit(-1);
+}
+
+static BenchmarkOptions ParseCommandLine(int argc, char **argv) {
+  BenchmarkOptions options;
+  for (int arg_idx = 1; arg_idx < argc; ++arg_idx) {
+    std::string arg = argv[arg_idx];
+    if (arg == "--csv") {
+      options.csv = true;
+      continue;
+    }
+    if (arg_idx + 1 >= argc) {
+      ExitWithUsage("Unknown option or missing value: " + arg);
+    }
+    std::string value = argv[++arg_idx];
+    if (arg == "--scale") {
+      if (!ParseSize(value, options.scale) || options.scale == 0) {
+        ExitWithUsage("Invalid scale: " + value);
+      }
+    } else if (arg == "--repeat") {
+      if (!ParseSize(value, options.repeat) || options.repeat == 0) {
+        ExitWithUsage("Invalid repeat count: " + value);
+      }
+    } else if (arg == "--filter") {
+      options.filter = value;
+    } else if (arg == "--emit") {
+      options.emit_dir = argv[arg_idx];
+    } else if (arg == "--output") {
+      options.output_path = argv[arg_idx];
+    } else if (arg == "--baseline") {
+      options.baseline_path = argv[arg_idx];
+    } else if (arg == "--tolerance") {
+      char *end = nullptr;
+      options.tolerance = std::strtod(value.c_str(), &end);
+      if (*end != '\0' || options.tolerance < 0) {
+        ExitWithUsage("Invalid tolerance: " + value);
+      }
+    } else {
+      ExitWithUsage("Unknown option: " + arg);
+    }
+  }
+  return options;
+}
+
+// instructions are counted over all lanes
+static BenchmarkResult RunLockstep(const Program &program,
+                                   const std::string &workload,
+                                   const EngineConfig &engine, size_t repeat) {
+  BenchmarkResult result{workload, engine.name, 0, 0, 0.0};
+  std::vector<std::vector<long>> lane_memory(engine.lanes,
+                                             program.init_memory);
+  for (size_t run = 0; run < repeat; ++run) {
+    LockstepBatch batch(program, lane_memory);
+    auto start = std::chrono::steady_clock::now();
+    batch.Run();
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    result.instructions = 0;
+    for (size_t lane = 0; lane < batch.LaneNum(); ++lane) {
+      result.instructions += batch.InstructionCount(lane);
+    }
+    if (run == 0 || elapsed.count() < result.seconds) {
+      result.seconds = elapsed.count();
+    }
+  }
+  return result;
+}
+
+static BenchmarkResult RunEngine(const Program &program,
+                                 const std::string &workload,
+                                 const EngineConfig &engine, size_t repeat) {
+  if (engine.lanes != 0) {
+    return RunLockstep(program, workload, engine, repeat);
+  }
+  BenchmarkResult result{workload, engine.name, 0, 0, 0.0};
+  for (size_t run = 0; run < repeat; ++run) {
+    Simulator sim(program, engine.forwarding);
+    sim.SetVerbose(false);
+    sim.SetHistoryEnabled(engine.history);
+    sim.SetBlockTranslation(!engine.interpret);
+    sim.SetStatisticsLevel(engine.profile ? StatisticsLevel::PER_INSTRUCTION
+                                          : StatisticsLevel::TOTALS);
+    if (engine.cache_and_predictor) {
+      sim.SetDataCache(CacheConfig{});
+      sim.SetBranchPredictor(BranchPredictorConfig{});
+    }
+    if (engine.issue_width > 1) {
+      IssueConfig issue;
+      issue.width = engine.issue_width;
+      issue.alu_ops = engine.issue_width;
+      sim.SetIssueConfig(issue);
+    }
+    if (engine.ooo) {
+      sim.SetOutOfOrder(TomasuloConfig{});
+    }
+    auto start = std::chrono::steady_clock::now();
+    if (engine.functional) {
+      sim.RunFunctional();
+    } else {
+      sim.RunSilently(std::numeric_limits<size_t>::max());
+    }
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    SimulatorStatistics stats = sim.GetStatistics();
+    result.cycles = stats.cycle_clocks;
+    result.instructions =
+        stats.retired_instructions + stats.functional_instructions;
+    if (run == 0 || elapsed.count() < result.seconds) {
+      result.seconds = elapsed.count();
+    }
+  }
+  return result;
+}
+
+static double NsPer(double seconds, size_t count) {
+  return count == 0 ? 0.0 : seconds * 1e9 / count;
+}
+
+static void WriteReport(std::ostream &out,
+                        const std::vector<BenchmarkResult> &results,
+                        bool csv) {
+  if (csv) {
+    out << "workload,engine,cycles,instructions,seconds,ns_per_cycle,"
+           "ns_per_instruction\n";
+  } else {
+    out << std::left << std::setw(18) << "workload" << std::setw(24)
+        << "engine" << std::right << std::setw(12) << "cycles"
+        << std::setw(14) << "instructions" << std::setw(12) << "ns/cycle"
+        << std::setw(12) << "ns/instr" << '\n';
+  }
+  for (const BenchmarkResult &result : results) {
+    double ns_per_cycle = NsPer(result.seconds, result.cycles);
+    double ns_per_instruction = NsPer(result.seconds, result.instructions);
+    if (csv) {
+      out << result.workload << ',' << result.engine << ',' << result.cycles
+          << ',' << result.instructions << ',' << result.seconds << ','
+          << ns_per_cycle << ',' << ns_per_instruction << '\n';
+    } else {
+      // the functional engine has no cycles
+      std::ostringstream cycles;
+      std::ostringstream per_cycle;
+      if (result.cycles == 0) {
+        cycles << '-';
+        per_cycle << '-';
+      } else {
+        cycles << result.cycles;
+        per_cycle << std::fixed << std::setprecision(2) << ns_per_cycle;
+      }
+      out << std::left << std::setw(18) << result.workload << std::setw(24)
+          << result.engine << std::right << std::setw(12) << cycles.str()
+          << std::setw(14) << result.instructions << std::setw(12)
+          << per_cycle.str() << std::fixed << std::setprecision(2)
+          << std::setw(12) << ns_per_instruction << '\n'
+          << std::defaultfloat;
+    }
+  }
+}
+
+// workload,engine -> ns_per_instruction of a CSV report
+static bool ReadBaseline(const char *path,
+                         std::map<std::string, double> &baseline) {
+  std::ifstream fin(path);
+  if (!fin) {
+    std::cerr << "Cannot open baseline: " << path << '\n';
+    return false;
+  }
+  std::string line;
+  std::getline(fin, line); // header
+  while (std::getline(fin, line)) {
+    std::vector<std::string> fields;
+    std::stringstream stream(line);
+    std::string field;
+    while (std::getline(stream, field, ',')) {
+      fields.push_back(field);
+    }
+    if (fields.size() != 7) {
+      std::cerr << "Malformed baseline line: " << line << '\n';
+      return false;
+    }
+    baseline[fields[0] + ',' + fields[1]] = std::strtod(fields[6].c_str(),
+                                                        nullptr);
+  }
+  return true;
+}
+
+// return the number of results slower than the baseline by more than
+// tolerance percent
+static size_t CompareWithBaseline(const std::vector<BenchmarkResult> &results,
+                                  const std::map<std::string, double> &baseline,
+                                  double tolerance) {
+  size_t regressions = 0;
+  for (const BenchmarkResult &result : results) {
+    auto it = baseline.find(result.workload + ',' + result.engine);
+    if (it == baseline.end() || it->second <= 0.0) {
+      continue;
+    }
+    double now = NsPer(result.seconds, result.instructions);
+    double change = (now / it->second - 1.0) * 100.0;
+    if (change > tolerance) {
+      std::cerr << "Regression: " << result.workload << ' ' << result.engine
+                << ' ' << it->second << " -> " << now << " ns/instruction (+"
+                << change << "%)\n";
+      ++regressions;
+    }
+  }
+  return regressions;
+}
+
+int main(int argc, char **argv) {
+  BenchmarkOptions options = ParseCommandLine(argc, argv);
+  std::map<std::string, double> baseline;
+  if (options.baseline_path != nullptr &&
+      !ReadBaseline(options.baseline_path, baseline)) {
+    exit(-1);
+  }
+
+  std::vector<BenchmarkResult> results;
+  for (const WorkloadParams &params : StandardWorkloads(options.scale)) {
+    if (params.name.find(options.filter) == std::string::npos) {
+      continue;
+    }
+    std::string source = GenerateWorkload(params);
+    if (options.emit_dir != nullptr) {
+      std::string path =
+          std::string(options.emit_dir) + '/' + params.name + ".S";
+      std::ofstream fout(path, std::ios::trunc);
+      if (!(fout << source)) {
+        std::cerr << "Cannot write " << path << '\n';
+        exit(-1);
+      }
+    }
+    Program program;
+    AssemblerError error;
+    if (!Assemble(source, program, error)) {
+      std::cerr << params.name << ':' << error.line << ':' << error.column
+                << ": error: " << error.message << '\n';
+      exit(-1);
+    }
+    for (const EngineConfig &engine : kEngines) {
+      results.push_back(
+          RunEngine(program, params.name, engine, options.repeat));
+    }
+  }
+
+  std::ofstream fout;
+  if (options.output_path != nullptr) {
+    fout.open(options.output_path, std::ios::trunc);
+    if (!fout) {
+      std::cerr << "Cannot write " << options.output_path << '\n';
+      exit(-1);
+    }
+  }
+  std::ostream &out = options.output_path != nullptr ? fout : std::cout;
+  WriteReport(out, results, options.csv);
+  if (options.baseline_path != nullptr &&
+      CompareWithBaseline(results, baseline, options.tolerance) != 0) {
+    return 1;
+  }
+  return 0;
+}
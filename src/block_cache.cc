@@ -0,0 +1,256 @@
+#include "block_cache.h"
+
+using Register = BlockCache::Register;
+
+// the eight non-branch operations, in InstructionOp order
+static constexpr size_t kStraightOps = 8;
+static constexpr size_t kChains = 4;
+
+// execute one non-branch instruction and return the value it wrote, rs
+// or rt taken from the argument when the instruction before produced it;
+// false in ok if a lw/sw faults
+template <InstructionOp kOp, BlockCache::Chain kChain>
+static inline Register Execute(uint8_t rd, uint8_t rs, int32_t rt_or_imm,
+                               Register chained, size_t inst_idx,
+                               Register *regs,
+                               BlockCache::MachineState &state, bool &ok) {
+  using Chain = BlockCache::Chain;
+  const Register lhs = kChain == Chain::RS ? chained : regs[rs];
+  if constexpr (kOp == InstructionOp::LOAD || kOp == InstructionOp::STORE) {
+    Register address = lhs + rt_or_imm;
+    if (!PagedMemory::IsValidAddress(address)) {
+      state.fault_inst_idx = inst_idx;
+      state.fault_address = address;
+      ok = false;
+      return 0;
+    }
+    Register value;
+    if constexpr (kOp == InstructionOp::LOAD) {
+      value = state.memory->Read(address);
+      regs[rd] = value;
+    } else {
+      value = kChain == Chain::RD ? chained : regs[rd];
+      state.memory->Write(address, value);
+    }
+    if (state.data_cache != nullptr) {
+      state.data_cache->Warm(address, kOp == InstructionOp::STORE);
+    }
+    return value;
+  } else {
+    Register value;
+    if constexpr (kOp == InstructionOp::ADDI) {
+      value = lhs + rt_or_imm;
+    } else if constexpr (kOp == InstructionOp::SUBI) {
+      value = lhs - rt_or_imm;
+    } else {
+      const Register rhs = kChain == Chain::RT ? chained : regs[rt_or_imm];
+      if constexpr (kOp == InstructionOp::ADD) {
+        value = lhs + rhs;
+      } else if constexpr (kOp == InstructionOp::SUB) {
+        value = lhs - rhs;
+      } else if constexpr (kOp == InstructionOp::MUL) {
+        value = Multiply(lhs, rhs);
+      } else {
+        static_assert(kOp == InstructionOp::DIV);
+        value = Divide(lhs, rhs);
+      }
+    }
+    regs[rd] = value;
+    return value;
+  }
+}
+
+template <InstructionOp kOp>
+bool BlockCache::Single(const Op &op, Register *regs, MachineState &state) {
+  bool ok = true;
+  Execute<kOp, Chain::NONE>(op.rd[0], op.rs[0], op.rt_or_imm[0], 0,
+                            op.inst_idx, regs, state, ok);
+  return ok;
+}
+
+template <InstructionOp kFirst, InstructionOp kSecond, BlockCache::Chain kChain>
+bool BlockCache::Pair(const Op &op, Register *regs, MachineState &state) {
+  bool ok = true;
+  Register first = Execute<kFirst, Chain::NONE>(
+      op.rd[0], op.rs[0], op.rt_or_imm[0], 0, op.inst_idx, regs, state, ok);
+  if (!ok) {
+    return false;
+  }
+  Execute<kSecond, kChain>(op.rd[1], op.rs[1], op.rt_or_imm[1], first,
+                           op.inst_idx + 1, regs, state, ok);
+  return ok;
+}
+
+// index = (first * kStraightOps + second) * kChains + chain
+template <size_t... kIndexes>
+constexpr std::array<BlockCache::Handler, sizeof...(kIndexes)>
+BlockCache::MakePairHandlers(std::index_sequence<kIndexes...>) {
+  return {{&BlockCache::Pair<
+      static_cast<InstructionOp>(kIndexes / kChains / kStraightOps),
+      static_cast<InstructionOp>(kIndexes / kChains % kStraightOps),
+      static_cast<Chain>(kIndexes % kChains)>...}};
+}
+
+BlockCache &BlockCache::operator=(const BlockCache &other) {
+  if (this != &other) {
+    Clear();
+  }
+  return *this;
+}
+
+void BlockCache::Clear() {
+  blocks_.clear();
+  is_leader_.clear();
+}
+
+void BlockCache::FindLeaders(const std::vector<Instruction> &instructions) {
+  is_leader_.assign(instructions.size() + 1, false);
+  is_leader_[0] = true;
+  for (size_t inst_idx = 0; inst_idx < instructions.size(); ++inst_idx) {
+    InstructionOp op = instructions[inst_idx].instruction_op_;
+    if (op == InstructionOp::BEQZ || op == InstructionOp::BNEZ) {
+      is_leader_[instructions[inst_idx].rs_or_label_] = true;
+      is_leader_[inst_idx + 1] = true;
+    }
+  }
+}
+
+// the operand of second that reads the register first writes, if any
+static BlockCache::Chain ChainOf(const Instruction &first,
+                                 const Instruction &second) {
+  using Chain = BlockCache::Chain;
+  if (first.instruction_op_ == InstructionOp::STORE) {
+    return Chain::NONE;
+  }
+  if (second.rs_or_label_ == first.rd_) {
+    return Chain::RS;
+  }
+  if ((second.instruction_op_ == InstructionOp::ADD ||
+       second.instruction_op_ == InstructionOp::SUB ||
+       second.instruction_op_ == InstructionOp::MUL ||
+       second.instruction_op_ == InstructionOp::DIV) &&
+      second.rt_or_imm_ == first.rd_) {
+    return Chain::RT;
+  }
+  if (second.instruction_op_ == InstructionOp::STORE &&
+      second.rd_ == first.rd_) {
+    return Chain::RD;
+  }
+  return Chain::NONE;
+}
+
+BlockCache::Block *
+BlockCache::Translate(const std::vector<Instruction> &instructions,
+                      size_t pc) {
+  static constexpr Handler kSingleHandlers[kStraightOps] = {
+      &BlockCache::Single<InstructionOp::LOAD>,
+      &BlockCache::Single<InstructionOp::STORE>,
+      &BlockCache::Single<InstructionOp::ADDI>,
+      &BlockCache::Single<InstructionOp::SUBI>,
+      &BlockCache::Single<InstructionOp::ADD>,
+      &BlockCache::Single<InstructionOp::SUB>,
+      &BlockCache::Single<InstructionOp::MUL>,
+      &BlockCache::Single<InstructionOp::DIV>,
+  };
+  static constexpr auto kPairHandlers = MakePairHandlers(
+      std::make_index_sequence<kStraightOps * kStraightOps * kChains>());
+
+  auto block = std::make_unique<Block>();
+  block->start = pc;
+  block->ends_in_branch = false;
+  size_t end = pc;
+  // the operation of the last op if it still holds a single instruction
+  size_t unpaired = kStraightOps;
+  // straight-line part, up to a branch or the next leader
+  while (end < instructions.size() && (end == pc || !is_leader_[end])) {
+    const Instruction &inst = instructions[end];
+    if (inst.instruction_op_ == InstructionOp::BEQZ ||
+        inst.instruction_op_ == InstructionOp::BNEZ) {
+      block->ends_in_branch = true;
+      block->branch_on_zero = inst.instruction_op_ == InstructionOp::BEQZ;
+      block->branch_reg = inst.rd_;
+      block->taken_pc = inst.rs_or_label_;
+      ++end;
+      break;
+    }
+    size_t op_kind = static_cast<size_t>(inst.instruction_op_);
+    if (unpaired != kStraightOps) {
+      Op &op = block->ops.back();
+      Chain chain = ChainOf(instructions[end - 1], inst);
+      op.handler = kPairHandlers[(unpaired * kStraightOps + op_kind) * kChains +
+                                 static_cast<size_t>(chain)];
+      op.rd[1] = inst.rd_;
+      op.rs[1] = inst.rs_or_label_;
+      op.rt_or_imm[1] = inst.rt_or_imm_;
+      unpaired = kStraightOps;
+    } else {
+      Op &op = block->ops.emplace_back();
+      op.handler = kSingleHandlers[op_kind];
+      op.inst_idx = end;
+      op.rd[0] = inst.rd_;
+      op.rs[0] = inst.rs_or_label_;
+      op.rt_or_imm[0] = inst.rt_or_imm_;
+      unpaired = op_kind;
+    }
+    ++end;
+  }
+  block->inst_num = end - pc;
+  block->next_pc = end;
+  blocks_[pc] = std::move(block);
+  return blocks_[pc].get();
+}
+
+BlockCache::Block *
+BlockCache::BlockAt(const std::vector<Instruction> &instructions,
+                    size_t pc) {
+  if (blocks_.size() != instructions.size()) {
+    blocks_.resize(instructions.size());
+    FindLeaders(instructions);
+  }
+  Block *block = blocks_[pc].get();
+  return block != nullptr ? block : Translate(instructions, pc);
+}
+
+size_t BlockCache::Run(const std::vector<Instruction> &instructions,
+                       MachineState &state, size_t &pc,
+                       size_t max_instructions, bool &faulted) {
+  faulted = false;
+  const size_t inst_num = instructions.size();
+  if (pc >= inst_num) {
+    return 0;
+  }
+  size_t executed = 0;
+  Register *regs = state.registers;
+  Block *block = BlockAt(instructions, pc);
+  while (max_instructions - executed >= block->inst_num) {
+    for (const Op &op : block->ops) {
+      if (!op.handler(op, regs, state)) {
+        pc = state.fault_inst_idx;
+        faulted = true;
+        return executed + (pc - block->start);
+      }
+    }
+    executed += block->inst_num;
+    Block **successor = &block->next;
+    pc = block->next_pc;
+    if (block->ends_in_branch) {
+      bool taken = (regs[block->branch_reg] == 0) ==
+                   block->branch_on_zero;
+      if (state.predictor != nullptr) {
+        state.predictor->Train(block->next_pc - 1, block->taken_pc, taken);
+      }
+      if (taken) {
+        successor = &block->taken;
+        pc = block->taken_pc;
+      }
+    }
+    if (*successor == nullptr) {
+      if (pc >= inst_num) {
+        break;
+      }
+      *successor = BlockAt(instructions, pc);
+    }
+    block = *successor;
+  }
+  return executed;
+}
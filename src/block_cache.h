@@ -0,0 +1,100 @@
+#pragma once
+
+#include "branch_predictor.h"
+#include "cache.h"
+#include "instruction.h"
+#include "paged_memory.h"
+
+#include <array>
+#include <memory>
+#include <utility>
+#include <vector>
+
+// Translation cache of the functional engine. The program is cut into
+// basic blocks that end at a beqz/bnez or right before a branch target.
+// A block is translated the first time it is entered into a sequence of
+// handlers specialized for the operation, with the operands already
+// decoded; two consecutive non-branch instructions share one handler (a
+// superinstruction such as lw+add), so straight-line code pays one
+// dispatch per pair. The branch that ends a block is resolved by the
+// block loop, which follows pointers to the successor blocks, filled in
+// the first time each edge is taken.
+//
+// Translations depend only on the program, not on the machine state, so
+// the cache stays valid for the life of the simulator. Copies start empty.
+class BlockCache {
+public:
+  using Register = long long;
+
+  // what translated code reads and writes; data_cache and predictor are
+  // nullptr when the simulator has none
+  struct MachineState {
+    Register *registers;
+    PagedMemory *memory;
+    DataCache *data_cache;
+    BranchPredictor *predictor;
+    // set when a lw/sw faults
+    size_t fault_inst_idx;
+    Register fault_address;
+  };
+
+  // operand of the second half of a superinstruction that takes the first
+  // half's result directly instead of from the register file
+  enum class Chain : uint8_t { NONE, RS, RT, RD };
+
+  BlockCache() = default;
+  BlockCache(const BlockCache &) {}
+  BlockCache &operator=(const BlockCache &other);
+
+  // Execute whole blocks from pc while they fit in max_instructions and
+  // the program has not ended; pc is left at the next instruction. Return
+  // the instructions executed. Return early with pc at the lw/sw and
+  // faulted set if one accesses an address outside the address space.
+  size_t Run(const std::vector<Instruction> &instructions,
+             MachineState &state, size_t &pc, size_t max_instructions,
+             bool &faulted);
+  void Clear();
+
+private:
+  struct Op;
+  // false: a lw/sw faulted, state holds where
+  using Handler = bool (*)(const Op &op, Register *registers,
+                           MachineState &state);
+  // one instruction, or two for a superinstruction
+  struct Op {
+    Handler handler;
+    uint32_t inst_idx; // of the first instruction
+    uint8_t rd[2];
+    uint8_t rs[2];
+    int32_t rt_or_imm[2];
+  };
+  struct Block {
+    size_t start;
+    size_t inst_num; // including the branch
+    std::vector<Op> ops;
+    bool ends_in_branch;
+    bool branch_on_zero; // beqz
+    uint8_t branch_reg;
+    size_t taken_pc;
+    size_t next_pc; // fall-through
+    // successors once translated, chained on first use
+    Block *taken{nullptr};
+    Block *next{nullptr};
+  };
+
+  template <InstructionOp kOp>
+  static bool Single(const Op &op, Register *registers, MachineState &state);
+  template <InstructionOp kFirst, InstructionOp kSecond, Chain kChain>
+  static bool Pair(const Op &op, Register *registers, MachineState &state);
+  template <size_t... kIndexes>
+  static constexpr std::array<Handler, sizeof...(kIndexes)>
+      MakePairHandlers(std::index_sequence<kIndexes...>);
+
+  Block *BlockAt(const std::vector<Instruction> &instructions, size_t pc);
+  Block *Translate(const std::vector<Instruction> &instructions, size_t pc);
+  void FindLeaders(const std::vector<Instruction> &instructions);
+
+  // indexed by the pc a block starts at
+  std::vector<std::unique_ptr<Block>> blocks_;
+  std::vector<bool> is_leader_;
+};
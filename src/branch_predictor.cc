@@ -0,0 +1,222 @@
+#include "branch_predictor.h"
+
+#include <charconv>
+
+static inline bool IsPowerOfTwo(size_t value) {
+  return value != 0 && (value & (value - 1)) == 0;
+}
+
+static bool ParseNumber(std::string_view field, size_t &value) {
+  auto [end, ec] =
+      std::from_chars(field.data(), field.data() + field.size(), value);
+  return ec == std::errc() && end == field.data() + field.size();
+}
+
+static bool IsValidPredictorConfig(const BranchPredictorConfig &config) {
+  return config.kind <= PredictorKind::GSHARE &&
+         IsPowerOfTwo(config.table_entries) && config.history_bits <= 30 &&
+         (config.btb_entries == 0 || IsPowerOfTwo(config.btb_entries));
+}
+
+bool ParsePredictorConfig(std::string_view spec, BranchPredictorConfig &config,
+                          std::string &error) {
+  BranchPredictorConfig parsed = config;
+  size_t colon = spec.find(':');
+  std::string_view kind = spec.substr(0, colon);
+  if (kind == "not-taken") {
+    parsed.kind = PredictorKind::NOT_TAKEN;
+  } else if (kind == "btfn") {
+    parsed.kind = PredictorKind::BACKWARD_TAKEN;
+  } else if (kind == "1bit") {
+    parsed.kind = PredictorKind::ONE_BIT;
+  } else if (kind == "2bit") {
+    parsed.kind = PredictorKind::TWO_BIT;
+  } else if (kind == "gshare") {
+    parsed.kind = PredictorKind::GSHARE;
+  } else {
+    error = "unknown predictor '" + std::string(kind) + "'";
+    return false;
+  }
+  if (colon != std::string_view::npos) {
+    std::string_view rest = spec.substr(colon + 1);
+    size_t history_colon = rest.find(':');
+    if (!ParseNumber(rest.substr(0, history_colon), parsed.table_entries) ||
+        (history_colon != std::string_view::npos &&
+         !ParseNumber(rest.substr(history_colon + 1), parsed.history_bits))) {
+      error = "expected kind[:entries[:history bits]]";
+      return false;
+    }
+  }
+  if (!IsPowerOfTwo(parsed.table_entries)) {
+    error = "table entries must be a power of two";
+    return false;
+  }
+  if (parsed.history_bits > 30) {
+    error = "history is limited to 30 bits";
+    return false;
+  }
+  config = parsed;
+  return true;
+}
+
+bool ParseBtbEntries(std::string_view spec, BranchPredictorConfig &config,
+                     std::string &error) {
+  size_t entries;
+  if (!ParseNumber(spec, entries) || !IsPowerOfTwo(entries)) {
+    error = "BTB entries must be a power of two";
+    return false;
+  }
+  config.btb_entries = entries;
+  return true;
+}
+
+BranchPredictor::BranchPredictor(const BranchPredictorConfig &config)
+    : config_(config), btb_(config.btb_entries, BtbEntry{}) {
+  switch (config_.kind) {
+  case PredictorKind::ONE_BIT:
+    counters_.assign(config_.table_entries, 0);
+    break;
+  case PredictorKind::TWO_BIT:
+  case PredictorKind::GSHARE:
+    counters_.assign(config_.table_entries, 1); // weakly not taken
+    break;
+  default:
+    break;
+  }
+}
+
+bool BranchPredictor::Predict(size_t pc, size_t target, size_t &next_pc) {
+  bool taken = false;
+  switch (config_.kind) {
+  case PredictorKind::NOT_TAKEN:
+    return false;
+  case PredictorKind::BACKWARD_TAKEN:
+    taken = target <= pc;
+    break;
+  case PredictorKind::ONE_BIT:
+    taken = counters_[CounterIndex(pc)] != 0;
+    break;
+  case PredictorKind::TWO_BIT:
+  case PredictorKind::GSHARE:
+    taken = counters_[CounterIndex(pc)] >= 2;
+    break;
+  }
+  if (!taken) {
+    return false;
+  }
+  if (!btb_.empty()) {
+    const BtbEntry &entry = btb_[pc & (btb_.size() - 1)];
+    if (!entry.valid || entry.pc != pc) {
+      ++stats_.btb_misses;
+      return false;
+    }
+    ++stats_.btb_hits;
+    target = entry.target;
+  }
+  next_pc = target;
+  return true;
+}
+
+void BranchPredictor::Update(size_t pc, size_t target, bool taken,
+                             bool predicted_taken) {
+  ++stats_.branches;
+  stats_.mispredictions += taken != predicted_taken;
+  Train(pc, target, taken);
+}
+
+void BranchPredictor::Train(size_t pc, size_t target, bool taken) {
+  switch (config_.kind) {
+  case PredictorKind::ONE_BIT:
+    counters_journal_.Touch(counters_, CounterIndex(pc));
+    counters_[CounterIndex(pc)] = taken;
+    break;
+  case PredictorKind::TWO_BIT:
+  case PredictorKind::GSHARE: {
+    counters_journal_.Touch(counters_, CounterIndex(pc));
+    uint8_t &counter = counters_[CounterIndex(pc)];
+    if (taken && counter < 3) {
+      ++counter;
+    } else if (!taken && counter > 0) {
+      --counter;
+    }
+    break;
+  }
+  default:
+    break;
+  }
+  if (config_.kind == PredictorKind::GSHARE) {
+    history_ = ((history_ << 1) | taken) &
+               ((size_t{1} << config_.history_bits) - 1);
+  }
+  if (taken && !btb_.empty()) {
+    btb_journal_.Touch(btb_, pc & (btb_.size() - 1));
+    btb_[pc & (btb_.size() - 1)] = {pc, target, true};
+  }
+}
+
+void BranchPredictor::SaveState(StateWriter &writer) const {
+  writer.Put(config_);
+  writer.PutVector(counters_);
+  writer.PutVector(btb_);
+  writer.Put(history_);
+  writer.Put(stats_);
+}
+
+bool BranchPredictor::LoadState(StateReader &reader) {
+  BranchPredictorConfig config;
+  if (!reader.Get(config) || !IsValidPredictorConfig(config)) {
+    return false;
+  }
+  *this = BranchPredictor(config);
+  size_t counter_num = counters_.size();
+  size_t btb_entry_num = btb_.size();
+  return reader.GetVector(counters_) && counters_.size() == counter_num &&
+         reader.GetVector(btb_) && btb_.size() == btb_entry_num &&
+         reader.Get(history_) && reader.Get(stats_);
+}
+
+void BranchPredictor::SaveKeyframe(StateWriter &writer) const {
+  writer.Put(history_);
+  writer.Put(stats_);
+}
+
+bool BranchPredictor::LoadKeyframe(StateReader &reader, uint64_t epoch) {
+  counters_journal_.RollBack(counters_, epoch);
+  btb_journal_.RollBack(btb_, epoch);
+  return reader.Get(history_) && reader.Get(stats_);
+}
+
+void BranchPredictor::SetJournalEpoch(uint64_t epoch) {
+  counters_journal_.SetEpoch(counters_, epoch);
+  btb_journal_.SetEpoch(btb_, epoch);
+}
+
+void BranchPredictor::ForgetJournal(uint64_t epoch) {
+  counters_journal_.Forget(epoch);
+  btb_journal_.Forget(epoch);
+}
+
+void BranchPredictor::StopJournal() {
+  counters_journal_.Stop();
+  btb_journal_.Stop();
+}
+
+size_t BranchPredictor::JournalBytes() const {
+  return counters_journal_.Bytes() + btb_journal_.Bytes();
+}
+
+void BranchPredictor::PrintStatistics(std::ostream &out,
+                                      size_t penalty_cycles) const {
+  out << "Branch prediction:\n\t" << stats_.branches << " branches, "
+      << stats_.mispredictions << " mispredicted";
+  if (stats_.branches != 0) {
+    out << " ("
+        << 100.0 * (stats_.branches - stats_.mispredictions) / stats_.branches
+        << "% accuracy)";
+  }
+  out << "\n\tMisprediction penalty: " << penalty_cycles << " cycles\n";
+  if (!btb_.empty()) {
+    out << "\tBTB: " << stats_.btb_hits << " hits, " << stats_.btb_misses
+        << " misses\n";
+  }
+}
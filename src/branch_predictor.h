@@ -0,0 +1,99 @@
+#pragma once
+
+#include "history.h"
+#include "state_stream.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+enum class PredictorKind : uint8_t {
+  NOT_TAKEN,      // static, what the pipeline does without a predictor
+  BACKWARD_TAKEN, // static, backward taken / forward not taken
+  ONE_BIT,        // last outcome per branch
+  TWO_BIT,        // 2-bit saturating counter per branch
+  GSHARE,         // 2-bit counters indexed by pc xor global history
+};
+
+struct BranchPredictorConfig {
+  PredictorKind kind{PredictorKind::TWO_BIT};
+  // entries of the ONE_BIT / TWO_BIT / GSHARE table, a power of two
+  size_t table_entries{1024};
+  // global history length of GSHARE
+  size_t history_bits{8};
+  // direct-mapped branch target buffer entries, a power of two; 0: the
+  // target is known at fetch (pre-decoded), otherwise a branch can only be
+  // predicted taken once its target is in the BTB
+  size_t btb_entries{0};
+};
+
+// Parse "kind[:entries[:history bits]]", kind one of not-taken, btfn, 1bit,
+// 2bit, gshare. Return false and describe the problem in error.
+bool ParsePredictorConfig(std::string_view spec, BranchPredictorConfig &config,
+                          std::string &error);
+// validate a BTB size given separately
+bool ParseBtbEntries(std::string_view spec, BranchPredictorConfig &config,
+                     std::string &error);
+
+struct BranchPredictorStats {
+  size_t branches{0};
+  size_t mispredictions{0};
+  size_t btb_hits{0};
+  size_t btb_misses{0};
+};
+
+// Predicts beqz/bnez at fetch and is trained when they resolve in ID.
+class BranchPredictor {
+public:
+  // config must have been validated by ParsePredictorConfig
+  explicit BranchPredictor(const BranchPredictorConfig &config);
+
+  // Predict the branch at pc whose decoded target is target. Return true
+  // and set next_pc if fetch should continue at the target.
+  bool Predict(size_t pc, size_t target, size_t &next_pc);
+  // train with the resolved outcome and count it
+  void Update(size_t pc, size_t target, bool taken, bool predicted_taken);
+  // train without counting, used by the functional engine
+  void Train(size_t pc, size_t target, bool taken);
+
+  const BranchPredictorStats &Stats() const { return stats_; }
+  // penalty_cycles: cycles lost to mispredictions
+  void PrintStatistics(std::ostream &out, size_t penalty_cycles) const;
+
+  // checkpoint the configuration, tables and history; LoadState replaces
+  // all of them
+  void SaveState(StateWriter &writer) const;
+  bool LoadState(StateReader &reader);
+  // Keyframes for reverse stepping leave the tables to the journals (see
+  // TableJournal); LoadKeyframe rolls them back to epoch.
+  void SaveKeyframe(StateWriter &writer) const;
+  bool LoadKeyframe(StateReader &reader, uint64_t epoch);
+  void SetJournalEpoch(uint64_t epoch);
+  void ForgetJournal(uint64_t epoch);
+  void StopJournal();
+  size_t JournalBytes() const;
+
+private:
+  struct BtbEntry {
+    size_t pc;
+    size_t target;
+    bool valid;
+  };
+
+  size_t CounterIndex(size_t pc) const {
+    size_t index = config_.kind == PredictorKind::GSHARE ? pc ^ history_ : pc;
+    return index & (config_.table_entries - 1);
+  }
+
+  BranchPredictorConfig config_;
+  // last outcomes for ONE_BIT, saturating counters 0..3 otherwise
+  std::vector<uint8_t> counters_;
+  std::vector<BtbEntry> btb_;
+  TableJournal<uint8_t> counters_journal_;
+  TableJournal<BtbEntry> btb_journal_;
+  size_t history_{0};
+  BranchPredictorStats stats_;
+};
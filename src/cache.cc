@@ -0,0 +1,313 @@
+#include "cache.h"
+
+#include <charconv>
+
+static inline bool IsPowerOfTwo(size_t value) {
+  return value != 0 && (value & (value - 1)) == 0;
+}
+
+static inline size_t Log2(size_t value) {
+  size_t bits = 0;
+  while ((size_t{1} << bits) < value) {
+    ++bits;
+  }
+  return bits;
+}
+
+static bool IsValidCacheConfig(const CacheConfig &config) {
+  return IsPowerOfTwo(config.line_words) && config.ways != 0 &&
+         config.size_words % (config.line_words * config.ways) == 0 &&
+         IsPowerOfTwo(config.size_words / (config.line_words * config.ways));
+}
+
+bool ParseCacheConfig(std::string_view spec, CacheConfig &config,
+                      std::string &error) {
+  std::vector<std::string_view> fields;
+  for (size_t begin = 0;;) {
+    size_t end = spec.find(':', begin);
+    fields.push_back(spec.substr(begin, end - begin));
+    if (end == std::string_view::npos) {
+      break;
+    }
+    begin = end + 1;
+  }
+  if (fields.size() < 3 || fields.size() > 5) {
+    error = "expected size:line:ways[:policy[:latency]]";
+    return false;
+  }
+  auto parse_number = [&](std::string_view field, size_t &value) {
+    auto [end, ec] =
+        std::from_chars(field.data(), field.data() + field.size(), value);
+    return ec == std::errc() && end == field.data() + field.size();
+  };
+  CacheConfig parsed = config;
+  if (!parse_number(fields[0], parsed.size_words) ||
+      !parse_number(fields[1], parsed.line_words) ||
+      !parse_number(fields[2], parsed.ways)) {
+    error = "size, line and ways must be numbers";
+    return false;
+  }
+  if (fields.size() >= 4) {
+    if (fields[3] == "lru") {
+      parsed.policy = ReplacementPolicy::LRU;
+    } else if (fields[3] == "fifo") {
+      parsed.policy = ReplacementPolicy::FIFO;
+    } else if (fields[3] == "random") {
+      parsed.policy = ReplacementPolicy::RANDOM;
+    } else {
+      error = "unknown replacement policy '" + std::string(fields[3]) + "'";
+      return false;
+    }
+  }
+  if (fields.size() == 5 && !parse_number(fields[4], parsed.miss_latency)) {
+    error = "miss latency must be a number";
+    return false;
+  }
+  if (!IsValidCacheConfig(parsed)) {
+    error = "line size and set count (size / line / ways) must be powers of "
+            "two";
+    return false;
+  }
+  config = parsed;
+  return true;
+}
+
+Cache::Cache(const CacheConfig &config)
+    : config_(config), line_bits_(Log2(config.line_words)),
+      set_bits_(Log2(config.size_words / config.line_words / config.ways)),
+      lines_(config.size_words / config.line_words, Line{}) {}
+
+Cache::AccessResult Cache::Access(uint64_t address, bool is_write) {
+  ++clock_;
+  uint64_t line_address = address >> line_bits_;
+  size_t set_idx = line_address & ((uint64_t{1} << set_bits_) - 1);
+  uint64_t tag = line_address >> set_bits_;
+  size_t set_base = set_idx * config_.ways;
+  for (size_t way = 0; way < config_.ways; ++way) {
+    Line &line = lines_[set_base + way];
+    if (line.valid && line.tag == tag) {
+      journal_.Touch(lines_, set_base + way);
+      if (config_.policy == ReplacementPolicy::LRU) {
+        line.stamp = clock_;
+      }
+      line.dirty |= is_write;
+      return {true, false, 0};
+    }
+  }
+  size_t victim_idx = ChooseVictim(set_base);
+  journal_.Touch(lines_, victim_idx);
+  Line &victim = lines_[victim_idx];
+  AccessResult result{false, victim.valid && victim.dirty,
+                      ((victim.tag << set_bits_) | set_idx) << line_bits_};
+  victim = {tag, clock_, true, is_write};
+  return result;
+}
+
+bool Cache::Invalidate(uint64_t address) {
+  uint64_t line_address = address >> line_bits_;
+  size_t set_idx = line_address & ((uint64_t{1} << set_bits_) - 1);
+  uint64_t tag = line_address >> set_bits_;
+  size_t set_base = set_idx * config_.ways;
+  for (size_t way = 0; way < config_.ways; ++way) {
+    Line &line = lines_[set_base + way];
+    if (line.valid && line.tag == tag) {
+      journal_.Touch(lines_, set_base + way);
+      line.valid = false;
+      return true;
+    }
+  }
+  return false;
+}
+
+void Cache::SaveState(StateWriter &writer) const {
+  writer.Put(config_);
+  writer.PutVector(lines_);
+  writer.Put(clock_);
+  writer.Put(random_state_);
+}
+
+bool Cache::LoadState(StateReader &reader) {
+  CacheConfig config;
+  std::vector<Line> lines;
+  uint64_t clock;
+  uint64_t random_state;
+  if (!reader.Get(config) || !IsValidCacheConfig(config) ||
+      !reader.GetVector(lines) ||
+      lines.size() != config.size_words / config.line_words ||
+      !reader.Get(clock) || !reader.Get(random_state)) {
+    return false;
+  }
+  *this = Cache(config);
+  lines_ = std::move(lines);
+  clock_ = clock;
+  random_state_ = random_state;
+  return true;
+}
+
+void Cache::SaveKeyframe(StateWriter &writer) const {
+  writer.Put(clock_);
+  writer.Put(random_state_);
+}
+
+bool Cache::LoadKeyframe(StateReader &reader, uint64_t epoch) {
+  journal_.RollBack(lines_, epoch);
+  return reader.Get(clock_) && reader.Get(random_state_);
+}
+
+size_t Cache::ChooseVictim(size_t set_base) {
+  size_t victim = set_base;
+  for (size_t way = 0; way < config_.ways; ++way) {
+    const Line &line = lines_[set_base + way];
+    if (!line.valid) {
+      return set_base + way;
+    }
+    if (line.stamp < lines_[victim].stamp) {
+      victim = set_base + way;
+    }
+  }
+  if (config_.policy == ReplacementPolicy::RANDOM) {
+    // xorshift64, deterministic so that runs are reproducible
+    random_state_ ^= random_state_ << 13;
+    random_state_ ^= random_state_ >> 7;
+    random_state_ ^= random_state_ << 17;
+    victim = set_base + random_state_ % config_.ways;
+  }
+  return victim;
+}
+
+DataCache::DataCache(const CacheConfig &l1,
+                     const std::optional<CacheConfig> &l2)
+    : l1_(l1) {
+  if (l2.has_value()) {
+    l2_.emplace(*l2);
+  }
+}
+
+bool DataCache::Invalidate(uint64_t address) {
+  bool cached = l1_.Invalidate(address);
+  if (l2_.has_value()) {
+    cached |= l2_->Invalidate(address);
+  }
+  return cached;
+}
+
+template <bool kCountStats>
+size_t DataCache::DoAccess(uint64_t address, bool is_write) {
+  Cache::AccessResult l1_result = l1_.Access(address, is_write);
+  if (kCountStats) {
+    ++(l1_result.hit ? l1_stats_.hits : l1_stats_.misses);
+    l1_stats_.writebacks += l1_result.writeback;
+  }
+  if (l1_result.hit) {
+    return 0;
+  }
+  size_t latency = l1_.Config().miss_latency;
+  if (!l2_.has_value()) {
+    return latency;
+  }
+  if (l1_result.writeback) {
+    Cache::AccessResult wb_result = l2_->Access(l1_result.victim_address, true);
+    if (kCountStats) {
+      l2_stats_.writebacks += wb_result.writeback;
+    }
+  }
+  // the L1 fill reads the line from L2, the write stays in L1
+  Cache::AccessResult l2_result = l2_->Access(address, false);
+  if (kCountStats) {
+    ++(l2_result.hit ? l2_stats_.hits : l2_stats_.misses);
+    l2_stats_.writebacks += l2_result.writeback;
+  }
+  if (!l2_result.hit) {
+    latency += l2_->Config().miss_latency;
+  }
+  return latency;
+}
+
+size_t DataCache::Access(uint64_t address, bool is_write) {
+  return DoAccess<true>(address, is_write);
+}
+
+void DataCache::Warm(uint64_t address, bool is_write) {
+  DoAccess<false>(address, is_write);
+}
+
+void DataCache::SaveState(StateWriter &writer) const {
+  l1_.SaveState(writer);
+  writer.Put<uint8_t>(l2_.has_value());
+  if (l2_.has_value()) {
+    l2_->SaveState(writer);
+  }
+  writer.Put(l1_stats_);
+  writer.Put(l2_stats_);
+}
+
+bool DataCache::LoadState(StateReader &reader) {
+  uint8_t has_l2;
+  if (!l1_.LoadState(reader) || !reader.Get(has_l2)) {
+    return false;
+  }
+  l2_.reset();
+  if (has_l2 != 0 && !l2_.emplace(CacheConfig{}).LoadState(reader)) {
+    return false;
+  }
+  return reader.Get(l1_stats_) && reader.Get(l2_stats_);
+}
+
+void DataCache::SaveKeyframe(StateWriter &writer) const {
+  l1_.SaveKeyframe(writer);
+  if (l2_.has_value()) {
+    l2_->SaveKeyframe(writer);
+  }
+  writer.Put(l1_stats_);
+  writer.Put(l2_stats_);
+}
+
+bool DataCache::LoadKeyframe(StateReader &reader, uint64_t epoch) {
+  return l1_.LoadKeyframe(reader, epoch) &&
+         (!l2_.has_value() || l2_->LoadKeyframe(reader, epoch)) &&
+         reader.Get(l1_stats_) && reader.Get(l2_stats_);
+}
+
+void DataCache::SetJournalEpoch(uint64_t epoch) {
+  l1_.SetJournalEpoch(epoch);
+  if (l2_.has_value()) {
+    l2_->SetJournalEpoch(epoch);
+  }
+}
+
+void DataCache::ForgetJournal(uint64_t epoch) {
+  l1_.ForgetJournal(epoch);
+  if (l2_.has_value()) {
+    l2_->ForgetJournal(epoch);
+  }
+}
+
+void DataCache::StopJournal() {
+  l1_.StopJournal();
+  if (l2_.has_value()) {
+    l2_->StopJournal();
+  }
+}
+
+size_t DataCache::JournalBytes() const {
+  return l1_.JournalBytes() + (l2_.has_value() ? l2_->JournalBytes() : 0);
+}
+
+static void PrintLevel(std::ostream &out, const char *name,
+                       const CacheStats &stats) {
+  size_t accesses = stats.hits + stats.misses;
+  out << '\t' << name << ": " << stats.hits << " hits, " << stats.misses
+      << " misses";
+  if (accesses != 0) {
+    out << " (" << 100.0 * stats.misses / accesses << "% miss rate)";
+  }
+  out << ", " << stats.writebacks << " write-backs\n";
+}
+
+void DataCache::PrintStatistics(std::ostream &out) const {
+  out << "Data cache:\n";
+  PrintLevel(out, "L1", l1_stats_);
+  if (l2_.has_value()) {
+    PrintLevel(out, "L2", l2_stats_);
+  }
+}
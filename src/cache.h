@@ -0,0 +1,132 @@
+#pragma once
+
+#include "history.h"
+#include "state_stream.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+enum class ReplacementPolicy : uint8_t {
+  LRU,
+  FIFO,
+  RANDOM,
+};
+
+// Geometry and timing of one cache level. Sizes are in words, like the
+// addresses of lw/sw.
+struct CacheConfig {
+  size_t size_words{256};
+  size_t line_words{4};
+  size_t ways{2};
+  ReplacementPolicy policy{ReplacementPolicy::LRU};
+  // cycles to fill a line from the next level on a miss
+  size_t miss_latency{10};
+};
+
+// Parse "size:line:ways[:policy[:latency]]", e.g. "256:4:2:lru:10", policy
+// one of lru, fifo, random. Return false and describe the problem in error.
+bool ParseCacheConfig(std::string_view spec, CacheConfig &config,
+                      std::string &error);
+
+// One set-associative, write-back, write-allocate level. Only tags are
+// kept; the data stays in PagedMemory, the cache decides timing only.
+class Cache {
+public:
+  struct AccessResult {
+    bool hit;
+    // a dirty line was evicted to make room, written back to victim_address
+    bool writeback;
+    uint64_t victim_address;
+  };
+
+  // config must have been validated by ParseCacheConfig
+  explicit Cache(const CacheConfig &config);
+
+  // look up address, allocating its line on a miss
+  AccessResult Access(uint64_t address, bool is_write);
+  // drop the line holding address; return false if it was not cached
+  bool Invalidate(uint64_t address);
+  const CacheConfig &Config() const { return config_; }
+
+  // checkpoint the configuration and every line; LoadState replaces both
+  void SaveState(StateWriter &writer) const;
+  bool LoadState(StateReader &reader);
+  // Keyframes for reverse stepping leave the lines to the journal (see
+  // TableJournal); LoadKeyframe rolls them back to epoch.
+  void SaveKeyframe(StateWriter &writer) const;
+  bool LoadKeyframe(StateReader &reader, uint64_t epoch);
+  void SetJournalEpoch(uint64_t epoch) { journal_.SetEpoch(lines_, epoch); }
+  void ForgetJournal(uint64_t epoch) { journal_.Forget(epoch); }
+  void StopJournal() { journal_.Stop(); }
+  size_t JournalBytes() const { return journal_.Bytes(); }
+
+private:
+  struct Line {
+    uint64_t tag;
+    // last use for LRU, fill time for FIFO
+    uint64_t stamp;
+    bool valid;
+    bool dirty;
+  };
+
+  size_t ChooseVictim(size_t set_base);
+
+  CacheConfig config_;
+  size_t line_bits_;
+  size_t set_bits_;
+  std::vector<Line> lines_; // ways consecutive lines per set
+  TableJournal<Line> journal_;
+  uint64_t clock_{0};
+  uint64_t random_state_{0x9e3779b97f4a7c15};
+};
+
+struct CacheStats {
+  size_t hits{0};
+  size_t misses{0};
+  size_t writebacks{0};
+};
+
+// L1 data cache with an optional L2 behind it, accessed by lw/sw in MEM.
+class DataCache {
+public:
+  DataCache(const CacheConfig &l1, const std::optional<CacheConfig> &l2);
+
+  // Return the cycles the access keeps the instruction in MEM beyond its
+  // first one: 0 on an L1 hit, otherwise the fill latency of each level
+  // missed. Write-backs are absorbed by a write buffer and cost nothing.
+  size_t Access(uint64_t address, bool is_write);
+  // update the cache state like Access without counting statistics, used to
+  // keep the caches warm while executing functionally
+  void Warm(uint64_t address, bool is_write);
+  // another core wrote address: drop its line from both levels; return
+  // false if neither held it
+  bool Invalidate(uint64_t address);
+
+  const CacheStats &L1Stats() const { return l1_stats_; }
+  const CacheStats &L2Stats() const { return l2_stats_; }
+  bool HasL2() const { return l2_.has_value(); }
+  void PrintStatistics(std::ostream &out) const;
+
+  void SaveState(StateWriter &writer) const;
+  bool LoadState(StateReader &reader);
+  // both levels, see Cache
+  void SaveKeyframe(StateWriter &writer) const;
+  bool LoadKeyframe(StateReader &reader, uint64_t epoch);
+  void SetJournalEpoch(uint64_t epoch);
+  void ForgetJournal(uint64_t epoch);
+  void StopJournal();
+  size_t JournalBytes() const;
+
+private:
+  template <bool kCountStats> size_t DoAccess(uint64_t address, bool is_write);
+
+  Cache l1_;
+  std::optional<Cache> l2_;
+  CacheStats l1_stats_;
+  CacheStats l2_stats_;
+};
@@ -0,0 +1,178 @@
+#include "checkpoint.h"
+
+#include <unordered_set>
+
+static_assert(sizeof(long) == sizeof(int64_t),
+              "memory words are stored as 64-bit values");
+
+static std::string BaseName(const std::string &path) {
+  size_t slash = path.rfind('/');
+  return slash == std::string::npos ? path : path.substr(slash + 1);
+}
+
+static std::string DirectoryOf(const std::string &path) {
+  size_t slash = path.rfind('/');
+  return slash == std::string::npos ? "" : path.substr(0, slash + 1);
+}
+
+// base == nullptr: store every resident page; otherwise only the pages that
+// are no longer shared with base
+static bool WriteCheckpoint(const Simulator &sim, const std::string &path,
+                            const PagedMemory *base,
+                            const std::string &base_path) {
+  StateWriter writer;
+  writer.PutBytes(kCheckpointMagic, sizeof(kCheckpointMagic));
+  writer.Put(kCheckpointVersion);
+  writer.PutString(base == nullptr ? "" : BaseName(base_path));
+  writer.Put(sim.ProgramFingerprint());
+  StateWriter state;
+  sim.SaveState(state);
+  writer.PutString(state.Buffer());
+
+  const PagedMemory &memory = sim.GetMemory();
+  std::vector<uint64_t> pages;
+  for (uint64_t page_idx : memory.ResidentPages()) {
+    if (base == nullptr ||
+        base->PageData(page_idx) != memory.PageData(page_idx)) {
+      pages.push_back(page_idx);
+    }
+  }
+  writer.Put<uint64_t>(pages.size());
+  for (uint64_t page_idx : pages) {
+    writer.Put(page_idx);
+    writer.PutBytes(memory.PageData(page_idx),
+                    PagedMemory::kPageWords * sizeof(long));
+  }
+
+  std::ofstream fout(path, std::ios::binary | std::ios::trunc);
+  if (!fout.write(writer.Buffer().data(), writer.Buffer().size())) {
+    std::cerr << "Cannot write checkpoint: " << path << '\n';
+    return false;
+  }
+  return true;
+}
+
+bool SaveCheckpoint(const Simulator &sim, const std::string &path) {
+  return WriteCheckpoint(sim, path, nullptr, "");
+}
+
+std::string CheckpointSeries::Save(const Simulator &sim) {
+  std::string path =
+      path_prefix_ + '.' + std::to_string(sim.GetCycleClocks());
+  bool is_delta = saved_num_ % kFullInterval != 0;
+  if (!WriteCheckpoint(sim, path, is_delta ? &last_memory_ : nullptr,
+                       last_path_)) {
+    return "";
+  }
+  last_memory_ = sim.GetMemory();
+  last_path_ = path;
+  ++saved_num_;
+  return path;
+}
+
+struct CheckpointFile {
+  std::string content;
+  std::string base_name;
+  std::string state;
+  // page index -> offset of its words in content
+  std::vector<std::pair<uint64_t, size_t>> pages;
+};
+
+static bool ReadCheckpoint(const std::string &path, uint64_t fingerprint,
+                           CheckpointFile &file) {
+  std::ifstream fin(path, std::ios::binary);
+  if (!fin) {
+    std::cerr << "Cannot open checkpoint: " << path << '\n';
+    return false;
+  }
+  file.content.assign(std::istreambuf_iterator<char>(fin),
+                      std::istreambuf_iterator<char>());
+  StateReader reader(file.content.data(), file.content.size());
+  char magic[sizeof(kCheckpointMagic)];
+  uint32_t version;
+  uint64_t file_fingerprint;
+  if (!reader.GetBytes(magic, sizeof(magic)) ||
+      std::memcmp(magic, kCheckpointMagic, sizeof(magic)) != 0) {
+    std::cerr << "Not a checkpoint: " << path << '\n';
+    return false;
+  }
+  if (!reader.Get(version) || version != kCheckpointVersion) {
+    std::cerr << "Checkpoint " << path
+              << " was written by another version of the simulator\n";
+    return false;
+  }
+  if (!reader.GetString(file.base_name) || !reader.Get(file_fingerprint) ||
+      !reader.GetString(file.state)) {
+    std::cerr << "Checkpoint is truncated: " << path << '\n';
+    return false;
+  }
+  if (file_fingerprint != fingerprint) {
+    std::cerr << "Checkpoint " << path << " was taken of another program\n";
+    return false;
+  }
+  uint64_t page_num;
+  if (!reader.Get(page_num)) {
+    std::cerr << "Checkpoint is truncated: " << path << '\n';
+    return false;
+  }
+  const size_t page_bytes = PagedMemory::kPageWords * sizeof(long);
+  for (uint64_t page = 0; page < page_num; ++page) {
+    uint64_t page_idx;
+    const char *words = nullptr;
+    if (!reader.Get(page_idx) ||
+        (words = reader.Take(page_bytes)) == nullptr) {
+      std::cerr << "Checkpoint is truncated: " << path << '\n';
+      return false;
+    }
+    if (page_idx >=
+        PagedMemory::kAddressSpaceWords >> PagedMemory::kPageBits) {
+      std::cerr << "Checkpoint holds an invalid page: " << path << '\n';
+      return false;
+    }
+    file.pages.emplace_back(page_idx, words - file.content.data());
+  }
+  return true;
+}
+
+bool RestoreCheckpoint(const std::string &path, Simulator &sim) {
+  const uint64_t fingerprint = sim.ProgramFingerprint();
+  CheckpointFile file;
+  if (!ReadCheckpoint(path, fingerprint, file)) {
+    return false;
+  }
+  Simulator restored = sim;
+  StateReader state_reader(file.state.data(), file.state.size());
+  if (!restored.LoadState(state_reader) || !state_reader.AtEnd()) {
+    std::cerr << "Checkpoint holds invalid state: " << path << '\n';
+    return false;
+  }
+
+  // newest first: a page is taken from the first file of the chain that
+  // stores it
+  PagedMemory &memory = restored.MutableMemory();
+  memory.Clear();
+  std::unordered_set<uint64_t> loaded_pages;
+  std::unordered_set<std::string> visited{BaseName(path)};
+  const std::string directory = DirectoryOf(path);
+  while (true) {
+    for (const auto &[page_idx, offset] : file.pages) {
+      if (loaded_pages.insert(page_idx).second) {
+        memory.LoadPage(page_idx, file.content.data() + offset);
+      }
+    }
+    if (file.base_name.empty()) {
+      break;
+    }
+    if (!visited.insert(file.base_name).second) {
+      std::cerr << "Checkpoint chain of " << path << " is circular\n";
+      return false;
+    }
+    std::string base_path = directory + file.base_name;
+    file = CheckpointFile{};
+    if (!ReadCheckpoint(base_path, fingerprint, file)) {
+      return false;
+    }
+  }
+  sim = std::move(restored);
+  return true;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include "simulator.h"
+
+// Checkpoint files hold the whole machine state of a Simulator: registers,
+// memory, pipeline latches, scoreboard, pc, counters, caches and branch
+// predictor. They do not hold the program; a checkpoint is restored into a
+// Simulator built from the same program, which is checked by fingerprint.
+//
+// Layout: magic, version, base file name (empty for a full checkpoint),
+// program fingerprint, size and bytes of Simulator::SaveState, then the
+// stored memory pages as (page index, kPageWords words). A delta checkpoint
+// stores only the pages written since its base; the other pages come from
+// the chain of bases down to a full checkpoint.
+
+constexpr char kCheckpointMagic[8] = {'M', 'I', 'P', 'S', 'C', 'K', 'P', '\0'};
+constexpr uint32_t kCheckpointVersion = 6;
+
+// write a full checkpoint of sim to path
+bool SaveCheckpoint(const Simulator &sim, const std::string &path);
+// Replace the state of sim by the checkpoint at path, following its delta
+// chain. On failure print why and leave sim unchanged.
+bool RestoreCheckpoint(const std::string &path, Simulator &sim);
+
+// Checkpoints taken repeatedly during one run, written as <prefix>.<cycle>.
+// The series keeps a copy-on-write snapshot of the memory at the previous
+// checkpoint, so each new one stores only the pages written since then and
+// costs little more than the state itself. Every kFullInterval-th
+// checkpoint is full again to bound the chains a restore has to read.
+class CheckpointSeries {
+public:
+  static constexpr size_t kFullInterval = 16;
+
+  explicit CheckpointSeries(std::string path_prefix)
+      : path_prefix_(std::move(path_prefix)) {}
+
+  // return the path written, empty on failure
+  std::string Save(const Simulator &sim);
+
+private:
+  std::string path_prefix_;
+  std::string last_path_;
+  PagedMemory last_memory_;
+  size_t saved_num_{0};
+};
@@ -0,0 +1,9 @@
+#include "command_line.h"
+
+#include <charconv>
+
+bool ParseSize(const std::string &text, size_t &value) {
+  const char *end = text.data() + text.size();
+  auto [ptr, ec] = std::from_chars(text.data(), end, value);
+  return ec == std::errc() && ptr == end && !text.empty();
+}
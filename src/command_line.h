@@ -0,0 +1,10 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+// Helpers shared by the command lines of the drivers (main.cc, sweep.cc,
+// lockstep_main.cc, multicore_main.cc, benchmark.cc).
+
+// parse a decimal count; false on anything but digits or on overflow
+bool ParseSize(const std::string &text, size_t &value);
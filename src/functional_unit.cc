@@ -0,0 +1,36 @@
+#include "functional_unit.h"
+
+#include <charconv>
+
+bool ParseFunctionalUnitConfig(std::string_view spec,
+                               FunctionalUnitConfig &config,
+                               std::string &error) {
+  size_t colon = spec.find(':');
+  std::string_view latency_text = spec.substr(0, colon);
+  uint32_t latency;
+  auto [end, ec] = std::from_chars(
+      latency_text.data(), latency_text.data() + latency_text.size(), latency);
+  if (ec != std::errc() || end != latency_text.data() + latency_text.size() ||
+      latency == 0 || latency > kMaxUnitLatency) {
+    error = "latency must be 1 to " + std::to_string(kMaxUnitLatency);
+    return false;
+  }
+  uint32_t interval = 1;
+  if (colon != std::string_view::npos) {
+    std::string_view mode = spec.substr(colon + 1);
+    if (mode == "blocking") {
+      interval = latency;
+    } else if (mode != "pipelined") {
+      auto [mode_end, mode_ec] =
+          std::from_chars(mode.data(), mode.data() + mode.size(), interval);
+      if (mode_ec != std::errc() || mode_end != mode.data() + mode.size() ||
+          interval == 0 || interval > latency) {
+        error = "expected pipelined, blocking or an issue interval of 1 to "
+                "the latency";
+        return false;
+      }
+    }
+  }
+  config = {latency, interval};
+  return true;
+}
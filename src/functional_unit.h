@@ -0,0 +1,54 @@
+#pragma once
+
+#include "instruction.h"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+// Long-latency functional units of EX. Every other instruction spends one
+// cycle in EX; a mul or div spends latency cycles in its unit, which
+// accepts a new instruction every interval cycles: 1 is fully pipelined,
+// latency is blocking, anything in between partially pipelined.
+enum class UnitKind : uint8_t { MUL, DIV };
+constexpr size_t kUnitKinds = 2;
+constexpr size_t kMaxUnitLatency = 32;
+
+struct FunctionalUnitConfig {
+  uint32_t latency;
+  uint32_t interval;
+};
+
+struct FunctionalUnitsConfig {
+  std::array<FunctionalUnitConfig, kUnitKinds> units{{{4, 1}, {12, 12}}};
+
+  const FunctionalUnitConfig &operator[](UnitKind kind) const {
+    return units[static_cast<size_t>(kind)];
+  }
+  FunctionalUnitConfig &operator[](UnitKind kind) {
+    return units[static_cast<size_t>(kind)];
+  }
+};
+
+// Parse "latency[:pipelined|blocking|interval]", e.g. "12:blocking" or
+// "6:2"; the unit is fully pipelined by default. Return false and describe
+// the problem in error.
+bool ParseFunctionalUnitConfig(std::string_view spec,
+                               FunctionalUnitConfig &config,
+                               std::string &error);
+
+// the unit inst runs on, false for the single-cycle instructions
+inline bool UnitOf(const Instruction &inst, UnitKind &kind) {
+  switch (inst.instruction_op_) {
+  case InstructionOp::MUL:
+    kind = UnitKind::MUL;
+    return true;
+  case InstructionOp::DIV:
+    kind = UnitKind::DIV;
+    return true;
+  default:
+    return false;
+  }
+}
@@ -0,0 +1,54 @@
+#include "history.h"
+
+#include <algorithm>
+
+void ExecutionHistory::Reset() {
+  keyframes_.clear();
+  undo_.clear();
+  undo_base_ = 0;
+  interval_ = kInitialInterval;
+  next_keyframe_cycle_ = 0;
+  keyframe_bytes_ = 0;
+}
+
+void ExecutionHistory::AppendKeyframe(size_t cycle, std::string state) {
+  ++epoch_;
+  keyframe_bytes_ += state.size();
+  keyframes_.push_back(
+      {cycle, epoch_, undo_base_ + undo_.size(), std::move(state)});
+  next_keyframe_cycle_ = cycle + interval_;
+  if (keyframes_.size() > kMaxKeyframes) {
+    // keep the oldest and every other one after it
+    size_t kept = 1;
+    for (size_t keyframe_idx = 1; keyframe_idx < keyframes_.size();
+         ++keyframe_idx) {
+      if (keyframe_idx % 2 == 0) {
+        keyframes_[kept++] = std::move(keyframes_[keyframe_idx]);
+      } else {
+        keyframe_bytes_ -= keyframes_[keyframe_idx].state.size();
+      }
+    }
+    keyframes_.resize(kept);
+    interval_ *= 2;
+    next_keyframe_cycle_ = keyframes_.back().cycle + interval_;
+  }
+}
+
+void ExecutionHistory::DropOldestKeyframe() {
+  keyframe_bytes_ -= keyframes_.front().state.size();
+  keyframes_.erase(keyframes_.begin());
+  uint64_t oldest_needed = keyframes_.front().undo_idx;
+  while (undo_base_ < oldest_needed) {
+    undo_.pop_front();
+    ++undo_base_;
+  }
+}
+
+size_t ExecutionHistory::FindKeyframe(size_t cycle) const {
+  auto it = std::upper_bound(
+      keyframes_.begin(), keyframes_.end(), cycle,
+      [](size_t cycle, const Keyframe &keyframe) {
+        return cycle < keyframe.cycle;
+      });
+  return it - keyframes_.begin() - 1;
+}
@@ -0,0 +1,171 @@
+#pragma once
+
+#include "paged_memory.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <vector>
+
+// Undo journal of one table of trivially copyable entries, for the tables
+// that would make keyframes large: cache lines and predictor tables. The
+// first change of an entry in each epoch saves its old value, so a keyframe
+// leaves the table out and going back to it restores the entries changed
+// since. ExecutionHistory starts an epoch at every keyframe and every
+// rewind.
+template <typename T> class TableJournal {
+public:
+  // journal changes of table from epoch on
+  void SetEpoch(const std::vector<T> &table, uint64_t epoch) {
+    if (!active_) {
+      stamps_.assign(table.size(), 0);
+      active_ = true;
+    }
+    epoch_ = epoch;
+  }
+  // stop journaling and forget the saved entries
+  void Stop() {
+    active_ = false;
+    stamps_.clear();
+    entries_.clear();
+  }
+  // call before table[idx] changes
+  inline void Touch(const std::vector<T> &table, size_t idx) {
+    if (active_ && stamps_[idx] != epoch_) {
+      stamps_[idx] = epoch_;
+      entries_.push_back({epoch_, idx, table[idx]});
+    }
+  }
+  // bring table back to where it was when epoch started
+  void RollBack(std::vector<T> &table, uint64_t epoch) {
+    while (!entries_.empty() && entries_.back().epoch >= epoch) {
+      table[entries_.back().idx] = entries_.back().old_value;
+      entries_.pop_back();
+    }
+  }
+  // drop the entries only needed to go back before epoch
+  void Forget(uint64_t epoch) {
+    while (!entries_.empty() && entries_.front().epoch < epoch) {
+      entries_.pop_front();
+    }
+  }
+  size_t Bytes() const {
+    return entries_.size() * sizeof(Entry) + stamps_.size() * sizeof(uint64_t);
+  }
+
+private:
+  struct Entry {
+    uint64_t epoch;
+    size_t idx;
+    T old_value;
+  };
+  bool active_{false};
+  uint64_t epoch_{0};
+  std::vector<uint64_t> stamps_; // epoch of the last saved change per entry
+  std::deque<Entry> entries_;
+};
+
+// Execution history for reverse stepping. It consists of keyframes, an
+// undo log and the table journals above:
+// - a keyframe holds the serialized machine state except memory, cache
+//   lines and predictor tables and is taken every interval cycles;
+// - the undo log holds the old value of every memory word written since
+//   the oldest keyframe, 16 bytes per sw, and the pages those writes
+//   allocated, so that going back also drops them.
+// Going back to cycle c means undoing the memory writes and rolling back
+// the journals down to the keyframe at or before c, loading it and
+// replaying forward, so a seek replays at most one interval. When the
+// keyframes exceed kMaxKeyframes every other one is dropped and the
+// interval doubles; when keyframes, undo log and journals together exceed
+// kMaxBytes the oldest keyframes are forgotten.
+class ExecutionHistory {
+public:
+  static constexpr size_t kInitialInterval = 4096;
+  static constexpr size_t kMaxKeyframes = 1024;
+  static constexpr size_t kMaxBytes = size_t{1} << 27; // 128 MiB
+
+  struct Keyframe {
+    size_t cycle;
+    uint64_t epoch;    // journal epoch started here
+    uint64_t undo_idx; // absolute index of the first later undo record
+    std::string state;
+  };
+  struct UndoRecord {
+    uint64_t address; // with kNewPage: index of a page allocated here
+    long old_value;
+  };
+  static constexpr uint64_t kNewPage = uint64_t{1} << 63;
+
+  // forget everything; the next keyframe is taken at the next cycle
+  void Reset();
+  inline bool KeyframeDue(size_t cycle) const {
+    return keyframes_.empty() || cycle >= next_keyframe_cycle_;
+  }
+  // Add a keyframe, which starts a new epoch. Over kMaxBytes the oldest
+  // keyframes go, always keeping the newest; forget(epoch) must then drop
+  // the journal entries of the epochs before epoch and return the bytes
+  // the journals still hold, which were journal_bytes.
+  template <typename ForgetFunc>
+  void AddKeyframe(size_t cycle, std::string state, size_t journal_bytes,
+                   ForgetFunc forget) {
+    AppendKeyframe(cycle, std::move(state));
+    while (keyframe_bytes_ + undo_.size() * sizeof(UndoRecord) +
+                   journal_bytes >
+               kMaxBytes &&
+           keyframes_.size() > 1) {
+      DropOldestKeyframe();
+      journal_bytes = forget(keyframes_.front().epoch);
+    }
+  }
+  // allocated_page: the write allocated the page of address
+  inline void RecordWrite(uint64_t address, long old_value,
+                          bool allocated_page) {
+    if (allocated_page) {
+      undo_.push_back({kNewPage | (address >> PagedMemory::kPageBits), 0});
+    }
+    undo_.push_back({address, old_value});
+  }
+
+  // the journals record changes into this epoch
+  uint64_t Epoch() const { return epoch_; }
+  bool Empty() const { return keyframes_.empty(); }
+  size_t OldestCycle() const { return keyframes_.front().cycle; }
+  // index of the latest keyframe at or before cycle, which must not be
+  // older than OldestCycle()
+  size_t FindKeyframe(size_t cycle) const;
+  const Keyframe &GetKeyframe(size_t keyframe_idx) const {
+    return keyframes_[keyframe_idx];
+  }
+  // Drop everything after keyframe keyframe_idx and hand out the undo
+  // records taken since it, newest first, so the caller can write back
+  // their old values before loading the keyframe and rolling the journals
+  // back to its epoch. The replay goes into a new epoch.
+  template <typename UndoFunc>
+  void RewindTo(size_t keyframe_idx, UndoFunc undo) {
+    const Keyframe &keyframe = keyframes_[keyframe_idx];
+    while (undo_base_ + undo_.size() > keyframe.undo_idx) {
+      undo(undo_.back());
+      undo_.pop_back();
+    }
+    next_keyframe_cycle_ = keyframe.cycle + interval_;
+    for (size_t later = keyframe_idx + 1; later < keyframes_.size(); ++later) {
+      keyframe_bytes_ -= keyframes_[later].state.size();
+    }
+    keyframes_.resize(keyframe_idx + 1);
+    ++epoch_;
+  }
+
+private:
+  void AppendKeyframe(size_t cycle, std::string state);
+  void DropOldestKeyframe();
+
+  std::vector<Keyframe> keyframes_;
+  std::deque<UndoRecord> undo_;
+  uint64_t undo_base_{0}; // absolute index of undo_.front()
+  size_t interval_{kInitialInterval};
+  size_t next_keyframe_cycle_{0};
+  size_t keyframe_bytes_{0}; // of the states held by keyframes_
+  // never reset, so that an epoch is not reused
+  uint64_t epoch_{0};
+};
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// lw   rd,rs,imm
+// sw   rd,rs,imm
+// addi rd,rs,imm
+// subi rd,rs,imm
+// add  rd,rs,rt
+// sub  rd,rs,rt
+// mul  rd,rs,rt
+// div  rd,rs,rt
+// beqz rd,label
+// bnez rd,label
+
+enum class InstructionOp : uint8_t {
+  LOAD,  // lw
+  STORE, // sw
+  ADDI,  // addi
+  SUBI,  // subi
+  ADD,   // add
+  SUB,   // sub
+  MUL,   // mul
+  DIV,   // div
+  BEQZ,  // beqz
+  BNEZ,  // bnez
+};
+
+// mul keeps the low 64 bits of the product; div truncates toward zero, a
+// division by zero yields 0 and LLONG_MIN / -1 wraps to LLONG_MIN
+inline long long Multiply(long long lhs, long long rhs) {
+  return static_cast<long long>(static_cast<unsigned long long>(lhs) *
+                                static_cast<unsigned long long>(rhs));
+}
+inline long long Divide(long long lhs, long long rhs) {
+  if (rhs == 0) {
+    return 0;
+  }
+  if (rhs == -1) {
+    return static_cast<long long>(0ull - static_cast<unsigned long long>(lhs));
+  }
+  return lhs / rhs;
+}
+
+// decoded static instruction, never modified by the pipeline: everything a
+// dynamic instance computes lives in the simulator's pipeline latches
+class Instruction {
+public:
+  InstructionOp instruction_op_;
+  uint8_t rd_;
+  bool is_breakpoint_;
+  uint32_t rs_or_label_;
+  int32_t rt_or_imm_;
+  Instruction() = delete;
+  inline Instruction(InstructionOp instruction_op, size_t rd, size_t rs,
+                     int rt_or_imm, bool is_breakpoint = false)
+      : instruction_op_(instruction_op), rd_(rd),
+        is_breakpoint_(is_breakpoint), rs_or_label_(rs),
+        rt_or_imm_(rt_or_imm) {}
+  ~Instruction() = default;
+};
+
+// instruction text of a whole program interned in one arena, the text of
+// instruction i is arena[offsets[i], offsets[i + 1])
+class InstructionText {
+public:
+  size_t Size() const { return offsets_.size() - 1; }
+  std::string_view operator[](size_t inst_idx) const {
+    return std::string_view(arena_).substr(
+        offsets_[inst_idx], offsets_[inst_idx + 1] - offsets_[inst_idx]);
+  }
+  void Reserve(size_t inst_num, size_t arena_size) {
+    offsets_.reserve(inst_num + 1);
+    arena_.reserve(arena_size);
+  }
+  // append the pieces of one instruction's text
+  void Append(std::initializer_list<std::string_view> pieces) {
+    size_t text_size = 0;
+    for (std::string_view piece : pieces) {
+      text_size += piece.size();
+    }
+    size_t begin = arena_.size();
+    arena_.resize(begin + text_size);
+    for (std::string_view piece : pieces) {
+      piece.copy(&arena_[begin], piece.size());
+      begin += piece.size();
+    }
+    offsets_.push_back(arena_.size());
+  }
+  const std::string &Arena() const { return arena_; }
+  const std::vector<uint32_t> &Offsets() const { return offsets_; }
+  void Assign(std::string arena, std::vector<uint32_t> offsets) {
+    arena_ = std::move(arena);
+    offsets_ = std::move(offsets);
+  }
+
+private:
+  std::string arena_;
+  std::vector<uint32_t> offsets_{0};
+};
+
+// assembled program with its symbol tables, as produced by the assembler or
+// loaded from a program image
+struct Program {
+  std::vector<long> init_memory;
+  std::vector<Instruction> instructions;
+  InstructionText instruction_text;
+  std::unordered_map<std::string, size_t> symbol_to_memory;
+  std::unordered_map<std::string, size_t> label_to_inst_idx;
+};
@@ -0,0 +1,349 @@
+#include "lockstep.h"
+#include "paged_memory.h"
+
+#include <algorithm>
+
+#if defined(__x86_64__) && defined(__has_attribute)
+#if __has_attribute(target_clones)
+#define LOCKSTEP_CLONES                                                        \
+  __attribute__((flatten, target_clones("avx512f", "avx2", "default")))
+#endif
+#endif
+#ifndef LOCKSTEP_CLONES
+#define LOCKSTEP_CLONES
+#endif
+
+using Register = LockstepBatch::Register;
+static constexpr size_t kLaneBlock = LockstepBatch::kLaneBlock;
+
+// dst = compute(lane) for every lane, or only for the lanes whose mask is
+// ~0. A block is computed completely before it is stored, so dst may be
+// one of the rows compute reads.
+template <bool kMasked, typename Word, typename Compute>
+static inline void StoreLanes(Word *dst, size_t stride, const Register *mask,
+                              Compute compute) {
+  for (size_t base = 0; base < stride; base += kLaneBlock) {
+    Word value[kLaneBlock];
+    for (size_t k = 0; k < kLaneBlock; ++k) {
+      value[k] = compute(base + k);
+    }
+    for (size_t k = 0; k < kLaneBlock; ++k) {
+      if constexpr (kMasked) {
+        dst[base + k] =
+            (value[k] & mask[base + k]) | (dst[base + k] & ~mask[base + k]);
+      } else {
+        dst[base + k] = value[k];
+      }
+    }
+  }
+}
+
+template <bool kMasked>
+static inline void AluLanes(const Instruction &inst, Register *registers,
+                            size_t stride, const Register *mask) {
+  Register *dst = registers + inst.rd_ * stride;
+  const Register *lhs = registers + inst.rs_or_label_ * stride;
+  const Register imm = inst.rt_or_imm_;
+  switch (inst.instruction_op_) {
+  case InstructionOp::ADDI:
+    StoreLanes<kMasked>(dst, stride, mask,
+                        [&](size_t lane) { return lhs[lane] + imm; });
+    break;
+  case InstructionOp::SUBI:
+    StoreLanes<kMasked>(dst, stride, mask,
+                        [&](size_t lane) { return lhs[lane] - imm; });
+    break;
+  case InstructionOp::ADD: {
+    const Register *rhs = registers + inst.rt_or_imm_ * stride;
+    StoreLanes<kMasked>(dst, stride, mask,
+                        [&](size_t lane) { return lhs[lane] + rhs[lane]; });
+    break;
+  }
+  case InstructionOp::SUB: {
+    const Register *rhs = registers + inst.rt_or_imm_ * stride;
+    StoreLanes<kMasked>(dst, stride, mask,
+                        [&](size_t lane) { return lhs[lane] - rhs[lane]; });
+    break;
+  }
+  case InstructionOp::MUL: {
+    const Register *rhs = registers + inst.rt_or_imm_ * stride;
+    StoreLanes<kMasked>(dst, stride, mask, [&](size_t lane) {
+      return Multiply(lhs[lane], rhs[lane]);
+    });
+    break;
+  }
+  default: { // DIV
+    const Register *rhs = registers + inst.rt_or_imm_ * stride;
+    StoreLanes<kMasked>(dst, stride, mask, [&](size_t lane) {
+      return Divide(lhs[lane], rhs[lane]);
+    });
+    break;
+  }
+  }
+}
+
+LockstepBatch::LockstepBatch(const Program &program,
+                             const std::vector<std::vector<long>> &lane_memory)
+    : instructions_(program.instructions), lane_num_(lane_memory.size()),
+      stride_((lane_memory.size() + kLaneBlock - 1) / kLaneBlock *
+              kLaneBlock),
+      registers_(32 * stride_, 0), pc_(stride_, 0), executed_(stride_, 0),
+      fault_pc_(stride_, 0), fault_address_(stride_, 0), mask_(stride_, 0),
+      address_(stride_, 0) {
+  if (lane_num_ == 0) {
+    uniform_pc_ = instructions_.size();
+    return;
+  }
+  size_t word_num = program.init_memory.size();
+  for (const std::vector<long> &memory : lane_memory) {
+    word_num = std::max(word_num, memory.size());
+  }
+  for (size_t address = 0; address < word_num; ++address) {
+    long *words = TouchPage(address >> kPageBits) + WordOffset(address);
+    for (size_t lane = 0; lane < stride_; ++lane) {
+      // the padding lanes repeat lane 0
+      const std::vector<long> &memory =
+          lane_memory[lane < lane_num_ ? lane : 0];
+      if (address < memory.size()) {
+        words[lane] = memory[address];
+      } else if (address < program.init_memory.size()) {
+        words[lane] = program.init_memory[address];
+      }
+    }
+  }
+}
+
+size_t LockstepBatch::Run(size_t max_steps) { return RunImpl(max_steps); }
+
+bool LockstepBatch::IsFinished() const {
+  const size_t inst_num = instructions_.size();
+  if (uniform_) {
+    return uniform_pc_ >= inst_num;
+  }
+  return std::all_of(pc_.begin(), pc_.end(),
+                     [inst_num](uint64_t pc) { return pc >= inst_num; });
+}
+
+long LockstepBatch::ReadMemory(size_t lane, uint64_t address) const {
+  const long *page = FindPage(address >> kPageBits);
+  return page == nullptr ? 0 : page[WordOffset(address) + lane];
+}
+
+const long *LockstepBatch::FindPage(uint64_t page_idx) const {
+  if (page_idx == last_page_idx_) {
+    return last_page_;
+  }
+  auto it = pages_.find(page_idx);
+  if (it == pages_.end()) {
+    return nullptr;
+  }
+  last_page_idx_ = page_idx;
+  last_page_ = it->second.get();
+  return last_page_;
+}
+
+long *LockstepBatch::TouchPage(uint64_t page_idx) {
+  if (page_idx == last_page_idx_) {
+    return last_page_;
+  }
+  std::unique_ptr<long[]> &page = pages_[page_idx];
+  if (page == nullptr) {
+    page.reset(new long[kPageWords * stride_]());
+  }
+  last_page_idx_ = page_idx;
+  last_page_ = page.get();
+  return last_page_;
+}
+
+void LockstepBatch::Diverge() {
+  for (size_t lane = 0; lane < stride_; ++lane) {
+    pc_[lane] = uniform_pc_;
+    executed_[lane] += uniform_steps_;
+  }
+  uniform_steps_ = 0;
+  uniform_ = false;
+}
+
+bool LockstepBatch::MemoryUniform(const Instruction &inst) {
+  const Register *base = registers_.data() + inst.rs_or_label_ * stride_;
+  Register *data = registers_.data() + inst.rd_ * stride_;
+  const Register imm = inst.rt_or_imm_;
+  const bool is_load = inst.instruction_op_ == InstructionOp::LOAD;
+  Register differ[kLaneBlock] = {};
+  for (size_t block = 0; block < stride_; block += kLaneBlock) {
+    for (size_t k = 0; k < kLaneBlock; ++k) {
+      differ[k] |= base[block + k] ^ base[0];
+    }
+  }
+  if (std::all_of(differ, differ + kLaneBlock,
+                  [](Register bits) { return bits == 0; })) {
+    // the common case: one address for all lanes, one row of words
+    Register address = base[0] + imm;
+    if (!PagedMemory::IsValidAddress(address)) {
+      return false;
+    }
+    if (is_load) {
+      const long *page = FindPage(address >> kPageBits);
+      if (page == nullptr) {
+        std::fill(data, data + stride_, 0);
+        return true;
+      }
+      const long *words = page + WordOffset(address);
+      StoreLanes<false>(data, stride_, nullptr,
+                        [&](size_t lane) { return words[lane]; });
+    } else {
+      long *words = TouchPage(address >> kPageBits) + WordOffset(address);
+      StoreLanes<false>(words, stride_, nullptr,
+                        [&](size_t lane) { return data[lane]; });
+    }
+    return true;
+  }
+  bool valid = true;
+  for (size_t lane = 0; lane < stride_; ++lane) {
+    address_[lane] = base[lane] + imm;
+    valid &= PagedMemory::IsValidAddress(address_[lane]);
+  }
+  if (!valid) {
+    return false;
+  }
+  for (size_t lane = 0; lane < stride_; ++lane) {
+    uint64_t address = address_[lane];
+    if (is_load) {
+      data[lane] = ReadMemory(lane, address);
+    } else {
+      TouchPage(address >> kPageBits)[WordOffset(address) + lane] = data[lane];
+    }
+  }
+  return true;
+}
+
+void LockstepBatch::StepMasked(uint64_t pc) {
+  const Instruction &inst = instructions_[pc];
+  const uint64_t *mask = reinterpret_cast<const uint64_t *>(mask_.data());
+  switch (inst.instruction_op_) {
+  case InstructionOp::LOAD:
+  case InstructionOp::STORE: {
+    const Register *base = registers_.data() + inst.rs_or_label_ * stride_;
+    Register *data = registers_.data() + inst.rd_ * stride_;
+    for (size_t lane = 0; lane < stride_; ++lane) {
+      if (mask_[lane] == 0) {
+        continue;
+      }
+      Register address = base[lane] + inst.rt_or_imm_;
+      if (!PagedMemory::IsValidAddress(address)) {
+        pc_[lane] = kFaultedPc;
+        fault_pc_[lane] = pc;
+        fault_address_[lane] = address;
+        mask_[lane] = 0;
+        continue;
+      }
+      if (inst.instruction_op_ == InstructionOp::LOAD) {
+        data[lane] = ReadMemory(lane, address);
+      } else {
+        TouchPage(address >> kPageBits)[WordOffset(address) + lane] =
+            data[lane];
+      }
+    }
+    break;
+  }
+  case InstructionOp::BEQZ:
+  case InstructionOp::BNEZ: {
+    const Register *cond = registers_.data() + inst.rd_ * stride_;
+    const uint64_t flip = inst.instruction_op_ == InstructionOp::BEQZ ? 0 : ~0;
+    const uint64_t target = inst.rs_or_label_;
+    for (size_t lane = 0; lane < stride_; ++lane) {
+      uint64_t taken = (0 - uint64_t{cond[lane] == 0}) ^ flip;
+      uint64_t next = (target & taken) | ((pc + 1) & ~taken);
+      pc_[lane] = (next & mask[lane]) | (pc_[lane] & ~mask[lane]);
+      executed_[lane] += mask[lane] & 1;
+    }
+    return;
+  }
+  default:
+    AluLanes<true>(inst, registers_.data(), stride_, mask_.data());
+    break;
+  }
+  for (size_t lane = 0; lane < stride_; ++lane) {
+    pc_[lane] += mask[lane] & 1;
+    executed_[lane] += mask[lane] & 1;
+  }
+}
+
+LOCKSTEP_CLONES
+size_t LockstepBatch::RunImpl(size_t max_steps) {
+  const size_t inst_num = instructions_.size();
+  size_t steps = 0;
+  while (steps < max_steps) {
+    if (!uniform_) {
+      uint64_t pc = kFaultedPc;
+      for (size_t lane = 0; lane < stride_; ++lane) {
+        pc = std::min(pc, pc_[lane]);
+      }
+      if (pc >= inst_num) {
+        break;
+      }
+      size_t at_pc = 0;
+      for (size_t lane = 0; lane < stride_; ++lane) {
+        mask_[lane] = pc_[lane] == pc ? ~Register{0} : 0;
+        at_pc += pc_[lane] == pc;
+      }
+      if (at_pc == stride_) {
+        // reconverged
+        uniform_ = true;
+        uniform_pc_ = pc;
+        continue;
+      }
+      StepMasked(pc);
+      ++steps;
+      continue;
+    }
+
+    if (uniform_pc_ >= inst_num) {
+      break;
+    }
+    const Instruction &inst = instructions_[uniform_pc_];
+    switch (inst.instruction_op_) {
+    case InstructionOp::LOAD:
+    case InstructionOp::STORE:
+      if (!MemoryUniform(inst)) {
+        // some lane faults, let the masked step sort them out
+        Diverge();
+        std::fill(mask_.begin(), mask_.end(), ~Register{0});
+        StepMasked(pc_[0]);
+        ++steps;
+        continue;
+      }
+      break;
+    case InstructionOp::BEQZ:
+    case InstructionOp::BNEZ: {
+      const Register *cond = registers_.data() + inst.rd_ * stride_;
+      size_t zeros = 0;
+      for (size_t lane = 0; lane < stride_; ++lane) {
+        zeros += cond[lane] == 0;
+      }
+      ++uniform_steps_;
+      ++steps;
+      if (zeros == 0 || zeros == stride_) {
+        bool taken = (inst.instruction_op_ == InstructionOp::BEQZ) ==
+                     (zeros == stride_);
+        uniform_pc_ = taken ? inst.rs_or_label_ : uniform_pc_ + 1;
+        continue;
+      }
+      Diverge();
+      const bool on_zero = inst.instruction_op_ == InstructionOp::BEQZ;
+      for (size_t lane = 0; lane < stride_; ++lane) {
+        pc_[lane] =
+            (cond[lane] == 0) == on_zero ? inst.rs_or_label_ : pc_[lane] + 1;
+      }
+      continue;
+    }
+    default:
+      AluLanes<false>(inst, registers_.data(), stride_, nullptr);
+      break;
+    }
+    ++uniform_pc_;
+    ++uniform_steps_;
+    ++steps;
+  }
+  return steps;
+}
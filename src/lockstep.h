@@ -0,0 +1,100 @@
+#pragma once
+
+#include "instruction.h"
+
+#include <limits>
+#include <memory>
+
+// Functional simulation of one program over many data sets at once. Every
+// data set is a lane with its own registers, memory and pc; the lanes
+// share the decoded program and step through it in lockstep, so decode and
+// dispatch are paid once per instruction for all lanes.
+//
+// Registers and memory are kept structure-of-arrays: register r of all
+// lanes is one contiguous row, and so is every memory word, which turns the
+// per-instruction work into loops over lane blocks that the compiler
+// vectorizes. The step loop is compiled for AVX-512, AVX2 and the baseline
+// ISA where the compiler supports function clones, and the best one is
+// picked at load time.
+//
+// While all lanes are at the same pc the batch runs without masks. When a
+// beqz/bnez goes different ways, or a lane faults, the lanes diverge: each
+// step then executes the lowest pc among the running lanes for the lanes
+// at that pc only, which reconverges them at the first common pc.
+class LockstepBatch {
+public:
+  using Register = long long;
+  // lanes are padded to a multiple of this, the padding copies lane 0
+  static constexpr size_t kLaneBlock = 8;
+  static constexpr size_t kPageBits = 6; // 64 words of every lane per page
+  static constexpr size_t kPageWords = size_t{1} << kPageBits;
+
+  // one lane per entry of lane_memory, which replaces the program's .data
+  // for that lane; words past its end keep the program's values
+  LockstepBatch(const Program &program,
+                const std::vector<std::vector<long>> &lane_memory);
+  LockstepBatch(const LockstepBatch &) = delete;
+  LockstepBatch &operator=(const LockstepBatch &) = delete;
+
+  // execute at most max_steps instructions, each for every lane at its pc;
+  // return the steps executed
+  size_t Run(size_t max_steps = std::numeric_limits<size_t>::max());
+  bool IsFinished() const;
+
+  size_t LaneNum() const { return lane_num_; }
+  Register GetRegister(size_t lane, size_t reg) const {
+    return registers_[reg * stride_ + lane];
+  }
+  long ReadMemory(size_t lane, uint64_t address) const;
+  // instructions lane executed, not counting one that faulted
+  uint64_t InstructionCount(size_t lane) const {
+    return executed_[lane] + (uniform_ ? uniform_steps_ : 0);
+  }
+  bool IsFaulted(size_t lane) const { return LanePc(lane) == kFaultedPc; }
+  // the lw/sw and address of a faulted lane
+  size_t FaultPc(size_t lane) const { return fault_pc_[lane]; }
+  Register FaultAddress(size_t lane) const { return fault_address_[lane]; }
+
+private:
+  static constexpr uint64_t kFaultedPc = std::numeric_limits<uint64_t>::max();
+
+  uint64_t LanePc(size_t lane) const {
+    return uniform_ ? uniform_pc_ : pc_[lane];
+  }
+  size_t RunImpl(size_t max_steps);
+  // leave the uniform mode: every lane gets the shared pc and step count
+  void Diverge();
+  // execute the instruction at pc for the lanes in mask_
+  void StepMasked(uint64_t pc);
+  // lw/sw in uniform mode; false if a lane would fault, nothing done then
+  bool MemoryUniform(const Instruction &inst);
+
+  // page of every lane's words, nullptr if never written
+  const long *FindPage(uint64_t page_idx) const;
+  long *TouchPage(uint64_t page_idx);
+  inline size_t WordOffset(uint64_t address) const {
+    return (address & (kPageWords - 1)) * stride_;
+  }
+
+  std::vector<Instruction> instructions_;
+  size_t lane_num_;
+  size_t stride_; // lane_num_ rounded up to kLaneBlock
+  std::vector<Register> registers_; // 32 rows of stride_
+  std::unordered_map<uint64_t, std::unique_ptr<long[]>> pages_;
+  mutable uint64_t last_page_idx_{std::numeric_limits<uint64_t>::max()};
+  mutable long *last_page_{nullptr};
+
+  // all lanes at uniform_pc_ and none faulted; uniform_steps_ instructions
+  // ran since, not yet added to executed_
+  bool uniform_{true};
+  uint64_t uniform_pc_{0};
+  uint64_t uniform_steps_{0};
+  // divergent mode state, kFaultedPc once a lane faulted
+  std::vector<uint64_t> pc_;
+  std::vector<uint64_t> executed_;
+  std::vector<size_t> fault_pc_;
+  std::vector<Register> fault_address_;
+  // scratch: ~0 for the lanes a divergent step executes, and addresses
+  std::vector<Register> mask_;
+  std::vector<Register> address_;
+};
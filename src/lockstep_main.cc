@@ -0,0 +1,251 @@
+// Lockstep driver: run one program over every data set of a CSV file. The
+// data sets are split into groups of --width lanes; each group is one
+// LockstepBatch, and the groups run on a work-stealing thread pool. The
+// output has one CSV row per data set, in input order.
+
+#include "command_line.h"
+#include "lockstep.h"
+#include "program_image.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+struct LockstepOptions {
+  const char *program_path{nullptr};
+  const char *inputs_path{nullptr};
+  size_t width{64};
+  size_t max_steps{std::numeric_limits<size_t>::max()};
+  size_t thread_num{0};
+  const char *output_path{nullptr};
+};
+
+// final state of one data set
+struct LaneResult {
+  const char *status{"running"};
+  uint64_t instructions{0};
+  size_t fault_pc{0};
+  LockstepBatch::Register fault_address{0};
+  std::vector<long> memory; // the data words, in address order
+  std::vector<LockstepBatch::Register> registers;
+};
+
+static void PrintLockstepUsage() {
+  std::cerr
+      << "Usage: ./Lockstep [your MIPS assembly code file | program image] "
+         "--inputs <csv> [options]\n"
+      << "  --inputs <file>      one data set per line; the header line "
+         "names the data symbols the columns set, others keep their .data "
+         "value\n"
+      << "  --width <n>          data sets simulated together (default: 64)\n"
+      << "  --max-steps <n>      instruction limit of every group\n"
+      << "  --threads <n>        worker threads (default: all cores)\n"
+      << "  --output <file>      write the results to file instead of "
+         "stdout\n";
+}
+
+[[noreturn]] static void ExitWithUsage(const std::string &message) {
+  std::cerr << message << '\n';
+  PrintLockstepUsage();
+  exit(-1);
+}
+
+static LockstepOptions ParseCommandLine(int argc, char **argv) {
+  LockstepOptions options;
+  for (int arg_idx = 1; arg_idx < argc; ++arg_idx) {
+    std::string arg = argv[arg_idx];
+    if (arg[0] != '-' && options.program_path == nullptr) {
+      options.program_path = argv[arg_idx];
+      continue;
+    }
+    if (arg_idx + 1 >= argc) {
+      ExitWithUsage("Unknown option or missing value: " + arg);
+    }
+    std::string value = argv[++arg_idx];
+    if (arg == "--inputs") {
+      options.inputs_path = argv[arg_idx];
+    } else if (arg == "--width") {
+      if (!ParseSize(value, options.width) || options.width == 0) {
+        ExitWithUsage("Invalid width: " + value);
+      }
+    } else if (arg == "--max-steps") {
+      if (!ParseSize(value, options.max_steps)) {
+        ExitWithUsage("Invalid instruction limit: " + value);
+      }
+    } else if (arg == "--threads") {
+      if (!ParseSize(value, options.thread_num)) {
+        ExitWithUsage("Invalid thread count: " + value);
+      }
+    } else if (arg == "--output") {
+      options.output_path = argv[arg_idx];
+    } else {
+      ExitWithUsage("Unknown option: " + arg);
+    }
+  }
+  if (options.program_path == nullptr) {
+    ExitWithUsage("You did not provide MIPS file.");
+  }
+  if (options.inputs_path == nullptr) {
+    ExitWithUsage("You did not provide the data sets.");
+  }
+  return options;
+}
+
+static std::vector<std::string> SplitLine(const std::string &line) {
+  std::vector<std::string> fields;
+  std::stringstream stream(line);
+  std::string field;
+  while (std::getline(stream, field, ',')) {
+    fields.push_back(field);
+  }
+  return fields;
+}
+
+// every data set as the program's .data with the columns' words replaced
+static bool ReadInputs(const char *path, const Program &program,
+                       std::vector<std::vector<long>> &lane_memory) {
+  std::ifstream fin(path);
+  if (!fin) {
+    std::cerr << "Cannot open inputs: " << path << '\n';
+    return false;
+  }
+  std::string line;
+  std::vector<size_t> addresses;
+  if (std::getline(fin, line)) {
+    for (const std::string &symbol : SplitLine(line)) {
+      auto it = program.symbol_to_memory.find(symbol);
+      if (it == program.symbol_to_memory.end()) {
+        std::cerr << path << ":1: error: unknown data symbol " << symbol
+                  << '\n';
+        return false;
+      }
+      addresses.push_back(it->second);
+    }
+  }
+  for (size_t line_num = 2; std::getline(fin, line); ++line_num) {
+    if (line.empty()) {
+      continue;
+    }
+    std::vector<std::string> fields = SplitLine(line);
+    if (fields.size() != addresses.size()) {
+      std::cerr << path << ':' << line_num << ": error: expected "
+                << addresses.size() << " values\n";
+      return false;
+    }
+    std::vector<long> &memory = lane_memory.emplace_back(program.init_memory);
+    for (size_t column = 0; column < fields.size(); ++column) {
+      char *end = nullptr;
+      long value = std::strtol(fields[column].c_str(), &end, 10);
+      if (fields[column].empty() || *end != '\0') {
+        std::cerr << path << ':' << line_num << ": error: invalid value "
+                  << fields[column] << '\n';
+        return false;
+      }
+      memory[addresses[column]] = value;
+    }
+  }
+  return true;
+}
+
+static void RunGroup(const Program &program,
+                     const std::vector<std::vector<long>> &lane_memory,
+                     size_t first, size_t last, size_t max_steps,
+                     std::vector<LaneResult> &results) {
+  LockstepBatch batch(program,
+                      std::vector<std::vector<long>>(
+                          lane_memory.begin() + first,
+                          lane_memory.begin() + last));
+  batch.Run(max_steps);
+  const bool finished = batch.IsFinished();
+  for (size_t lane = 0; lane < batch.LaneNum(); ++lane) {
+    LaneResult &result = results[first + lane];
+    result.instructions = batch.InstructionCount(lane);
+    if (batch.IsFaulted(lane)) {
+      result.status = "fault";
+      result.fault_pc = batch.FaultPc(lane);
+      result.fault_address = batch.FaultAddress(lane);
+    } else if (finished) {
+      result.status = "done";
+    }
+    for (size_t address = 0; address < program.init_memory.size();
+         ++address) {
+      result.memory.push_back(batch.ReadMemory(lane, address));
+    }
+    for (size_t reg = 0; reg < 32; ++reg) {
+      result.registers.push_back(batch.GetRegister(lane, reg));
+    }
+  }
+}
+
+static void WriteCsv(std::ostream &out, const Program &program,
+                     const std::vector<LaneResult> &results) {
+  std::vector<std::string> symbols(program.init_memory.size());
+  for (const auto &[symbol, address] : program.symbol_to_memory) {
+    symbols[address] = symbol;
+  }
+  out << "lane,status,instructions,fault_pc,fault_address";
+  for (const std::string &symbol : symbols) {
+    out << ',' << symbol;
+  }
+  for (size_t reg = 0; reg < 32; ++reg) {
+    out << ",r" << reg;
+  }
+  out << '\n';
+  for (size_t lane = 0; lane < results.size(); ++lane) {
+    const LaneResult &result = results[lane];
+    out << lane << ',' << result.status << ',' << result.instructions << ',';
+    if (result.status[0] == 'f') {
+      out << result.fault_pc << ',' << result.fault_address;
+    } else {
+      out << ',';
+    }
+    for (long word : result.memory) {
+      out << ',' << word;
+    }
+    for (LockstepBatch::Register value : result.registers) {
+      out << ',' << value;
+    }
+    out << '\n';
+  }
+}
+
+int main(int argc, char **argv) {
+  LockstepOptions options = ParseCommandLine(argc, argv);
+  Program program;
+  if (!LoadProgram(options.program_path, program)) {
+    exit(-1);
+  }
+  std::vector<std::vector<long>> lane_memory;
+  if (!ReadInputs(options.inputs_path, program, lane_memory)) {
+    exit(-1);
+  }
+
+  // every group writes its own slots of results
+  std::vector<LaneResult> results(lane_memory.size());
+  {
+    ThreadPool pool(options.thread_num);
+    for (size_t first = 0; first < lane_memory.size();
+         first += options.width) {
+      size_t last = std::min(first + options.width, lane_memory.size());
+      pool.Submit([&, first, last] {
+        RunGroup(program, lane_memory, first, last, options.max_steps,
+                 results);
+      });
+    }
+    pool.Wait();
+  }
+
+  std::ofstream fout;
+  if (options.output_path != nullptr) {
+    fout.open(options.output_path, std::ios::trunc);
+    if (!fout) {
+      std::cerr << "Cannot write " << options.output_path << '\n';
+      exit(-1);
+    }
+  }
+  std::ostream &out = options.output_path != nullptr ? fout : std::cout;
+  WriteCsv(out, program, results);
+  return 0;
+}
@@ -1,115 +1,564 @@
+#include "command_line.h"
+#include "checkpoint.h"
+#include "program_image.h"
+#include "sampling.h"
 #include "simulator.h"
 
-int main(int argc, char **argv) {
-  if (argc < 2) {
-    std::cerr << "You did not provide MIPS file.\n"
-              << "Usage: ./Simulator [your  MIPS assembly code file]\n";
+#include <algorithm>
+
+struct CommandLineOptions {
+  const char *program_path{nullptr};
+  bool batch{false};
+  // -1: ask interactively, 0: disabled, 1: enabled
+  int enable_forwarding{-1};
+  std::vector<BreakpointSpec> breakpoints;
+  std::vector<Watch> watches;
+  size_t max_cycles{std::numeric_limits<size_t>::max()};
+  // instructions executed by the functional engine before the pipeline starts
+  size_t fast_forward{0};
+  // views printed at the end of a batch run, same letters as the v command
+  std::string dumps{"srm"};
+  // write the assembled program as a binary image for faster reloads
+  const char *save_image{nullptr};
+  // data cache levels, none: ideal single-cycle memory
+  std::optional<CacheConfig> l1_cache;
+  std::optional<CacheConfig> l2_cache;
+  // none: branches always fall through
+  std::optional<BranchPredictorConfig> predictor;
+  // restore this checkpoint before running
+  const char *restore{nullptr};
+  // batch runs write a checkpoint to this path, at checkpoint_at or at the
+  // end of the run, or to <path>.<cycle> every checkpoint_every cycles
+  const char *checkpoint_path{nullptr};
+  size_t checkpoint_at{std::numeric_limits<size_t>::max()};
+  size_t checkpoint_every{0};
+  // interactive runs record a history for the u, R and j commands
+  bool history{true};
+  // binary pipeline trace, see trace.h
+  const char *trace_path{nullptr};
+  // the functional engine runs translated basic blocks
+  bool translation{true};
+  // list-schedule each basic block before running, see scheduler.h
+  bool schedule{false};
+  // instructions issued per cycle, see superscalar.h
+  IssueConfig issue;
+  // run on the out-of-order core instead, see tomasulo.h
+  std::optional<TomasuloConfig> ooo;
+  // mul and div latencies, see functional_unit.h
+  FunctionalUnitsConfig units;
+  // batch runs estimate the statistics from samples or weighted regions
+  // instead of simulating every cycle, see sampling.h
+  std::optional<SamplingConfig> sampling;
+  std::vector<SampleRegion> regions;
+  size_t region_warmup{SamplingConfig{}.warmup};
+  // batch runs write basic block vectors for a clustering tool instead
+  const char *bbv_path{nullptr};
+  size_t bbv_interval{100000};
+};
+
+static void PrintCommandLineUsage() {
+  std::cerr << "Usage: ./Simulator [your MIPS assembly code file | program "
+               "image] [options]\n"
+            << "  --batch            run without interaction, print only the "
+               "final dumps\n"
+            << "  --forwarding       enable forwarding without asking\n"
+            << "  --no-forwarding    disable forwarding without asking\n"
+            << "  --break <spec>     set a breakpoint, may be repeated; spec "
+               "is index[:condition[:hit count]], e.g. 12:r3==0:2\n"
+            << "  --watch <spec>     stop when a register or memory words "
+               "change, spec is rN, address or first-last; may be repeated\n"
+            << "  --max-cycles <n>   stop a batch run after n cycles\n"
+            << "  --fast-forward <n> execute n instructions functionally "
+               "before the pipeline starts\n"
+            << "  --functional       execute the whole program functionally\n"
+            << "  --no-translation   execute functionally one instruction "
+               "at a time instead of by translated basic blocks\n"
+            << "  --issue <spec>     issue several instructions per cycle in "
+               "order, spec is width[:lw/sw[:ALU]] per cycle, e.g. 2:1\n"
+            << "  --ooo <spec>       execute out of order, spec is "
+               "rob[:ALU stations[:lw/sw stations[:CDB width[:width]]]],\n"
+            << "                     e.g. 32:8:4:2:2\n"
+            << "  --mul <spec>       mul unit, spec is "
+               "latency[:pipelined|blocking|issue interval] (default 4)\n"
+            << "  --div <spec>       div unit, same spec (default "
+               "12:blocking)\n"
+            << "  --sample <spec>    estimate the statistics from samples, "
+               "spec is period[:unit[:warmup]] in instructions,\n"
+            << "                     e.g. 100000:1000:2000\n"
+            << "  --regions <file>   estimate them from weighted regions, "
+               "lines of start length weight\n"
+            << "  --region-warmup <n> detailed instructions before each "
+               "region (default 2000)\n"
+            << "  --bbv <file>       write the basic block vectors of the run "
+               "for a clustering tool such as SimPoint\n"
+            << "  --bbv-interval <n> instructions per vector (default "
+               "100000)\n"
+            << "  --schedule         reorder each basic block to avoid RAW "
+               "stalls before running; batch runs also run the original "
+               "order to compare\n"
+            << "  --dump <views>     views printed after a batch run, any of "
+               "i p r b w m s h (default: srm)\n"
+            << "  --save-image <file> save the assembled program as a binary "
+               "image, which can be given instead of the assembly file\n"
+            << "  --l1 <spec>        model an L1 data cache, spec is "
+               "size:line:ways[:lru|fifo|random[:miss latency]] in words,\n"
+            << "                     e.g. 256:4:2:lru:10\n"
+            << "  --l2 <spec>        add an L2 behind the L1, same spec\n"
+            << "  --predictor <spec> predict branches at fetch, spec is "
+               "not-taken|btfn|1bit|2bit|gshare[:entries[:history bits]]\n"
+            << "  --btb <entries>    predicted-taken branches need their "
+               "target in a BTB of that size\n"
+            << "  --restore <file>   continue from a checkpoint of the same "
+               "program, with its forwarding, cache, predictor, issue and "
+               "mul/div settings\n"
+            << "  --checkpoint <file> write a checkpoint at the end of the "
+               "batch run\n"
+            << "  --checkpoint-at <cycle>   ... at that cycle instead\n"
+            << "  --checkpoint-every <n>    ... to <file>.<cycle> every n "
+               "cycles instead, storing only the pages changed in between\n"
+            << "  --no-history       do not record the history needed to "
+               "step backward\n"
+            << "  --trace <file>     write a binary pipeline trace, convert it "
+               "with TraceConvert; implies --no-history\n";
+}
+
+static CommandLineOptions ParseCommandLine(int argc, char **argv) {
+  CommandLineOptions options;
+  for (int arg_idx = 1; arg_idx < argc; ++arg_idx) {
+    std::string arg = argv[arg_idx];
+    bool has_value = arg_idx + 1 < argc;
+    if (arg == "--batch") {
+      options.batch = true;
+    } else if (arg == "--no-history") {
+      options.history = false;
+    } else if (arg == "--forwarding") {
+      options.enable_forwarding = 1;
+    } else if (arg == "--no-forwarding") {
+      options.enable_forwarding = 0;
+    } else if (arg == "--break" && has_value) {
+      std::string error;
+      if (!ParseBreakpointSpec(argv[++arg_idx],
+                               options.breakpoints.emplace_back(), error)) {
+        std::cerr << "Invalid breakpoint " << argv[arg_idx] << ": " << error
+                  << '\n';
+        exit(-1);
+      }
+    } else if (arg == "--watch" && has_value) {
+      std::string error;
+      if (!ParseWatchSpec(argv[++arg_idx], options.watches.emplace_back(),
+                          error)) {
+        std::cerr << "Invalid watchpoint " << argv[arg_idx] << ": " << error
+                  << '\n';
+        exit(-1);
+      }
+    } else if (arg == "--max-cycles" && has_value) {
+      if (!ParseSize(argv[++arg_idx], options.max_cycles)) {
+        std::cerr << "Invalid cycle limit: " << argv[arg_idx] << '\n';
+        exit(-1);
+      }
+    } else if (arg == "--fast-forward" && has_value) {
+      if (!ParseSize(argv[++arg_idx], options.fast_forward)) {
+        std::cerr << "Invalid instruction count: " << argv[arg_idx] << '\n';
+        exit(-1);
+      }
+    } else if (arg == "--issue" && has_value) {
+      std::string error;
+      if (!ParseIssueConfig(argv[++arg_idx], options.issue, error)) {
+        std::cerr << "Invalid issue " << argv[arg_idx] << ": " << error
+                  << '\n';
+        exit(-1);
+      }
+    } else if (arg == "--ooo" && has_value) {
+      std::string error;
+      if (!ParseTomasuloConfig(argv[++arg_idx], options.ooo.emplace(),
+                               error)) {
+        std::cerr << "Invalid out-of-order core " << argv[arg_idx] << ": "
+                  << error << '\n';
+        exit(-1);
+      }
+    } else if ((arg == "--mul" || arg == "--div") && has_value) {
+      UnitKind kind = arg == "--mul" ? UnitKind::MUL : UnitKind::DIV;
+      std::string error;
+      if (!ParseFunctionalUnitConfig(argv[++arg_idx], options.units[kind],
+                                     error)) {
+        std::cerr << "Invalid " << arg.substr(2) << " unit " << argv[arg_idx]
+                  << ": " << error << '\n';
+        exit(-1);
+      }
+    } else if (arg == "--schedule") {
+      options.schedule = true;
+    } else if (arg == "--no-translation") {
+      options.translation = false;
+    } else if (arg == "--functional") {
+      options.fast_forward = std::numeric_limits<size_t>::max();
+    } else if (arg == "--save-image" && has_value) {
+      options.save_image = argv[++arg_idx];
+    } else if ((arg == "--l1" || arg == "--l2") && has_value) {
+      std::optional<CacheConfig> &cache =
+          arg == "--l1" ? options.l1_cache : options.l2_cache;
+      cache.emplace();
+      std::string error;
+      if (!ParseCacheConfig(argv[++arg_idx], *cache, error)) {
+        std::cerr << "Invalid cache " << argv[arg_idx] << ": " << error
+                  << '\n';
+        exit(-1);
+      }
+    } else if ((arg == "--predictor" || arg == "--btb") && has_value) {
+      if (!options.predictor.has_value()) {
+        options.predictor.emplace();
+      }
+      std::string error;
+      bool parsed =
+          arg == "--predictor"
+              ? ParsePredictorConfig(argv[++arg_idx], *options.predictor, error)
+              : ParseBtbEntries(argv[++arg_idx], *options.predictor, error);
+      if (!parsed) {
+        std::cerr << "Invalid " << arg << ' ' << argv[arg_idx] << ": "
+                  << error << '\n';
+        exit(-1);
+      }
+    } else if (arg == "--restore" && has_value) {
+      options.restore = argv[++arg_idx];
+    } else if (arg == "--checkpoint" && has_value) {
+      options.checkpoint_path = argv[++arg_idx];
+    } else if (arg == "--checkpoint-at" && has_value) {
+      if (!ParseSize(argv[++arg_idx], options.checkpoint_at)) {
+        std::cerr << "Invalid checkpoint cycle: " << argv[arg_idx] << '\n';
+        exit(-1);
+      }
+    } else if (arg == "--checkpoint-every" && has_value) {
+      if (!ParseSize(argv[++arg_idx], options.checkpoint_every) ||
+          options.checkpoint_every == 0) {
+        std::cerr << "Invalid checkpoint interval: " << argv[arg_idx] << '\n';
+        exit(-1);
+      }
+    } else if (arg == "--trace" && has_value) {
+      options.trace_path = argv[++arg_idx];
+      options.history = false;
+    } else if (arg == "--sample" && has_value) {
+      std::string error;
+      if (!ParseSamplingConfig(argv[++arg_idx], options.sampling.emplace(),
+                               error)) {
+        std::cerr << "Invalid sampling " << argv[arg_idx] << ": " << error
+                  << '\n';
+        exit(-1);
+      }
+    } else if (arg == "--regions" && has_value) {
+      if (!LoadSampleRegions(argv[++arg_idx], options.regions)) {
+        exit(-1);
+      }
+    } else if (arg == "--region-warmup" && has_value) {
+      if (!ParseSize(argv[++arg_idx], options.region_warmup)) {
+        std::cerr << "Invalid region warmup: " << argv[arg_idx] << '\n';
+        exit(-1);
+      }
+    } else if (arg == "--bbv" && has_value) {
+      options.bbv_path = argv[++arg_idx];
+    } else if (arg == "--bbv-interval" && has_value) {
+      if (!ParseSize(argv[++arg_idx], options.bbv_interval) ||
+          options.bbv_interval == 0) {
+        std::cerr << "Invalid vector interval: " << argv[arg_idx] << '\n';
+        exit(-1);
+      }
+    } else if (arg == "--dump" && has_value) {
+      options.dumps = argv[++arg_idx];
+    } else if (arg[0] != '-' && options.program_path == nullptr) {
+      options.program_path = argv[arg_idx];
+    } else {
+      std::cerr << "Unknown option: " << arg << '\n';
+      PrintCommandLineUsage();
+      exit(-1);
+    }
+  }
+  if (options.program_path == nullptr) {
+    std::cerr << "You did not provide MIPS file.\n";
+    PrintCommandLineUsage();
+    exit(-1);
+  }
+  if ((options.checkpoint_at != std::numeric_limits<size_t>::max() ||
+       options.checkpoint_every != 0) &&
+      options.checkpoint_path == nullptr) {
+    std::cerr << "--checkpoint-at/--checkpoint-every need --checkpoint\n";
+    exit(-1);
+  }
+  if (options.l2_cache.has_value() && !options.l1_cache.has_value()) {
+    std::cerr << "--l2 needs an --l1 in front of it\n";
+    exit(-1);
+  }
+  if (options.issue.width > 1 && options.trace_path != nullptr) {
+    std::cerr << "--trace needs single issue\n";
+    exit(-1);
+  }
+  if (options.ooo.has_value() &&
+      (options.issue.width > 1 || options.trace_path != nullptr ||
+       options.checkpoint_path != nullptr || options.restore != nullptr)) {
+    std::cerr << "--ooo cannot be combined with --issue, --trace, "
+                 "--checkpoint or --restore\n";
+    exit(-1);
+  }
+  bool watching = !options.watches.empty() ||
+                  std::any_of(options.breakpoints.begin(),
+                              options.breakpoints.end(),
+                              [](const BreakpointSpec &bp) {
+                                return !bp.IsPlain();
+                              });
+  // the functional engine does not check them, so --fast-forward and
+  // --functional would miss every change they make
+  if (watching && (options.issue.width > 1 || options.ooo.has_value() ||
+                   options.fast_forward != 0)) {
+    std::cerr << "--watch and conditional breakpoints need single issue "
+                 "without --ooo, --fast-forward or --functional\n";
     exit(-1);
   }
-  std::ifstream fin(argv[1]);
-  std::unordered_map<std::string, size_t> symbol_to_memory;
-  std::unordered_map<std::string, size_t> label_to_inst_idx;
-  std::unordered_map<std::string, std::vector<size_t>> unresolved_label;
-  std::vector<long> init_memory;
-  std::vector<Instruction> instructions;
-  std::vector<std::string> instruction_text;
+  const int sampled_modes = options.sampling.has_value() +
+                            !options.regions.empty() +
+                            (options.bbv_path != nullptr);
+  if (sampled_modes > 1) {
+    std::cerr << "--sample, --regions and --bbv exclude each other\n";
+    exit(-1);
+  }
+  if (sampled_modes != 0 &&
+      (!options.batch || options.checkpoint_path != nullptr ||
+       !options.breakpoints.empty() || !options.watches.empty() ||
+       options.max_cycles != std::numeric_limits<size_t>::max())) {
+    std::cerr << "--sample, --regions and --bbv need --batch, and cannot be "
+                 "combined with --checkpoint, --break, --watch or "
+                 "--max-cycles\n";
+    exit(-1);
+  }
+  return options;
+}
 
-  size_t memo_top = 0;
-  std::string curr_tok;
-  fin >> curr_tok;
+// return false if view is not one of i p r b w m s h
+static bool PrintView(const Simulator &sim, char view) {
+  switch (view) {
+  case 'i':
+    sim.PrintInstructions();
+    break;
+  case 'p':
+    sim.PrintPipelines();
+    break;
+  case 'r':
+    sim.PrintRegisters();
+    break;
+  case 'b':
+    sim.PrintBreakpoints();
+    break;
+  case 'w':
+    sim.PrintWatches();
+    break;
+  case 'm':
+    sim.PrintMemory();
+    break;
+  case 's':
+    sim.PrintStatistics();
+    break;
+  case 'h':
+    sim.PrintProfile();
+    break;
+  default:
+    return false;
+  }
+  return true;
+}
 
-  if (curr_tok == ".data") {
-    // std::cout << curr_tok << '\n';
-    while ((fin >> curr_tok) && curr_tok != ".text") {
-      curr_tok.pop_back();
-      symbol_to_memory[curr_tok] = memo_top;
-      long val;
-      fin >> val;
-      // std::cout << curr_tok << " " << val << '\n';
-      init_memory.emplace_back(val);
-      memo_top++;
-    }
+// Run a batch until the end, a breakpoint or the cycle limit, writing the
+// requested checkpoints on the way. Return true if stopped at a breakpoint
+// or watchpoint.
+static bool RunBatch(Simulator &sim, const CommandLineOptions &options) {
+  constexpr size_t kNever = std::numeric_limits<size_t>::max();
+  const size_t start_cycle = sim.GetCycleClocks();
+  const size_t end_cycle = options.max_cycles > kNever - start_cycle
+                               ? kNever
+                               : start_cycle + options.max_cycles;
+  std::optional<CheckpointSeries> series;
+  size_t next_checkpoint = kNever;
+  if (options.checkpoint_every != 0) {
+    series.emplace(options.checkpoint_path);
+    next_checkpoint =
+        (start_cycle / options.checkpoint_every + 1) * options.checkpoint_every;
+  } else if (options.checkpoint_at != kNever &&
+             options.checkpoint_at >= start_cycle) {
+    next_checkpoint = options.checkpoint_at;
   }
-  size_t inst_num = 0;
-  while ((fin >> curr_tok)) {
-    if (curr_tok.back() == ':') {
-      curr_tok.pop_back();
-      label_to_inst_idx[curr_tok] = inst_num;
-      // std::cout << curr_tok << " : Label\n";
-    } else {
-      std::string opname = std::move(curr_tok);
-      std::string optors;
-      fin >> optors;
-      std::string inst_text = opname + '\t' + optors;
-      instruction_text.push_back(inst_text);
-      std::string::size_type first_comma_idx = optors.find(',');
-      std::string optor1 = optors.substr(0, first_comma_idx);
-      std::string::size_type second_comma_idx =
-          optors.find(',', first_comma_idx + 1);
-      std::string optor2, optor3;
-      if (second_comma_idx == std::string::npos) {
-        optor2 = optors.substr(first_comma_idx + 1);
+  bool reached_bp = false;
+  while (true) {
+    size_t stop_cycle = std::min(end_cycle, next_checkpoint);
+    reached_bp = sim.RunSilently(stop_cycle - sim.GetCycleClocks());
+    if (reached_bp) {
+      break;
+    }
+    if (sim.GetCycleClocks() == next_checkpoint) {
+      if (series.has_value()) {
+        if (series->Save(sim).empty()) {
+          exit(-1);
+        }
+        next_checkpoint += options.checkpoint_every;
       } else {
-        optor2 = optors.substr(first_comma_idx + 1,
-                               second_comma_idx - first_comma_idx - 1);
-        optor3 = optors.substr(second_comma_idx + 1);
-      }
-
-      // std::cout << inst_text << '\n';
-      if (opname == "lw" or opname == "sw") {
-        size_t rd = std::stoi(optor1.substr(1));
-        size_t rs = std::stoi(optor2.substr(1));
-        size_t imm = symbol_to_memory[optor3];
-        instructions.emplace_back(opname == "lw" ? InstructionOp::LOAD
-                                                 : InstructionOp::STORE,
-                                  rd, rs, imm);
-      } else if (opname == "addi" or opname == "subi") {
-        size_t rd = std::stoi(optor1.substr(1));
-        size_t rs = std::stoi(optor2.substr(1));
-        size_t imm = std::stoi(optor3);
-        instructions.emplace_back(opname == "addi" ? InstructionOp::ADDI
-                                                   : InstructionOp::SUBI,
-                                  rd, rs, imm);
-      } else if (opname == "add" or opname == "sub") {
-        size_t rd = std::stoi(optor1.substr(1));
-        size_t rs = std::stoi(optor2.substr(1));
-        size_t rt = std::stoi(optor3.substr(1));
-        instructions.emplace_back(opname == "add" ? InstructionOp::ADD
-                                                  : InstructionOp::SUB,
-                                  rd, rs, rt);
-      } else if (opname == "beqz" || opname == "bnez") {
-        size_t rd = std::stoi(optor1.substr(1));
-        size_t label_inst_idx = -1;
-        auto it = label_to_inst_idx.find(optor2);
-        if (it != label_to_inst_idx.end()) {
-          label_inst_idx = label_to_inst_idx[optor2];
-        } else {
-          unresolved_label[optor2].push_back(inst_num);
+        if (!SaveCheckpoint(sim, options.checkpoint_path)) {
+          exit(-1);
         }
-        instructions.emplace_back(opname == "beqz" ? InstructionOp::BEQZ
-                                                   : InstructionOp::BNEZ,
-                                  rd, label_inst_idx, -1);
+        next_checkpoint = kNever;
       }
-      inst_num++;
     }
+    if (sim.IsFinished() || sim.GetCycleClocks() >= end_cycle) {
+      break;
+    }
+  }
+  // a plain --checkpoint captures where the run stopped
+  if (options.checkpoint_path != nullptr && options.checkpoint_every == 0 &&
+      options.checkpoint_at == kNever &&
+      !SaveCheckpoint(sim, options.checkpoint_path)) {
+    exit(-1);
+  }
+  return reached_bp;
+}
+
+// settings shared by the simulator and the unscheduled reference run
+static void ConfigureSimulator(Simulator &sim,
+                               const CommandLineOptions &options) {
+  sim.SetVerbose(!options.batch);
+  // batch runs cannot step backward, and only pay for the profile when
+  // they print it
+  sim.SetHistoryEnabled(options.history && !options.batch);
+  sim.SetBlockTranslation(options.translation);
+  if (options.batch && options.dumps.find('h') == std::string::npos) {
+    sim.SetStatisticsLevel(StatisticsLevel::TOTALS);
+  }
+  if (options.l1_cache.has_value()) {
+    sim.SetDataCache(*options.l1_cache, options.l2_cache);
+  }
+  if (options.predictor.has_value()) {
+    sim.SetBranchPredictor(*options.predictor);
+  }
+  sim.SetIssueConfig(options.issue);
+  sim.SetFunctionalUnits(options.units);
+  if (options.ooo.has_value()) {
+    sim.SetOutOfOrder(*options.ooo);
+  }
+}
+
+// run the program as assembled, with the same settings and cycle limit but
+// without breakpoints, and note its stalls in report
+static void MeasureUnscheduled(Program program, bool enable_forward,
+                               const CommandLineOptions &options,
+                               ScheduleReport &report) {
+  Simulator sim(std::move(program), enable_forward);
+  ConfigureSimulator(sim, options);
+  sim.SetStatisticsLevel(StatisticsLevel::TOTALS);
+  if (options.fast_forward != 0) {
+    sim.RunFunctional(options.fast_forward);
+  }
+  sim.RunSilently(options.max_cycles);
+  SimulatorStatistics stats = sim.GetStatistics();
+  report.has_unscheduled_run = true;
+  report.unscheduled_raw_stalls = stats.raw_stalls;
+  report.unscheduled_cycle_clocks = stats.cycle_clocks;
+}
+
+int main(int argc, char **argv) {
+  CommandLineOptions options = ParseCommandLine(argc, argv);
+  Program program;
+  if (!LoadProgram(options.program_path, program)) {
+    exit(-1);
+  }
+  if (options.save_image != nullptr &&
+      !SaveProgramImage(program, options.save_image)) {
+    exit(-1);
   }
 
-  for (auto &[label, inst_idx] : label_to_inst_idx) {
-    auto it = unresolved_label.find(label);
-    if (it != unresolved_label.end()) {
-      for (auto resolved_idx : it->second) {
-        instructions[resolved_idx].rs_or_label_ = inst_idx;
+  bool enable_forward = options.enable_forwarding == 1;
+  if (options.enable_forwarding == -1 && !options.batch &&
+      options.restore == nullptr) {
+    std::cout << "Enable forwarding:(y/n): ";
+    char inch;
+    std::cin >> inch;
+    enable_forward = (inch == 'y' || inch == 'Y');
+  }
+  // the schedule depends on forwarding; a restored checkpoint must match
+  // the scheduled program
+  std::optional<ScheduleReport> schedule;
+  if (options.schedule) {
+    std::optional<Program> unscheduled;
+    if (options.batch && options.restore == nullptr) {
+      unscheduled = program;
+    }
+    schedule = ScheduleProgram(program, enable_forward, options.units);
+    if (unscheduled.has_value()) {
+      MeasureUnscheduled(std::move(*unscheduled), enable_forward, options,
+                         *schedule);
+    }
+  }
+  // opened before the program moves into the simulator, which records into
+  // it; declared first so that it outlives the simulator
+  TraceWriter trace;
+  if (options.trace_path != nullptr &&
+      !trace.Open(options.trace_path, program.instruction_text)) {
+    exit(-1);
+  }
+  Simulator mysim(std::move(program), enable_forward);
+  ConfigureSimulator(mysim, options);
+  if (schedule.has_value()) {
+    mysim.SetScheduleReport(*schedule);
+  }
+  for (const BreakpointSpec &bp : options.breakpoints) {
+    if (bp.inst_idx >= mysim.GetInstructionCount()) {
+      std::cerr << "Breakpoint index out of range: " << bp.inst_idx << '\n';
+      exit(-1);
+    }
+    mysim.SetBreakpoint(bp);
+  }
+  for (const Watch &watch : options.watches) {
+    mysim.AddWatch(watch);
+  }
+  if (options.restore != nullptr &&
+      !RestoreCheckpoint(options.restore, mysim)) {
+    exit(-1);
+  }
+  if (options.fast_forward != 0) {
+    mysim.RunFunctional(options.fast_forward);
+  }
+  if (options.trace_path != nullptr) {
+    mysim.SetTrace(&trace);
+  }
+  if (options.batch) {
+    bool reached_bp = false;
+    if (options.sampling.has_value()) {
+      PrintSampleEstimate(std::cout, RunSampled(mysim, *options.sampling));
+    } else if (!options.regions.empty()) {
+      PrintSampleEstimate(std::cout,
+                          RunSampledRegions(mysim, options.regions,
+                                            options.region_warmup));
+    } else if (options.bbv_path != nullptr) {
+      if (!WriteBasicBlockVectors(mysim, options.bbv_interval,
+                                  options.bbv_path)) {
+        exit(-1);
+      }
+    } else {
+      reached_bp = RunBatch(mysim, options);
+    }
+    if (mysim.HasFaulted()) {
+      std::cerr << mysim.GetFaultMessage() << '\n';
+    } else if (reached_bp && !mysim.GetWatchMessage().empty()) {
+      std::cerr << "Stopped at " << mysim.GetWatchMessage() << " after "
+                << mysim.GetCycleClocks() << " cycle clocks\n";
+    } else if (reached_bp) {
+      std::cerr << "Stopped at breakpoint after " << mysim.GetCycleClocks()
+                << " cycle clocks\n";
+    } else if (!mysim.IsFinished()) {
+      std::cerr << "Stopped at cycle limit after " << mysim.GetCycleClocks()
+                << " cycle clocks\n";
+    }
+    for (char view : options.dumps) {
+      if (!PrintView(mysim, view)) {
+        std::cerr << "Unknown dump view: " << view << '\n';
       }
-      unresolved_label.erase(it);
     }
+    if (!trace.Close()) {
+      exit(-1);
+    }
+    return 0;
   }
-
-  bool enable_forward = false;
-  std::cout << "Enable forwarding:(y/n): ";
-  char inch;
-  std::cin >> inch;
-  enable_forward = (inch == 'y' || inch == 'Y');
-  Simulator mysim(init_memory, instructions, instruction_text, enable_forward);
   mysim.PrintInstructions();
   Simulator::PrintUsage();
   bool is_terminated = false;
@@ -121,33 +570,49 @@ int main(int argc, char **argv) {
     case 'v':
       char cmd_specific;
       std::cin >> cmd_specific;
-      switch (cmd_specific) {
-      case 'i':
-        mysim.PrintInstructions();
-        break;
-      case 'p':
-        mysim.PrintPipelines();
-        break;
-      case 'r':
-        mysim.PrintRegisters();
-        break;
-      case 'b':
-        mysim.PrintBreakpoints();
-        break;
-      case 'm':
-        mysim.PrintMemory();
+      if (!PrintView(mysim, cmd_specific)) {
+        Simulator::PrintUsage();
+      }
+      break;
+    case 'b': {
+      std::string spec, error;
+      BreakpointSpec bp;
+      if (!(std::cin >> spec)) {
         break;
-      case 's':
-        mysim.PrintStatistics();
+      }
+      if (!ParseBreakpointSpec(spec, bp, error)) {
+        std::cout << "Invalid breakpoint: " << error << '\n';
+      } else if (bp.inst_idx >= mysim.GetInstructionCount()) {
+        std::cout << "Breakpoint index out of range: " << bp.inst_idx << '\n';
+      } else if (!bp.IsPlain() && (mysim.IsOutOfOrder() ||
+                                   mysim.GetIssueConfig().width > 1)) {
+        std::cout << "Conditional breakpoints need single issue\n";
+      } else {
+        mysim.SetBreakpoint(bp);
+      }
+      break;
+    }
+    case 'w': {
+      std::string spec, error;
+      Watch watch;
+      if (!(std::cin >> spec)) {
         break;
-      default:
-        Simulator::PrintUsage();
+      }
+      if (!ParseWatchSpec(spec, watch, error)) {
+        std::cout << "Invalid watchpoint: " << error << '\n';
+      } else if (mysim.IsOutOfOrder() || mysim.GetIssueConfig().width > 1) {
+        std::cout << "Watchpoints need single issue\n";
+      } else {
+        mysim.AddWatch(watch);
       }
       break;
-    case 'b':
-      size_t bp_inst_idx;
-      if (std::cin >> bp_inst_idx) {
-        mysim.SetBreakpoint(bp_inst_idx);
+    }
+    case 'd':
+      size_t watch_idx;
+      if (std::cin >> watch_idx) {
+        if (!mysim.DeleteWatch(watch_idx)) {
+          std::cout << "No watchpoint " << watch_idx << '\n';
+        }
       } else {
         std::cin.clear();
         std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
@@ -162,6 +627,64 @@ int main(int argc, char **argv) {
       mysim.RunToStop();
       mysim.PrintPipelines();
       break;
+    case 'f':
+      size_t ff_inst_num;
+      if (std::cin >> ff_inst_num) {
+        if (mysim.WatchesArmed()) {
+          std::cout << "The functional engine does not check watchpoints or "
+                       "conditional breakpoints, delete them first\n";
+          break;
+        }
+        std::cout << mysim.RunFunctional(ff_inst_num)
+                  << " instructions executed functionally\n";
+        mysim.PrintPipelines();
+      } else {
+        std::cin.clear();
+        std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+        Simulator::PrintUsage();
+      }
+      break;
+    case 'c': {
+      std::string checkpoint_path;
+      if (!(std::cin >> checkpoint_path)) {
+        break;
+      }
+      if (mysim.IsOutOfOrder()) {
+        std::cout << "The out-of-order core cannot be checkpointed\n";
+      } else if (SaveCheckpoint(mysim, checkpoint_path)) {
+        std::cout << "Checkpoint written to " << checkpoint_path << '\n';
+      }
+      break;
+    }
+    case 'u':
+      if (mysim.GetCycleClocks() == mysim.HistoryStartCycle()) {
+        std::cout << "No earlier cycle in the history\n";
+      } else {
+        mysim.SeekCycle(mysim.GetCycleClocks() - 1);
+      }
+      mysim.PrintPipelines();
+      break;
+    case 'R':
+      if (!mysim.ReverseRun()) {
+        std::cout << "No breakpoint or watchpoint reached since cycle "
+                  << mysim.GetCycleClocks() << '\n';
+      }
+      mysim.PrintPipelines();
+      break;
+    case 'j':
+      size_t cycle;
+      if (std::cin >> cycle) {
+        if (!mysim.SeekCycle(cycle)) {
+          std::cout << "The history starts at cycle "
+                    << mysim.HistoryStartCycle() << '\n';
+        }
+        mysim.PrintPipelines();
+      } else {
+        std::cin.clear();
+        std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+        Simulator::PrintUsage();
+      }
+      break;
     case 'q':
       is_terminated = true;
       break;
@@ -0,0 +1,78 @@
+#include "multicore.h"
+
+#include <algorithm>
+
+MultiCore::MultiCore(const Program &program, const MultiCoreConfig &config)
+    : shared_(program.init_memory),
+      pool_(config.thread_num != 0 ? config.thread_num : config.cores),
+      quantum_(std::max<size_t>(config.quantum, 1)),
+      invalidations_(config.cores, 0) {
+  cores_.reserve(config.cores);
+  for (size_t core = 0; core < config.cores; ++core) {
+    Simulator &sim = cores_.emplace_back(program, config.enable_forwarding);
+    sim.SetVerbose(false);
+    sim.SetHistoryEnabled(false);
+    sim.SetStatisticsLevel(StatisticsLevel::TOTALS);
+    if (config.l1.has_value()) {
+      sim.SetDataCache(*config.l1, config.l2);
+    }
+    sim.SetRegister(31, static_cast<Register>(core));
+    sim.SetRegister(30, static_cast<Register>(config.cores));
+    sim.MutableMemory() = shared_;
+  }
+}
+
+bool MultiCore::IsFinished() const {
+  return std::all_of(cores_.begin(), cores_.end(),
+                     [](const Simulator &sim) { return sim.IsFinished(); });
+}
+
+size_t MultiCore::Run(size_t max_cycles) {
+  size_t start = cycle_clocks_;
+  while (!IsFinished() && cycle_clocks_ - start < max_cycles) {
+    size_t cycles = std::min(quantum_, max_cycles - (cycle_clocks_ - start));
+    for (Simulator &sim : cores_) {
+      if (!sim.IsFinished()) {
+        pool_.Submit([&sim, cycles] { sim.RunSilently(cycles); });
+      }
+    }
+    pool_.Wait();
+    cycle_clocks_ += cycles;
+    Synchronize();
+  }
+  return cycle_clocks_ - start;
+}
+
+void MultiCore::Synchronize() {
+  PagedMemory merged = shared_;
+  for (size_t core = 0; core < cores_.size(); ++core) {
+    const PagedMemory &memory = cores_[core].GetMemory();
+    for (uint64_t page_idx : memory.ResidentPages()) {
+      const long *page = memory.PageData(page_idx);
+      const long *before = shared_.PageData(page_idx);
+      if (page == before) {
+        // still shared with the snapshot: not written in this quantum
+        continue;
+      }
+      uint64_t page_base = page_idx << PagedMemory::kPageBits;
+      for (size_t word_idx = 0; word_idx < PagedMemory::kPageWords;
+           ++word_idx) {
+        long old_value = before != nullptr ? before[word_idx] : 0;
+        if (page[word_idx] == old_value) {
+          continue;
+        }
+        uint64_t address = page_base + word_idx;
+        merged.Write(address, page[word_idx]);
+        for (size_t other = 0; other < cores_.size(); ++other) {
+          if (other != core && cores_[other].InvalidateDataCache(address)) {
+            ++invalidations_[other];
+          }
+        }
+      }
+    }
+  }
+  shared_ = std::move(merged);
+  for (Simulator &sim : cores_) {
+    sim.MutableMemory() = shared_;
+  }
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include "simulator.h"
+#include "thread_pool.h"
+
+// Settings shared by every core of a MultiCore.
+struct MultiCoreConfig {
+  size_t cores{2};
+  // cycles every core runs between two synchronizations
+  size_t quantum{1000};
+  bool enable_forwarding{false};
+  // private caches of every core, kept coherent at the synchronizations
+  std::optional<CacheConfig> l1;
+  std::optional<CacheConfig> l2;
+  // 0: one per core
+  size_t thread_num{0};
+};
+
+// N copies of the pipeline running one program against one shared data
+// memory. Core i starts with r31 = i and r30 = N, its other registers 0.
+//
+// The cores run a quantum of cycles in parallel on a thread pool, each on
+// a copy-on-write snapshot of the shared memory taken at the start of the
+// quantum, so a core sees the writes of the others only from the next
+// quantum on. At the end of the quantum the words each core changed are
+// merged into the shared memory in core order; when two cores wrote the
+// same word, the higher core index wins. Since no core reads another's
+// state inside a quantum, the result depends on the quantum but not on the
+// host thread scheduling.
+//
+// With caches, the merge is also a write-invalidate coherence step: every
+// line another core changed is dropped from a core's L1 and L2, so its next
+// access to the line pays the miss latency.
+class MultiCore {
+public:
+  MultiCore(const Program &program, const MultiCoreConfig &config);
+
+  // run quanta until every core finished or max_cycles cycles; return the
+  // cycles simulated
+  size_t Run(size_t max_cycles = std::numeric_limits<size_t>::max());
+  bool IsFinished() const;
+
+  size_t CoreNum() const { return cores_.size(); }
+  // a core's memory equals the shared memory between quanta
+  const Simulator &Core(size_t core) const { return cores_[core]; }
+  const PagedMemory &SharedMemory() const { return shared_; }
+  size_t GetCycleClocks() const { return cycle_clocks_; }
+  // lines dropped from core's caches because other cores wrote them
+  size_t Invalidations(size_t core) const { return invalidations_[core]; }
+
+private:
+  // merge the cores' writes into shared_ and hand out the new snapshot
+  void Synchronize();
+
+  std::vector<Simulator> cores_;
+  PagedMemory shared_;
+  ThreadPool pool_;
+  size_t quantum_;
+  size_t cycle_clocks_{0};
+  std::vector<size_t> invalidations_;
+};
@@ -0,0 +1,140 @@
+// Multi-core driver: run one program on N pipelined cores that share the
+// data memory, see multicore.h, and print the final dumps.
+
+#include "command_line.h"
+#include "multicore.h"
+#include "program_image.h"
+
+struct MultiCoreOptions {
+  const char *program_path{nullptr};
+  MultiCoreConfig config;
+  size_t max_cycles{std::numeric_limits<size_t>::max()};
+  std::string dumps{"srm"};
+};
+
+static void PrintMultiCoreUsage() {
+  std::cerr
+      << "Usage: ./MultiCore [your MIPS assembly code file | program image] "
+         "[options]\n"
+      << "Core i starts with r31 = i and r30 = the number of cores.\n"
+      << "  --cores <n>          simulated cores (default: 2)\n"
+      << "  --quantum <cycles>   cycles between two synchronizations of the "
+         "shared memory (default: 1000)\n"
+      << "  --threads <n>        host threads (default: one per core)\n"
+      << "  --forwarding         enable forwarding in every core\n"
+      << "  --l1 <spec>          private L1 data cache of every core, as for "
+         "Simulator --l1\n"
+      << "  --l2 <spec>          private L2 behind it\n"
+      << "  --max-cycles <n>     stop after n cycles\n"
+      << "  --dump <views>       any of r (registers of every core), m "
+         "(shared memory), s (statistics of every core) (default: srm)\n";
+}
+
+[[noreturn]] static void ExitWithUsage(const std::string &message) {
+  std::cerr << message << '\n';
+  PrintMultiCoreUsage();
+  exit(-1);
+}
+
+static MultiCoreOptions ParseCommandLine(int argc, char **argv) {
+  MultiCoreOptions options;
+  std::string error;
+  for (int arg_idx = 1; arg_idx < argc; ++arg_idx) {
+    std::string arg = argv[arg_idx];
+    if (arg[0] != '-' && options.program_path == nullptr) {
+      options.program_path = argv[arg_idx];
+      continue;
+    }
+    if (arg == "--forwarding") {
+      options.config.enable_forwarding = true;
+      continue;
+    }
+    if (arg_idx + 1 >= argc) {
+      ExitWithUsage("Unknown option or missing value: " + arg);
+    }
+    std::string value = argv[++arg_idx];
+    if (arg == "--cores") {
+      if (!ParseSize(value, options.config.cores) ||
+          options.config.cores == 0) {
+        ExitWithUsage("Invalid core count: " + value);
+      }
+    } else if (arg == "--quantum") {
+      if (!ParseSize(value, options.config.quantum) ||
+          options.config.quantum == 0) {
+        ExitWithUsage("Invalid quantum: " + value);
+      }
+    } else if (arg == "--threads") {
+      if (!ParseSize(value, options.config.thread_num)) {
+        ExitWithUsage("Invalid thread count: " + value);
+      }
+    } else if (arg == "--l1" || arg == "--l2") {
+      std::optional<CacheConfig> &cache =
+          arg == "--l1" ? options.config.l1 : options.config.l2;
+      if (!ParseCacheConfig(value, cache.emplace(), error)) {
+        ExitWithUsage("Invalid cache " + value + ": " + error);
+      }
+    } else if (arg == "--max-cycles") {
+      if (!ParseSize(value, options.max_cycles)) {
+        ExitWithUsage("Invalid cycle limit: " + value);
+      }
+    } else if (arg == "--dump") {
+      options.dumps = value;
+    } else {
+      ExitWithUsage("Unknown option: " + arg);
+    }
+  }
+  if (options.program_path == nullptr) {
+    ExitWithUsage("You did not provide MIPS file.");
+  }
+  if (options.config.l2.has_value() && !options.config.l1.has_value()) {
+    ExitWithUsage("--l2 needs an --l1 in front of it");
+  }
+  return options;
+}
+
+int main(int argc, char **argv) {
+  MultiCoreOptions options = ParseCommandLine(argc, argv);
+  Program program;
+  if (!LoadProgram(options.program_path, program)) {
+    exit(-1);
+  }
+
+  MultiCore multicore(program, options.config);
+  multicore.Run(options.max_cycles);
+  for (size_t core = 0; core < multicore.CoreNum(); ++core) {
+    if (multicore.Core(core).HasFaulted()) {
+      std::cerr << "Core " << core << ": "
+                << multicore.Core(core).GetFaultMessage() << '\n';
+    }
+  }
+
+  for (char view : options.dumps) {
+    switch (view) {
+    case 'r':
+      for (size_t core = 0; core < multicore.CoreNum(); ++core) {
+        std::cout << "Core " << core << ":\n";
+        multicore.Core(core).PrintRegisters();
+      }
+      break;
+    case 'm':
+      // every core's memory is the shared memory once the run stopped
+      multicore.Core(0).PrintMemory();
+      break;
+    case 's':
+      std::cout << multicore.GetCycleClocks() << " cycle clocks executed\n";
+      for (size_t core = 0; core < multicore.CoreNum(); ++core) {
+        std::cout << "Core " << core << ":\n";
+        multicore.Core(core).PrintStatistics();
+        if (options.config.l1.has_value()) {
+          std::cout << "\tLines invalidated by other cores: "
+                    << multicore.Invalidations(core) << '\n';
+        }
+      }
+      break;
+    default:
+      std::cerr << "Unknown view: " << view << '\n';
+      break;
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,102 @@
+#include "paged_memory.h"
+
+#include <algorithm>
+#include <cstring>
+
+PagedMemory::PagedMemory(const std::vector<long> &init_memory) {
+  for (size_t address = 0; address < init_memory.size(); ++address) {
+    Write(address, init_memory[address]);
+  }
+}
+
+PagedMemory::PagedMemory(const PagedMemory &other) { *this = other; }
+
+PagedMemory &PagedMemory::operator=(const PagedMemory &other) {
+  if (this == &other) {
+    return *this;
+  }
+  pages_ = other.pages_;
+  // every page is shared now, neither side may write in place
+  InvalidateCaches();
+  other.InvalidateCaches();
+  return *this;
+}
+
+PagedMemory &PagedMemory::operator=(PagedMemory &&other) noexcept {
+  pages_ = std::move(other.pages_);
+  // the pages themselves do not move, the caches stay valid
+  last_page_idx_ = other.last_page_idx_;
+  last_page_ = other.last_page_;
+  last_write_page_idx_ = other.last_write_page_idx_;
+  last_write_page_ = other.last_write_page_;
+  other.pages_.clear();
+  other.InvalidateCaches();
+  return *this;
+}
+
+std::vector<uint64_t> PagedMemory::ResidentPages() const {
+  std::vector<uint64_t> page_indexes;
+  page_indexes.reserve(pages_.size());
+  for (const auto &[page_idx, page] : pages_) {
+    page_indexes.push_back(page_idx);
+  }
+  std::sort(page_indexes.begin(), page_indexes.end());
+  return page_indexes;
+}
+
+const long *PagedMemory::PageData(uint64_t page_idx) const {
+  auto it = pages_.find(page_idx);
+  return it == pages_.end() ? nullptr : it->second.get();
+}
+
+void PagedMemory::LoadPage(uint64_t page_idx, const void *words) {
+  std::shared_ptr<long[]> page(new long[kPageWords]);
+  std::memcpy(page.get(), words, kPageWords * sizeof(long));
+  pages_[page_idx] = std::move(page);
+  InvalidateCaches();
+}
+
+void PagedMemory::DropPage(uint64_t page_idx) {
+  pages_.erase(page_idx);
+  InvalidateCaches();
+}
+
+void PagedMemory::Clear() {
+  pages_.clear();
+  InvalidateCaches();
+}
+
+long PagedMemory::ReadSlow(uint64_t address) const {
+  auto it = pages_.find(address >> kPageBits);
+  if (it == pages_.end()) {
+    return 0;
+  }
+  last_page_idx_ = it->first;
+  last_page_ = it->second.get();
+  return last_page_[address & (kPageWords - 1)];
+}
+
+bool PagedMemory::SwitchWritePage(uint64_t page_idx) {
+  std::shared_ptr<long[]> &page = pages_[page_idx];
+  bool allocated = page == nullptr;
+  if (allocated) {
+    page.reset(new long[kPageWords]());
+  } else if (page.use_count() > 1) {
+    std::shared_ptr<long[]> copy(new long[kPageWords]);
+    std::memcpy(copy.get(), page.get(), kPageWords * sizeof(long));
+    page = std::move(copy);
+  }
+  last_write_page_idx_ = page_idx;
+  last_write_page_ = page.get();
+  // the read cache may still point to the shared original of this page
+  last_page_idx_ = page_idx;
+  last_page_ = page.get();
+  return allocated;
+}
+
+void PagedMemory::InvalidateCaches() const {
+  last_page_idx_ = UINT64_MAX;
+  last_page_ = nullptr;
+  last_write_page_idx_ = UINT64_MAX;
+  last_write_page_ = nullptr;
+}
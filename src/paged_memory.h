@@ -0,0 +1,94 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+// Sparse word-addressed data memory. Pages are allocated zero-filled when
+// first written; reading a page that was never written yields 0 without
+// allocating it, so the footprint follows the pages touched rather than the
+// address range. The last page used is cached, which makes the common case
+// of lw/sw in MEM a compare and an indexed access.
+//
+// Copies share their pages copy-on-write: a copy costs one pointer per
+// resident page, and whichever side writes a shared page first clones it.
+// A page that is still shared has not been written since the copy, which
+// is how checkpoints find the pages to store (see checkpoint.h).
+class PagedMemory {
+public:
+  static constexpr size_t kPageBits = 10; // 1024 words, 8 KiB per page
+  static constexpr size_t kPageWords = size_t{1} << kPageBits;
+  static constexpr uint64_t kAddressSpaceWords = uint64_t{1} << 32;
+
+  PagedMemory() = default;
+  explicit PagedMemory(const std::vector<long> &init_memory);
+  PagedMemory(const PagedMemory &other);
+  PagedMemory &operator=(const PagedMemory &other);
+  PagedMemory(PagedMemory &&other) noexcept { *this = std::move(other); }
+  PagedMemory &operator=(PagedMemory &&other) noexcept;
+
+  // lw/sw must fault on addresses outside the address space; negative
+  // addresses wrap around to huge ones and fault as well
+  static inline bool IsValidAddress(uint64_t address) {
+    return address < kAddressSpaceWords;
+  }
+
+  // address must be valid
+  inline long Read(uint64_t address) const {
+    if ((address >> kPageBits) == last_page_idx_) {
+      return last_page_[address & (kPageWords - 1)];
+    }
+    return ReadSlow(address);
+  }
+  // address must be valid
+  inline void Write(uint64_t address, long value) {
+    if ((address >> kPageBits) != last_write_page_idx_) {
+      SwitchWritePage(address >> kPageBits);
+    }
+    last_write_page_[address & (kPageWords - 1)] = value;
+  }
+  // Write that returns the old value and sets allocated if the page was
+  // not resident, for the undo log of reverse stepping; address must be
+  // valid
+  inline long Exchange(uint64_t address, long value, bool &allocated) {
+    allocated = false;
+    if ((address >> kPageBits) != last_write_page_idx_) {
+      allocated = SwitchWritePage(address >> kPageBits);
+    }
+    long &word = last_write_page_[address & (kPageWords - 1)];
+    long old_value = word;
+    word = value;
+    return old_value;
+  }
+
+  size_t ResidentPageNum() const { return pages_.size(); }
+  // indexes of the resident pages in ascending address order
+  std::vector<uint64_t> ResidentPages() const;
+  // words of a resident page, nullptr if the page is not resident; two
+  // memories return the same pointer for a page they still share
+  const long *PageData(uint64_t page_idx) const;
+  // replace the content of a page with the kPageWords words at words,
+  // which need not be aligned
+  void LoadPage(uint64_t page_idx, const void *words);
+  // forget a page, which reads as zeros again
+  void DropPage(uint64_t page_idx);
+  void Clear();
+
+private:
+  long ReadSlow(uint64_t address) const;
+  // allocate the page or clone it if shared, and make it the cached one;
+  // return true if it was allocated
+  bool SwitchWritePage(uint64_t page_idx);
+  void InvalidateCaches() const;
+
+  std::unordered_map<uint64_t, std::shared_ptr<long[]>> pages_;
+  // mutable: reads move the cache too
+  mutable uint64_t last_page_idx_{UINT64_MAX};
+  mutable const long *last_page_{nullptr};
+  // only ever points to a page owned by this memory alone; mutable because
+  // copying from this memory shares its pages and has to drop it
+  mutable uint64_t last_write_page_idx_{UINT64_MAX};
+  mutable long *last_write_page_{nullptr};
+};
@@ -0,0 +1,215 @@
+#include "profile.h"
+
+#include <algorithm>
+#include <iomanip>
+
+void InstructionProfile::Reset(size_t instruction_num) {
+  counters_.assign(instruction_num, InstructionCounters{});
+  raw_stall_pairs_.clear();
+  StopJournal();
+}
+
+void InstructionProfile::CountRawStall(size_t consumer_idx,
+                                       size_t producer_idx,
+                                       bool producer_in_mem) {
+  if (producer_in_mem) {
+    ++counters_[consumer_idx].raw_stalls_mem;
+    Journal(consumer_idx, RAW_STALLS_MEM);
+  } else {
+    ++counters_[consumer_idx].raw_stalls_ex;
+    Journal(consumer_idx, RAW_STALLS_EX);
+  }
+  if (journaling_) {
+    producer_log_.push_back(static_cast<uint32_t>(producer_idx));
+  }
+  ++raw_stall_pairs_[uint64_t{consumer_idx} << 32 | producer_idx];
+}
+
+uint64_t InstructionProfile::LostCycles(size_t inst_idx) const {
+  const InstructionCounters &counters = counters_[inst_idx];
+  return counters.raw_stalls_ex + counters.raw_stalls_mem +
+         counters.structural_stalls + counters.squashes +
+         counters.memory_stalls;
+}
+
+std::vector<InstructionProfile::RawStallPair>
+InstructionProfile::SortedRawStallPairs() const {
+  std::vector<RawStallPair> pairs;
+  pairs.reserve(raw_stall_pairs_.size());
+  for (const auto &[key, cycles] : raw_stall_pairs_) {
+    pairs.push_back({static_cast<uint32_t>(key >> 32),
+                     static_cast<uint32_t>(key), cycles});
+  }
+  std::sort(pairs.begin(), pairs.end(),
+            [](const RawStallPair &lhs, const RawStallPair &rhs) {
+              if (lhs.cycles != rhs.cycles) {
+                return lhs.cycles > rhs.cycles;
+              }
+              return std::make_pair(lhs.consumer_idx, lhs.producer_idx) <
+                     std::make_pair(rhs.consumer_idx, rhs.producer_idx);
+            });
+  return pairs;
+}
+
+void InstructionProfile::Print(std::ostream &out, const InstructionText &text,
+                               size_t max_rows) const {
+  std::vector<size_t> hotspots;
+  for (size_t inst_idx = 0; inst_idx < counters_.size(); ++inst_idx) {
+    if (LostCycles(inst_idx) != 0) {
+      hotspots.push_back(inst_idx);
+    }
+  }
+  std::stable_sort(hotspots.begin(), hotspots.end(),
+                   [this](size_t lhs, size_t rhs) {
+                     return LostCycles(lhs) > LostCycles(rhs);
+                   });
+  if (hotspots.size() > max_rows) {
+    hotspots.resize(max_rows);
+  }
+  out << "Hotspots (cycles lost per instruction):\n"
+      << "\tindex\tlost\texec\tRAW-EX\tRAW-MEM\tstruct\tfwd\tsquash\t"
+         "memory\tinstruction\n";
+  if (hotspots.empty()) {
+    out << "\tnone\n";
+  }
+  for (size_t inst_idx : hotspots) {
+    const InstructionCounters &counters = counters_[inst_idx];
+    out << '\t' << inst_idx << '\t' << LostCycles(inst_idx) << '\t'
+        << counters.executions << '\t' << counters.raw_stalls_ex << '\t'
+        << counters.raw_stalls_mem << '\t' << counters.structural_stalls
+        << '\t' << counters.forwards << '\t'
+        << counters.squashes << '\t' << counters.memory_stalls << '\t'
+        << text[inst_idx] << '\n';
+  }
+
+  std::vector<RawStallPair> pairs = SortedRawStallPairs();
+  if (pairs.empty()) {
+    return;
+  }
+  if (pairs.size() > max_rows) {
+    pairs.resize(max_rows);
+  }
+  out << "RAW stalls by producer:\n\tcycles\tproducer -> consumer\n";
+  for (const RawStallPair &pair : pairs) {
+    out << '\t' << pair.cycles << "\t[" << pair.producer_idx << ' '
+        << text[pair.producer_idx] << "] -> [" << pair.consumer_idx << ' '
+        << text[pair.consumer_idx] << "]\n";
+  }
+}
+
+void InstructionProfile::SaveState(StateWriter &writer) const {
+  writer.PutVector(counters_);
+  writer.PutVector(SortedRawStallPairs());
+}
+
+bool InstructionProfile::LoadState(StateReader &reader,
+                                   size_t instruction_num) {
+  std::vector<InstructionCounters> counters;
+  std::vector<RawStallPair> pairs;
+  if (!reader.GetVector(counters) || counters.size() != instruction_num ||
+      !reader.GetVector(pairs)) {
+    return false;
+  }
+  std::unordered_map<uint64_t, uint64_t> raw_stall_pairs;
+  for (const RawStallPair &pair : pairs) {
+    if (pair.consumer_idx >= instruction_num ||
+        pair.producer_idx >= instruction_num) {
+      return false;
+    }
+    raw_stall_pairs[uint64_t{pair.consumer_idx} << 32 | pair.producer_idx] =
+        pair.cycles;
+  }
+  counters_ = std::move(counters);
+  raw_stall_pairs_ = std::move(raw_stall_pairs);
+  return true;
+}
+
+void InstructionProfile::SetJournalEpoch(uint64_t epoch) {
+  journaling_ = true;
+  marks_.push_back({epoch, count_base_ + count_log_.size(),
+                    producer_base_ + producer_log_.size()});
+}
+
+void InstructionProfile::RollBack(uint64_t epoch) {
+  if (marks_.empty() || marks_.back().epoch < epoch) {
+    return;
+  }
+  JournalMark mark = marks_.back();
+  while (!marks_.empty() && marks_.back().epoch >= epoch) {
+    mark = marks_.back();
+    marks_.pop_back();
+  }
+  while (count_base_ + count_log_.size() > mark.count_idx) {
+    uint32_t record = count_log_.back();
+    count_log_.pop_back();
+    uint32_t inst_idx = record >> kCounterBits;
+    InstructionCounters &counters = counters_[inst_idx];
+    switch (static_cast<Counter>(record & ((1u << kCounterBits) - 1))) {
+    case EXECUTIONS:
+      --counters.executions;
+      break;
+    case RAW_STALLS_EX:
+      --counters.raw_stalls_ex;
+      TakeBackRawStall(inst_idx);
+      break;
+    case RAW_STALLS_MEM:
+      --counters.raw_stalls_mem;
+      TakeBackRawStall(inst_idx);
+      break;
+    case STRUCTURAL_STALLS:
+      --counters.structural_stalls;
+      break;
+    case FORWARDS:
+      --counters.forwards;
+      break;
+    case SQUASHES:
+      --counters.squashes;
+      break;
+    case MEMORY_STALLS:
+      --counters.memory_stalls;
+      break;
+    }
+  }
+}
+
+void InstructionProfile::TakeBackRawStall(uint32_t consumer_idx) {
+  auto pair = raw_stall_pairs_.find(uint64_t{consumer_idx} << 32 |
+                                    producer_log_.back());
+  producer_log_.pop_back();
+  if (--pair->second == 0) {
+    raw_stall_pairs_.erase(pair);
+  }
+}
+
+void InstructionProfile::ForgetJournal(uint64_t epoch) {
+  while (!marks_.empty() && marks_.front().epoch < epoch) {
+    marks_.pop_front();
+  }
+  uint64_t count_end = marks_.empty() ? count_base_ + count_log_.size()
+                                      : marks_.front().count_idx;
+  uint64_t producer_end = marks_.empty()
+                              ? producer_base_ + producer_log_.size()
+                              : marks_.front().producer_idx;
+  while (count_base_ < count_end) {
+    count_log_.pop_front();
+    ++count_base_;
+  }
+  while (producer_base_ < producer_end) {
+    producer_log_.pop_front();
+    ++producer_base_;
+  }
+}
+
+void InstructionProfile::StopJournal() {
+  journaling_ = false;
+  count_log_.clear();
+  count_base_ = 0;
+  producer_log_.clear();
+  producer_base_ = 0;
+  marks_.clear();
+}
+
+size_t InstructionProfile::JournalBytes() const {
+  return (count_log_.size() + producer_log_.size()) * sizeof(uint32_t) +
+         marks_.size() * sizeof(JournalMark);
+}
@@ -0,0 +1,135 @@
+#pragma once
+
+#include "instruction.h"
+#include "state_stream.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <ostream>
+#include <unordered_map>
+#include <vector>
+
+// counters of one static instruction, pipelined execution only
+struct InstructionCounters {
+  uint64_t executions;     // retired in WB
+  uint64_t raw_stalls_ex;  // ID stalled on a producer in EX
+  uint64_t raw_stalls_mem; // ID stalled on a producer in MEM
+  uint64_t structural_stalls; // ID waited for a mul/div unit or MEM slot
+  uint64_t forwards;       // operands taken from EX/MEM instead of registers
+  uint64_t squashes;       // wrong-path fetches flushed by this branch
+  uint64_t memory_stalls;  // frozen cycles of its cache misses
+};
+
+// Per-instruction stall attribution. The counters live in one flat array
+// parallel to the program, so counting is an indexed increment; the RAW
+// stalls are additionally broken down by producer, which only happens on
+// the stall path.
+//
+// For reverse stepping the profile stays out of keyframes: while the
+// journal is on, every count also logs which counter it bumped, 4 bytes,
+// and going back to an epoch takes back the counts logged since. Unlike a
+// TableJournal this does not grow with the instructions a loop touches.
+class InstructionProfile {
+public:
+  // forget all counts and size the array for instruction_num instructions
+  void Reset(size_t instruction_num);
+
+  inline void CountExecution(size_t inst_idx) {
+    ++counters_[inst_idx].executions;
+    Journal(inst_idx, EXECUTIONS);
+  }
+  inline void CountForward(size_t inst_idx) {
+    ++counters_[inst_idx].forwards;
+    Journal(inst_idx, FORWARDS);
+  }
+  inline void CountSquash(size_t inst_idx) {
+    ++counters_[inst_idx].squashes;
+    Journal(inst_idx, SQUASHES);
+  }
+  inline void CountMemoryStall(size_t inst_idx) {
+    ++counters_[inst_idx].memory_stalls;
+    Journal(inst_idx, MEMORY_STALLS);
+  }
+  inline void CountStructuralStall(size_t inst_idx) {
+    ++counters_[inst_idx].structural_stalls;
+    Journal(inst_idx, STRUCTURAL_STALLS);
+  }
+  // consumer waits in ID for producer, which is in MEM or else in EX
+  void CountRawStall(size_t consumer_idx, size_t producer_idx,
+                     bool producer_in_mem);
+
+  const InstructionCounters &Counters(size_t inst_idx) const {
+    return counters_[inst_idx];
+  }
+  // cycles lost by inst_idx: its stalls, squashes and cache misses
+  uint64_t LostCycles(size_t inst_idx) const;
+
+  // Hotspot table of the instructions that lost cycles, the worst first,
+  // followed by the producer/consumer pairs behind the RAW stalls. At most
+  // max_rows rows each.
+  void Print(std::ostream &out, const InstructionText &text,
+             size_t max_rows) const;
+
+  // LoadState fails unless the profile was taken of instruction_num
+  // instructions
+  void SaveState(StateWriter &writer) const;
+  bool LoadState(StateReader &reader, size_t instruction_num);
+
+  // journal the counts from epoch on
+  void SetJournalEpoch(uint64_t epoch);
+  // take back the counts made since epoch started
+  void RollBack(uint64_t epoch);
+  // drop the counts only needed to go back before epoch
+  void ForgetJournal(uint64_t epoch);
+  void StopJournal();
+  size_t JournalBytes() const;
+
+private:
+  enum Counter : uint32_t {
+    EXECUTIONS,
+    RAW_STALLS_EX,
+    RAW_STALLS_MEM,
+    STRUCTURAL_STALLS,
+    FORWARDS,
+    SQUASHES,
+    MEMORY_STALLS,
+  };
+  static constexpr uint32_t kCounterBits = 3;
+  // where the log stood when an epoch started, as absolute indexes
+  struct JournalMark {
+    uint64_t epoch;
+    uint64_t count_idx;
+    uint64_t producer_idx;
+  };
+
+  // undo the newest logged RAW stall pair of consumer_idx
+  void TakeBackRawStall(uint32_t consumer_idx);
+  inline void Journal(size_t inst_idx, Counter counter) {
+    if (journaling_) {
+      count_log_.push_back(static_cast<uint32_t>(inst_idx) << kCounterBits |
+                           counter);
+    }
+  }
+
+  struct RawStallPair {
+    uint32_t consumer_idx;
+    uint32_t producer_idx;
+    uint64_t cycles;
+  };
+  std::vector<RawStallPair> SortedRawStallPairs() const;
+
+  std::vector<InstructionCounters> counters_;
+  // consumer_idx << 32 | producer_idx -> stall cycles
+  std::unordered_map<uint64_t, uint64_t> raw_stall_pairs_;
+
+  bool journaling_{false};
+  // inst_idx << kCounterBits | counter per count, so programs of up to
+  // 2^29 instructions
+  std::deque<uint32_t> count_log_;
+  uint64_t count_base_{0}; // absolute index of count_log_.front()
+  // producer of every RAW stall in count_log_
+  std::deque<uint32_t> producer_log_;
+  uint64_t producer_base_{0};
+  std::deque<JournalMark> marks_;
+};
@@ -0,0 +1,261 @@
+#include "program_image.h"
+#include "assembler.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <type_traits>
+
+static_assert(std::is_trivially_copyable<Instruction>::value,
+              "Instruction is stored in program images by memcpy");
+
+static inline size_t AlignUp(size_t size) { return (size + 7) & ~size_t{7}; }
+
+static void AppendBytes(std::string &image, const void *data, size_t size) {
+  image.append(static_cast<const char *>(data), size);
+  image.resize(AlignUp(image.size()), '\0');
+}
+
+static std::vector<ImageSymbol>
+CollectSymbols(const std::unordered_map<std::string, size_t> &table,
+               std::string &names) {
+  std::vector<ImageSymbol> symbols;
+  symbols.reserve(table.size());
+  for (const auto &[name, value] : table) {
+    symbols.push_back({value, static_cast<uint32_t>(names.size()),
+                       static_cast<uint32_t>(name.size())});
+    names += name;
+  }
+  return symbols;
+}
+
+// the instructions as stored, field by field so that the padding byte is
+// zero and equal programs give equal images
+static std::string InstructionBytes(const std::vector<Instruction> &insts) {
+  std::string bytes(insts.size() * sizeof(Instruction), '\0');
+  char *out = bytes.data();
+  for (const Instruction &inst : insts) {
+    std::memcpy(out + offsetof(Instruction, instruction_op_),
+                &inst.instruction_op_, sizeof(inst.instruction_op_));
+    std::memcpy(out + offsetof(Instruction, rd_), &inst.rd_,
+                sizeof(inst.rd_));
+    std::memcpy(out + offsetof(Instruction, is_breakpoint_),
+                &inst.is_breakpoint_, sizeof(inst.is_breakpoint_));
+    std::memcpy(out + offsetof(Instruction, rs_or_label_), &inst.rs_or_label_,
+                sizeof(inst.rs_or_label_));
+    std::memcpy(out + offsetof(Instruction, rt_or_imm_), &inst.rt_or_imm_,
+                sizeof(inst.rt_or_imm_));
+    out += sizeof(Instruction);
+  }
+  return bytes;
+}
+
+bool IsProgramImage(const char *path) {
+  std::ifstream fin(path, std::ios::binary);
+  char magic[sizeof(kProgramImageMagic)];
+  return fin.read(magic, sizeof(magic)) &&
+         std::memcmp(magic, kProgramImageMagic, sizeof(magic)) == 0;
+}
+
+bool SaveProgramImage(const Program &program, const char *path) {
+  const std::string &text = program.instruction_text.Arena();
+  const std::vector<uint32_t> &text_offsets = program.instruction_text.Offsets();
+  std::vector<int64_t> init_memory(program.init_memory.begin(),
+                                   program.init_memory.end());
+  std::string names;
+  std::vector<ImageSymbol> symbols =
+      CollectSymbols(program.symbol_to_memory, names);
+  std::vector<ImageSymbol> labels =
+      CollectSymbols(program.label_to_inst_idx, names);
+
+  ProgramImageHeader header{};
+  std::memcpy(header.magic, kProgramImageMagic, sizeof(header.magic));
+  header.version = kProgramImageVersion;
+  header.instruction_size = sizeof(Instruction);
+  header.instruction_num = program.instructions.size();
+  header.memory_num = init_memory.size();
+  header.symbol_num = symbols.size();
+  header.label_num = labels.size();
+  header.names_size = names.size();
+
+  std::string image;
+  AppendBytes(image, &header, sizeof(header));
+  const std::string instruction_bytes = InstructionBytes(program.instructions);
+  AppendBytes(image, instruction_bytes.data(), instruction_bytes.size());
+  AppendBytes(image, init_memory.data(), init_memory.size() * sizeof(int64_t));
+  AppendBytes(image, text_offsets.data(),
+              text_offsets.size() * sizeof(uint32_t));
+  AppendBytes(image, text.data(), text.size());
+  AppendBytes(image, symbols.data(), symbols.size() * sizeof(ImageSymbol));
+  AppendBytes(image, labels.data(), labels.size() * sizeof(ImageSymbol));
+  AppendBytes(image, names.data(), names.size());
+
+  std::ofstream fout(path, std::ios::binary | std::ios::trunc);
+  if (!fout.write(image.data(), image.size())) {
+    std::cerr << "Cannot write program image: " << path << '\n';
+    return false;
+  }
+  return true;
+}
+
+// bounds-checked cursor over the mapped image
+class ImageReader {
+public:
+  ImageReader(const char *data, size_t size) : data_(data), size_(size) {}
+
+  // return nullptr if count elements of T do not fit in the image
+  template <typename T> const T *Take(uint64_t count) {
+    if (count > (size_ - offset_) / sizeof(T)) {
+      return nullptr;
+    }
+    const T *section = reinterpret_cast<const T *>(data_ + offset_);
+    offset_ = std::min(size_, AlignUp(offset_ + count * sizeof(T)));
+    return section;
+  }
+
+private:
+  const char *data_;
+  size_t size_;
+  size_t offset_{0};
+};
+
+static bool ReadImage(const char *data, size_t size, Program &program) {
+  ImageReader reader(data, size);
+  const ProgramImageHeader *header = reader.Take<ProgramImageHeader>(1);
+  if (header == nullptr ||
+      std::memcmp(header->magic, kProgramImageMagic, sizeof(header->magic)) !=
+          0) {
+    std::cerr << "Not a program image\n";
+    return false;
+  }
+  if (header->version != kProgramImageVersion ||
+      header->instruction_size != sizeof(Instruction)) {
+    std::cerr << "Program image version " << header->version
+              << " does not match this simulator (version "
+              << kProgramImageVersion << "), please save it again\n";
+    return false;
+  }
+  const Instruction *instructions =
+      reader.Take<Instruction>(header->instruction_num);
+  const int64_t *init_memory = reader.Take<int64_t>(header->memory_num);
+  const uint32_t *text_offsets =
+      instructions == nullptr
+          ? nullptr
+          : reader.Take<uint32_t>(header->instruction_num + 1);
+  const char *text =
+      text_offsets == nullptr
+          ? nullptr
+          : reader.Take<char>(text_offsets[header->instruction_num]);
+  const ImageSymbol *symbols = reader.Take<ImageSymbol>(header->symbol_num);
+  const ImageSymbol *labels = reader.Take<ImageSymbol>(header->label_num);
+  const char *names = reader.Take<char>(header->names_size);
+  if (instructions == nullptr || init_memory == nullptr || text == nullptr ||
+      symbols == nullptr || labels == nullptr || names == nullptr) {
+    std::cerr << "Program image is truncated\n";
+    return false;
+  }
+
+  size_t inst_num = header->instruction_num;
+  // opcode and breakpoint flag checked as bytes, before they are read as
+  // an enum and a bool
+  const char *inst_bytes = reinterpret_cast<const char *>(instructions);
+  for (size_t inst_idx = 0; inst_idx < inst_num; ++inst_idx) {
+    const char *bytes = inst_bytes + inst_idx * sizeof(Instruction);
+    uint8_t op, is_breakpoint;
+    std::memcpy(&op, bytes + offsetof(Instruction, instruction_op_), 1);
+    std::memcpy(&is_breakpoint, bytes + offsetof(Instruction, is_breakpoint_),
+                1);
+    if (op > static_cast<uint8_t>(InstructionOp::BNEZ) || is_breakpoint > 1) {
+      std::cerr << "Program image holds an invalid instruction\n";
+      return false;
+    }
+  }
+  program.instructions.assign(instructions, instructions + inst_num);
+  for (const Instruction &inst : program.instructions) {
+    bool is_branch = Simulator::IsBrachInst(inst);
+    bool reads_rt = inst.instruction_op_ == InstructionOp::ADD ||
+                    inst.instruction_op_ == InstructionOp::SUB ||
+                    inst.instruction_op_ == InstructionOp::MUL ||
+                    inst.instruction_op_ == InstructionOp::DIV;
+    if (inst.rd_ >= 32 || (!is_branch && inst.rs_or_label_ >= 32) ||
+        (is_branch && inst.rs_or_label_ > inst_num) ||
+        (reads_rt && (inst.rt_or_imm_ < 0 || inst.rt_or_imm_ >= 32))) {
+      std::cerr << "Program image holds an invalid instruction\n";
+      return false;
+    }
+  }
+  program.init_memory.assign(init_memory, init_memory + header->memory_num);
+  for (size_t inst_idx = 0; inst_idx < inst_num; ++inst_idx) {
+    if (text_offsets[inst_idx] > text_offsets[inst_idx + 1]) {
+      std::cerr << "Program image holds invalid instruction text\n";
+      return false;
+    }
+  }
+  program.instruction_text.Assign(
+      std::string(text, text_offsets[inst_num]),
+      std::vector<uint32_t>(text_offsets, text_offsets + inst_num + 1));
+  auto load_table = [&](const ImageSymbol *entries, uint64_t entry_num,
+                        std::unordered_map<std::string, size_t> &table) {
+    table.clear();
+    table.reserve(entry_num);
+    for (uint64_t entry_idx = 0; entry_idx < entry_num; ++entry_idx) {
+      const ImageSymbol &entry = entries[entry_idx];
+      if (uint64_t{entry.name_offset} + entry.name_size > header->names_size) {
+        return false;
+      }
+      table.emplace(std::string(names + entry.name_offset, entry.name_size),
+                    entry.value);
+    }
+    return true;
+  };
+  if (!load_table(symbols, header->symbol_num, program.symbol_to_memory) ||
+      !load_table(labels, header->label_num, program.label_to_inst_idx)) {
+    std::cerr << "Program image holds an invalid symbol table\n";
+    return false;
+  }
+  return true;
+}
+
+bool LoadProgramImage(const char *path, Program &program) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    std::cerr << "Cannot open program image: " << path << '\n';
+    return false;
+  }
+  struct stat image_stat;
+  if (fstat(fd, &image_stat) != 0 || image_stat.st_size == 0) {
+    std::cerr << "Cannot read program image: " << path << '\n';
+    close(fd);
+    return false;
+  }
+  size_t size = image_stat.st_size;
+  void *data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    std::cerr << "Cannot map program image: " << path << '\n';
+    return false;
+  }
+  bool loaded = ReadImage(static_cast<const char *>(data), size, program);
+  munmap(data, size);
+  return loaded;
+}
+
+bool LoadProgram(const char *path, Program &program) {
+  if (IsProgramImage(path)) {
+    return LoadProgramImage(path, program);
+  }
+  AssemblerError error;
+  if (!AssembleFile(path, program, error)) {
+    std::cerr << path << ':';
+    if (error.line != 0) {
+      std::cerr << error.line << ':' << error.column << ':';
+    }
+    std::cerr << " error: " << error.message << '\n';
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include "simulator.h"
+
+// Program image: a versioned binary file holding an assembled Program, i.e.
+// the decoded instructions, the initial data memory, the instruction text and
+// both symbol tables, so that repeated runs skip parsing the assembly.
+//
+// Layout (host byte order, every section 8-byte aligned):
+//   ProgramImageHeader
+//   Instruction      instructions[instruction_num]
+//   int64_t          init_memory[memory_num]
+//   uint32_t         text_offsets[instruction_num + 1]
+//   char             text[text_offsets[instruction_num]]
+//   ImageSymbol      symbols[symbol_num]
+//   ImageSymbol      labels[label_num]
+//   char             names[names_size]
+
+constexpr char kProgramImageMagic[8] = {'M', 'I', 'P', 'S', 'I', 'M', 'G', 0};
+// bump whenever the layout or Instruction changes
+constexpr uint32_t kProgramImageVersion = 2;
+
+struct ProgramImageHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t instruction_size;
+  uint64_t instruction_num;
+  uint64_t memory_num;
+  uint64_t symbol_num;
+  uint64_t label_num;
+  uint64_t names_size;
+};
+
+struct ImageSymbol {
+  uint64_t value;
+  uint32_t name_offset;
+  uint32_t name_size;
+};
+
+// true if the file at path starts with the program image magic
+bool IsProgramImage(const char *path);
+// return false and report on std::cerr if the image cannot be written
+bool SaveProgramImage(const Program &program, const char *path);
+// memory-map the image at path into program; return false and report on
+// std::cerr if it is not a valid image of this version
+bool LoadProgramImage(const char *path, Program &program);
+// load the image or else assemble the file at path, what every driver takes;
+// return false and report on std::cerr if neither works
+bool LoadProgram(const char *path, Program &program);
@@ -0,0 +1,388 @@
+#include "sampling.h"
+
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+namespace {
+
+// two-sided 95% confidence
+constexpr double kConfidenceZ = 1.96;
+
+// counters a measured unit is the difference of
+struct Counters {
+  size_t instructions; // both engines
+  size_t retired;      // pipeline only
+  size_t cycle_clocks;
+  size_t raw_stalls;
+  size_t control_stalls;
+  size_t structural_stalls;
+  size_t memory_stalls;
+};
+
+Counters ReadCounters(const Simulator &sim) {
+  SimulatorStatistics stats = sim.GetStatistics();
+  return {stats.retired_instructions + stats.functional_instructions,
+          stats.retired_instructions,
+          stats.cycle_clocks,
+          stats.raw_stalls,
+          stats.control_stalls,
+          stats.structural_stalls,
+          stats.memory_stalls};
+}
+
+// Run the pipeline until it retired instructions more, the program ended or
+// faulted. Each step runs few enough cycles not to overshoot by more than
+// one cycle's retirement, assuming at most kMaxIssueWidth per cycle.
+void RunDetailed(Simulator &sim, size_t instructions) {
+  const size_t target = ReadCounters(sim).retired + instructions;
+  while (!sim.IsFinished()) {
+    const size_t retired = ReadCounters(sim).retired;
+    if (retired >= target) {
+      break;
+    }
+    sim.RunSilently(std::max<size_t>(1, (target - retired) / kMaxIssueWidth));
+  }
+}
+
+// per-instruction rates of one measured unit
+struct UnitRates {
+  double cpi;
+  double raw_stalls;
+  double control_stalls;
+  double structural_stalls;
+  double memory_stalls;
+};
+
+// Measure the next unit instructions in the pipeline; false if the program
+// ended or faulted before all of them retired.
+bool MeasureUnit(Simulator &sim, size_t unit, UnitRates &rates,
+                 size_t &measured) {
+  const Counters before = ReadCounters(sim);
+  RunDetailed(sim, unit);
+  const Counters after = ReadCounters(sim);
+  measured = after.retired - before.retired;
+  if (measured < unit || sim.HasFaulted()) {
+    return false;
+  }
+  const double inst = static_cast<double>(measured);
+  rates = {(after.cycle_clocks - before.cycle_clocks) / inst,
+           (after.raw_stalls - before.raw_stalls) / inst,
+           (after.control_stalls - before.control_stalls) / inst,
+           (after.structural_stalls - before.structural_stalls) / inst,
+           (after.memory_stalls - before.memory_stalls) / inst};
+  return true;
+}
+
+// mean and confidence interval of one rate over the units
+SampledRate Summarize(const std::vector<UnitRates> &units,
+                      double UnitRates::*rate) {
+  SampledRate summary{0, 0};
+  if (units.empty()) {
+    return summary;
+  }
+  for (const UnitRates &unit : units) {
+    summary.mean += unit.*rate;
+  }
+  summary.mean /= units.size();
+  if (units.size() < 2) {
+    return summary;
+  }
+  double squares = 0;
+  for (const UnitRates &unit : units) {
+    squares += (unit.*rate - summary.mean) * (unit.*rate - summary.mean);
+  }
+  const double deviation = std::sqrt(squares / (units.size() - 1));
+  summary.half_width = kConfidenceZ * deviation / std::sqrt(units.size());
+  return summary;
+}
+
+void PrintRate(std::ostream &out, const char *name, const SampledRate &rate,
+               bool weighted) {
+  std::ostringstream line;
+  line << std::fixed << std::setprecision(5) << '\t' << name << ": "
+       << rate.mean;
+  if (!weighted) {
+    line << " +- " << rate.half_width;
+  }
+  out << line.str() << '\n';
+}
+
+} // namespace
+
+bool ParseSamplingConfig(std::string_view spec, SamplingConfig &config,
+                         std::string &error) {
+  std::vector<std::string_view> fields;
+  for (size_t begin = 0;;) {
+    size_t end = spec.find(':', begin);
+    fields.push_back(spec.substr(begin, end - begin));
+    if (end == std::string_view::npos) {
+      break;
+    }
+    begin = end + 1;
+  }
+  if (fields.size() > 3) {
+    error = "expected period[:unit[:warmup]]";
+    return false;
+  }
+  SamplingConfig parsed;
+  size_t *values[3] = {&parsed.period, &parsed.unit, &parsed.warmup};
+  for (size_t field = 0; field < fields.size(); ++field) {
+    const std::string_view text = fields[field];
+    auto [end, ec] =
+        std::from_chars(text.data(), text.data() + text.size(), *values[field]);
+    if (ec != std::errc() || end != text.data() + text.size()) {
+      error = "the sizes must be numbers of instructions";
+      return false;
+    }
+  }
+  if (parsed.unit == 0 || parsed.unit > parsed.period ||
+      parsed.warmup > parsed.period - parsed.unit) {
+    error = "the unit must be positive and fit in the period with the warmup";
+    return false;
+  }
+  config = parsed;
+  return true;
+}
+
+bool LoadSampleRegions(const char *path, std::vector<SampleRegion> &regions) {
+  std::ifstream fin(path);
+  if (!fin) {
+    std::cerr << "Cannot open regions: " << path << '\n';
+    return false;
+  }
+  std::vector<SampleRegion> loaded;
+  std::string line;
+  for (size_t line_num = 1; std::getline(fin, line); ++line_num) {
+    line = line.substr(0, line.find('#'));
+    std::istringstream fields(line);
+    SampleRegion region;
+    std::string rest;
+    if (!(fields >> region.start)) {
+      if (line.find_first_not_of(" \t\r") == std::string::npos) {
+        continue;
+      }
+    } else if (fields >> region.length >> region.weight &&
+               !(fields >> rest) && region.length != 0 &&
+               region.weight > 0) {
+      loaded.push_back(region);
+      continue;
+    }
+    std::cerr << path << ':' << line_num
+              << ": expected start, length and a positive weight\n";
+    return false;
+  }
+  std::sort(loaded.begin(), loaded.end(),
+            [](const SampleRegion &a, const SampleRegion &b) {
+              return a.start < b.start;
+            });
+  for (size_t i = 1; i < loaded.size(); ++i) {
+    if (loaded[i].start < loaded[i - 1].start + loaded[i - 1].length) {
+      std::cerr << path << ": the regions at " << loaded[i - 1].start
+                << " and " << loaded[i].start << " overlap\n";
+      return false;
+    }
+  }
+  if (loaded.empty()) {
+    std::cerr << path << ": no regions\n";
+    return false;
+  }
+  regions = std::move(loaded);
+  return true;
+}
+
+SampleEstimate RunSampled(Simulator &sim, const SamplingConfig &config) {
+  SampleEstimate estimate;
+  std::vector<UnitRates> units;
+  const size_t skip = config.period - config.unit - config.warmup;
+  while (!sim.IsFinished()) {
+    // functional warming, then the detailed window at the end of the period
+    sim.RunFunctional(skip);
+    const size_t window_start = ReadCounters(sim).retired;
+    RunDetailed(sim, config.warmup);
+    UnitRates rates;
+    size_t measured;
+    const bool complete = MeasureUnit(sim, config.unit, rates, measured);
+    estimate.detailed_instructions += ReadCounters(sim).retired - window_start;
+    if (complete) {
+      units.push_back(rates);
+      estimate.measured_instructions += measured;
+    }
+  }
+  estimate.instructions = ReadCounters(sim).instructions;
+  estimate.samples = units.size();
+  estimate.cpi = Summarize(units, &UnitRates::cpi);
+  estimate.raw_stalls = Summarize(units, &UnitRates::raw_stalls);
+  estimate.control_stalls = Summarize(units, &UnitRates::control_stalls);
+  estimate.structural_stalls = Summarize(units, &UnitRates::structural_stalls);
+  estimate.memory_stalls = Summarize(units, &UnitRates::memory_stalls);
+  if (units.size() >= 2 && estimate.cpi.mean > 0) {
+    // n grows with the square of the relative interval wanted
+    const double ratio = estimate.cpi.half_width / (0.02 * estimate.cpi.mean);
+    estimate.samples_for_2_percent =
+        static_cast<size_t>(std::ceil(units.size() * ratio * ratio));
+  }
+  return estimate;
+}
+
+SampleEstimate RunSampledRegions(Simulator &sim,
+                                 const std::vector<SampleRegion> &regions,
+                                 size_t warmup) {
+  SampleEstimate estimate;
+  estimate.weighted = true;
+  UnitRates weighted{0, 0, 0, 0, 0};
+  double total_weight = 0;
+  for (const SampleRegion &region : regions) {
+    const size_t now = ReadCounters(sim).instructions;
+    if (sim.IsFinished() || region.start < now) {
+      break;
+    }
+    const size_t detailed_from =
+        std::max(now, region.start > warmup ? region.start - warmup : 0);
+    sim.RunFunctional(detailed_from - now);
+    const size_t window_start = ReadCounters(sim).retired;
+    RunDetailed(sim, region.start - std::min(region.start,
+                                             ReadCounters(sim).instructions));
+    UnitRates rates;
+    size_t measured;
+    const bool complete = MeasureUnit(sim, region.length, rates, measured);
+    estimate.detailed_instructions += ReadCounters(sim).retired - window_start;
+    if (!complete) {
+      break;
+    }
+    estimate.measured_instructions += measured;
+    estimate.region_cpi.push_back(rates.cpi);
+    weighted.cpi += region.weight * rates.cpi;
+    weighted.raw_stalls += region.weight * rates.raw_stalls;
+    weighted.control_stalls += region.weight * rates.control_stalls;
+    weighted.structural_stalls += region.weight * rates.structural_stalls;
+    weighted.memory_stalls += region.weight * rates.memory_stalls;
+    total_weight += region.weight;
+  }
+  // the rest only counts the instructions
+  sim.RunFunctional();
+  estimate.instructions = ReadCounters(sim).instructions;
+  estimate.samples = estimate.region_cpi.size();
+  if (total_weight > 0) {
+    estimate.cpi.mean = weighted.cpi / total_weight;
+    estimate.raw_stalls.mean = weighted.raw_stalls / total_weight;
+    estimate.control_stalls.mean = weighted.control_stalls / total_weight;
+    estimate.structural_stalls.mean =
+        weighted.structural_stalls / total_weight;
+    estimate.memory_stalls.mean = weighted.memory_stalls / total_weight;
+  }
+  return estimate;
+}
+
+void PrintSampleEstimate(std::ostream &out, const SampleEstimate &estimate) {
+  out << "Sampled simulation:\n\t" << estimate.instructions
+      << " instructions, " << estimate.detailed_instructions
+      << " of them in the pipeline, " << estimate.measured_instructions
+      << " measured in " << estimate.samples
+      << (estimate.weighted ? " regions\n" : " units\n");
+  if (estimate.samples == 0) {
+    out << "\tNo complete "
+        << (estimate.weighted ? "region" : "unit, the program is shorter than "
+                                           "a sampling period")
+        << '\n';
+    return;
+  }
+  if (estimate.weighted) {
+    out << "\tWeighted means of the regions:\n";
+  } else {
+    out << "\tMeans per instruction, +- 95% confidence interval:\n";
+  }
+  PrintRate(out, "CPI", estimate.cpi, estimate.weighted);
+  PrintRate(out, "RAW stalls", estimate.raw_stalls, estimate.weighted);
+  PrintRate(out, "Control stalls", estimate.control_stalls,
+            estimate.weighted);
+  PrintRate(out, "Structural stalls", estimate.structural_stalls,
+            estimate.weighted);
+  PrintRate(out, "Memory stalls", estimate.memory_stalls, estimate.weighted);
+  const double instructions = static_cast<double>(estimate.instructions);
+  out << "\tEstimated cycle clocks: "
+      << std::llround(estimate.cpi.mean * instructions);
+  if (!estimate.weighted) {
+    out << " +- " << std::llround(estimate.cpi.half_width * instructions)
+        << " (" << 100 * estimate.cpi.half_width / estimate.cpi.mean << "%)";
+  }
+  out << '\n';
+  if (estimate.samples_for_2_percent != 0) {
+    out << "\tUnits needed for +- 2% CPI: " << estimate.samples_for_2_percent
+        << '\n';
+  }
+  for (size_t region = 0; region < estimate.region_cpi.size(); ++region) {
+    out << "\tRegion " << region << " CPI: " << estimate.region_cpi[region]
+        << '\n';
+  }
+}
+
+bool WriteBasicBlockVectors(Simulator &sim, size_t interval,
+                            const char *path) {
+  std::ofstream fout(path, std::ios::trunc);
+  if (!fout) {
+    std::cerr << "Cannot write basic block vectors: " << path << '\n';
+    return false;
+  }
+  // blocks as the block cache cuts them: a beqz/bnez ends one, its target
+  // and fall-through start one
+  const std::vector<Instruction> &instructions = sim.GetInstructions();
+  const size_t inst_num = instructions.size();
+  std::vector<bool> is_leader(inst_num + 1, false);
+  is_leader[0] = true;
+  for (size_t inst_idx = 0; inst_idx < inst_num; ++inst_idx) {
+    if (Simulator::IsBrachInst(instructions[inst_idx])) {
+      is_leader[std::min<size_t>(instructions[inst_idx].rs_or_label_,
+                                 inst_num)] = true;
+      is_leader[inst_idx + 1] = true;
+    }
+  }
+  std::vector<size_t> block_of(inst_num);
+  size_t block_num = 0;
+  for (size_t inst_idx = 0; inst_idx < inst_num; ++inst_idx) {
+    block_num += is_leader[inst_idx];
+    block_of[inst_idx] = block_num - 1;
+  }
+  std::vector<size_t> counts(block_num, 0);
+  auto flush_interval = [&]() {
+    fout << 'T';
+    for (size_t block = 0; block < block_num; ++block) {
+      if (counts[block] != 0) {
+        fout << ':' << block + 1 << ':' << counts[block] << ' ';
+      }
+    }
+    fout << '\n';
+    std::fill(counts.begin(), counts.end(), 0);
+  };
+  // one block at a time; an interval ends after the block that fills it
+  size_t in_interval = 0;
+  while (!sim.IsFinished()) {
+    const size_t pc = sim.GetPc();
+    size_t end = pc + 1;
+    while (end < inst_num && !is_leader[end]) {
+      ++end;
+    }
+    const size_t executed = sim.RunFunctional(end - pc);
+    counts[block_of[pc]] += executed;
+    in_interval += executed;
+    if (in_interval >= interval) {
+      flush_interval();
+      in_interval = 0;
+    }
+    if (executed < end - pc) {
+      break;
+    }
+  }
+  if (in_interval != 0) {
+    flush_interval();
+  }
+  if (!fout) {
+    std::cerr << "Cannot write basic block vectors: " << path << '\n';
+    return false;
+  }
+  return true;
+}
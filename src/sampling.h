@@ -0,0 +1,84 @@
+#pragma once
+
+#include "simulator.h"
+
+#include <cstddef>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Sampled simulation after SMARTS: the functional engine runs most of the
+// program, keeping the registers, memory, data cache and branch predictor
+// current (functional warming), and every period instructions the pipeline
+// runs warmup instructions to fill itself, then measures the next unit
+// instructions. The per-instruction rates of the measured units estimate
+// those of the whole program, with a confidence interval from their
+// variance. Works with every engine, since only the pipeline model
+// changes between the detailed windows.
+struct SamplingConfig {
+  size_t period{100000}; // instructions from one sample to the next
+  size_t unit{1000};     // measured instructions per sample
+  size_t warmup{2000};   // detailed instructions before each, not measured
+};
+
+// Parse "period[:unit[:warmup]]", e.g. "100000:1000:2000"; unit plus warmup
+// must fit in the period. Return false and describe the problem in error.
+bool ParseSamplingConfig(std::string_view spec, SamplingConfig &config,
+                         std::string &error);
+
+// A representative region picked by a basic block vector clustering pass
+// (e.g. SimPoint over WriteBasicBlockVectors): length instructions from the
+// start-th dynamic instruction on, standing for weight of the program.
+struct SampleRegion {
+  size_t start;
+  size_t length;
+  double weight;
+};
+
+// Read regions from a text file of "start length weight" lines, '#'
+// comments allowed; they must not overlap. Return false and print the
+// problem on failure.
+bool LoadSampleRegions(const char *path, std::vector<SampleRegion> &regions);
+
+// a per-instruction rate over the measured units, with the half width of
+// its 95% confidence interval (0 when there are too few units for one)
+struct SampledRate {
+  double mean;
+  double half_width;
+};
+
+struct SampleEstimate {
+  // instructions of the whole run, counted by both engines
+  size_t instructions{0};
+  size_t samples{0};
+  size_t measured_instructions{0};
+  size_t detailed_instructions{0}; // measured and warm-up
+  // regions were given: their weighted mean, without confidence intervals
+  bool weighted{false};
+  SampledRate cpi{};
+  SampledRate raw_stalls{};
+  SampledRate control_stalls{};
+  SampledRate structural_stalls{};
+  SampledRate memory_stalls{};
+  // units for a CPI interval within 2% of the mean, 0 if unknown
+  size_t samples_for_2_percent{0};
+  // per region, for the report
+  std::vector<double> region_cpi;
+};
+
+// Run sim to the end or the first fault, sampling as config says.
+SampleEstimate RunSampled(Simulator &sim, const SamplingConfig &config);
+// Run sim to the end or the first fault, measuring only the regions (sorted
+// by start) after warmup detailed instructions each.
+SampleEstimate RunSampledRegions(Simulator &sim,
+                                 const std::vector<SampleRegion> &regions,
+                                 size_t warmup);
+void PrintSampleEstimate(std::ostream &out, const SampleEstimate &estimate);
+
+// Run sim functionally to the end or the first fault and write the basic
+// block vector of every interval instructions to path, one line each in
+// the SimPoint frequency vector format "T:block:count :block:count ...",
+// block numbers from 1 in program order and counts in instructions. Return
+// false and print the problem if path cannot be written.
+bool WriteBasicBlockVectors(Simulator &sim, size_t interval, const char *path);
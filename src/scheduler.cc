@@ -0,0 +1,291 @@
+#include "scheduler.h"
+
+#include <algorithm>
+#include <array>
+#include <numeric>
+#include <utility>
+#include <vector>
+
+namespace {
+
+// a register an instruction reads; in_id: consumed in ID (store data,
+// branch condition) rather than at the start of EX
+struct Use {
+  uint8_t reg;
+  bool in_id;
+};
+
+// edge of the dependency DAG inside one window
+struct Dependence {
+  size_t from;
+  size_t latency;
+};
+
+size_t UsesOf(const Instruction &inst, Use (&uses)[2]) {
+  const uint8_t rs = static_cast<uint8_t>(inst.rs_or_label_);
+  switch (inst.instruction_op_) {
+  case InstructionOp::LOAD:
+  case InstructionOp::ADDI:
+  case InstructionOp::SUBI:
+    uses[0] = {rs, false};
+    return 1;
+  case InstructionOp::ADD:
+  case InstructionOp::SUB:
+  case InstructionOp::MUL:
+  case InstructionOp::DIV:
+    uses[0] = {rs, false};
+    uses[1] = {static_cast<uint8_t>(inst.rt_or_imm_), false};
+    return 2;
+  case InstructionOp::STORE:
+    uses[0] = {rs, false};
+    uses[1] = {inst.rd_, true};
+    return 2;
+  case InstructionOp::BEQZ:
+  case InstructionOp::BNEZ:
+    uses[0] = {inst.rd_, true};
+    return 1;
+  }
+  return 0;
+}
+
+bool IsBranch(const Instruction &inst) {
+  return inst.instruction_op_ == InstructionOp::BEQZ ||
+         inst.instruction_op_ == InstructionOp::BNEZ;
+}
+
+bool IsMemory(const Instruction &inst) {
+  return inst.instruction_op_ == InstructionOp::LOAD ||
+         inst.instruction_op_ == InstructionOp::STORE;
+}
+
+bool WritesRegister(const Instruction &inst) {
+  return !IsBranch(inst) && inst.instruction_op_ != InstructionOp::STORE;
+}
+
+// cycles from the producer's ID to the first cycle a consumer in ID can
+// take its result, as Simulator::IsOperandReady decides it
+size_t Latency(const Instruction &producer, bool in_id, bool forwarding,
+               const FunctionalUnitsConfig &units) {
+  UnitKind kind;
+  if (UnitOf(producer, kind)) {
+    // the result is first seen in MEM, after latency cycles of EX
+    return units[kind].latency + (forwarding ? 1 : 2);
+  }
+  if (!forwarding) {
+    return 3; // register file, written in WB
+  }
+  bool from_load = producer.instruction_op_ == InstructionOp::LOAD;
+  return (from_load ? 2 : 1) + (in_id ? 1 : 0);
+}
+
+// RAW stalls of the instructions in order, issued from an empty pipeline
+size_t PredictStalls(const std::vector<Instruction> &instructions,
+                     const uint32_t *order, size_t inst_num, bool forwarding,
+                     const FunctionalUnitsConfig &units) {
+  std::array<long long, 32> written_at{};
+  // nullptr: written before the block
+  std::array<const Instruction *, 32> writer{};
+  long long cycle = -1;
+  size_t stalls = 0;
+  for (size_t pos = 0; pos < inst_num; ++pos) {
+    const Instruction &inst = instructions[order[pos]];
+    Use uses[2];
+    long long issue = cycle + 1;
+    for (size_t use = 0, use_num = UsesOf(inst, uses); use < use_num; ++use) {
+      const Use &operand = uses[use];
+      if (writer[operand.reg] == nullptr) {
+        continue;
+      }
+      size_t latency = Latency(*writer[operand.reg], operand.in_id,
+                               forwarding, units);
+      issue = std::max(issue, written_at[operand.reg] +
+                                  static_cast<long long>(latency));
+    }
+    stalls += issue - (cycle + 1);
+    cycle = issue;
+    if (WritesRegister(inst)) {
+      written_at[inst.rd_] = issue;
+      writer[inst.rd_] = &inst;
+    }
+  }
+  return stalls;
+}
+
+// Reorder instructions [begin, begin + inst_num) into order, given in and
+// returned as program indexes. Return the predicted stalls of the new
+// order, or before if it is kept.
+size_t ScheduleWindow(const std::vector<Instruction> &instructions,
+                      size_t begin, size_t inst_num, bool forwarding,
+                      const FunctionalUnitsConfig &units, size_t before,
+                      uint32_t *order) {
+  std::vector<std::vector<Dependence>> preds(inst_num);
+  std::vector<std::vector<size_t>> succs(inst_num);
+  auto depend = [&](size_t from, size_t to, size_t latency) {
+    preds[to].push_back({from, latency});
+    succs[from].push_back(to);
+  };
+  // last writer and readers since, per register; npos: before the window
+  constexpr size_t npos = static_cast<size_t>(-1);
+  std::array<size_t, 32> last_writer;
+  last_writer.fill(npos);
+  std::array<std::vector<size_t>, 32> readers;
+  // writer of the base register each lw/sw saw, to tell addresses apart
+  std::vector<size_t> base_version(inst_num, npos);
+  for (size_t node = 0; node < inst_num; ++node) {
+    const Instruction &inst = instructions[begin + node];
+    Use uses[2];
+    size_t use_num = UsesOf(inst, uses);
+    for (size_t use = 0; use < use_num; ++use) {
+      size_t writer = last_writer[uses[use].reg];
+      if (writer != npos) {
+        depend(writer, node,
+               Latency(instructions[begin + writer], uses[use].in_id,
+                       forwarding, units));
+      }
+    }
+    if (IsMemory(inst)) {
+      base_version[node] = last_writer[inst.rs_or_label_];
+      for (size_t other = 0; other < node; ++other) {
+        const Instruction &earlier = instructions[begin + other];
+        if (!IsMemory(earlier) ||
+            (earlier.instruction_op_ == InstructionOp::LOAD &&
+             inst.instruction_op_ == InstructionOp::LOAD)) {
+          continue;
+        }
+        bool disjoint = earlier.rs_or_label_ == inst.rs_or_label_ &&
+                        base_version[other] == base_version[node] &&
+                        earlier.rt_or_imm_ != inst.rt_or_imm_;
+        if (!disjoint) {
+          depend(other, node, 0);
+        }
+      }
+    }
+    if (IsBranch(inst)) {
+      // the branch ends the block
+      for (size_t other = 0; other < node; ++other) {
+        depend(other, node, 0);
+      }
+    }
+    for (size_t use = 0; use < use_num; ++use) {
+      readers[uses[use].reg].push_back(node);
+    }
+    if (WritesRegister(inst)) {
+      if (last_writer[inst.rd_] != npos) {
+        depend(last_writer[inst.rd_], node, 0);
+      }
+      for (size_t reader : readers[inst.rd_]) {
+        if (reader != node) {
+          depend(reader, node, 0);
+        }
+      }
+      readers[inst.rd_].clear();
+      last_writer[inst.rd_] = node;
+    }
+  }
+
+  // longest latency path from each instruction to the end of the window
+  std::vector<size_t> height(inst_num, 0);
+  for (size_t node = inst_num; node-- > 0;) {
+    for (const Dependence &dep : preds[node]) {
+      height[dep.from] = std::max(height[dep.from], height[node] + dep.latency);
+    }
+  }
+
+  std::vector<size_t> pending(inst_num);
+  for (size_t node = 0; node < inst_num; ++node) {
+    pending[node] = preds[node].size();
+  }
+  std::vector<long long> issue(inst_num, -1);
+  std::vector<uint32_t> scheduled;
+  scheduled.reserve(inst_num);
+  long long cycle = 0;
+  while (scheduled.size() < inst_num) {
+    size_t best = npos;
+    long long best_issue = 0;
+    for (size_t node = 0; node < inst_num; ++node) {
+      if (pending[node] != 0 || issue[node] >= 0) {
+        continue;
+      }
+      long long earliest = cycle;
+      for (const Dependence &dep : preds[node]) {
+        earliest = std::max(
+            earliest, issue[dep.from] + static_cast<long long>(dep.latency));
+      }
+      if (best == npos || earliest < best_issue ||
+          (earliest == best_issue && height[node] > height[best])) {
+        best = node;
+        best_issue = earliest;
+      }
+    }
+    issue[best] = best_issue;
+    cycle = best_issue + 1;
+    scheduled.push_back(static_cast<uint32_t>(begin + best));
+    for (size_t succ : succs[best]) {
+      --pending[succ];
+    }
+  }
+
+  size_t after = PredictStalls(instructions, scheduled.data(), inst_num,
+                               forwarding, units);
+  if (after >= before) {
+    return before;
+  }
+  std::copy(scheduled.begin(), scheduled.end(), order);
+  return after;
+}
+
+} // namespace
+
+ScheduleReport ScheduleProgram(Program &program, bool forwarding,
+                               const FunctionalUnitsConfig &units) {
+  ScheduleReport report;
+  const std::vector<Instruction> &instructions = program.instructions;
+  const size_t inst_num = instructions.size();
+  std::vector<bool> is_leader(inst_num + 1, false);
+  is_leader[0] = true;
+  for (size_t inst_idx = 0; inst_idx < inst_num; ++inst_idx) {
+    if (IsBranch(instructions[inst_idx])) {
+      is_leader[std::min<size_t>(instructions[inst_idx].rs_or_label_,
+                                 inst_num)] = true;
+      is_leader[inst_idx + 1] = true;
+    }
+  }
+  for (const auto &[label, inst_idx] : program.label_to_inst_idx) {
+    is_leader[std::min(inst_idx, inst_num)] = true;
+  }
+
+  std::vector<uint32_t> order(inst_num);
+  std::iota(order.begin(), order.end(), 0);
+  for (size_t begin = 0; begin < inst_num;) {
+    size_t end = begin + 1;
+    while (end < inst_num && !is_leader[end] &&
+           end - begin < kScheduleWindow) {
+      ++end;
+    }
+    size_t before = PredictStalls(instructions, &order[begin], end - begin,
+                                  forwarding, units);
+    size_t after = before == 0 ? 0
+                               : ScheduleWindow(instructions, begin,
+                                                end - begin, forwarding, units,
+                                                before, &order[begin]);
+    report.predicted_stalls_before += before;
+    report.predicted_stalls_after += after;
+    if (after != before) {
+      ++report.reordered_blocks;
+    }
+    begin = end;
+  }
+
+  std::vector<Instruction> scheduled;
+  scheduled.reserve(inst_num);
+  InstructionText text;
+  text.Reserve(inst_num, program.instruction_text.Arena().size());
+  for (size_t inst_idx = 0; inst_idx < inst_num; ++inst_idx) {
+    scheduled.push_back(instructions[order[inst_idx]]);
+    text.Append({program.instruction_text[order[inst_idx]]});
+    report.moved_instructions += order[inst_idx] != inst_idx;
+  }
+  program.instructions = std::move(scheduled);
+  program.instruction_text = std::move(text);
+  return report;
+}
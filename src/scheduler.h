@@ -0,0 +1,42 @@
+#pragma once
+
+#include "functional_unit.h"
+#include "instruction.h"
+
+#include <cstddef>
+
+// what ScheduleProgram did, printed by Simulator::PrintStatistics
+struct ScheduleReport {
+  size_t reordered_blocks{0};
+  size_t moved_instructions{0};
+  // RAW stalls of one pass through every block, each entered with an empty
+  // pipeline, in the original and in the scheduled order
+  size_t predicted_stalls_before{0};
+  size_t predicted_stalls_after{0};
+  // a run of the unscheduled program to compare with, if the caller made one
+  bool has_unscheduled_run{false};
+  size_t unscheduled_raw_stalls{0};
+  size_t unscheduled_cycle_clocks{0};
+};
+
+// Static list scheduler run on a program before it is simulated. Each basic
+// block (ending at a beqz/bnez or right before a branch target or label) is
+// turned into a dependency DAG: register RAW edges carry the cycles the
+// pipeline needs between producer and consumer in ID (see
+// Simulator::IsOperandReady, with units giving the mul/div latencies), WAR
+// and WAW edges and the memory order only keep the instructions in order.
+// Stores stay ordered with every lw/sw except those on the same base
+// register, not redefined in between, at a different offset. The block is
+// then list-scheduled, the instruction with the longest latency path to the
+// end of the block first among those that can issue without stalling, and
+// the new order is kept only if it predicts fewer stalls. Blocks longer
+// than kScheduleWindow instructions are scheduled in windows of that size.
+//
+// Blocks keep their bounds and the branch stays last, so branch targets and
+// labels still point at the same blocks; instruction_text follows the
+// instructions. The architectural state at the end of every block is the
+// same as before, while a memory fault inside a block may see registers
+// written by instructions moved above the faulting lw/sw.
+constexpr size_t kScheduleWindow = 64;
+ScheduleReport ScheduleProgram(Program &program, bool forwarding,
+                               const FunctionalUnitsConfig &units);
@@ -1,30 +1,58 @@
 #include "simulator.h"
 
-Simulator::Simulator() : memory_(16, 0), register_(32, 0), pipeline_(5, -1) {}
+Simulator::Simulator() : register_(32, 0) { SelectPipeline(); }
 
-Simulator::Simulator(std::vector<long> init_memory,
-                     std::vector<Instruction> instructions,
-                     std::vector<std::string> instruction_text,
-                     bool enable_forwarding)
-    : memory_(init_memory), register_(32, 0), pipeline_(5, -1),
+Simulator::Simulator(Program program, bool enable_forwarding)
+    : memory_(program.init_memory), register_(32, 0),
       enable_forwarding_(enable_forwarding) {
-  memory_.resize(16);
-  instructions_ = std::move(instructions);
-  instruction_text_ = std::move(instruction_text);
+  instructions_ = std::move(program.instructions);
+  instruction_text_ = std::move(program.instruction_text);
+  profile_.Reset(instructions_.size());
+  SelectPipeline();
 }
 
 void Simulator::PrintInstructions() const {
-  for (size_t i = 0; i < instruction_text_.size(); ++i) {
+  for (size_t i = 0; i < instruction_text_.Size(); ++i) {
     std::cout << i << '\t' << instruction_text_[i] << '\n';
   }
 }
+void Simulator::PrintProfile() const {
+  if (statistics_level_ != StatisticsLevel::PER_INSTRUCTION) {
+    std::cout << "Per-instruction statistics are off\n";
+    return;
+  }
+  profile_.Print(std::cout, instruction_text_, 20);
+}
 void Simulator::PrintPipelines() const {
+  if (ooo_.has_value()) {
+    ooo_->Print(std::cout, instruction_text_);
+    return;
+  }
+  if (issue_config_.width > 1) {
+    PrintWidePipelines();
+    return;
+  }
+  const std::pair<bool, uint32_t> occupants[5] = {
+      {pipeline_.if_id.valid, pipeline_.if_id.inst_idx},
+      {pipeline_.id_ex.valid, pipeline_.id_ex.inst_idx},
+      {pipeline_.ex_mem.valid, pipeline_.ex_mem.inst_idx},
+      {pipeline_.mem_wb.valid, pipeline_.mem_wb.inst_idx},
+      {pipeline_.wb.valid, pipeline_.wb.inst_idx},
+  };
   for (size_t ppl_idx = 0; ppl_idx < 5; ++ppl_idx) {
     std::cout << pipeline_name[ppl_idx] << '\t';
-    if (pipeline_[ppl_idx] == (unsigned long)-1) {
+    if (!occupants[ppl_idx].first) {
       std::cout << "nop\n";
     } else {
-      std::cout << instruction_text_[pipeline_[ppl_idx]] << '\n';
+      std::cout << instruction_text_[occupants[ppl_idx].second] << '\n';
+    }
+    if (ppl_idx == 2) {
+      // mul/div still in their units, beside the EX occupant
+      for (size_t op = 0; op < pipeline_.units.size; ++op) {
+        const UnitOp &unit_op = pipeline_.units.ops[op];
+        std::cout << "\t" << instruction_text_[unit_op.inst_idx]
+                  << "\t(cycles left: " << unit_op.cycles_left << ")\n";
+      }
     }
   }
 }
@@ -37,278 +65,877 @@ void Simulator::PrintRegisters() const {
   }
 }
 void Simulator::PrintBreakpoints() const {
-  for (size_t i = 0; i < instruction_text_.size(); ++i) {
-    std::cout << i << '\t' << (instructions_[i].is_breakpoint_ ? "BID\t" : "\t")
-              << instruction_text_[i] << '\n';
+  for (size_t i = 0; i < instruction_text_.Size(); ++i) {
+    auto conditional = conditional_bps_.find(i);
+    bool is_breakpoint = instructions_[i].is_breakpoint_ ||
+                         conditional != conditional_bps_.end();
+    std::cout << i << '\t' << (is_breakpoint ? "BID\t" : "\t")
+              << instruction_text_[i];
+    if (conditional != conditional_bps_.end()) {
+      const BreakpointSpec &spec = conditional->second.spec;
+      std::cout << "\t(";
+      if (spec.has_condition) {
+        std::cout << "if " << DescribeCondition(spec.condition) << ", ";
+      }
+      std::cout << "hits " << conditional->second.hits << '/'
+                << spec.hit_count << ')';
+    }
+    std::cout << '\n';
+  }
+}
+void Simulator::PrintWatches() const {
+  if (watches_.empty()) {
+    std::cout << "No watchpoints\n";
+    return;
+  }
+  for (size_t i = 0; i < watches_.size(); ++i) {
+    std::cout << i << '\t' << DescribeWatch(watches_[i]) << '\n';
   }
 }
 void Simulator::PrintMemory() const {
   std::cout
       << "Address\tValue\tAddress\tValue\tAddress\tValue\tAddress\tValue\t\n";
-  for (size_t mem_idx = 0; mem_idx < memory_.size(); ++mem_idx) {
-    std::cout << mem_idx << '\t' << memory_[mem_idx] << '\t';
-    if ((mem_idx + 1) % 4 == 0) {
+  // resident pages only; the first four rows of each page are always shown,
+  // all-zero rows after them are skipped
+  for (uint64_t page_idx : memory_.ResidentPages()) {
+    const long *page = memory_.PageData(page_idx);
+    uint64_t page_base = page_idx << PagedMemory::kPageBits;
+    for (size_t row = 0; row < PagedMemory::kPageWords; row += 4) {
+      if (row >= 16 && page[row] == 0 && page[row + 1] == 0 &&
+          page[row + 2] == 0 && page[row + 3] == 0) {
+        continue;
+      }
+      for (size_t word_idx = row; word_idx < row + 4; ++word_idx) {
+        std::cout << page_base + word_idx << '\t' << page[word_idx] << '\t';
+      }
       std::cout << '\n';
     }
   }
 }
 void Simulator::PrintStatistics() const {
   std::cout << "Total:\n\t" << cycle_clocks_ << " cycle clocks executed\n";
+  if (functional_instructions_ != 0) {
+    std::cout << "\t" << functional_instructions_
+              << " instructions fast-forwarded functionally\n";
+  }
   std::cout << "Stalls:\n"
             << "\tRAW stalls: " << raw_stalls_ << "\n"
             << "\tControl stalls: " << control_stalls_ << "\n"
-            << "\tTotal: " << raw_stalls_ + control_stalls_ << "\n";
+            << "\tStructural stalls: " << structural_stalls_ << "\n";
+  if (data_cache_.has_value()) {
+    std::cout << "\tMemory stalls: " << memory_stalls_ << "\n";
+  }
+  std::cout << "\tTotal: "
+            << raw_stalls_ + control_stalls_ + structural_stalls_ +
+                   memory_stalls_
+            << "\n";
+  if (issue_config_.width > 1) {
+    PrintIssueStatistics();
+  }
+  if (ooo_.has_value()) {
+    ooo_->PrintStatistics(std::cout);
+  }
+  if (data_cache_.has_value()) {
+    data_cache_->PrintStatistics(std::cout);
+  }
+  if (branch_predictor_.has_value()) {
+    branch_predictor_->PrintStatistics(std::cout, control_stalls_);
+  }
+  if (schedule_report_.has_value()) {
+    const ScheduleReport &report = *schedule_report_;
+    std::cout << "Scheduling:\n"
+              << "\tReordered blocks: " << report.reordered_blocks << " ("
+              << report.moved_instructions << " instructions moved)\n"
+              << "\tPredicted RAW stalls per pass over the blocks: "
+              << report.predicted_stalls_before << " -> "
+              << report.predicted_stalls_after << "\n";
+    if (report.has_unscheduled_run) {
+      std::cout << "\tUnscheduled run: " << report.unscheduled_raw_stalls
+                << " RAW stalls, " << report.unscheduled_cycle_clocks
+                << " cycle clocks\n"
+                << "\tRAW stalls saved: "
+                << static_cast<long long>(report.unscheduled_raw_stalls) -
+                       static_cast<long long>(raw_stalls_)
+                << "\n"
+                << "\tCycle clocks saved: "
+                << static_cast<long long>(report.unscheduled_cycle_clocks) -
+                       static_cast<long long>(cycle_clocks_)
+                << "\n";
+    }
+  }
+}
+
+SimulatorStatistics Simulator::GetStatistics() const {
+  SimulatorStatistics stats{};
+  stats.cycle_clocks = cycle_clocks_;
+  stats.retired_instructions = retired_instructions_;
+  stats.functional_instructions = functional_instructions_;
+  stats.raw_stalls = raw_stalls_;
+  stats.control_stalls = control_stalls_;
+  stats.structural_stalls = structural_stalls_;
+  stats.memory_stalls = memory_stalls_;
+  if (data_cache_.has_value()) {
+    stats.l1 = data_cache_->L1Stats();
+    stats.l2 = data_cache_->L2Stats();
+  }
+  if (branch_predictor_.has_value()) {
+    stats.branches = branch_predictor_->Stats();
+  }
+  stats.faulted = faulted_;
+  return stats;
+}
+
+uint64_t Simulator::ProgramFingerprint() const {
+  // FNV-1a over the decoded fields
+  uint64_t hash = 14695981039346656037ull;
+  auto mix = [&hash](uint64_t value) {
+    for (size_t byte = 0; byte < 8; ++byte) {
+      hash = (hash ^ ((value >> (byte * 8)) & 0xff)) * 1099511628211ull;
+    }
+  };
+  mix(instructions_.size());
+  for (const Instruction &inst : instructions_) {
+    mix(static_cast<uint64_t>(inst.instruction_op_));
+    mix(inst.rd_);
+    mix(inst.rs_or_label_);
+    mix(static_cast<uint32_t>(inst.rt_or_imm_));
+  }
+  return hash;
+}
+
+void Simulator::SaveState(StateWriter &writer) const {
+  SaveMachineState(writer);
+  writer.Put<uint8_t>(data_cache_.has_value());
+  if (data_cache_.has_value()) {
+    data_cache_->SaveState(writer);
+  }
+  writer.Put<uint8_t>(branch_predictor_.has_value());
+  if (branch_predictor_.has_value()) {
+    branch_predictor_->SaveState(writer);
+  }
+  profile_.SaveState(writer);
+}
+
+bool Simulator::LoadState(StateReader &reader) {
+  ResetHistory();
+  uint8_t has_data_cache;
+  uint8_t has_branch_predictor;
+  if (!LoadMachineState(reader) || !reader.Get(has_data_cache)) {
+    return false;
+  }
+  data_cache_.reset();
+  if (has_data_cache != 0 &&
+      !data_cache_.emplace(CacheConfig{}, std::nullopt).LoadState(reader)) {
+    return false;
+  }
+  if (!reader.Get(has_branch_predictor)) {
+    return false;
+  }
+  branch_predictor_.reset();
+  if (has_branch_predictor != 0 &&
+      !branch_predictor_.emplace(BranchPredictorConfig{}).LoadState(reader)) {
+    return false;
+  }
+  return profile_.LoadState(reader, instructions_.size());
+}
+
+// The latches are written field by field: their padding stays out of the
+// state, and their bools and counts are checked when read back, since a
+// corrupt checkpoint must not put invalid values into them.
+static void PutLatches(StateWriter &writer, const PipelineLatches &latches) {
+  const IfIdLatch &if_id = latches.if_id;
+  writer.Put(if_id.inst_idx);
+  writer.Put(if_id.seq);
+  writer.PutBool(if_id.valid);
+  writer.PutBool(if_id.predicted_taken);
+  const IdExLatch &id_ex = latches.id_ex;
+  writer.Put(id_ex.inst_idx);
+  writer.Put(id_ex.seq);
+  writer.PutBool(id_ex.valid);
+  writer.Put(id_ex.in1);
+  writer.Put(id_ex.in2);
+  const ExMemLatch &ex_mem = latches.ex_mem;
+  writer.Put(ex_mem.inst_idx);
+  writer.Put(ex_mem.seq);
+  writer.PutBool(ex_mem.valid);
+  writer.Put(ex_mem.res);
+  writer.Put(ex_mem.store_data);
+  for (const MemWbLatch *latch : {&latches.mem_wb, &latches.wb}) {
+    writer.Put(latch->inst_idx);
+    writer.Put(latch->seq);
+    writer.PutBool(latch->valid);
+    writer.Put(latch->res);
+  }
+  const UnitLatches &units = latches.units;
+  writer.Put(units.size);
+  for (size_t op = 0; op < units.size; ++op) {
+    writer.Put(units.ops[op].inst_idx);
+    writer.Put(units.ops[op].seq);
+    writer.Put(units.ops[op].res);
+    writer.Put(units.ops[op].cycles_left);
+  }
+  writer.Put(units.busy);
+  writer.Put(units.mem_slots);
+}
+
+static bool GetLatches(StateReader &reader, PipelineLatches &latches) {
+  IfIdLatch &if_id = latches.if_id;
+  IdExLatch &id_ex = latches.id_ex;
+  ExMemLatch &ex_mem = latches.ex_mem;
+  if (!reader.Get(if_id.inst_idx) || !reader.Get(if_id.seq) ||
+      !reader.GetBool(if_id.valid) || !reader.GetBool(if_id.predicted_taken) ||
+      !reader.Get(id_ex.inst_idx) || !reader.Get(id_ex.seq) ||
+      !reader.GetBool(id_ex.valid) || !reader.Get(id_ex.in1) ||
+      !reader.Get(id_ex.in2) || !reader.Get(ex_mem.inst_idx) ||
+      !reader.Get(ex_mem.seq) || !reader.GetBool(ex_mem.valid) ||
+      !reader.Get(ex_mem.res) || !reader.Get(ex_mem.store_data)) {
+    return false;
+  }
+  for (MemWbLatch *latch : {&latches.mem_wb, &latches.wb}) {
+    if (!reader.Get(latch->inst_idx) || !reader.Get(latch->seq) ||
+        !reader.GetBool(latch->valid) || !reader.Get(latch->res)) {
+      return false;
+    }
+  }
+  UnitLatches &units = latches.units;
+  units = UnitLatches{};
+  if (!reader.Get(units.size) || units.size > units.ops.size()) {
+    return false;
+  }
+  for (size_t op = 0; op < units.size; ++op) {
+    if (!reader.Get(units.ops[op].inst_idx) || !reader.Get(units.ops[op].seq) ||
+        !reader.Get(units.ops[op].res) ||
+        !reader.Get(units.ops[op].cycles_left)) {
+      return false;
+    }
+  }
+  return reader.Get(units.busy) && reader.Get(units.mem_slots);
+}
+
+static void PutWideLatches(StateWriter &writer, const WideLatches &wide) {
+  for (const WideGroup *group :
+       {&wide.if_id, &wide.id_ex, &wide.ex_mem, &wide.mem_wb, &wide.wb}) {
+    writer.Put(group->size);
+    for (size_t slot = 0; slot < group->size; ++slot) {
+      const WideSlot &wide_slot = group->slots[slot];
+      writer.Put(wide_slot.inst_idx);
+      writer.Put(wide_slot.seq);
+      writer.PutBool(wide_slot.predicted_taken);
+      writer.Put(wide_slot.in1);
+      writer.Put(wide_slot.in2);
+      writer.Put(wide_slot.res);
+      writer.Put(wide_slot.store_data);
+    }
+  }
+  writer.Put(wide.ex_cycles_left);
+}
+
+static bool GetWideLatches(StateReader &reader, WideLatches &wide) {
+  wide = WideLatches{};
+  for (WideGroup *group :
+       {&wide.if_id, &wide.id_ex, &wide.ex_mem, &wide.mem_wb, &wide.wb}) {
+    if (!reader.Get(group->size) || group->size > group->slots.size()) {
+      return false;
+    }
+    for (size_t slot = 0; slot < group->size; ++slot) {
+      WideSlot &wide_slot = group->slots[slot];
+      if (!reader.Get(wide_slot.inst_idx) || !reader.Get(wide_slot.seq) ||
+          !reader.GetBool(wide_slot.predicted_taken) ||
+          !reader.Get(wide_slot.in1) || !reader.Get(wide_slot.in2) ||
+          !reader.Get(wide_slot.res) || !reader.Get(wide_slot.store_data)) {
+        return false;
+      }
+    }
+  }
+  return reader.Get(wide.ex_cycles_left);
+}
+
+void Simulator::SaveMachineState(StateWriter &writer) const {
+  writer.PutBool(enable_forwarding_);
+  writer.PutVector(register_);
+  PutLatches(writer, pipeline_);
+  for (const ScoreboardEntry &entry : scoreboard_) {
+    writer.Put(static_cast<uint8_t>(entry.stage));
+    writer.PutBool(entry.is_load);
+    writer.PutBool(entry.is_long);
+  }
+  writer.Put(issue_config_);
+  PutWideLatches(writer, wide_);
+  writer.Put(issue_stats_.issued);
+  writer.Put(issue_stats_.groups);
+  writer.Put(issue_stats_.limits);
+  for (size_t counter : {pc_, cycle_clocks_, raw_stalls_, control_stalls_,
+                         retired_instructions_, functional_instructions_,
+                         memory_stall_cycles_left_, memory_stalls_,
+                         fetched_instructions_, structural_stalls_}) {
+    writer.Put<uint64_t>(counter);
+  }
+  writer.Put(unit_config_);
+  writer.PutBool(faulted_);
+  writer.PutString(fault_message_);
+}
+
+bool Simulator::LoadMachineState(StateReader &reader) {
+  bool enable_forwarding;
+  std::vector<Register> registers;
+  PipelineLatches pipeline;
+  std::array<ScoreboardEntry, 32> scoreboard;
+  IssueConfig issue_config;
+  WideLatches wide;
+  IssueStats issue_stats;
+  if (!reader.GetBool(enable_forwarding) || !reader.GetVector(registers) ||
+      registers.size() != register_.size() || !GetLatches(reader, pipeline)) {
+    return false;
+  }
+  for (ScoreboardEntry &entry : scoreboard) {
+    uint8_t stage;
+    if (!reader.Get(stage) ||
+        stage > static_cast<uint8_t>(PipelineStage::NONE) ||
+        !reader.GetBool(entry.is_load) || !reader.GetBool(entry.is_long)) {
+      return false;
+    }
+    entry.stage = static_cast<PipelineStage>(stage);
+  }
+  if (!reader.Get(issue_config) || !GetWideLatches(reader, wide) ||
+      !reader.Get(issue_stats.issued) || !reader.Get(issue_stats.groups) ||
+      !reader.Get(issue_stats.limits)) {
+    return false;
+  }
+  if (issue_config.width == 0 || issue_config.width > kMaxIssueWidth ||
+      issue_config.memory_ops == 0 || issue_config.alu_ops == 0) {
+    return false;
+  }
+  for (const WideGroup *group :
+       {&wide.if_id, &wide.id_ex, &wide.ex_mem, &wide.mem_wb, &wide.wb}) {
+    if (group->size > issue_config.width) {
+      return false;
+    }
+    for (size_t slot = 0; slot < group->size; ++slot) {
+      if (group->slots[slot].inst_idx >= instructions_.size()) {
+        return false;
+      }
+    }
+  }
+  // a group spends at most one latency plus an issue interval per further
+  // instruction of the same unit in EX
+  if (wide.ex_cycles_left >= kMaxUnitLatency * kMaxIssueWidth) {
+    return false;
+  }
+  const std::pair<bool, uint32_t> occupants[] = {
+      {pipeline.if_id.valid, pipeline.if_id.inst_idx},
+      {pipeline.id_ex.valid, pipeline.id_ex.inst_idx},
+      {pipeline.ex_mem.valid, pipeline.ex_mem.inst_idx},
+      {pipeline.mem_wb.valid, pipeline.mem_wb.inst_idx},
+      {pipeline.wb.valid, pipeline.wb.inst_idx},
+  };
+  for (const auto &[valid, inst_idx] : occupants) {
+    if (valid && inst_idx >= instructions_.size()) {
+      return false;
+    }
+  }
+  const UnitLatches &units = pipeline.units;
+  for (size_t op = 0; op < units.size; ++op) {
+    if (units.ops[op].inst_idx >= instructions_.size() ||
+        units.ops[op].cycles_left >= kMaxUnitLatency) {
+      return false;
+    }
+  }
+  uint64_t counters[10];
+  bool faulted;
+  for (uint64_t &counter : counters) {
+    if (!reader.Get(counter)) {
+      return false;
+    }
+  }
+  FunctionalUnitsConfig unit_config;
+  if (!reader.Get(unit_config)) {
+    return false;
+  }
+  for (const FunctionalUnitConfig &unit : unit_config.units) {
+    if (unit.latency == 0 || unit.latency > kMaxUnitLatency ||
+        unit.interval == 0 || unit.interval > unit.latency) {
+      return false;
+    }
+  }
+  if (!reader.GetBool(faulted) || !reader.GetString(fault_message_)) {
+    return false;
+  }
+  enable_forwarding_ = enable_forwarding;
+  issue_config_ = issue_config;
+  SelectPipeline();
+  register_ = std::move(registers);
+  pipeline_ = pipeline;
+  scoreboard_ = scoreboard;
+  wide_ = wide;
+  issue_stats_ = issue_stats;
+  pc_ = counters[0];
+  cycle_clocks_ = counters[1];
+  raw_stalls_ = counters[2];
+  control_stalls_ = counters[3];
+  retired_instructions_ = counters[4];
+  functional_instructions_ = counters[5];
+  memory_stall_cycles_left_ = counters[6];
+  memory_stalls_ = counters[7];
+  fetched_instructions_ = counters[8];
+  structural_stalls_ = counters[9];
+  unit_config_ = unit_config;
+  faulted_ = faulted;
+  return true;
 }
 
 void Simulator::SetBreakpoint(size_t instruction_index) {
   instructions_[instruction_index].is_breakpoint_ = true;
+  if (!verbose_) {
+    return;
+  }
   std::cout << "Set Breakpoint at:\t" << instruction_index << '\t'
             << instruction_text_[instruction_index] << '\n';
 }
 
-bool Simulator::IsFinished() const {
-  return instructions_.size() == 0 or pc_ >= instructions_.size() + 5;
-}
-bool Simulator::TryForwarding(Instruction& new_inst, Instruction& old_inst, bool enable_forwarding) {
-  switch (new_inst.instruction_op_) {
-    case InstructionOp::LOAD:
-    case InstructionOp::ADDI:
-    case InstructionOp::SUBI:
-      if (!IsBrachInst(old_inst) && !IsStoreInst(old_inst) && new_inst.rs_or_label_ == old_inst.rd_) {
-        if (!enable_forwarding || (old_inst.instruction_op_ == InstructionOp::LOAD && old_inst.ppl_stage != PipelineStage::MEM)) {
-          return false;
-        }
-        new_inst.in1 = old_inst.res;
-        new_inst.in2 = new_inst.rt_or_imm_;
-      } else {
-        new_inst.in1 = register_[new_inst.rs_or_label_];
-        new_inst.in2 = new_inst.rt_or_imm_;
-      }
-      break;
-    case InstructionOp::ADD:
-    case InstructionOp::SUB:
-      if (!IsBrachInst(old_inst) && !IsStoreInst(old_inst)) {
-        if (new_inst.rs_or_label_ == old_inst.rd_) {
-          if (!enable_forwarding || (old_inst.instruction_op_ == InstructionOp::LOAD && old_inst.ppl_stage != PipelineStage::MEM)) {
-            
-            new_inst.in1 = LLONG_MAX;
-            return false;
-          }
-          // can forward
-          new_inst.in1 = old_inst.res;
-        } else {
-          new_inst.in1 = register_[new_inst.rs_or_label_];
-        }
-        if ((size_t)new_inst.rt_or_imm_ == old_inst.rd_) {
-          if (!enable_forwarding || (old_inst.instruction_op_ == InstructionOp::LOAD && old_inst.ppl_stage != PipelineStage::MEM)) {
-            new_inst.in1 = LLONG_MAX;
-            return false;
-          }
-          // can forward
-          new_inst.in2 = old_inst.res;
-        } else {
-          new_inst.in2 = register_[new_inst.rt_or_imm_];
-        }
-      } else {  // no hazard
-        new_inst.in1 = register_[new_inst.rs_or_label_];
-        new_inst.in2 = register_[new_inst.rt_or_imm_];
-      }
-      break;
-    case InstructionOp::STORE:
-      if (!IsBrachInst(old_inst) && !IsStoreInst(old_inst) && new_inst.rd_ == old_inst.rd_) {
-        if (!enable_forwarding || (old_inst.instruction_op_ == InstructionOp::LOAD && old_inst.ppl_stage != PipelineStage::MEM)) {
-          return false;
-        }
-        // can forward
-        new_inst.in1 = register_[new_inst.rs_or_label_];
-        new_inst.in2 = old_inst.res;
-      } else {
-        new_inst.in1 = register_[new_inst.rs_or_label_];
-        new_inst.in2 = new_inst.rd_;
-      }
-      
-    case InstructionOp::BEQZ:
-    case InstructionOp::BNEZ:
-      if (!IsBrachInst(old_inst) && !IsStoreInst(old_inst) && new_inst.rd_ == old_inst.rd_) {
-        if (!enable_forwarding || old_inst.instruction_op_ == InstructionOp::LOAD || old_inst.ppl_stage != PipelineStage::MEM) {
-          return false;
+void Simulator::SetBreakpoint(const BreakpointSpec &spec) {
+  if (spec.IsPlain()) {
+    conditional_bps_.erase(spec.inst_idx);
+    SetBreakpoint(spec.inst_idx);
+    SelectPipeline();
+    return;
+  }
+  instructions_[spec.inst_idx].is_breakpoint_ = false;
+  conditional_bps_[spec.inst_idx] = {spec, 0};
+  SelectPipeline();
+  if (!verbose_) {
+    return;
+  }
+  std::cout << "Set Breakpoint at:\t" << spec.inst_idx << '\t'
+            << instruction_text_[spec.inst_idx];
+  if (spec.has_condition) {
+    std::cout << "\tif " << DescribeCondition(spec.condition);
+  }
+  if (spec.hit_count != 1) {
+    std::cout << "\tfrom hit " << spec.hit_count;
+  }
+  std::cout << '\n';
+}
+
+void Simulator::AddWatch(const Watch &watch) {
+  watches_.push_back(watch);
+  if (watch.kind == Watch::Kind::REGISTER) {
+    watched_registers_ |= uint32_t{1} << watch.reg;
+  }
+  SelectPipeline();
+  if (verbose_) {
+    std::cout << "Set Watchpoint " << watches_.size() - 1 << ":\t"
+              << DescribeWatch(watch) << '\n';
+  }
+}
+
+bool Simulator::DeleteWatch(size_t index) {
+  if (index >= watches_.size()) {
+    return false;
+  }
+  watches_.erase(watches_.begin() + index);
+  watched_registers_ = 0;
+  for (const Watch &watch : watches_) {
+    if (watch.kind == Watch::Kind::REGISTER) {
+      watched_registers_ |= uint32_t{1} << watch.reg;
+    }
+  }
+  SelectPipeline();
+  return true;
+}
+
+bool Simulator::CheckRegisterWatch(size_t reg, Register value) {
+  if (((watched_registers_ >> reg) & 1) == 0 || register_[reg] == value) {
+    return false;
+  }
+  ReportWatch("WB-Stage", "watchpoint: r" + std::to_string(reg) +
+                              " changed from " +
+                              std::to_string(register_[reg]) + " to " +
+                              std::to_string(value));
+  return true;
+}
+
+bool Simulator::CheckMemoryWatches(uint64_t address, Register value) {
+  const long old_value = memory_.Read(address);
+  if (old_value == static_cast<long>(value)) {
+    return false;
+  }
+  for (const Watch &watch : watches_) {
+    if (watch.kind == Watch::Kind::MEMORY && watch.first <= address &&
+        address <= watch.last) {
+      ReportWatch("MEM-Stage", "watchpoint: memory[" +
+                                   std::to_string(address) + "] changed from " +
+                                   std::to_string(old_value) + " to " +
+                                   std::to_string(value));
+      return true;
+    }
+  }
+  return false;
+}
+
+bool Simulator::CheckConditionalBreakpoint(size_t inst_idx) {
+  auto found = conditional_bps_.find(inst_idx);
+  if (found == conditional_bps_.end()) {
+    return false;
+  }
+  ConditionalBreakpoint &bp = found->second;
+  if (bp.spec.has_condition) {
+    const RegisterCondition &condition = bp.spec.condition;
+    const long long rhs = condition.rhs_is_register
+                              ? ProgramOrderValue(condition.rhs)
+                              : condition.rhs;
+    if (!Compare(ProgramOrderValue(condition.reg), condition.op, rhs)) {
+      return false;
+    }
+  }
+  if (++bp.hits < bp.spec.hit_count) {
+    return false;
+  }
+  std::string message = "breakpoint " + std::to_string(inst_idx) + " (";
+  if (bp.spec.has_condition) {
+    message += "if " + DescribeCondition(bp.spec.condition) + ", ";
+  }
+  message += "hit " + std::to_string(bp.hits) + ')';
+  ReportWatch("ID-Stage", message);
+  return true;
+}
+
+void Simulator::ReportWatch(const char *stage, const std::string &message) {
+  if (verbose_) {
+    std::cout << "!!! " << stage << ": Reached at " << message << " !!!\n";
+  }
+  if (!watch_message_.empty()) {
+    watch_message_ += "; ";
+  }
+  watch_message_ += message;
+}
+
+Register Simulator::ProgramOrderValue(size_t reg) const {
+  const ScoreboardEntry &entry = scoreboard_[reg];
+  switch (entry.stage) {
+  case PipelineStage::EX:
+    if (entry.is_long) {
+      // the youngest mul/div in the units writing reg
+      Register value = 0;
+      const UnitLatches &units = pipeline_.units;
+      for (size_t op = 0; op < units.size; ++op) {
+        if (instructions_[units.ops[op].inst_idx].rd_ == reg) {
+          value = units.ops[op].res;
         }
-        new_inst.in2 = old_inst.res;
       }
-      break;
+      return value;
+    }
+    if (entry.is_load) {
+      // older stores have all passed MEM
+      return PagedMemory::IsValidAddress(pipeline_.ex_mem.res)
+                 ? memory_.Read(pipeline_.ex_mem.res)
+                 : 0;
+    }
+    return pipeline_.ex_mem.res;
+  case PipelineStage::MEM:
+    return pipeline_.mem_wb.res;
+  default:
+    return register_[reg];
   }
-  return true;
+}
+
+bool Simulator::IsFinished() const {
+  return faulted_ ||
+         (pc_ >= instructions_.size() && !pipeline_.if_id.valid &&
+          !pipeline_.id_ex.valid && !pipeline_.ex_mem.valid &&
+          !pipeline_.mem_wb.valid && !pipeline_.wb.valid &&
+          pipeline_.units.size == 0 && wide_.if_id.size == 0 &&
+          wide_.id_ex.size == 0 && wide_.ex_mem.size == 0 &&
+          wide_.mem_wb.size == 0 && wide_.wb.size == 0 &&
+          (!ooo_.has_value() || ooo_->Empty()));
 }
 bool Simulator::SingleCycle() {
+  watch_message_.clear();
+  return (this->*single_cycle_)();
+}
+
+template <typename Policy> bool Simulator::SingleCycleImpl() {
   if (IsFinished()) {
-    std::cerr << "!!!All the instructions has been executed!!!\n";
+    std::cerr << (faulted_ ? fault_message_
+                           : "!!!All the instructions has been executed!!!")
+              << '\n';
     return true;
   }
-  if (pipeline_[4] != (size_t)-1) {
-    instructions_[pipeline_[4]].in1 = LLONG_MAX;
-    instructions_[pipeline_[4]].in2 = LLONG_MAX;
-    instructions_[pipeline_[4]].res = LLONG_MAX;
+  if (Policy::history && history_.KeyframeDue(cycle_clocks_)) {
+    TakeKeyframe();
+  }
+  // a cache miss holds the instruction in MEM: nothing moves, WB idles
+  if (memory_stall_cycles_left_ != 0) {
+    --memory_stall_cycles_left_;
+    ++memory_stalls_;
+    if constexpr (Policy::profiling) {
+      profile_.CountMemoryStall(pipeline_.mem_wb.inst_idx);
+    }
+    if constexpr (Policy::tracing) {
+      trace_->Record({cycle_clocks_, pipeline_.mem_wb.seq,
+                      pipeline_.mem_wb.inst_idx,
+                      TraceEventKind::MEMORY_STALL, 0});
+      trace_->EndCycle(cycle_clocks_);
+    }
+    pipeline_.wb.valid = false;
+    ++cycle_clocks_;
+    return false;
+  }
+  bool watch_hit = false;
+  UnitLatches &units = pipeline_.units;
+  units.mem_slots >>= 1;
+  for (uint32_t &busy : units.busy) {
+    busy -= busy != 0;
   }
   // update WB
-  pipeline_[4] = pipeline_[3];
-  if (pipeline_[4] != (size_t)-1) {
-    auto &WB_Inst = instructions_[pipeline_[4]];
-    switch (WB_Inst.instruction_op_) {
-      case InstructionOp::LOAD:
-        register_[WB_Inst.rd_] = WB_Inst.res;
-        break;
-      case InstructionOp::ADDI:
-      case InstructionOp::SUBI:
-      case InstructionOp::ADD:
-      case InstructionOp::SUB:
-        register_[WB_Inst.rd_] = WB_Inst.res;
-        break;
-      default:
-        break;
+  pipeline_.wb = pipeline_.mem_wb;
+  if (pipeline_.wb.valid) {
+    ++retired_instructions_;
+    if constexpr (Policy::profiling) {
+      profile_.CountExecution(pipeline_.wb.inst_idx);
+    }
+    const Instruction &WB_Inst = instructions_[pipeline_.wb.inst_idx];
+    if (WritesRegister(WB_Inst)) {
+      if constexpr (Policy::watching) {
+        watch_hit |= CheckRegisterWatch(WB_Inst.rd_, pipeline_.wb.res);
+      }
+      register_[WB_Inst.rd_] = pipeline_.wb.res;
     }
-    WB_Inst.ppl_stage = PipelineStage::WB;
+    AdvanceScoreboard(WB_Inst, PipelineStage::MEM, PipelineStage::NONE);
   }
   // update MEM
-  pipeline_[3] = pipeline_[2];
-  if (pipeline_[3] != (size_t)-1) {
-    auto &MEM_Inst = instructions_[pipeline_[3]];
+  MemWbLatch &mem_wb = pipeline_.mem_wb;
+  const ExMemLatch &ex_mem = pipeline_.ex_mem;
+  mem_wb.inst_idx = ex_mem.inst_idx;
+  mem_wb.seq = ex_mem.seq;
+  mem_wb.valid = ex_mem.valid;
+  mem_wb.res = ex_mem.res;
+  // a mul/div done with EX takes the MEM slot it reserved, left free by EX
+  for (size_t op = 0; op < units.size; ++op) {
+    if (units.ops[op].cycles_left == 0) {
+      mem_wb = {units.ops[op].inst_idx, units.ops[op].seq, true,
+                units.ops[op].res};
+      std::copy(units.ops.begin() + op + 1, units.ops.begin() + units.size,
+                units.ops.begin() + op);
+      --units.size;
+      break;
+    }
+  }
+  if constexpr (Policy::tracing) {
+    // the rest stay in EX
+    for (size_t op = 0; op < units.size; ++op) {
+      trace_->Record({cycle_clocks_, units.ops[op].seq, units.ops[op].inst_idx,
+                      TraceEventKind::STAGE, 2});
+    }
+  }
+  if (mem_wb.valid) {
+    const Instruction &MEM_Inst = instructions_[mem_wb.inst_idx];
+    AdvanceScoreboard(MEM_Inst, PipelineStage::EX, PipelineStage::MEM);
     switch (MEM_Inst.instruction_op_) {
       case InstructionOp::LOAD:
-        MEM_Inst.res = memory_[MEM_Inst.res];
+        if (!PagedMemory::IsValidAddress(ex_mem.res)) {
+          RaiseMemoryFault(mem_wb.inst_idx, ex_mem.res);
+          SettleUnits(mem_wb.seq);
+          break;
+        }
+        mem_wb.res = memory_.Read(ex_mem.res);
+        AccessDataCache(ex_mem.res, false);
         break;
       case InstructionOp::STORE:
-        memory_[MEM_Inst.res] = MEM_Inst.in2;
+        if (!PagedMemory::IsValidAddress(ex_mem.res)) {
+          RaiseMemoryFault(mem_wb.inst_idx, ex_mem.res);
+          SettleUnits(mem_wb.seq);
+          break;
+        }
+        if constexpr (Policy::watching) {
+          watch_hit |= CheckMemoryWatches(ex_mem.res, ex_mem.store_data);
+        }
+        if constexpr (Policy::history) {
+          bool allocated_page;
+          long old_value = memory_.Exchange(ex_mem.res, ex_mem.store_data,
+                                            allocated_page);
+          history_.RecordWrite(ex_mem.res, old_value, allocated_page);
+        } else {
+          memory_.Write(ex_mem.res, ex_mem.store_data);
+        }
+        AccessDataCache(ex_mem.res, true);
         break;
       default:
         break;
     }
-    MEM_Inst.ppl_stage = PipelineStage::MEM;
   }
   // update EX
-  pipeline_[2] = pipeline_[1];
-  if (pipeline_[2] != (size_t)-1) {
-    auto &EX_Inst = instructions_[pipeline_[2]];
+  for (size_t op = 0; op < units.size; ++op) {
+    units.ops[op].cycles_left -= units.ops[op].cycles_left != 0;
+  }
+  ExMemLatch &next_ex_mem = pipeline_.ex_mem;
+  const IdExLatch &id_ex = pipeline_.id_ex;
+  next_ex_mem.inst_idx = id_ex.inst_idx;
+  next_ex_mem.seq = id_ex.seq;
+  next_ex_mem.valid = id_ex.valid;
+  if (next_ex_mem.valid) {
+    const Instruction &EX_Inst = instructions_[next_ex_mem.inst_idx];
+    AdvanceScoreboard(EX_Inst, PipelineStage::ID, PipelineStage::EX);
     switch (EX_Inst.instruction_op_) {
       case InstructionOp::LOAD:
       case InstructionOp::STORE:
-        EX_Inst.res = EX_Inst.in1 + EX_Inst.rt_or_imm_;
+        next_ex_mem.res = id_ex.in1 + EX_Inst.rt_or_imm_;
+        next_ex_mem.store_data = id_ex.in2;
         break;
       case InstructionOp::ADDI:
       case InstructionOp::ADD:
-        EX_Inst.res = EX_Inst.in1 + EX_Inst.in2;
+        next_ex_mem.res = id_ex.in1 + id_ex.in2;
         break;
       case InstructionOp::SUBI:
       case InstructionOp::SUB:
-        EX_Inst.res = EX_Inst.in1 - EX_Inst.in2;
+        next_ex_mem.res = id_ex.in1 - id_ex.in2;
+        break;
+      case InstructionOp::MUL:
+      case InstructionOp::DIV: {
+        // into the unit; EX passes a bubble to MEM
+        UnitKind kind;
+        UnitOf(EX_Inst, kind);
+        units.ops[units.size++] = {
+            id_ex.inst_idx, id_ex.seq,
+            EX_Inst.instruction_op_ == InstructionOp::MUL
+                ? Multiply(id_ex.in1, id_ex.in2)
+                : Divide(id_ex.in1, id_ex.in2),
+            unit_config_[kind].latency - 1};
+        next_ex_mem.valid = false;
         break;
+      }
       default:
         break;
     }
-    EX_Inst.ppl_stage = PipelineStage::EX;
   }
   // update ID and IF
-  size_t old_IF = pipeline_[0];
-  bool should_stall = false;
-  if (old_IF != (size_t)-1) {
-    auto &old_IF_Inst = instructions_[old_IF];
-    if (pipeline_[2] != (size_t)-1) { // check EX
-      auto &EX_Inst = instructions_[pipeline_[2]];
-      should_stall = HasHazard(old_IF_Inst, EX_Inst);
-      if (should_stall && enable_forwarding_) {
-        should_stall = !TryForwarding(old_IF_Inst, EX_Inst);
-      }
-    }
-    if (!should_stall && pipeline_[3] != (size_t)-1) { // check MEM
-      auto &MEM_Inst = instructions_[pipeline_[3]];
-      should_stall = HasHazard(old_IF_Inst, MEM_Inst);
-      if (should_stall && enable_forwarding_) {
-        should_stall = !TryForwarding(old_IF_Inst, MEM_Inst);
-      }
-    }
-  }
+  IfIdLatch old_IF = pipeline_.if_id;
+  bool should_stall =
+      old_IF.valid &&
+      !AreOperandsReady<Policy::forwarding>(instructions_[old_IF.inst_idx]);
+  bool structural_stall = !should_stall && old_IF.valid &&
+                          !ReserveExecution(instructions_[old_IF.inst_idx]);
   bool reached_bp = false;
-  // no data hazard
-  if (!should_stall) {
-    if (pc_ >= instructions_.size()) {
-      pipeline_[0] = -1;
-    } else {
-      pipeline_[0] = pc_;
-    }
+  // no data or structural hazard
+  if (!should_stall && !structural_stall) {
+    pipeline_.if_id.valid = pc_ < instructions_.size();
+    pipeline_.if_id.inst_idx = pc_;
+    pipeline_.if_id.seq = fetched_instructions_;
+    pipeline_.if_id.predicted_taken = false;
+    fetched_instructions_ += pipeline_.if_id.valid;
     ++pc_;
+    if (branch_predictor_.has_value() && pipeline_.if_id.valid) {
+      const Instruction &IF_Inst = instructions_[pipeline_.if_id.inst_idx];
+      if (IsBrachInst(IF_Inst)) {
+        pipeline_.if_id.predicted_taken = branch_predictor_->Predict(
+            pipeline_.if_id.inst_idx, IF_Inst.rs_or_label_, pc_);
+      }
+    }
 
-    pipeline_[1] = old_IF;
-    size_t curr_ID = pipeline_[1];
-    if (curr_ID != (size_t)-1) {
-      auto &ID_Inst = instructions_[curr_ID];
+    IdExLatch &next_id_ex = pipeline_.id_ex;
+    next_id_ex.inst_idx = old_IF.inst_idx;
+    next_id_ex.seq = old_IF.seq;
+    next_id_ex.valid = old_IF.valid;
+    if (next_id_ex.valid) {
+      const Instruction &ID_Inst = instructions_[next_id_ex.inst_idx];
       if (ID_Inst.is_breakpoint_) {
         reached_bp = true;
-        std::cout << "!!! ID-Stage: Reached at breakpoint [" << curr_ID << '\t'
-                  << instruction_text_[curr_ID] << "] !!!\n";
+        if (verbose_) {
+          std::cout << "!!! ID-Stage: Reached at breakpoint ["
+                    << next_id_ex.inst_idx << '\t'
+                    << instruction_text_[next_id_ex.inst_idx] << "] !!!\n";
+        }
+      }
+      if constexpr (Policy::watching) {
+        watch_hit |= !conditional_bps_.empty() &&
+                     CheckConditionalBreakpoint(next_id_ex.inst_idx);
       }
       switch (ID_Inst.instruction_op_) {
         case InstructionOp::LOAD:
         case InstructionOp::STORE:
-          if (ID_Inst.in1 == LLONG_MAX) {
-            ID_Inst.in1 = register_[ID_Inst.rs_or_label_];
-          }
-          if (ID_Inst.in2 == LLONG_MAX) {
-            ID_Inst.in2 = register_[ID_Inst.rd_];
-          }
+          next_id_ex.in1 = ReadOperand<Policy>(ID_Inst.rs_or_label_, next_id_ex);
+          next_id_ex.in2 = ReadOperand<Policy>(ID_Inst.rd_, next_id_ex);
           break;
         case InstructionOp::ADD:
         case InstructionOp::SUB:
-          if (ID_Inst.in1 == LLONG_MAX) {
-            ID_Inst.in1 = register_[ID_Inst.rs_or_label_];
-          }
-          if (ID_Inst.in2 == LLONG_MAX) {
-            ID_Inst.in2 = register_[ID_Inst.rt_or_imm_];
-          }
-          
+        case InstructionOp::MUL:
+        case InstructionOp::DIV:
+          next_id_ex.in1 = ReadOperand<Policy>(ID_Inst.rs_or_label_, next_id_ex);
+          next_id_ex.in2 = ReadOperand<Policy>(ID_Inst.rt_or_imm_, next_id_ex);
           break;
         case InstructionOp::ADDI:
         case InstructionOp::SUBI:
-          if (ID_Inst.in1 == LLONG_MAX) {
-            ID_Inst.in1 = register_[ID_Inst.rs_or_label_];
-          }
-          if (ID_Inst.in2 == LLONG_MAX) {
-            ID_Inst.in2 = ID_Inst.rt_or_imm_;
-          }
+          next_id_ex.in1 = ReadOperand<Policy>(ID_Inst.rs_or_label_, next_id_ex);
+          next_id_ex.in2 = ID_Inst.rt_or_imm_;
           break;
         case InstructionOp::BEQZ:
-          if (ID_Inst.in2 == LLONG_MAX) {
-            ID_Inst.in2 = register_[ID_Inst.rd_];
-          }
-          if (ID_Inst.in2 == 0) {
-            pipeline_[0] = -1;
-            pc_ = ID_Inst.rs_or_label_;
+        case InstructionOp::BNEZ: {
+          next_id_ex.in2 = ReadOperand<Policy>(ID_Inst.rd_, next_id_ex);
+          bool taken = (ID_Inst.instruction_op_ == InstructionOp::BEQZ) ==
+                       (next_id_ex.in2 == 0);
+          if (taken != old_IF.predicted_taken) {
+            // the instruction fetched this cycle is on the wrong path
+            if (Policy::tracing && pipeline_.if_id.valid) {
+              trace_->Fetch(pipeline_.if_id.seq, pipeline_.if_id.inst_idx,
+                            cycle_clocks_);
+              trace_->Record({cycle_clocks_, pipeline_.if_id.seq,
+                              pipeline_.if_id.inst_idx, TraceEventKind::SQUASH,
+                              0});
+            }
+            pipeline_.if_id.valid = false;
+            pc_ = taken ? ID_Inst.rs_or_label_ : next_id_ex.inst_idx + 1;
             ++control_stalls_;
+            if constexpr (Policy::profiling) {
+              profile_.CountSquash(next_id_ex.inst_idx);
+            }
           }
-          break;
-        case InstructionOp::BNEZ:
-          if (ID_Inst.in2 == LLONG_MAX) {
-            ID_Inst.in2 = register_[ID_Inst.rd_];
+          if (branch_predictor_.has_value()) {
+            branch_predictor_->Update(next_id_ex.inst_idx, ID_Inst.rs_or_label_,
+                                      taken, old_IF.predicted_taken);
           }
-          if (ID_Inst.in2 != 0) {
-            pipeline_[0] = -1;
-            pc_ = ID_Inst.rs_or_label_;
-            ++control_stalls_;
-          }
-          break;
-        default:
           break;
+        }
+      }
+      // operands are read, now ID_Inst is the youngest writer of rd
+      if (WritesRegister(ID_Inst)) {
+        UnitKind kind;
+        scoreboard_[ID_Inst.rd_] = {
+            PipelineStage::ID,
+            ID_Inst.instruction_op_ == InstructionOp::LOAD,
+            UnitOf(ID_Inst, kind)};
       }
-      ID_Inst.ppl_stage = PipelineStage::ID;
     }
-  } else {
+  } else if (should_stall) {
     ++raw_stalls_;
-    pipeline_[1] = -1;
+    pipeline_.id_ex.valid = false;
+    if constexpr (Policy::profiling || Policy::tracing) {
+      CountRawStall<Policy>(old_IF);
+    }
+  } else {
+    ++structural_stalls_;
+    pipeline_.id_ex.valid = false;
+    if constexpr (Policy::profiling) {
+      profile_.CountStructuralStall(old_IF.inst_idx);
+    }
+    if constexpr (Policy::tracing) {
+      trace_->Record({cycle_clocks_, old_IF.seq, old_IF.inst_idx,
+                      TraceEventKind::STRUCTURAL_STALL, 0});
+    }
+  }
+  if constexpr (Policy::tracing) {
+    if (pipeline_.if_id.valid) {
+      trace_->Fetch(pipeline_.if_id.seq, pipeline_.if_id.inst_idx,
+                    cycle_clocks_);
+    }
+    trace_->EndCycle(cycle_clocks_);
   }
   ++cycle_clocks_;
-  if (IsFinished()) {
+  if (verbose_ && faulted_) {
+    std::cout << fault_message_ << '\n';
+  } else if (verbose_ && IsFinished()) {
     std::cout << "Instructions execution finished! " << cycle_clocks_
               << " cycle clocks executed!\n";
   }
-  return reached_bp;
+  return reached_bp || watch_hit;
 }
 void Simulator::RunToStop() {
   if (IsFinished()) {
@@ -322,4 +949,456 @@ void Simulator::RunToStop() {
       break;
     }
   }
-}
\ No newline at end of file
+}
+bool Simulator::RunSilently(size_t max_cycles) {
+  bool verbose = verbose_;
+  verbose_ = false;
+  watch_message_.clear();
+  bool reached_bp = (this->*run_silently_)(max_cycles);
+  verbose_ = verbose;
+  return reached_bp;
+}
+
+template <typename Policy>
+bool Simulator::RunSilentlyImpl(size_t max_cycles) {
+  for (size_t cycle = 0; cycle < max_cycles && !IsFinished(); ++cycle) {
+    if (SingleCycleImpl<Policy>()) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool Simulator::SingleCycleOutOfOrder() {
+  if (IsFinished()) {
+    std::cerr << (faulted_ ? fault_message_
+                           : "!!!All the instructions has been executed!!!")
+              << '\n';
+    return true;
+  }
+  TomasuloCore::MachineState state{
+      &instructions_,
+      register_.data(),
+      &memory_,
+      data_cache_.has_value() ? &*data_cache_ : nullptr,
+      branch_predictor_.has_value() ? &*branch_predictor_ : nullptr,
+      pc_};
+  ooo_->Cycle(state);
+  pc_ = state.pc;
+  retired_instructions_ += state.committed;
+  raw_stalls_ += state.raw_stall;
+  memory_stalls_ += state.memory_stall;
+  structural_stalls_ += state.structural_stall;
+  control_stalls_ += state.penalty_cycles;
+  if (state.faulted) {
+    RaiseMemoryFault(state.fault_inst_idx, state.fault_address);
+  }
+  if (state.reached_bp && verbose_) {
+    std::cout << "!!! Dispatch: Reached at breakpoint [" << state.bp_inst_idx
+              << '\t' << instruction_text_[state.bp_inst_idx] << "] !!!\n";
+  }
+  ++cycle_clocks_;
+  if (verbose_ && faulted_) {
+    std::cout << fault_message_ << '\n';
+  } else if (verbose_ && IsFinished()) {
+    std::cout << "Instructions execution finished! " << cycle_clocks_
+              << " cycle clocks executed!\n";
+  }
+  return state.reached_bp;
+}
+
+bool Simulator::RunSilentlyOutOfOrder(size_t max_cycles) {
+  for (size_t cycle = 0; cycle < max_cycles && !IsFinished(); ++cycle) {
+    if (SingleCycleOutOfOrder()) {
+      return true;
+    }
+  }
+  return false;
+}
+
+template <typename Policy>
+void Simulator::CountRawStall(const IfIdLatch &consumer) {
+  // the producer is the youngest writer of the blocking register
+  size_t reg =
+      BlockingRegister<Policy::forwarding>(instructions_[consumer.inst_idx]);
+  bool producer_in_mem = scoreboard_[reg].stage == PipelineStage::MEM;
+  if constexpr (Policy::profiling) {
+    size_t producer_idx = producer_in_mem ? pipeline_.mem_wb.inst_idx
+                                          : pipeline_.ex_mem.inst_idx;
+    if (!producer_in_mem && scoreboard_[reg].is_long) {
+      // a mul/div in its unit, the youngest writing reg
+      const UnitLatches &units = pipeline_.units;
+      for (size_t op = 0; op < units.size; ++op) {
+        if (instructions_[units.ops[op].inst_idx].rd_ == reg) {
+          producer_idx = units.ops[op].inst_idx;
+        }
+      }
+    }
+    profile_.CountRawStall(consumer.inst_idx, producer_idx, producer_in_mem);
+  }
+  if constexpr (Policy::tracing) {
+    trace_->Record({cycle_clocks_, consumer.seq, consumer.inst_idx,
+                    TraceEventKind::RAW_STALL, static_cast<uint8_t>(reg)});
+  }
+}
+
+template <size_t kIndex>
+using PolicyAt =
+    PipelinePolicy<(kIndex & 1) != 0, (kIndex & 2) != 0, (kIndex & 4) != 0,
+                   (kIndex & 8) != 0, (kIndex & 16) != 0>;
+
+template <size_t... kIndexes>
+constexpr std::array<Simulator::PipelineVariant, sizeof...(kIndexes)>
+Simulator::MakePipelineVariants(std::index_sequence<kIndexes...>) {
+  return {{{&Simulator::SingleCycleImpl<PolicyAt<kIndexes>>,
+            &Simulator::RunSilentlyImpl<PolicyAt<kIndexes>>}...}};
+}
+
+void Simulator::SelectPipeline() {
+  static constexpr auto kVariants =
+      MakePipelineVariants(std::make_index_sequence<32>());
+  size_t index =
+      (enable_forwarding_ ? 1 : 0) |
+      (statistics_level_ == StatisticsLevel::PER_INSTRUCTION ? 2 : 0) |
+      (trace_ != nullptr ? 4 : 0) | (record_history_ ? 8 : 0) |
+      (WatchesArmed() ? 16 : 0);
+  single_cycle_ = kVariants[index].single_cycle;
+  run_silently_ = kVariants[index].run_silently;
+  if (ooo_.has_value()) {
+    single_cycle_ = &Simulator::SingleCycleOutOfOrder;
+    run_silently_ = &Simulator::RunSilentlyOutOfOrder;
+  } else if (issue_config_.width > 1) {
+    SelectWidePipeline();
+  }
+}
+
+void Simulator::SettleUnits(uint64_t seq) {
+  UnitLatches &units = pipeline_.units;
+  for (size_t op = 0; op < units.size && units.ops[op].seq < seq; ++op) {
+    register_[instructions_[units.ops[op].inst_idx].rd_] = units.ops[op].res;
+    ++retired_instructions_;
+  }
+  units = UnitLatches{};
+}
+
+void Simulator::RaiseMemoryFault(size_t inst_idx, Register address) {
+  faulted_ = true;
+  fault_message_ = "!!! Memory fault: address " + std::to_string(address) +
+                   " is outside the address space, accessed by [" +
+                   std::to_string(inst_idx) + '\t' +
+                   std::string(instruction_text_[inst_idx]) + "] !!!";
+}
+
+void Simulator::FlushPipeline() {
+  if (ooo_.has_value()) {
+    // nothing in flight is architectural yet
+    pc_ = ooo_->Flush(pc_);
+    return;
+  }
+  if (issue_config_.width > 1) {
+    FlushWidePipeline();
+    return;
+  }
+  if (trace_ != nullptr && cycle_clocks_ != 0) {
+    // what was in flight leaves the trace here
+    trace_->Record({cycle_clocks_ - 1, 0, 0, TraceEventKind::END, 0});
+  }
+  // a pending cache miss is settled with the MEM occupant
+  memory_stall_cycles_left_ = 0;
+  // the settled instructions retire at once
+  if (pipeline_.mem_wb.valid) {
+    const Instruction &MEM_Inst = instructions_[pipeline_.mem_wb.inst_idx];
+    if (WritesRegister(MEM_Inst)) {
+      register_[MEM_Inst.rd_] = pipeline_.mem_wb.res;
+    }
+    ++retired_instructions_;
+  }
+  // the mul/div in the units are older than the EX occupant
+  SettleUnits(UINT64_MAX);
+  if (pipeline_.ex_mem.valid) {
+    const Instruction &EX_Inst = instructions_[pipeline_.ex_mem.inst_idx];
+    switch (EX_Inst.instruction_op_) {
+      case InstructionOp::LOAD:
+      case InstructionOp::STORE:
+        if (!PagedMemory::IsValidAddress(pipeline_.ex_mem.res)) {
+          // the access has not happened yet, refetch from the faulting lw/sw
+          // so the functional engine reports the fault at the same point
+          pc_ = pipeline_.ex_mem.inst_idx;
+          pipeline_ = PipelineLatches{};
+          scoreboard_.fill(ScoreboardEntry{});
+          return;
+        }
+        if (EX_Inst.instruction_op_ == InstructionOp::LOAD) {
+          register_[EX_Inst.rd_] = memory_.Read(pipeline_.ex_mem.res);
+        } else {
+          memory_.Write(pipeline_.ex_mem.res, pipeline_.ex_mem.store_data);
+        }
+        WarmDataCache(pipeline_.ex_mem.res, IsStoreInst(EX_Inst));
+        break;
+      case InstructionOp::BEQZ:
+      case InstructionOp::BNEZ:
+        break;
+      default:
+        register_[EX_Inst.rd_] = pipeline_.ex_mem.res;
+        break;
+    }
+    ++retired_instructions_;
+  }
+  // a branch in ID has already redirected pc_ and is simply executed again
+  if (pipeline_.id_ex.valid) {
+    pc_ = pipeline_.id_ex.inst_idx;
+  } else if (pipeline_.if_id.valid) {
+    pc_ = pipeline_.if_id.inst_idx;
+  }
+  pipeline_ = PipelineLatches{};
+  scoreboard_.fill(ScoreboardEntry{});
+}
+
+size_t Simulator::RunFunctional(size_t max_instructions) {
+  // memory writes are not logged here, the history restarts afterwards
+  ResetHistory();
+  FlushPipeline();
+  const size_t inst_num = instructions_.size();
+  size_t executed = 0;
+  if (translate_blocks_ && !faulted_) {
+    // whole blocks first, the interpreter finishes a partial one
+    BlockCache::MachineState state{
+        register_.data(),
+        &memory_,
+        data_cache_.has_value() ? &*data_cache_ : nullptr,
+        branch_predictor_.has_value() ? &*branch_predictor_ : nullptr,
+        0,
+        0};
+    bool faulted = false;
+    executed = block_cache_.Run(instructions_, state, pc_, max_instructions,
+                                faulted);
+    if (faulted) {
+      RaiseMemoryFault(pc_, state.fault_address);
+      functional_instructions_ += executed;
+      return executed;
+    }
+  }
+  while (executed < max_instructions && pc_ < inst_num && !faulted_) {
+    const Instruction &inst = instructions_[pc_++];
+    switch (inst.instruction_op_) {
+      case InstructionOp::LOAD:
+      case InstructionOp::STORE: {
+        Register address = register_[inst.rs_or_label_] + inst.rt_or_imm_;
+        if (!PagedMemory::IsValidAddress(address)) {
+          --pc_;
+          RaiseMemoryFault(pc_, address);
+          functional_instructions_ += executed;
+          return executed;
+        }
+        if (inst.instruction_op_ == InstructionOp::LOAD) {
+          register_[inst.rd_] = memory_.Read(address);
+        } else {
+          memory_.Write(address, register_[inst.rd_]);
+        }
+        WarmDataCache(address, IsStoreInst(inst));
+        break;
+      }
+      case InstructionOp::ADDI:
+        register_[inst.rd_] = register_[inst.rs_or_label_] + inst.rt_or_imm_;
+        break;
+      case InstructionOp::SUBI:
+        register_[inst.rd_] = register_[inst.rs_or_label_] - inst.rt_or_imm_;
+        break;
+      case InstructionOp::ADD:
+        register_[inst.rd_] =
+            register_[inst.rs_or_label_] + register_[inst.rt_or_imm_];
+        break;
+      case InstructionOp::SUB:
+        register_[inst.rd_] =
+            register_[inst.rs_or_label_] - register_[inst.rt_or_imm_];
+        break;
+      case InstructionOp::MUL:
+        register_[inst.rd_] =
+            Multiply(register_[inst.rs_or_label_], register_[inst.rt_or_imm_]);
+        break;
+      case InstructionOp::DIV:
+        register_[inst.rd_] =
+            Divide(register_[inst.rs_or_label_], register_[inst.rt_or_imm_]);
+        break;
+      case InstructionOp::BEQZ:
+      case InstructionOp::BNEZ: {
+        bool taken = (inst.instruction_op_ == InstructionOp::BEQZ) ==
+                     (register_[inst.rd_] == 0);
+        if (branch_predictor_.has_value()) {
+          branch_predictor_->Train(pc_ - 1, inst.rs_or_label_, taken);
+        }
+        if (taken) {
+          pc_ = inst.rs_or_label_;
+        }
+        break;
+      }
+    }
+    ++executed;
+  }
+  functional_instructions_ += executed;
+  return executed;
+}
+
+void Simulator::SetHistoryEnabled(bool enabled) {
+  record_history_ = enabled;
+  ResetHistory();
+  SelectPipeline();
+}
+
+void Simulator::SetStatisticsLevel(StatisticsLevel level) {
+  statistics_level_ = level;
+  SelectPipeline();
+}
+
+void Simulator::SetTrace(TraceWriter *trace) {
+  trace_ = trace;
+  SelectPipeline();
+}
+
+size_t Simulator::HistoryStartCycle() const {
+  return history_.Empty() ? cycle_clocks_ : history_.OldestCycle();
+}
+
+void Simulator::ResetHistory() {
+  history_.Reset();
+  profile_.StopJournal();
+  if (data_cache_.has_value()) {
+    data_cache_->StopJournal();
+  }
+  if (branch_predictor_.has_value()) {
+    branch_predictor_->StopJournal();
+  }
+}
+
+void Simulator::SetJournalEpoch(uint64_t epoch) {
+  profile_.SetJournalEpoch(epoch);
+  if (data_cache_.has_value()) {
+    data_cache_->SetJournalEpoch(epoch);
+  }
+  if (branch_predictor_.has_value()) {
+    branch_predictor_->SetJournalEpoch(epoch);
+  }
+}
+
+size_t Simulator::ForgetJournals(uint64_t epoch) {
+  profile_.ForgetJournal(epoch);
+  if (data_cache_.has_value()) {
+    data_cache_->ForgetJournal(epoch);
+  }
+  if (branch_predictor_.has_value()) {
+    branch_predictor_->ForgetJournal(epoch);
+  }
+  return JournalBytes();
+}
+
+size_t Simulator::JournalBytes() const {
+  return profile_.JournalBytes() +
+         (data_cache_.has_value() ? data_cache_->JournalBytes() : 0) +
+         (branch_predictor_.has_value() ? branch_predictor_->JournalBytes()
+                                        : 0);
+}
+
+void Simulator::TakeKeyframe() {
+  StateWriter writer;
+  SaveMachineState(writer);
+  if (data_cache_.has_value()) {
+    data_cache_->SaveKeyframe(writer);
+  }
+  if (branch_predictor_.has_value()) {
+    branch_predictor_->SaveKeyframe(writer);
+  }
+  // breakpoint hit counts are not machine state, but replaying from here
+  // must count from their values here
+  std::vector<uint64_t> bp_hits;
+  for (const auto &[inst_idx, bp] : conditional_bps_) {
+    bp_hits.push_back(inst_idx);
+    bp_hits.push_back(bp.hits);
+  }
+  writer.PutVector(bp_hits);
+  history_.AddKeyframe(cycle_clocks_, writer.TakeBuffer(), JournalBytes(),
+                       [this](uint64_t epoch) { return ForgetJournals(epoch); });
+  SetJournalEpoch(history_.Epoch());
+}
+
+void Simulator::RewindTo(size_t cycle, std::vector<size_t> *bp_cycles) {
+  size_t keyframe_idx = history_.FindKeyframe(cycle);
+  history_.RewindTo(keyframe_idx,
+                    [this](const ExecutionHistory::UndoRecord &record) {
+                      if ((record.address & ExecutionHistory::kNewPage) != 0) {
+                        memory_.DropPage(record.address &
+                                         ~ExecutionHistory::kNewPage);
+                      } else {
+                        memory_.Write(record.address, record.old_value);
+                      }
+                    });
+  const ExecutionHistory::Keyframe &keyframe =
+      history_.GetKeyframe(keyframe_idx);
+  StateReader reader(keyframe.state.data(), keyframe.state.size());
+  LoadMachineState(reader);
+  if (data_cache_.has_value()) {
+    data_cache_->LoadKeyframe(reader, keyframe.epoch);
+  }
+  if (branch_predictor_.has_value()) {
+    branch_predictor_->LoadKeyframe(reader, keyframe.epoch);
+  }
+  profile_.RollBack(keyframe.epoch);
+  SetJournalEpoch(history_.Epoch());
+  // breakpoints set after the keyframe start from no hits
+  std::vector<uint64_t> bp_hits;
+  reader.GetVector(bp_hits);
+  for (auto &entry : conditional_bps_) {
+    entry.second.hits = 0;
+  }
+  for (size_t i = 0; i + 1 < bp_hits.size(); i += 2) {
+    auto found = conditional_bps_.find(bp_hits[i]);
+    if (found != conditional_bps_.end()) {
+      found->second.hits = bp_hits[i + 1];
+    }
+  }
+  bool verbose = verbose_;
+  TraceWriter *trace = trace_;
+  verbose_ = false;
+  SetTrace(nullptr);
+  while (cycle_clocks_ < cycle) {
+    if (SingleCycle() && bp_cycles != nullptr) {
+      bp_cycles->push_back(cycle_clocks_);
+    }
+  }
+  verbose_ = verbose;
+  SetTrace(trace);
+}
+
+bool Simulator::SeekCycle(size_t cycle) {
+  if (cycle < HistoryStartCycle()) {
+    return false;
+  }
+  if (cycle < cycle_clocks_) {
+    RewindTo(cycle, nullptr);
+  }
+  bool verbose = verbose_;
+  verbose_ = false;
+  while (cycle_clocks_ < cycle && !IsFinished()) {
+    SingleCycle();
+  }
+  verbose_ = verbose;
+  return true;
+}
+
+bool Simulator::ReverseRun() {
+  size_t now = cycle_clocks_;
+  // replay one keyframe interval after another, newest first, until one
+  // holds a breakpoint before now
+  while (now > HistoryStartCycle()) {
+    size_t segment_start =
+        history_.GetKeyframe(history_.FindKeyframe(now - 1)).cycle;
+    std::vector<size_t> bp_cycles;
+    RewindTo(now - 1, &bp_cycles);
+    if (!bp_cycles.empty()) {
+      RewindTo(bp_cycles.back(), nullptr);
+      return true;
+    }
+    now = segment_start;
+  }
+  RewindTo(HistoryStartCycle(), nullptr);
+  return false;
+}
@@ -1,6 +1,25 @@
+#pragma once
+
+#include "block_cache.h"
+#include "branch_predictor.h"
+#include "cache.h"
+#include "functional_unit.h"
+#include "history.h"
+#include "instruction.h"
+#include "paged_memory.h"
+#include "profile.h"
+#include "scheduler.h"
+#include "superscalar.h"
+#include "tomasulo.h"
+#include "trace.h"
+#include "watch.h"
+
+#include <array>
 #include <climits>
 #include <cstddef>
+#include <cstdint>
 #include <iostream>
+#include <map>
 #include <set>
 #include <string>
 #include <vector>
@@ -10,29 +29,12 @@
 #include <ostream>
 #include <unordered_map>
 #include <limits>
+#include <cstdlib>
+#include <optional>
+#include <utility>
 
 using Register = long long;
 
-// lw   rd,rs,imm
-// sw   rd,rs,imm
-// addi rd,rs,imm
-// subi rd,rs,imm
-// add  rd,rs,rt
-// sub  rd,rs,rt
-// beqz rd,label
-// bnez rd,label
-
-enum class InstructionOp {
-  LOAD,  // lw
-  STORE, // sw
-  ADDI,  // addi
-  SUBI,  // subi
-  ADD,   // add
-  SUB,   // sub
-  BEQZ,  // beqz
-  BNEZ,  // bnez
-};
-
 enum class PipelineStage {
   IF = 0,
   ID = 1,
@@ -44,102 +46,600 @@ enum class PipelineStage {
 
 const std::vector<std::string> pipeline_name = {"IF", "ID", "EX", "MEM", "WB"};
 
-class Instruction {
-public:
-  InstructionOp instruction_op_;
-  size_t rd_;
-  size_t rs_or_label_;
-  int rt_or_imm_;
-  long long in1{LLONG_MAX};
-  long long in2{LLONG_MAX};
-  long long res{LLONG_MAX};
-  bool is_breakpoint_;
-  PipelineStage ppl_stage{PipelineStage::NONE};
-  Instruction() = delete;
-  inline Instruction(InstructionOp instruction_op, size_t rd, size_t rs,
-                     int rt_or_imm, bool is_breakpoint = false)
-      : instruction_op_(instruction_op), rd_(rd), rs_or_label_(rs),
-        rt_or_imm_(rt_or_imm), is_breakpoint_(is_breakpoint) {}
-  ~Instruction() = default;
+// Each latch holds the dynamic instruction that currently occupies the stage
+// in front of it, e.g. IdExLatch is the instruction shown in ID, which has
+// read its operands and will execute in EX next cycle.
+struct IfIdLatch {
+  uint32_t inst_idx;
+  uint64_t seq; // fetch order, identifies the instance in traces
+  bool valid;
+  bool predicted_taken; // fetch continued at the branch target
+};
+
+struct IdExLatch {
+  uint32_t inst_idx;
+  uint64_t seq;
+  bool valid;
+  Register in1;
+  Register in2;
+};
+
+struct ExMemLatch {
+  uint32_t inst_idx;
+  uint64_t seq;
+  bool valid;
+  Register res; // ALU result or memory address
+  Register store_data;
+};
+
+struct MemWbLatch {
+  uint32_t inst_idx;
+  uint64_t seq;
+  bool valid;
+  Register res;
+};
+
+// a mul/div in its functional unit, computed on entry and moved to MEM
+// once its latency has elapsed
+struct UnitOp {
+  uint32_t inst_idx;
+  uint64_t seq;
+  Register res;
+  uint32_t cycles_left; // EX cycles after the current one
+};
+
+// the long-latency side of EX, see functional_unit.h
+struct UnitLatches {
+  std::array<UnitOp, kUnitKinds * kMaxUnitLatency> ops; // oldest first
+  uint8_t size;
+  // cycles until each unit accepts another instruction
+  std::array<uint32_t, kUnitKinds> busy;
+  // bit k: an instruction enters MEM k cycles from now; MEM, and with it
+  // the register write port of WB, takes one instruction per cycle
+  uint64_t mem_slots;
+};
+
+struct PipelineLatches {
+  IfIdLatch if_id;
+  IdExLatch id_ex;
+  ExMemLatch ex_mem;
+  MemWbLatch mem_wb;
+  MemWbLatch wb; // already written back, kept to display the WB stage
+  UnitLatches units;
+};
+
+// N-wide counterpart of PipelineLatches, used when the issue width is
+// above one: every stage holds a group of instructions in program order,
+// and if_id is the fetch buffer ID issues from
+struct WideSlot {
+  uint32_t inst_idx;
+  uint64_t seq;
+  bool predicted_taken;
+  Register in1;
+  Register in2;
+  Register res;
+  Register store_data;
+};
+
+struct WideGroup {
+  std::array<WideSlot, kMaxIssueWidth> slots;
+  uint8_t size;
+};
+
+struct WideLatches {
+  WideGroup if_id;
+  WideGroup id_ex;
+  WideGroup ex_mem;
+  WideGroup mem_wb;
+  WideGroup wb;
+  // cycles the EX group still spends in the mul/div units
+  uint32_t ex_cycles_left;
+};
+
+// youngest in-flight writer of a register; advanced once per stage
+// transition so that ID decides stalls and forwarding by table lookups
+struct ScoreboardEntry {
+  PipelineStage stage{PipelineStage::NONE}; // NONE: register file is current
+  bool is_load{false};
+  bool is_long{false}; // mul/div: no result before MEM
+};
+
+// TOTALS: only the global counters; PER_INSTRUCTION: also the hotspot
+// profile (see profile.h)
+enum class StatisticsLevel { TOTALS, PER_INSTRUCTION };
+
+// Compile-time configuration of the pipeline. Each combination is a separate
+// instantiation of SingleCycle (or SingleCycleWide, which ignores tracing and
+// watching), and the simulator runs the one matching its run-time settings,
+// chosen again whenever they change, so a feature that is off costs nothing
+// per cycle.
+template <bool kForwarding, bool kProfiling, bool kTracing, bool kHistory,
+          bool kWatching>
+struct PipelinePolicy {
+  static constexpr bool forwarding = kForwarding;
+  static constexpr bool profiling = kProfiling; // PER_INSTRUCTION statistics
+  static constexpr bool tracing = kTracing;
+  static constexpr bool history = kHistory;
+  // watchpoints or conditional breakpoints are set, see watch.h
+  static constexpr bool watching = kWatching;
+};
+
+// counters of one run, for tools that compare runs (see sweep.cc)
+struct SimulatorStatistics {
+  size_t cycle_clocks;
+  size_t retired_instructions; // by the pipeline, not the functional engine
+  size_t functional_instructions;
+  size_t raw_stalls;
+  size_t control_stalls;
+  size_t structural_stalls;
+  size_t memory_stalls;
+  CacheStats l1;
+  CacheStats l2;
+  BranchPredictorStats branches;
+  bool faulted;
 };
 
 class Simulator {
 private:
-  std::vector<long> memory_;
+  PagedMemory memory_;
   std::vector<Register> register_;
   std::vector<Instruction> instructions_;
-  std::vector<std::string> instruction_text_;
-  std::vector<size_t> pipeline_;
+  InstructionText instruction_text_;
+  PipelineLatches pipeline_{};
+  std::array<ScoreboardEntry, 32> scoreboard_{};
   size_t pc_{0};
   size_t cycle_clocks_{0};
   size_t raw_stalls_{0};
   size_t control_stalls_{0};
+  // ID waited for a busy mul/div unit or for its cycle to enter MEM
+  size_t structural_stalls_{0};
+  FunctionalUnitsConfig unit_config_;
+  size_t retired_instructions_{0};
+  size_t functional_instructions_{0};
+  size_t fetched_instructions_{0}; // sequence number of the next fetch
+  // no cache: every lw/sw completes in its MEM cycle
+  std::optional<DataCache> data_cache_;
+  // cycles the MEM occupant still waits for a cache miss; the pipeline is
+  // frozen meanwhile
+  size_t memory_stall_cycles_left_{0};
+  size_t memory_stalls_{0};
+  // no predictor: branches are predicted not taken without statistics
+  std::optional<BranchPredictor> branch_predictor_;
   bool enable_forwarding_{false};
+  bool verbose_{true};
+  // set by a lw/sw outside the address space, stops the simulation
+  bool faulted_{false};
+  std::string fault_message_;
+  // where the stall cycles went, per static instruction
+  InstructionProfile profile_;
+  StatisticsLevel statistics_level_{StatisticsLevel::PER_INSTRUCTION};
+  // not owned, nullptr: no tracing
+  TraceWriter *trace_{nullptr};
+  // keyframes and memory undo log for reverse stepping
+  ExecutionHistory history_;
+  bool record_history_{true};
+  // translated basic blocks of the functional engine
+  BlockCache block_cache_;
+  bool translate_blocks_{true};
+  // width 1 runs pipeline_, wider ones wide_
+  IssueConfig issue_config_;
+  WideLatches wide_{};
+  IssueStats issue_stats_;
+  // set: the out-of-order core replaces both in-order pipelines
+  std::optional<TomasuloCore> ooo_;
+  // set when the program was scheduled before it was loaded
+  std::optional<ScheduleReport> schedule_report_;
+  // conditional and hit-count breakpoints by instruction index, with the
+  // times each was reached with its condition holding
+  struct ConditionalBreakpoint {
+    BreakpointSpec spec;
+    uint64_t hits;
+  };
+  std::map<size_t, ConditionalBreakpoint> conditional_bps_;
+  std::vector<Watch> watches_;
+  uint32_t watched_registers_{0}; // bit r set: some watch is on rN
+  // what stopped the last cycle at a watchpoint or conditional breakpoint
+  std::string watch_message_;
+  // the PipelinePolicy instantiation matching the settings above
+  struct PipelineVariant {
+    bool (Simulator::*single_cycle)();
+    bool (Simulator::*run_silently)(size_t);
+  };
+  bool (Simulator::*single_cycle_)(){nullptr};
+  bool (Simulator::*run_silently_)(size_t){nullptr};
 
 public:
   Simulator();
-  Simulator(std::vector<long> init_memory,
-            std::vector<Instruction> instructions,
-            std::vector<std::string> instruction_text,
-            bool enable_forwarding = false);
+  Simulator(Program program, bool enable_forwarding = false);
   ~Simulator() = default;
 
   bool IsFinished() const;
   void PrintInstructions() const;
+  // hotspot table of the instructions that lost the most cycles
+  void PrintProfile() const;
   void PrintPipelines() const;
   void PrintRegisters() const;
   void PrintBreakpoints() const;
+  void PrintWatches() const;
   void PrintMemory() const;
   void PrintStatistics() const;
 
+  size_t GetInstructionCount() const { return instructions_.size(); }
+  const std::vector<Instruction> &GetInstructions() const {
+    return instructions_;
+  }
+  // next instruction to fetch, or to execute functionally
+  size_t GetPc() const { return pc_; }
+  size_t GetCycleClocks() const { return cycle_clocks_; }
+  bool HasFaulted() const { return faulted_; }
+  const std::string &GetFaultMessage() const { return fault_message_; }
+  SimulatorStatistics GetStatistics() const;
+  const PagedMemory &GetMemory() const { return memory_; }
+  PagedMemory &MutableMemory() { return memory_; }
+  // identifies the program for checkpoints, breakpoints do not count
+  uint64_t ProgramFingerprint() const;
+  // machine state except memory_ and the program, see checkpoint.h;
+  // LoadState returns false on malformed state and may leave it half
+  // loaded, and forgets the execution history
+  void SaveState(StateWriter &writer) const;
+  bool LoadState(StateReader &reader);
+  // verbose == false silences the per-event messages of SingleCycle and
+  // SetBreakpoint, e.g. for batch runs
+  void SetVerbose(bool verbose) { verbose_ = verbose; }
+  // model an L1 data cache (and an L2 behind it) in MEM; call before running
+  void SetDataCache(const CacheConfig &l1,
+                    const std::optional<CacheConfig> &l2 = std::nullopt) {
+    data_cache_.emplace(l1, l2);
+    ResetHistory();
+  }
+  // Record the pipeline into trace from now on, nullptr stops; the caller
+  // keeps it open while the simulator runs. Replaying history is not
+  // traced, so a trace of a run that steps backward is not linear.
+  void SetTrace(TraceWriter *trace);
+  // PER_INSTRUCTION by default; TOTALS leaves the profile empty and runs
+  // faster
+  void SetStatisticsLevel(StatisticsLevel level);
+  // predict branches at fetch instead of always falling through
+  void SetBranchPredictor(const BranchPredictorConfig &config) {
+    branch_predictor_.emplace(config);
+    ResetHistory();
+  }
+
+  // issue up to config.width instructions per cycle in order (see
+  // superscalar.cc); call before running. Wide pipelines are not traced.
+  void SetIssueConfig(const IssueConfig &config) {
+    issue_config_ = config;
+    SelectPipeline();
+  }
+  const IssueConfig &GetIssueConfig() const { return issue_config_; }
+  // Run on the out-of-order core of tomasulo.h instead of the in-order
+  // pipeline; call before running. RAW, control, memory and structural
+  // stalls then count the cycles nothing committed because of an operand, a
+  // wrong-path fetch, a cache miss or a busy mul/div unit. The core is not
+  // traced, profiled, checkpointed or recorded for stepping backward, so
+  // this also stops the history.
+  void SetOutOfOrder(const TomasuloConfig &config) {
+    ooo_.emplace(config, unit_config_);
+    SetHistoryEnabled(false);
+  }
+  bool IsOutOfOrder() const { return ooo_.has_value(); }
+
+  // latency and issue interval of the mul and div units; call before
+  // running and before SetOutOfOrder
+  void SetFunctionalUnits(const FunctionalUnitsConfig &config) {
+    unit_config_ = config;
+  }
+
+  // set a register before the run starts, e.g. to give each core of a
+  // MultiCore its index
+  void SetRegister(size_t reg, Register value) { register_[reg] = value; }
+  // another core wrote address (see multicore.h): drop its line from the
+  // data cache; return false if there is no cache or it held no such line
+  bool InvalidateDataCache(uint64_t address) {
+    return data_cache_.has_value() && data_cache_->Invalidate(address);
+  }
+
   void SetBreakpoint(size_t instruction_index);
+  // A breakpoint with a condition or a hit count replaces any other on the
+  // instruction; a plain spec turns it back into a plain one. Like
+  // watchpoints, conditions and hit counts are only checked by the
+  // single-issue in-order pipeline.
+  void SetBreakpoint(const BreakpointSpec &spec);
+  // Stop after a cycle that changed a watched register or memory word. The
+  // pipeline checks watches and conditional breakpoints in a separate
+  // instantiation, run only while any is set.
+  void AddWatch(const Watch &watch);
+  // index as listed by PrintWatches; return false if there is no such watch
+  bool DeleteWatch(size_t index);
+  // any watchpoint or conditional breakpoint is set, which RunFunctional
+  // would not check
+  bool WatchesArmed() const {
+    return !watches_.empty() || !conditional_bps_.empty();
+  }
+  // why the last cycle stopped at a watchpoint or conditional breakpoint,
+  // empty if it did not
+  const std::string &GetWatchMessage() const { return watch_message_; }
   bool SingleCycle();
   void RunToStop();
+  // run without printing anything until the end, a breakpoint or max_cycles
+  // cycles have been simulated; return true if stopped at a breakpoint
+  bool RunSilently(size_t max_cycles = std::numeric_limits<size_t>::max());
+  // Functional engine: execute up to max_instructions at ISA level, updating
+  // register_ and memory_ directly without modelling the pipeline and
+  // without stopping at breakpoints. In-flight instructions are settled
+  // first (see FlushPipeline), so SingleCycle() can continue afterwards from
+  // the identical architectural state. Return the number executed.
+  size_t RunFunctional(
+      size_t max_instructions = std::numeric_limits<size_t>::max());
+  // RunFunctional executes translated basic blocks by default (see
+  // block_cache.h); false interprets one instruction at a time
+  void SetBlockTranslation(bool enabled) { translate_blocks_ = enabled; }
+  // the program went through ScheduleProgram; PrintStatistics reports the
+  // predicted and, given a run of the unscheduled program, the measured
+  // savings
+  void SetScheduleReport(const ScheduleReport &report) {
+    schedule_report_ = report;
+  }
+
+  // Time travel over the cycles simulated since the history started: the
+  // first cycle, the last fast-forward or restore, or the oldest keyframe
+  // still kept. Recording is on by default; switching it off drops the
+  // history.
+  void SetHistoryEnabled(bool enabled);
+  // earliest cycle that can be reached backward
+  size_t HistoryStartCycle() const;
+  // Move to the state after cycle cycles: backward through the history,
+  // forward by simulating without stopping at breakpoints. Return false if
+  // cycle is before the history start.
+  bool SeekCycle(size_t cycle);
+  // Go back to the most recent cycle that reached a breakpoint or
+  // watchpoint, or to the history start if there is none; return true if
+  // one was found.
+  bool ReverseRun();
 
   static inline void PrintUsage() {
     std::cout << "Usage: \n"
-              << "v [i | p | r | b | m | s]: "
+              << "v [i | p | r | b | w | m | s | h]: "
                  "display instructions | pipelines | registers | breakpoints | "
-                 "memory | statistics\n"
-              << "b [instruction index] : set breakpoint at instruction of the "
-                 "index\n"
+                 "watchpoints | memory | statistics | hotspots\n"
+              << "b [index[:condition[:hit count]]] : set breakpoint at "
+                 "instruction of the index, e.g. b 12:r3==0:2\n"
+              << "w [rN | address | first-last] : stop when the register or "
+                 "memory words change\n"
+              << "d [watch index] : delete a watchpoint\n"
               << "s : single cycles\n"
               << "r : run to the end or breakpoint\n"
+              << "f [instruction count] : fast-forward functionally, then "
+                 "continue pipelined\n"
+              << "c [file] : write a checkpoint of the current state\n"
+              << "u : step one cycle back\n"
+              << "R : run back to the previous breakpoint\n"
+              << "j [cycle] : jump to the state after that many cycles\n"
               << "q : quit the simulator\n";
   }
 
-  static inline bool HasHazard(Instruction &new_inst, Instruction &old_inst) {
-    switch (new_inst.instruction_op_) {
+  static inline bool IsBrachInst(const Instruction &inst) {
+    return inst.instruction_op_ == InstructionOp::BEQZ or
+           inst.instruction_op_ == InstructionOp::BNEZ;
+  }
+  static inline bool IsStoreInst(const Instruction &inst) {
+    return inst.instruction_op_ == InstructionOp::STORE;
+  }
+  static inline bool IsMemoryInst(const Instruction &inst) {
+    return inst.instruction_op_ == InstructionOp::LOAD ||
+           inst.instruction_op_ == InstructionOp::STORE;
+  }
+  static inline bool WritesRegister(const Instruction &inst) {
+    return !IsBrachInst(inst) && !IsStoreInst(inst);
+  }
+
+private:
+  // stop the simulation because inst_idx accessed address outside the
+  // address space
+  void RaiseMemoryFault(size_t inst_idx, Register address);
+  // write back the mul/div in the units older than seq, dropping the rest
+  void SettleUnits(uint64_t seq);
+
+  // watching pipeline only: whether writing value to reg or address hits a
+  // watch, and whether the conditional breakpoint of the instruction in ID
+  // stops it; each reports a hit into watch_message_
+  bool CheckRegisterWatch(size_t reg, Register value);
+  bool CheckMemoryWatches(uint64_t address, Register value);
+  bool CheckConditionalBreakpoint(size_t inst_idx);
+  void ReportWatch(const char *stage, const std::string &message);
+  // value of reg in program order before the instruction now in ID, from
+  // its youngest older writer still in flight
+  Register ProgramOrderValue(size_t reg) const;
+
+  // Whether inst can leave ID this cycle without a structural hazard: its
+  // unit accepts a new instruction, and nothing else enters MEM in the
+  // cycle it will. If so claim both.
+  inline bool ReserveExecution(const Instruction &inst) {
+    UnitLatches &units = pipeline_.units;
+    UnitKind kind;
+    const bool is_long = UnitOf(inst, kind);
+    const uint32_t latency = is_long ? unit_config_[kind].latency : 1;
+    const uint64_t slot = uint64_t{1} << (latency + 1);
+    if ((units.mem_slots & slot) != 0 ||
+        (is_long && units.busy[static_cast<size_t>(kind)] != 0)) {
+      return false;
+    }
+    units.mem_slots |= slot;
+    if (is_long) {
+      units.busy[static_cast<size_t>(kind)] = unit_config_[kind].interval;
+    }
+    return true;
+  }
+
+  // charge the data cache for a lw/sw entering MEM
+  inline void AccessDataCache(Register address, bool is_write) {
+    if (data_cache_.has_value()) {
+      memory_stall_cycles_left_ = data_cache_->Access(address, is_write);
+    }
+  }
+  // lw/sw executed outside the pipeline only warm the data cache
+  inline void WarmDataCache(Register address, bool is_write) {
+    if (data_cache_.has_value()) {
+      data_cache_->Warm(address, is_write);
+    }
+  }
+
+  // pick single_cycle_ and run_silently_ for the current settings
+  void SelectPipeline();
+  // the same for issue_config_.width > 1, in superscalar.cc
+  void SelectWidePipeline();
+  template <size_t... kIndexes>
+  static constexpr std::array<PipelineVariant, sizeof...(kIndexes)>
+      MakePipelineVariants(std::index_sequence<kIndexes...>);
+  template <size_t... kIndexes>
+  static constexpr std::array<PipelineVariant, sizeof...(kIndexes)>
+      MakeWideVariants(std::index_sequence<kIndexes...>);
+  template <typename Policy> bool SingleCycleImpl();
+  template <typename Policy> bool RunSilentlyImpl(size_t max_cycles);
+  // the wide pipeline has no tracing or watching yet, see superscalar.h
+  template <typename Policy> bool SingleCycleWide();
+  template <typename Policy> bool RunSilentlyWide(size_t max_cycles);
+  bool SingleCycleOutOfOrder();
+  bool RunSilentlyOutOfOrder(size_t max_cycles);
+  // Find the youngest writer of reg in the EX and MEM groups, producer
+  // nullptr and in_mem false if there is none. Return false if ID cannot
+  // take the value this cycle, else set value.
+  template <bool kForwarding>
+  bool ReadWideOperand(size_t reg, bool in_id, Register &value,
+                       const WideSlot *&producer, bool &in_mem) const;
+  void FlushWidePipeline();
+  void PrintWidePipelines() const;
+  void PrintIssueStatistics() const;
+  // attribute a RAW stall of consumer to the producer it waits for
+  template <typename Policy> void CountRawStall(const IfIdLatch &consumer);
+
+  // forget the history and stop the table journals
+  void ResetHistory();
+  // the journals of the cache and predictor tables, see TableJournal, and
+  // the count log of the profile
+  void SetJournalEpoch(uint64_t epoch);
+  // drop the entries before epoch, return the bytes still journaled
+  size_t ForgetJournals(uint64_t epoch);
+  size_t JournalBytes() const;
+  void TakeKeyframe();
+  // go back to the keyframe at or before cycle and replay up to cycle;
+  // bp_cycles, if given, collects the replayed cycles that reached a
+  // breakpoint
+  void RewindTo(size_t cycle, std::vector<size_t> *bp_cycles);
+  // the part of the state keyframes share with checkpoints: everything
+  // but memory, caches, predictor and profile
+  void SaveMachineState(StateWriter &writer) const;
+  bool LoadMachineState(StateReader &reader);
+
+  // retire the EX and MEM occupants at once and squash IF and ID, refetching
+  // from the oldest squashed instruction; leaves the pipeline empty
+  void FlushPipeline();
+
+  // whether ID may take the value of reg this cycle, either from the
+  // register file or forwarded; in_id marks the store data and the branch
+  // condition, which are consumed in ID rather than at the start of EX
+  template <bool kForwarding>
+  inline bool IsOperandReady(size_t reg, bool in_id) const {
+    const ScoreboardEntry &entry = scoreboard_[reg];
+    switch (entry.stage) {
+    case PipelineStage::EX:
+      return kForwarding && !entry.is_load && !entry.is_long && !in_id;
+    case PipelineStage::MEM:
+      return kForwarding && !(entry.is_load && in_id);
+    default:
+      return true;
+    }
+  }
+
+  // first operand register of inst that ID cannot take yet, kNoRegister if
+  // there is none
+  static constexpr size_t kNoRegister = 32;
+  template <bool kForwarding>
+  inline size_t BlockingRegister(const Instruction &inst) const {
+    switch (inst.instruction_op_) {
     case InstructionOp::LOAD:
     case InstructionOp::ADDI:
     case InstructionOp::SUBI:
-      return !IsBrachInst(old_inst) && !IsStoreInst(old_inst) &&
-             (new_inst.rs_or_label_ == old_inst.rd_);
+      if (!IsOperandReady<kForwarding>(inst.rs_or_label_, false)) {
+        return inst.rs_or_label_;
+      }
       break;
     case InstructionOp::ADD:
     case InstructionOp::SUB:
-      return !IsBrachInst(old_inst) && !IsStoreInst(old_inst) &&
-             ((new_inst.rs_or_label_ == old_inst.rd_) ||
-              ((size_t)new_inst.rt_or_imm_ == old_inst.rd_));
+    case InstructionOp::MUL:
+    case InstructionOp::DIV:
+      if (!IsOperandReady<kForwarding>(inst.rs_or_label_, false)) {
+        return inst.rs_or_label_;
+      }
+      if (!IsOperandReady<kForwarding>(inst.rt_or_imm_, false)) {
+        return inst.rt_or_imm_;
+      }
       break;
     case InstructionOp::STORE:
+      if (!IsOperandReady<kForwarding>(inst.rs_or_label_, false)) {
+        return inst.rs_or_label_;
+      }
+      if (!IsOperandReady<kForwarding>(inst.rd_, true)) {
+        return inst.rd_;
+      }
+      break;
     case InstructionOp::BEQZ:
     case InstructionOp::BNEZ:
-      return !IsBrachInst(old_inst) && !IsStoreInst(old_inst) &&
-             (new_inst.rd_ == old_inst.rd_);
+      if (!IsOperandReady<kForwarding>(inst.rd_, true)) {
+        return inst.rd_;
+      }
       break;
     }
+    // WAW: a mul/div still in its unit would write rd after inst
+    if (WritesRegister(inst) && scoreboard_[inst.rd_].is_long &&
+        scoreboard_[inst.rd_].stage == PipelineStage::EX) {
+      return inst.rd_;
+    }
+    return kNoRegister;
   }
 
   // return bool: true -> not stall; false -> stall
-  bool TryForwarding(Instruction &new_inst, Instruction &old_inst,
-                     bool enable_forwarding = true);
+  template <bool kForwarding>
+  inline bool AreOperandsReady(const Instruction &inst) const {
+    return BlockingRegister<kForwarding>(inst) == kNoRegister;
+  }
 
-  static inline bool IsBrachInst(Instruction &inst) {
-    return inst.instruction_op_ == InstructionOp::BEQZ or
-           inst.instruction_op_ == InstructionOp::BNEZ;
+  // value of reg as seen in ID by consumer, valid once
+  // IsOperandReady(reg, ...) holds
+  template <typename Policy>
+  inline Register ReadOperand(size_t reg, const IdExLatch &consumer) {
+    switch (scoreboard_[reg].stage) {
+    case PipelineStage::EX:
+      CountForward<Policy>(reg, consumer, false);
+      return pipeline_.ex_mem.res;
+    case PipelineStage::MEM:
+      CountForward<Policy>(reg, consumer, true);
+      return pipeline_.mem_wb.res;
+    default:
+      return register_[reg];
+    }
   }
-  static inline bool IsStoreInst(Instruction &inst) {
-    return inst.instruction_op_ == InstructionOp::STORE;
+
+  template <typename Policy>
+  inline void CountForward(size_t reg, const IdExLatch &consumer,
+                           bool from_mem) {
+    if constexpr (Policy::profiling) {
+      profile_.CountForward(consumer.inst_idx);
+    }
+    if constexpr (Policy::tracing) {
+      trace_->Record({cycle_clocks_, consumer.seq, consumer.inst_idx,
+                      TraceEventKind::FORWARD,
+                      static_cast<uint8_t>(reg | (from_mem ? kForwardFromMem
+                                                           : 0))});
+    }
+  }
+
+  // advance the scoreboard entry of inst's destination when inst moves from
+  // stage from to stage to
+  inline void AdvanceScoreboard(const Instruction &inst, PipelineStage from,
+                                PipelineStage to) {
+    if (WritesRegister(inst) && scoreboard_[inst.rd_].stage == from) {
+      scoreboard_[inst.rd_].stage = to;
+    }
   }
 };
\ No newline at end of file
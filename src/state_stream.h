@@ -0,0 +1,105 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Flat binary encoding of simulator state for checkpoints. Values are
+// stored as their in-memory bytes, so a checkpoint is only read back by a
+// build of the same layout; the checkpoint header carries a version.
+class StateWriter {
+public:
+  template <typename T> void Put(const T &value) {
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "only trivially copyable state is written as bytes");
+    PutBytes(&value, sizeof(T));
+  }
+  template <typename T> void PutVector(const std::vector<T> &values) {
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "only trivially copyable state is written as bytes");
+    Put<uint64_t>(values.size());
+    PutBytes(values.data(), values.size() * sizeof(T));
+  }
+  // one byte, 0 or 1
+  void PutBool(bool value) { Put<uint8_t>(value); }
+  void PutString(const std::string &text) {
+    Put<uint64_t>(text.size());
+    PutBytes(text.data(), text.size());
+  }
+  void PutBytes(const void *data, size_t size) {
+    buffer_.append(static_cast<const char *>(data), size);
+  }
+
+  const std::string &Buffer() const { return buffer_; }
+  // hand the bytes over, leaving the writer empty
+  std::string TakeBuffer() { return std::move(buffer_); }
+
+private:
+  std::string buffer_;
+};
+
+// bounds-checked counterpart of StateWriter; every Get returns false once
+// the data runs out
+class StateReader {
+public:
+  StateReader(const char *data, size_t size) : data_(data), size_(size) {}
+
+  template <typename T> bool Get(T &value) {
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "only trivially copyable state is read as bytes");
+    return GetBytes(&value, sizeof(T));
+  }
+  template <typename T> bool GetVector(std::vector<T> &values) {
+    uint64_t count;
+    if (!Get(count) || count > (size_ - offset_) / sizeof(T)) {
+      return false;
+    }
+    values.resize(count);
+    return GetBytes(values.data(), count * sizeof(T));
+  }
+  // false as well on a byte other than 0 or 1, which is no valid bool
+  bool GetBool(bool &value) {
+    uint8_t byte;
+    if (!Get(byte) || byte > 1) {
+      return false;
+    }
+    value = byte != 0;
+    return true;
+  }
+  bool GetString(std::string &text) {
+    uint64_t size;
+    if (!Get(size) || size > size_ - offset_) {
+      return false;
+    }
+    text.assign(data_ + offset_, size);
+    offset_ += size;
+    return true;
+  }
+  bool GetBytes(void *data, size_t size) {
+    if (size > size_ - offset_) {
+      return false;
+    }
+    std::memcpy(data, data_ + offset_, size);
+    offset_ += size;
+    return true;
+  }
+  // pointer to the next size bytes without copying, nullptr if too short
+  const char *Take(size_t size) {
+    if (size > size_ - offset_) {
+      return nullptr;
+    }
+    const char *bytes = data_ + offset_;
+    offset_ += size;
+    return bytes;
+  }
+  bool AtEnd() const { return offset_ == size_; }
+
+private:
+  const char *data_;
+  size_t size_;
+  size_t offset_{0};
+};
@@ -0,0 +1,535 @@
+// N-wide in-order issue. The stages are the same as in SingleCycleImpl,
+// each holding a group of instructions: IF fills a fetch buffer of width
+// entries, and ID issues the longest prefix of the buffer whose operands
+// are ready, that reads nothing written by an older instruction of the
+// same group and stays within the per-class limits. Operands are forwarded
+// from the EX and MEM groups under the same rules as the single-issue
+// pipeline, and a mispredicted branch squashes the whole fetch buffer. The
+// lw/sw of a group access the cache one after another, so their miss
+// latencies add up, and likewise a group with mul/div stays in EX until
+// the last of them is done, the ones on the same unit an issue interval
+// apart, holding ID and IF behind it.
+
+#include "simulator.h"
+
+#include <algorithm>
+#include <charconv>
+#include <iomanip>
+#include <vector>
+
+bool ParseIssueConfig(std::string_view spec, IssueConfig &config,
+                      std::string &error) {
+  std::vector<std::string_view> fields;
+  for (size_t begin = 0;;) {
+    size_t end = spec.find(':', begin);
+    fields.push_back(spec.substr(begin, end - begin));
+    if (end == std::string_view::npos) {
+      break;
+    }
+    begin = end + 1;
+  }
+  if (fields.size() > 3) {
+    error = "expected width[:memory ops[:alu ops]]";
+    return false;
+  }
+  auto parse_number = [&](std::string_view field, size_t &value) {
+    auto [end, ec] =
+        std::from_chars(field.data(), field.data() + field.size(), value);
+    return ec == std::errc() && end == field.data() + field.size();
+  };
+  IssueConfig parsed;
+  if (!parse_number(fields[0], parsed.width) || parsed.width == 0 ||
+      parsed.width > kMaxIssueWidth) {
+    error = "width must be 1 to " + std::to_string(kMaxIssueWidth);
+    return false;
+  }
+  parsed.alu_ops = parsed.width;
+  if ((fields.size() >= 2 && !parse_number(fields[1], parsed.memory_ops)) ||
+      (fields.size() == 3 && !parse_number(fields[2], parsed.alu_ops)) ||
+      parsed.memory_ops == 0 || parsed.alu_ops == 0) {
+    error = "the limits must be positive numbers";
+    return false;
+  }
+  config = parsed;
+  return true;
+}
+
+template <bool kForwarding>
+bool Simulator::ReadWideOperand(size_t reg, bool in_id, Register &value,
+                                const WideSlot *&producer,
+                                bool &in_mem) const {
+  producer = nullptr;
+  in_mem = false;
+  for (const WideGroup *group : {&wide_.ex_mem, &wide_.mem_wb}) {
+    for (size_t slot = group->size; slot-- > 0;) {
+      const Instruction &inst = instructions_[group->slots[slot].inst_idx];
+      if (WritesRegister(inst) && inst.rd_ == reg) {
+        producer = &group->slots[slot];
+        break;
+      }
+    }
+    if (producer != nullptr) {
+      break;
+    }
+    in_mem = true;
+  }
+  if (producer == nullptr) {
+    in_mem = false;
+    value = register_[reg];
+    return true;
+  }
+  bool is_load = instructions_[producer->inst_idx].instruction_op_ ==
+                 InstructionOp::LOAD;
+  // same rules as IsOperandReady
+  bool ready = kForwarding && (in_mem ? !(is_load && in_id)
+                                      : !is_load && !in_id);
+  if (ready) {
+    value = producer->res;
+  }
+  return ready;
+}
+
+template <typename Policy> bool Simulator::SingleCycleWide() {
+  if (IsFinished()) {
+    std::cerr << (faulted_ ? fault_message_
+                           : "!!!All the instructions has been executed!!!")
+              << '\n';
+    return true;
+  }
+  if (Policy::history && history_.KeyframeDue(cycle_clocks_)) {
+    TakeKeyframe();
+  }
+  // a cache miss holds the MEM group: nothing moves, WB idles
+  if (memory_stall_cycles_left_ != 0) {
+    --memory_stall_cycles_left_;
+    ++memory_stalls_;
+    if constexpr (Policy::profiling) {
+      for (size_t slot = 0; slot < wide_.mem_wb.size; ++slot) {
+        if (IsMemoryInst(instructions_[wide_.mem_wb.slots[slot].inst_idx])) {
+          profile_.CountMemoryStall(wide_.mem_wb.slots[slot].inst_idx);
+          break;
+        }
+      }
+    }
+    wide_.wb.size = 0;
+    ++cycle_clocks_;
+    return false;
+  }
+  // update WB
+  wide_.wb = wide_.mem_wb;
+  for (size_t slot = 0; slot < wide_.wb.size; ++slot) {
+    const WideSlot &wb = wide_.wb.slots[slot];
+    const Instruction &WB_Inst = instructions_[wb.inst_idx];
+    if (WritesRegister(WB_Inst)) {
+      register_[WB_Inst.rd_] = wb.res;
+    }
+    if constexpr (Policy::profiling) {
+      profile_.CountExecution(wb.inst_idx);
+    }
+  }
+  retired_instructions_ += wide_.wb.size;
+  if (wide_.ex_cycles_left != 0) {
+    // the EX group is still in the mul/div units: MEM idles, EX, ID and IF
+    // hold
+    --wide_.ex_cycles_left;
+    wide_.mem_wb.size = 0;
+    ++structural_stalls_;
+    ++issue_stats_.groups[0];
+    ++issue_stats_.limits[static_cast<size_t>(IssueLimit::UNIT)];
+    if (Policy::profiling && wide_.if_id.size != 0) {
+      profile_.CountStructuralStall(wide_.if_id.slots[0].inst_idx);
+    }
+    ++cycle_clocks_;
+    return false;
+  }
+  // update MEM
+  WideGroup &mem_wb = wide_.mem_wb;
+  mem_wb = wide_.ex_mem;
+  size_t miss_cycles = 0;
+  for (size_t slot = 0; slot < mem_wb.size; ++slot) {
+    WideSlot &mem = mem_wb.slots[slot];
+    const Instruction &MEM_Inst = instructions_[mem.inst_idx];
+    if (!IsMemoryInst(MEM_Inst)) {
+      continue;
+    }
+    if (!PagedMemory::IsValidAddress(mem.res)) {
+      RaiseMemoryFault(mem.inst_idx, mem.res);
+      // the older instructions of the group complete, the younger do not
+      for (size_t older = 0; older < slot; ++older) {
+        const Instruction &inst = instructions_[mem_wb.slots[older].inst_idx];
+        if (WritesRegister(inst)) {
+          register_[inst.rd_] = mem_wb.slots[older].res;
+        }
+      }
+      retired_instructions_ += slot;
+      mem_wb.size = 0;
+      break;
+    }
+    bool is_store = IsStoreInst(MEM_Inst);
+    if (is_store) {
+      if constexpr (Policy::history) {
+        bool allocated_page;
+        long old_value =
+            memory_.Exchange(mem.res, mem.store_data, allocated_page);
+        history_.RecordWrite(mem.res, old_value, allocated_page);
+      } else {
+        memory_.Write(mem.res, mem.store_data);
+      }
+    }
+    if (data_cache_.has_value()) {
+      miss_cycles += data_cache_->Access(mem.res, is_store);
+    }
+    if (!is_store) {
+      mem.res = memory_.Read(mem.res);
+    }
+  }
+  memory_stall_cycles_left_ = miss_cycles;
+  // update EX
+  WideGroup &ex_mem = wide_.ex_mem;
+  ex_mem = wide_.id_ex;
+  // EX cycles of the group on each unit
+  std::array<uint32_t, kUnitKinds> unit_cycles{};
+  for (size_t slot = 0; slot < ex_mem.size; ++slot) {
+    WideSlot &ex = ex_mem.slots[slot];
+    UnitKind kind;
+    if (UnitOf(instructions_[ex.inst_idx], kind)) {
+      uint32_t &cycles = unit_cycles[static_cast<size_t>(kind)];
+      cycles = cycles == 0 ? unit_config_[kind].latency
+                           : cycles + unit_config_[kind].interval;
+    }
+    switch (instructions_[ex.inst_idx].instruction_op_) {
+      case InstructionOp::LOAD:
+      case InstructionOp::STORE:
+        ex.res = ex.in1 + instructions_[ex.inst_idx].rt_or_imm_;
+        ex.store_data = ex.in2;
+        break;
+      case InstructionOp::ADDI:
+      case InstructionOp::ADD:
+        ex.res = ex.in1 + ex.in2;
+        break;
+      case InstructionOp::SUBI:
+      case InstructionOp::SUB:
+        ex.res = ex.in1 - ex.in2;
+        break;
+      case InstructionOp::MUL:
+        ex.res = Multiply(ex.in1, ex.in2);
+        break;
+      case InstructionOp::DIV:
+        ex.res = Divide(ex.in1, ex.in2);
+        break;
+      default:
+        break;
+    }
+  }
+  for (uint32_t cycles : unit_cycles) {
+    wide_.ex_cycles_left = std::max(wide_.ex_cycles_left, cycles);
+  }
+  wide_.ex_cycles_left -= wide_.ex_cycles_left != 0;
+  // update ID: issue a prefix of the fetch buffer
+  WideGroup &buffer = wide_.if_id;
+  WideGroup &id_ex = wide_.id_ex;
+  id_ex.size = 0;
+  size_t memory_ops = 0;
+  size_t alu_ops = 0;
+  IssueLimit limit = IssueLimit::EMPTY;
+  bool reached_bp = false;
+  // the branch of the group, resolved here but trained after IF predicted,
+  // in the order of the single-issue pipeline
+  const WideSlot *branch = nullptr;
+  bool branch_taken = false;
+  while (id_ex.size < buffer.size) {
+    const WideSlot &candidate = buffer.slots[id_ex.size];
+    const Instruction &ID_Inst = instructions_[candidate.inst_idx];
+    if (IsMemoryInst(ID_Inst) && memory_ops == issue_config_.memory_ops) {
+      limit = IssueLimit::MEMORY;
+      break;
+    }
+    if (WritesRegister(ID_Inst) && !IsMemoryInst(ID_Inst) &&
+        alu_ops == issue_config_.alu_ops) {
+      limit = IssueLimit::ALU;
+      break;
+    }
+    // operand registers, the second consumed in ID for sw and branches
+    size_t regs[2];
+    bool in_id[2] = {false, false};
+    size_t reg_num = 0;
+    switch (ID_Inst.instruction_op_) {
+      case InstructionOp::LOAD:
+      case InstructionOp::ADDI:
+      case InstructionOp::SUBI:
+        regs[reg_num++] = ID_Inst.rs_or_label_;
+        break;
+      case InstructionOp::ADD:
+      case InstructionOp::SUB:
+      case InstructionOp::MUL:
+      case InstructionOp::DIV:
+        regs[reg_num++] = ID_Inst.rs_or_label_;
+        regs[reg_num++] = ID_Inst.rt_or_imm_;
+        break;
+      case InstructionOp::STORE:
+        regs[reg_num++] = ID_Inst.rs_or_label_;
+        in_id[reg_num] = true;
+        regs[reg_num++] = ID_Inst.rd_;
+        break;
+      case InstructionOp::BEQZ:
+      case InstructionOp::BNEZ:
+        in_id[reg_num] = true;
+        regs[reg_num++] = ID_Inst.rd_;
+        break;
+    }
+    Register values[2] = {0, 0};
+    size_t forwards = 0;
+    bool ready = true;
+    for (size_t op = 0; op < reg_num && ready; ++op) {
+      for (size_t older = 0; older < id_ex.size; ++older) {
+        const Instruction &inst = instructions_[id_ex.slots[older].inst_idx];
+        if (WritesRegister(inst) && inst.rd_ == regs[op]) {
+          limit = IssueLimit::GROUP_RAW;
+          ready = false;
+          break;
+        }
+      }
+      if (!ready) {
+        break;
+      }
+      const WideSlot *producer;
+      bool in_mem;
+      ready = ReadWideOperand<Policy::forwarding>(
+          regs[op], in_id[op], values[op], producer, in_mem);
+      if (!ready) {
+        limit = IssueLimit::RAW;
+        if (Policy::profiling && id_ex.size == 0) {
+          profile_.CountRawStall(candidate.inst_idx, producer->inst_idx,
+                                 in_mem);
+        }
+      } else if (producer != nullptr) {
+        ++forwards;
+      }
+    }
+    if (!ready) {
+      break;
+    }
+    WideSlot &issued = id_ex.slots[id_ex.size++];
+    issued = candidate;
+    if constexpr (Policy::profiling) {
+      for (size_t forward = 0; forward < forwards; ++forward) {
+        profile_.CountForward(issued.inst_idx);
+      }
+    }
+    memory_ops += IsMemoryInst(ID_Inst);
+    alu_ops += WritesRegister(ID_Inst) && !IsMemoryInst(ID_Inst);
+    if (ID_Inst.is_breakpoint_) {
+      reached_bp = true;
+      if (verbose_) {
+        std::cout << "!!! ID-Stage: Reached at breakpoint ["
+                  << issued.inst_idx << '\t'
+                  << instruction_text_[issued.inst_idx] << "] !!!\n";
+      }
+    }
+    switch (ID_Inst.instruction_op_) {
+      case InstructionOp::LOAD:
+      case InstructionOp::STORE:
+      case InstructionOp::ADD:
+      case InstructionOp::SUB:
+      case InstructionOp::MUL:
+      case InstructionOp::DIV:
+        issued.in1 = values[0];
+        issued.in2 = values[1];
+        break;
+      case InstructionOp::ADDI:
+      case InstructionOp::SUBI:
+        issued.in1 = values[0];
+        issued.in2 = ID_Inst.rt_or_imm_;
+        break;
+      case InstructionOp::BEQZ:
+      case InstructionOp::BNEZ:
+        issued.in2 = values[0];
+        branch = &issued;
+        branch_taken = (ID_Inst.instruction_op_ == InstructionOp::BEQZ) ==
+                       (values[0] == 0);
+        break;
+    }
+    if (branch != nullptr) {
+      limit = IssueLimit::BRANCH;
+      break;
+    }
+  }
+  // the issued instructions leave the fetch buffer
+  const size_t issued_num = id_ex.size;
+  for (size_t slot = issued_num; slot < buffer.size; ++slot) {
+    buffer.slots[slot - issued_num] = buffer.slots[slot];
+  }
+  buffer.size -= issued_num;
+  issue_stats_.issued += issued_num;
+  ++issue_stats_.groups[issued_num];
+  if (issued_num < issue_config_.width) {
+    ++issue_stats_.limits[static_cast<size_t>(limit)];
+  }
+  if (issued_num == 0 && limit == IssueLimit::RAW) {
+    ++raw_stalls_;
+  }
+  // update IF: refill the fetch buffer, up to a predicted-taken branch
+  while (buffer.size < issue_config_.width && pc_ < instructions_.size()) {
+    WideSlot &fetched = buffer.slots[buffer.size++];
+    fetched.inst_idx = pc_;
+    fetched.seq = fetched_instructions_++;
+    fetched.predicted_taken = false;
+    ++pc_;
+    const Instruction &IF_Inst = instructions_[fetched.inst_idx];
+    if (branch_predictor_.has_value() && IsBrachInst(IF_Inst) &&
+        branch_predictor_->Predict(fetched.inst_idx, IF_Inst.rs_or_label_,
+                                   pc_)) {
+      fetched.predicted_taken = true;
+      break;
+    }
+  }
+  if (branch != nullptr) {
+    const Instruction &inst = instructions_[branch->inst_idx];
+    if (branch_taken != branch->predicted_taken) {
+      // everything in the fetch buffer is on the wrong path
+      buffer.size = 0;
+      pc_ = branch_taken ? inst.rs_or_label_ : branch->inst_idx + 1;
+      ++control_stalls_;
+      if constexpr (Policy::profiling) {
+        profile_.CountSquash(branch->inst_idx);
+      }
+    }
+    if (branch_predictor_.has_value()) {
+      branch_predictor_->Update(branch->inst_idx, inst.rs_or_label_,
+                                branch_taken, branch->predicted_taken);
+    }
+  }
+  ++cycle_clocks_;
+  if (verbose_ && faulted_) {
+    std::cout << fault_message_ << '\n';
+  } else if (verbose_ && IsFinished()) {
+    std::cout << "Instructions execution finished! " << cycle_clocks_
+              << " cycle clocks executed!\n";
+  }
+  return reached_bp;
+}
+
+template <typename Policy>
+bool Simulator::RunSilentlyWide(size_t max_cycles) {
+  for (size_t cycle = 0; cycle < max_cycles && !IsFinished(); ++cycle) {
+    if (SingleCycleWide<Policy>()) {
+      return true;
+    }
+  }
+  return false;
+}
+
+template <size_t kIndex>
+using WidePolicyAt = PipelinePolicy<(kIndex & 1) != 0, (kIndex & 2) != 0,
+                                    false, (kIndex & 4) != 0, false>;
+
+template <size_t... kIndexes>
+constexpr std::array<Simulator::PipelineVariant, sizeof...(kIndexes)>
+Simulator::MakeWideVariants(std::index_sequence<kIndexes...>) {
+  return {{{&Simulator::SingleCycleWide<WidePolicyAt<kIndexes>>,
+            &Simulator::RunSilentlyWide<WidePolicyAt<kIndexes>>}...}};
+}
+
+void Simulator::FlushWidePipeline() {
+  memory_stall_cycles_left_ = 0;
+  for (size_t slot = 0; slot < wide_.mem_wb.size; ++slot) {
+    const WideSlot &mem = wide_.mem_wb.slots[slot];
+    const Instruction &MEM_Inst = instructions_[mem.inst_idx];
+    if (WritesRegister(MEM_Inst)) {
+      register_[MEM_Inst.rd_] = mem.res;
+    }
+  }
+  // the settled instructions retire at once
+  retired_instructions_ += wide_.mem_wb.size;
+  for (size_t slot = 0; slot < wide_.ex_mem.size; ++slot) {
+    const WideSlot &ex = wide_.ex_mem.slots[slot];
+    const Instruction &EX_Inst = instructions_[ex.inst_idx];
+    if (IsMemoryInst(EX_Inst)) {
+      if (!PagedMemory::IsValidAddress(ex.res)) {
+        // refetch from the faulting lw/sw, see FlushPipeline
+        pc_ = ex.inst_idx;
+        wide_ = WideLatches{};
+        return;
+      }
+      if (IsStoreInst(EX_Inst)) {
+        memory_.Write(ex.res, ex.store_data);
+      } else {
+        register_[EX_Inst.rd_] = memory_.Read(ex.res);
+      }
+      WarmDataCache(ex.res, IsStoreInst(EX_Inst));
+    } else if (WritesRegister(EX_Inst)) {
+      register_[EX_Inst.rd_] = ex.res;
+    }
+    ++retired_instructions_;
+  }
+  if (wide_.id_ex.size != 0) {
+    pc_ = wide_.id_ex.slots[0].inst_idx;
+  } else if (wide_.if_id.size != 0) {
+    pc_ = wide_.if_id.slots[0].inst_idx;
+  }
+  wide_ = WideLatches{};
+}
+
+void Simulator::PrintWidePipelines() const {
+  const WideGroup *groups[5] = {&wide_.if_id, &wide_.id_ex, &wide_.ex_mem,
+                                &wide_.mem_wb, &wide_.wb};
+  for (size_t ppl_idx = 0; ppl_idx < 5; ++ppl_idx) {
+    std::cout << pipeline_name[ppl_idx] << '\t';
+    if (groups[ppl_idx]->size == 0) {
+      std::cout << "nop";
+    }
+    for (size_t slot = 0; slot < groups[ppl_idx]->size; ++slot) {
+      std::cout << (slot == 0 ? "" : " | ")
+                << instruction_text_[groups[ppl_idx]->slots[slot].inst_idx];
+    }
+    std::cout << '\n';
+  }
+}
+
+void Simulator::PrintIssueStatistics() const {
+  static constexpr const char *kLimitNames[kIssueLimits] = {
+      "empty fetch buffer", "RAW on an instruction in flight",
+      "RAW inside the group", "lw/sw limit", "ALU limit", "branch",
+      "EX held by mul/div"};
+  size_t issue_cycles = 0;
+  for (size_t count : issue_stats_.groups) {
+    issue_cycles += count;
+  }
+  std::cout << std::fixed << std::setprecision(3) << "Issue:\n"
+            << "\tWidth: " << issue_config_.width << ", at most "
+            << issue_config_.memory_ops << " lw/sw and "
+            << issue_config_.alu_ops << " ALU instructions per cycle\n"
+            << "\tIPC: "
+            << (cycle_clocks_ == 0
+                    ? 0.0
+                    : static_cast<double>(retired_instructions_) /
+                          cycle_clocks_)
+            << "\n"
+            << "\tIssue slot utilization: "
+            << (issue_cycles == 0
+                    ? 0.0
+                    : 100.0 * issue_stats_.issued /
+                          (issue_cycles * issue_config_.width))
+            << "%\n";
+  std::cout << std::defaultfloat << "\tCycles issuing";
+  for (size_t count = 0; count <= issue_config_.width; ++count) {
+    std::cout << ' ' << count << ": " << issue_stats_.groups[count]
+              << (count == issue_config_.width ? "\n" : ",");
+  }
+  std::cout << "\tGroups cut short by:\n";
+  for (size_t limit = 0; limit < kIssueLimits; ++limit) {
+    std::cout << "\t\t" << kLimitNames[limit] << ": "
+              << issue_stats_.limits[limit] << '\n';
+  }
+}
+
+void Simulator::SelectWidePipeline() {
+  static constexpr auto kVariants =
+      MakeWideVariants(std::make_index_sequence<8>());
+  size_t index =
+      (enable_forwarding_ ? 1 : 0) |
+      (statistics_level_ == StatisticsLevel::PER_INSTRUCTION ? 2 : 0) |
+      (record_history_ ? 4 : 0);
+  single_cycle_ = kVariants[index].single_cycle;
+  run_silently_ = kVariants[index].run_silently;
+}
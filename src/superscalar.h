@@ -0,0 +1,43 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+constexpr size_t kMaxIssueWidth = 8;
+
+// Issue width of the pipeline and the per-cycle limits by instruction
+// class. A beqz/bnez always ends its issue group.
+struct IssueConfig {
+  size_t width{1};
+  size_t memory_ops{1}; // lw, sw
+  size_t alu_ops{kMaxIssueWidth}; // addi, subi, add, sub, mul, div
+};
+
+// Parse "width[:memory ops[:alu ops]]", e.g. "2:1"; the limits default to
+// one lw/sw and width ALU instructions per cycle. Return false and describe
+// the problem in error.
+bool ParseIssueConfig(std::string_view spec, IssueConfig &config,
+                      std::string &error);
+
+// why ID issued fewer instructions than the width in a cycle
+enum class IssueLimit : uint8_t {
+  EMPTY,     // the fetch buffer ran out
+  RAW,       // operand not ready from an instruction in flight
+  GROUP_RAW, // operand written by an older instruction of the same group
+  MEMORY,    // lw/sw limit reached
+  ALU,       // ALU limit reached
+  BRANCH,    // group ended by a beqz/bnez
+  UNIT,      // the EX group is still in the mul/div units
+};
+constexpr size_t kIssueLimits = 7;
+
+struct IssueStats {
+  size_t issued{0}; // issue slots filled
+  // cycles, not counting cache miss stalls, that issued n instructions
+  std::array<size_t, kMaxIssueWidth + 1> groups{};
+  // cycles that issued fewer than the width, by reason
+  std::array<size_t, kIssueLimits> limits{};
+};
@@ -0,0 +1,392 @@
+// Parameter sweep driver: run one program under the cartesian product of
+// the configuration axes given on the command line, one independent
+// Simulator per point on a work-stealing thread pool, and print one merged
+// CSV or JSON table in grid order.
+
+#include "command_line.h"
+#include "program_image.h"
+#include "simulator.h"
+#include "thread_pool.h"
+
+#include <sstream>
+
+// one grid point; unset optionals mean the feature is off
+struct SweepPoint {
+  bool enable_forwarding{false};
+  std::string l1_spec{"none"};
+  std::string l2_spec{"none"};
+  std::string predictor_spec{"none"};
+  size_t btb_entries{0};
+  size_t fast_forward{0};
+  std::string issue_spec{"1"};
+  IssueConfig issue;
+  std::string ooo_spec{"none"};
+  std::optional<TomasuloConfig> ooo;
+  std::string mul_spec{"4"};
+  std::string div_spec{"12:blocking"};
+  FunctionalUnitsConfig units;
+  std::optional<CacheConfig> l1_cache;
+  std::optional<CacheConfig> l2_cache;
+  std::optional<BranchPredictorConfig> predictor;
+};
+
+struct SweepOptions {
+  const char *program_path{nullptr};
+  std::vector<std::string> forwarding{"off"};
+  std::vector<std::string> l1{"none"};
+  std::vector<std::string> l2{"none"};
+  std::vector<std::string> predictor{"none"};
+  std::vector<std::string> btb{"0"};
+  std::vector<std::string> fast_forward{"0"};
+  std::vector<std::string> issue{"1"};
+  std::vector<std::string> ooo{"none"};
+  std::vector<std::string> mul{"4"};
+  std::vector<std::string> div{"12:blocking"};
+  size_t max_cycles{std::numeric_limits<size_t>::max()};
+  size_t thread_num{0};
+  bool json{false};
+  const char *output_path{nullptr};
+};
+
+static void PrintSweepUsage() {
+  std::cerr
+      << "Usage: ./Sweep [your MIPS assembly code file | program image] "
+         "[axes] [options]\n"
+      << "Each axis takes a comma-separated list of values, every "
+         "combination is simulated:\n"
+      << "  --forwarding <on,off>       forwarding (default: off)\n"
+      << "  --l1 <none,spec,...>        L1 data cache, spec as for Simulator "
+         "--l1\n"
+      << "  --l2 <none,spec,...>        L2 data cache, only combined with an "
+         "L1\n"
+      << "  --predictor <none,spec,...> branch predictor, spec as for "
+         "Simulator --predictor\n"
+      << "  --btb <0,entries,...>       BTB entries, only combined with a "
+         "predictor\n"
+      << "  --fast-forward <n,...>      instructions executed functionally "
+         "first\n"
+      << "  --issue <1,spec,...>        issue width and limits, spec as for "
+         "Simulator --issue\n"
+      << "  --ooo <none,spec,...>       out-of-order core, spec as for "
+         "Simulator --ooo, only with issue 1\n"
+      << "  --mul <4,spec,...>          mul unit, spec as for Simulator "
+         "--mul\n"
+      << "  --div <12:blocking,...>     div unit, spec as for Simulator "
+         "--div\n"
+      << "Options:\n"
+      << "  --max-cycles <n>            cycle limit of every run\n"
+      << "  --threads <n>               worker threads (default: all cores)\n"
+      << "  --format <csv|json>         output format (default: csv)\n"
+      << "  --output <file>             write the table to file instead of "
+         "stdout\n";
+}
+
+static std::vector<std::string> SplitList(const std::string &list) {
+  std::vector<std::string> values;
+  std::stringstream stream(list);
+  std::string value;
+  while (std::getline(stream, value, ',')) {
+    values.push_back(value);
+  }
+  return values;
+}
+
+[[noreturn]] static void ExitWithUsage(const std::string &message) {
+  std::cerr << message << '\n';
+  PrintSweepUsage();
+  exit(-1);
+}
+
+static SweepOptions ParseCommandLine(int argc, char **argv) {
+  SweepOptions options;
+  for (int arg_idx = 1; arg_idx < argc; ++arg_idx) {
+    std::string arg = argv[arg_idx];
+    bool has_value = arg_idx + 1 < argc;
+    if (arg[0] != '-' && options.program_path == nullptr) {
+      options.program_path = argv[arg_idx];
+      continue;
+    }
+    if (!has_value) {
+      ExitWithUsage("Unknown option or missing value: " + arg);
+    }
+    std::string value = argv[++arg_idx];
+    if (arg == "--forwarding") {
+      options.forwarding = SplitList(value);
+    } else if (arg == "--l1") {
+      options.l1 = SplitList(value);
+    } else if (arg == "--l2") {
+      options.l2 = SplitList(value);
+    } else if (arg == "--predictor") {
+      options.predictor = SplitList(value);
+    } else if (arg == "--btb") {
+      options.btb = SplitList(value);
+    } else if (arg == "--fast-forward") {
+      options.fast_forward = SplitList(value);
+    } else if (arg == "--issue") {
+      options.issue = SplitList(value);
+    } else if (arg == "--ooo") {
+      options.ooo = SplitList(value);
+    } else if (arg == "--mul") {
+      options.mul = SplitList(value);
+    } else if (arg == "--div") {
+      options.div = SplitList(value);
+    } else if (arg == "--max-cycles") {
+      if (!ParseSize(value, options.max_cycles)) {
+        ExitWithUsage("Invalid cycle limit: " + value);
+      }
+    } else if (arg == "--threads") {
+      if (!ParseSize(value, options.thread_num)) {
+        ExitWithUsage("Invalid thread count: " + value);
+      }
+    } else if (arg == "--format" && (value == "csv" || value == "json")) {
+      options.json = value == "json";
+    } else if (arg == "--output") {
+      options.output_path = argv[arg_idx];
+    } else {
+      ExitWithUsage("Unknown option: " + arg + ' ' + value);
+    }
+  }
+  if (options.program_path == nullptr) {
+    ExitWithUsage("You did not provide MIPS file.");
+  }
+  return options;
+}
+
+// expand the axes into grid points, the first axis varying slowest,
+// skipping combinations that do not make sense (an L2 without L1, a BTB
+// without predictor, an out-of-order core behind a wide issue)
+static std::vector<SweepPoint> BuildGrid(const SweepOptions &options) {
+  std::vector<SweepPoint> grid(1);
+  std::string error;
+  // replace every point by one per value of the axis; set returns false to
+  // skip the combination
+  auto expand = [&grid](const std::vector<std::string> &values, auto set) {
+    std::vector<SweepPoint> expanded;
+    for (const SweepPoint &point : grid) {
+      for (const std::string &value : values) {
+        SweepPoint next = point;
+        if (set(next, value)) {
+          expanded.push_back(std::move(next));
+        }
+      }
+    }
+    grid = std::move(expanded);
+  };
+  expand(options.forwarding, [](SweepPoint &point, const std::string &value) {
+    if (value != "on" && value != "off") {
+      ExitWithUsage("Invalid forwarding value: " + value);
+    }
+    point.enable_forwarding = value == "on";
+    return true;
+  });
+  expand(options.l1, [&](SweepPoint &point, const std::string &value) {
+    point.l1_spec = value;
+    if (value != "none" &&
+        !ParseCacheConfig(value, point.l1_cache.emplace(), error)) {
+      ExitWithUsage("Invalid cache " + value + ": " + error);
+    }
+    return true;
+  });
+  expand(options.l2, [&](SweepPoint &point, const std::string &value) {
+    if (point.l1_spec == "none" && value != "none") {
+      return false;
+    }
+    point.l2_spec = value;
+    if (value != "none" &&
+        !ParseCacheConfig(value, point.l2_cache.emplace(), error)) {
+      ExitWithUsage("Invalid cache " + value + ": " + error);
+    }
+    return true;
+  });
+  expand(options.predictor, [&](SweepPoint &point, const std::string &value) {
+    point.predictor_spec = value;
+    if (value != "none") {
+      if (!ParsePredictorConfig(value, point.predictor.emplace(), error)) {
+        ExitWithUsage("Invalid predictor " + value + ": " + error);
+      }
+      point.btb_entries = point.predictor->btb_entries;
+    }
+    return true;
+  });
+  expand(options.btb, [&](SweepPoint &point, const std::string &value) {
+    if (value == "0") {
+      return true;
+    }
+    if (!point.predictor.has_value()) {
+      return false;
+    }
+    if (!ParseBtbEntries(value, *point.predictor, error)) {
+      ExitWithUsage("Invalid btb " + value + ": " + error);
+    }
+    point.btb_entries = point.predictor->btb_entries;
+    return true;
+  });
+  expand(options.fast_forward,
+         [](SweepPoint &point, const std::string &value) {
+           if (!ParseSize(value, point.fast_forward)) {
+             ExitWithUsage("Invalid instruction count: " + value);
+           }
+           return true;
+         });
+  expand(options.issue, [&](SweepPoint &point, const std::string &value) {
+    point.issue_spec = value;
+    if (!ParseIssueConfig(value, point.issue, error)) {
+      ExitWithUsage("Invalid issue " + value + ": " + error);
+    }
+    return true;
+  });
+  expand(options.ooo, [&](SweepPoint &point, const std::string &value) {
+    if (value == "none") {
+      return true;
+    }
+    if (point.issue.width > 1) {
+      return false;
+    }
+    point.ooo_spec = value;
+    if (!ParseTomasuloConfig(value, point.ooo.emplace(), error)) {
+      ExitWithUsage("Invalid out-of-order core " + value + ": " + error);
+    }
+    return true;
+  });
+  for (UnitKind kind : {UnitKind::MUL, UnitKind::DIV}) {
+    bool is_mul = kind == UnitKind::MUL;
+    expand(is_mul ? options.mul : options.div,
+           [&](SweepPoint &point, const std::string &value) {
+             (is_mul ? point.mul_spec : point.div_spec) = value;
+             if (!ParseFunctionalUnitConfig(value, point.units[kind],
+                                            error)) {
+               ExitWithUsage("Invalid unit " + value + ": " + error);
+             }
+             return true;
+           });
+  }
+  return grid;
+}
+
+static SimulatorStatistics RunPoint(const Program &program,
+                                    const SweepPoint &point,
+                                    size_t max_cycles) {
+  Simulator sim(program, point.enable_forwarding);
+  sim.SetVerbose(false);
+  sim.SetHistoryEnabled(false);
+  sim.SetStatisticsLevel(StatisticsLevel::TOTALS);
+  if (point.l1_cache.has_value()) {
+    sim.SetDataCache(*point.l1_cache, point.l2_cache);
+  }
+  if (point.predictor.has_value()) {
+    sim.SetBranchPredictor(*point.predictor);
+  }
+  sim.SetIssueConfig(point.issue);
+  sim.SetFunctionalUnits(point.units);
+  if (point.ooo.has_value()) {
+    sim.SetOutOfOrder(*point.ooo);
+  }
+  if (point.fast_forward != 0) {
+    sim.RunFunctional(point.fast_forward);
+  }
+  sim.RunSilently(max_cycles);
+  return sim.GetStatistics();
+}
+
+static double Cpi(const SimulatorStatistics &stats) {
+  return stats.retired_instructions == 0
+             ? 0.0
+             : static_cast<double>(stats.cycle_clocks) /
+                   stats.retired_instructions;
+}
+
+static void WriteCsv(std::ostream &out, const std::vector<SweepPoint> &grid,
+                     const std::vector<SimulatorStatistics> &results) {
+  out << "forwarding,l1,l2,predictor,btb,fast_forward,issue,ooo,mul,div,"
+         "cycle_clocks,instructions,cpi,raw_stalls,control_stalls,"
+         "structural_stalls,memory_stalls,l1_hits,l1_misses,l2_hits,"
+         "l2_misses,branches,mispredictions,faulted\n";
+  for (size_t point_idx = 0; point_idx < grid.size(); ++point_idx) {
+    const SweepPoint &point = grid[point_idx];
+    const SimulatorStatistics &stats = results[point_idx];
+    out << (point.enable_forwarding ? "on" : "off") << ',' << point.l1_spec
+        << ',' << point.l2_spec << ',' << point.predictor_spec << ','
+        << point.btb_entries << ',' << point.fast_forward << ','
+        << point.issue_spec << ',' << point.ooo_spec << ','
+        << point.mul_spec << ',' << point.div_spec << ','
+        << stats.cycle_clocks << ','
+        << stats.retired_instructions << ',' << Cpi(stats) << ','
+        << stats.raw_stalls << ',' << stats.control_stalls << ','
+        << stats.structural_stalls << ',' << stats.memory_stalls << ','
+        << stats.l1.hits << ',' << stats.l1.misses << ',' << stats.l2.hits
+        << ',' << stats.l2.misses << ',' << stats.branches.branches << ','
+        << stats.branches.mispredictions << ',' << stats.faulted << '\n';
+  }
+}
+
+static void WriteJson(std::ostream &out, const std::vector<SweepPoint> &grid,
+                      const std::vector<SimulatorStatistics> &results) {
+  out << "[\n";
+  for (size_t point_idx = 0; point_idx < grid.size(); ++point_idx) {
+    const SweepPoint &point = grid[point_idx];
+    const SimulatorStatistics &stats = results[point_idx];
+    out << "  {\"forwarding\": " << (point.enable_forwarding ? "true" : "false")
+        << ", \"l1\": \"" << point.l1_spec << "\", \"l2\": \""
+        << point.l2_spec << "\", \"predictor\": \"" << point.predictor_spec
+        << "\", \"btb\": " << point.btb_entries
+        << ", \"fast_forward\": " << point.fast_forward
+        << ", \"issue\": \"" << point.issue_spec << '"'
+        << ", \"ooo\": \"" << point.ooo_spec << '"'
+        << ", \"mul\": \"" << point.mul_spec << '"'
+        << ", \"div\": \"" << point.div_spec << '"'
+        << ", \"cycle_clocks\": " << stats.cycle_clocks
+        << ", \"instructions\": " << stats.retired_instructions
+        << ", \"cpi\": " << Cpi(stats)
+        << ", \"raw_stalls\": " << stats.raw_stalls
+        << ", \"control_stalls\": " << stats.control_stalls
+        << ", \"structural_stalls\": " << stats.structural_stalls
+        << ", \"memory_stalls\": " << stats.memory_stalls
+        << ", \"l1_hits\": " << stats.l1.hits
+        << ", \"l1_misses\": " << stats.l1.misses
+        << ", \"l2_hits\": " << stats.l2.hits
+        << ", \"l2_misses\": " << stats.l2.misses
+        << ", \"branches\": " << stats.branches.branches
+        << ", \"mispredictions\": " << stats.branches.mispredictions
+        << ", \"faulted\": " << (stats.faulted ? "true" : "false") << '}'
+        << (point_idx + 1 == grid.size() ? "\n" : ",\n");
+  }
+  out << "]\n";
+}
+
+int main(int argc, char **argv) {
+  SweepOptions options = ParseCommandLine(argc, argv);
+  std::vector<SweepPoint> grid = BuildGrid(options);
+  Program program;
+  if (!LoadProgram(options.program_path, program)) {
+    exit(-1);
+  }
+
+  // every task writes its own slot, the table is merged in grid order
+  std::vector<SimulatorStatistics> results(grid.size());
+  {
+    ThreadPool pool(options.thread_num);
+    for (size_t point_idx = 0; point_idx < grid.size(); ++point_idx) {
+      pool.Submit([&, point_idx] {
+        results[point_idx] =
+            RunPoint(program, grid[point_idx], options.max_cycles);
+      });
+    }
+    pool.Wait();
+  }
+
+  std::ofstream fout;
+  if (options.output_path != nullptr) {
+    fout.open(options.output_path, std::ios::trunc);
+    if (!fout) {
+      std::cerr << "Cannot write " << options.output_path << '\n';
+      exit(-1);
+    }
+  }
+  std::ostream &out = options.output_path != nullptr ? fout : std::cout;
+  if (options.json) {
+    WriteJson(out, grid, results);
+  } else {
+    WriteCsv(out, grid, results);
+  }
+  return 0;
+}
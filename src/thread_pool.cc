@@ -0,0 +1,90 @@
+#include "thread_pool.h"
+
+#include <algorithm>
+
+ThreadPool::ThreadPool(size_t thread_num) {
+  if (thread_num == 0) {
+    thread_num = std::max(1u, std::thread::hardware_concurrency());
+  }
+  for (size_t worker_idx = 0; worker_idx < thread_num; ++worker_idx) {
+    queues_.push_back(std::make_unique<WorkQueue>());
+  }
+  for (size_t worker_idx = 0; worker_idx < thread_num; ++worker_idx) {
+    workers_.emplace_back(&ThreadPool::WorkerLoop, this, worker_idx);
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(state_mutex_);
+    stopping_ = true;
+  }
+  work_available_.notify_all();
+  for (std::thread &worker : workers_) {
+    worker.join();
+  }
+}
+
+void ThreadPool::Submit(std::function<void()> task) {
+  // count first, so a worker finishing the task never sees the counters
+  // below zero
+  {
+    std::lock_guard<std::mutex> lock(state_mutex_);
+    ++unfinished_;
+    ++queued_;
+  }
+  WorkQueue &queue = *queues_[next_queue_++ % queues_.size()];
+  {
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    queue.tasks.push_back(std::move(task));
+  }
+  work_available_.notify_one();
+}
+
+void ThreadPool::Wait() {
+  std::unique_lock<std::mutex> lock(state_mutex_);
+  all_done_.wait(lock, [this] { return unfinished_ == 0; });
+}
+
+bool ThreadPool::TryTake(size_t worker_idx, std::function<void()> &task) {
+  {
+    WorkQueue &own = *queues_[worker_idx];
+    std::lock_guard<std::mutex> lock(own.mutex);
+    if (!own.tasks.empty()) {
+      task = std::move(own.tasks.back());
+      own.tasks.pop_back();
+      return true;
+    }
+  }
+  for (size_t offset = 1; offset < queues_.size(); ++offset) {
+    WorkQueue &victim = *queues_[(worker_idx + offset) % queues_.size()];
+    std::lock_guard<std::mutex> lock(victim.mutex);
+    if (!victim.tasks.empty()) {
+      task = std::move(victim.tasks.front());
+      victim.tasks.pop_front();
+      return true;
+    }
+  }
+  return false;
+}
+
+void ThreadPool::WorkerLoop(size_t worker_idx) {
+  std::function<void()> task;
+  while (true) {
+    if (TryTake(worker_idx, task)) {
+      --queued_;
+      task();
+      task = nullptr;
+      std::lock_guard<std::mutex> lock(state_mutex_);
+      if (--unfinished_ == 0) {
+        all_done_.notify_all();
+      }
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(state_mutex_);
+    work_available_.wait(lock, [this] { return stopping_ || queued_ != 0; });
+    if (stopping_ && queued_ == 0) {
+      return;
+    }
+  }
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed-size pool with one task deque per worker. Submit spreads tasks over
+// the deques round-robin; a worker runs its own tasks newest first and, once
+// its deque is empty, steals the oldest task of another worker, so uneven
+// task lengths still keep every worker busy.
+class ThreadPool {
+public:
+  // thread_num == 0: one worker per hardware thread
+  explicit ThreadPool(size_t thread_num = 0);
+  ~ThreadPool();
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  void Submit(std::function<void()> task);
+  // block until every submitted task has finished
+  void Wait();
+  size_t ThreadNum() const { return workers_.size(); }
+
+private:
+  struct WorkQueue {
+    std::mutex mutex;
+    std::deque<std::function<void()>> tasks;
+  };
+
+  // take a task from worker_idx's own deque, else steal one
+  bool TryTake(size_t worker_idx, std::function<void()> &task);
+  void WorkerLoop(size_t worker_idx);
+
+  std::vector<std::unique_ptr<WorkQueue>> queues_;
+  std::vector<std::thread> workers_;
+  std::atomic<size_t> next_queue_{0};
+  // guards the waits on the counters below
+  std::mutex state_mutex_;
+  std::condition_variable work_available_;
+  std::condition_variable all_done_;
+  std::atomic<size_t> queued_{0};  // in a deque, not taken yet
+  size_t unfinished_{0};           // submitted, not finished
+  bool stopping_{false};
+};
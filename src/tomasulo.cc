@@ -0,0 +1,565 @@
+#include "tomasulo.h"
+
+#include <algorithm>
+#include <charconv>
+#include <iomanip>
+
+namespace {
+
+bool IsBranch(const Instruction &inst) {
+  return inst.instruction_op_ == InstructionOp::BEQZ ||
+         inst.instruction_op_ == InstructionOp::BNEZ;
+}
+
+bool IsMemory(const Instruction &inst) {
+  return inst.instruction_op_ == InstructionOp::LOAD ||
+         inst.instruction_op_ == InstructionOp::STORE;
+}
+
+bool WritesRegister(const Instruction &inst) {
+  return !IsBranch(inst) && inst.instruction_op_ != InstructionOp::STORE;
+}
+
+} // namespace
+
+bool ParseTomasuloConfig(std::string_view spec, TomasuloConfig &config,
+                         std::string &error) {
+  std::vector<std::string_view> fields;
+  for (size_t begin = 0;;) {
+    size_t end = spec.find(':', begin);
+    fields.push_back(spec.substr(begin, end - begin));
+    if (end == std::string_view::npos) {
+      break;
+    }
+    begin = end + 1;
+  }
+  if (fields.size() > 5) {
+    error = "expected rob[:alu stations[:memory stations[:cdb width[:width]]]]";
+    return false;
+  }
+  TomasuloConfig parsed;
+  size_t *values[5] = {&parsed.rob_entries, &parsed.alu_stations,
+                       &parsed.memory_stations, &parsed.cdb_width,
+                       &parsed.width};
+  for (size_t field = 0; field < fields.size(); ++field) {
+    const std::string_view text = fields[field];
+    auto [end, ec] =
+        std::from_chars(text.data(), text.data() + text.size(), *values[field]);
+    if (ec != std::errc() || end != text.data() + text.size() ||
+        *values[field] == 0) {
+      error = "the sizes must be positive numbers";
+      return false;
+    }
+  }
+  config = parsed;
+  return true;
+}
+
+TomasuloCore::TomasuloCore(const TomasuloConfig &config,
+                           const FunctionalUnitsConfig &units)
+    : config_(config), units_(units),
+      stations_(config.alu_stations + config.memory_stations, Station{}),
+      rob_(config.rob_entries, RobEntry{}) {
+  rename_.fill(kNoTag);
+}
+
+void TomasuloCore::Cycle(MachineState &state) {
+  Commit(state);
+  if (!state.faulted) {
+    Complete(state);
+    Execute(state);
+    Dispatch(state);
+    Fetch(state);
+  }
+  ++stats_.cycles;
+  stats_.rob_occupancy += rob_size_;
+  stats_.max_rob_occupancy = std::max(stats_.max_rob_occupancy, rob_size_);
+  stats_.rob_full_cycles += rob_size_ == rob_.size();
+  ++cycle_;
+}
+
+size_t TomasuloCore::Flush(size_t pc) {
+  size_t resume = pc;
+  if (rob_size_ != 0) {
+    resume = rob_[head_].inst_idx;
+  } else if (!fetch_queue_.empty()) {
+    resume = fetch_queue_.front().inst_idx;
+  }
+  for (Station &station : stations_) {
+    station.busy = false;
+  }
+  head_ = 0;
+  rob_size_ = 0;
+  rename_.fill(kNoTag);
+  fetch_queue_.clear();
+  commit_wait_ = 0;
+  unit_free_.fill(0);
+  return resume;
+}
+
+TomasuloCore::Operand TomasuloCore::ReadOperand(
+    size_t reg, const Register *registers) const {
+  const uint32_t tag = rename_[reg];
+  if (tag == kNoTag) {
+    return {true, registers[reg], kNoTag};
+  }
+  if (rob_[tag].done) {
+    return {true, rob_[tag].value, kNoTag};
+  }
+  return {false, 0, tag};
+}
+
+void TomasuloCore::Broadcast(uint32_t rob, Register value) {
+  RobEntry &producer = rob_[rob];
+  producer.value = value;
+  producer.done = true;
+  FreeStation(producer.station);
+  for (size_t idx = 0; idx < stations_.size(); ++idx) {
+    Station &station = stations_[idx];
+    if (!station.busy) {
+      continue;
+    }
+    for (Operand &operand : station.src) {
+      if (!operand.ready && operand.tag == rob) {
+        operand = {true, value, kNoTag};
+      }
+    }
+    if (station.stage == Stage::STORE_DATA && station.src[1].ready) {
+      rob_[station.rob].value = station.src[1].value;
+      rob_[station.rob].done = true;
+      FreeStation(static_cast<uint32_t>(idx));
+    }
+  }
+}
+
+void TomasuloCore::Recover(uint32_t rob, size_t pc, MachineState &state) {
+  const size_t keep = Age(rob) + 1;
+  for (size_t age = keep; age < rob_size_; ++age) {
+    const RobEntry &entry = rob_[(head_ + age) % rob_.size()];
+    // a finished entry has already given its station away
+    if (!entry.done) {
+      FreeStation(entry.station);
+    }
+  }
+  stats_.squashed += rob_size_ - keep + fetch_queue_.size();
+  rob_size_ = keep;
+  rename_.fill(kNoTag);
+  for (size_t age = 0; age < keep; ++age) {
+    const uint32_t idx = static_cast<uint32_t>((head_ + age) % rob_.size());
+    const Instruction &inst = (*state.instructions)[rob_[idx].inst_idx];
+    if (WritesRegister(inst)) {
+      rename_[inst.rd_] = idx;
+    }
+  }
+  fetch_queue_.clear();
+  state.pc = pc;
+  // fetch is right again from this cycle on
+  state.penalty_cycles += cycle_ - rob_[rob].fetch_cycle - 1;
+}
+
+void TomasuloCore::Commit(MachineState &state) {
+  if (commit_wait_ != 0) {
+    --commit_wait_;
+    state.memory_stall = true;
+    return;
+  }
+  for (size_t count = 0; count < config_.width && rob_size_ != 0; ++count) {
+    const RobEntry &entry = rob_[head_];
+    if (!entry.done) {
+      if (count == 0) {
+        const Station &station = stations_[entry.station];
+        // a mul/div waiting with its operands only lacks its unit, unless
+        // it was dispatched in the last cycle
+        UnitKind kind;
+        const bool unit_wait =
+            station.stage == Stage::WAITING && station.src[0].ready &&
+            station.src[1].ready &&
+            UnitOf((*state.instructions)[entry.inst_idx], kind) &&
+            unit_free_[static_cast<size_t>(kind)] > cycle_;
+        state.structural_stall = unit_wait;
+        state.raw_stall = (station.stage == Stage::WAITING && !unit_wait) ||
+                          station.stage == Stage::STORE_DATA;
+        state.memory_stall =
+            station.stage == Stage::ACCESSING && station.missed;
+      }
+      return;
+    }
+    if (entry.faulted) {
+      state.faulted = true;
+      state.fault_inst_idx = entry.inst_idx;
+      state.fault_address = entry.address;
+      return;
+    }
+    const Instruction &inst = (*state.instructions)[entry.inst_idx];
+    size_t miss_cycles = 0;
+    switch (inst.instruction_op_) {
+    case InstructionOp::STORE:
+      state.memory->Write(entry.address, entry.value);
+      if (state.data_cache != nullptr) {
+        miss_cycles = state.data_cache->Access(entry.address, true);
+      }
+      break;
+    case InstructionOp::BEQZ:
+    case InstructionOp::BNEZ:
+      if (state.predictor != nullptr) {
+        state.predictor->Update(entry.inst_idx, inst.rs_or_label_,
+                                entry.value != 0, entry.predicted_taken);
+      }
+      break;
+    default:
+      state.registers[inst.rd_] = entry.value;
+      if (rename_[inst.rd_] == head_) {
+        rename_[inst.rd_] = kNoTag;
+      }
+      break;
+    }
+    head_ = (head_ + 1) % rob_.size();
+    --rob_size_;
+    ++state.committed;
+    ++stats_.committed;
+    if (miss_cycles != 0) {
+      // the sw holds commit until its line is written
+      commit_wait_ = miss_cycles;
+      return;
+    }
+  }
+}
+
+void TomasuloCore::Complete(MachineState &state) {
+  by_age_.clear();
+  for (size_t idx = 0; idx < stations_.size(); ++idx) {
+    const Station &station = stations_[idx];
+    if (station.busy &&
+        (station.stage == Stage::RESULT ||
+         ((station.stage == Stage::EXECUTING ||
+           station.stage == Stage::ACCESSING) &&
+          station.finish <= cycle_))) {
+      by_age_.push_back(static_cast<uint32_t>(idx));
+    }
+  }
+  std::sort(by_age_.begin(), by_age_.end(), [&](uint32_t a, uint32_t b) {
+    return Age(stations_[a].rob) < Age(stations_[b].rob);
+  });
+  size_t broadcasts = 0;
+  for (uint32_t idx : by_age_) {
+    Station &station = stations_[idx];
+    if (!station.busy) {
+      continue; // squashed by an older branch
+    }
+    RobEntry &entry = rob_[station.rob];
+    const Instruction &inst = (*state.instructions)[entry.inst_idx];
+    switch (inst.instruction_op_) {
+    case InstructionOp::STORE:
+      entry.address = station.result;
+      entry.address_ready = true;
+      if (!PagedMemory::IsValidAddress(entry.address)) {
+        entry.faulted = entry.done = true;
+        FreeStation(idx);
+      } else if (station.src[1].ready) {
+        entry.value = station.src[1].value;
+        entry.done = true;
+        FreeStation(idx);
+      } else {
+        station.stage = Stage::STORE_DATA;
+      }
+      break;
+    case InstructionOp::BEQZ:
+    case InstructionOp::BNEZ: {
+      const bool taken = station.result != 0;
+      entry.value = taken;
+      entry.done = true;
+      FreeStation(idx);
+      if (taken != entry.predicted_taken) {
+        Recover(station.rob, taken ? inst.rs_or_label_ : entry.inst_idx + 1,
+                state);
+      }
+      break;
+    }
+    case InstructionOp::LOAD:
+      if (station.stage == Stage::EXECUTING) {
+        entry.address = station.result;
+        entry.address_ready = true;
+        if (!PagedMemory::IsValidAddress(entry.address)) {
+          entry.faulted = entry.done = true;
+          FreeStation(idx);
+        } else {
+          station.stage = Stage::ADDRESSED;
+        }
+        break;
+      }
+      [[fallthrough]];
+    default:
+      if (broadcasts == config_.cdb_width) {
+        station.stage = Stage::RESULT;
+        ++stats_.cdb_waits;
+        break;
+      }
+      ++broadcasts;
+      Broadcast(station.rob, station.result);
+      break;
+    }
+  }
+}
+
+void TomasuloCore::Execute(MachineState &state) {
+  // in age order, so that the oldest ready mul/div gets its unit
+  by_age_.clear();
+  for (size_t idx = 0; idx < stations_.size(); ++idx) {
+    if (stations_[idx].busy) {
+      by_age_.push_back(static_cast<uint32_t>(idx));
+    }
+  }
+  std::sort(by_age_.begin(), by_age_.end(), [&](uint32_t a, uint32_t b) {
+    return Age(stations_[a].rob) < Age(stations_[b].rob);
+  });
+  for (uint32_t idx : by_age_) {
+    Station &station = stations_[idx];
+    if (station.stage == Stage::STORE_DATA) {
+      ++stats_.operand_waits;
+      continue;
+    }
+    if (station.stage != Stage::WAITING) {
+      continue;
+    }
+    const Instruction &inst =
+        (*state.instructions)[rob_[station.rob].inst_idx];
+    // a sw computes its address before its data is known
+    if (!station.src[0].ready ||
+        (!station.src[1].ready &&
+         inst.instruction_op_ != InstructionOp::STORE)) {
+      ++stats_.operand_waits;
+      continue;
+    }
+    UnitKind kind;
+    const bool is_long = UnitOf(inst, kind);
+    if (is_long && unit_free_[static_cast<size_t>(kind)] > cycle_) {
+      ++stats_.unit_waits;
+      continue;
+    }
+    const Register in1 = station.src[0].value;
+    const Register in2 = station.src[1].value;
+    switch (inst.instruction_op_) {
+    case InstructionOp::LOAD:
+    case InstructionOp::STORE:
+      station.result = in1 + inst.rt_or_imm_;
+      break;
+    case InstructionOp::ADDI:
+    case InstructionOp::ADD:
+      station.result = in1 + in2;
+      break;
+    case InstructionOp::SUBI:
+    case InstructionOp::SUB:
+      station.result = in1 - in2;
+      break;
+    case InstructionOp::MUL:
+      station.result = Multiply(in1, in2);
+      break;
+    case InstructionOp::DIV:
+      station.result = Divide(in1, in2);
+      break;
+    case InstructionOp::BEQZ:
+    case InstructionOp::BNEZ:
+      station.result =
+          (inst.instruction_op_ == InstructionOp::BEQZ) == (in1 == 0);
+      break;
+    }
+    station.stage = Stage::EXECUTING;
+    station.finish = cycle_ + 1;
+    if (is_long) {
+      station.finish = cycle_ + units_[kind].latency;
+      unit_free_[static_cast<size_t>(kind)] = cycle_ + units_[kind].interval;
+    }
+  }
+
+  // the memory port goes to the oldest lw that knows where every older sw
+  // writes
+  by_age_.clear();
+  for (size_t idx = config_.alu_stations; idx < stations_.size(); ++idx) {
+    if (stations_[idx].busy && stations_[idx].stage == Stage::ADDRESSED) {
+      by_age_.push_back(static_cast<uint32_t>(idx));
+    }
+  }
+  std::sort(by_age_.begin(), by_age_.end(), [&](uint32_t a, uint32_t b) {
+    return Age(stations_[a].rob) < Age(stations_[b].rob);
+  });
+  for (uint32_t idx : by_age_) {
+    Station &station = stations_[idx];
+    const RobEntry &load = rob_[station.rob];
+    bool blocked = false;
+    const RobEntry *source = nullptr;
+    for (size_t age = Age(station.rob); age-- > 0;) {
+      const RobEntry &older = rob_[(head_ + age) % rob_.size()];
+      if ((*state.instructions)[older.inst_idx].instruction_op_ !=
+          InstructionOp::STORE) {
+        continue;
+      }
+      if (!older.address_ready) {
+        blocked = true;
+        break;
+      }
+      if (older.address == load.address) {
+        blocked = !older.done;
+        source = &older;
+        break;
+      }
+    }
+    if (blocked) {
+      continue;
+    }
+    size_t miss_cycles = 0;
+    if (source != nullptr) {
+      station.result = source->value;
+      ++stats_.forwarded_loads;
+    } else {
+      station.result = state.memory->Read(load.address);
+      if (state.data_cache != nullptr) {
+        miss_cycles = state.data_cache->Access(load.address, false);
+      }
+    }
+    station.missed = miss_cycles != 0;
+    station.stage = Stage::ACCESSING;
+    station.finish = cycle_ + 1 + miss_cycles;
+    break;
+  }
+}
+
+void TomasuloCore::Dispatch(MachineState &state) {
+  for (size_t count = 0; count < config_.width && !fetch_queue_.empty();
+       ++count) {
+    const FetchEntry &fetched = fetch_queue_.front();
+    const Instruction &inst = (*state.instructions)[fetched.inst_idx];
+    if (rob_size_ == rob_.size()) {
+      ++stats_.dispatch_stalls[static_cast<size_t>(DispatchStall::ROB_FULL)];
+      return;
+    }
+    const bool memory = IsMemory(inst);
+    const size_t first = memory ? config_.alu_stations : 0;
+    const size_t last = memory ? stations_.size() : config_.alu_stations;
+    size_t free = first;
+    while (free < last && stations_[free].busy) {
+      ++free;
+    }
+    if (free == last) {
+      ++stats_.dispatch_stalls[static_cast<size_t>(
+          memory ? DispatchStall::MEMORY_FULL : DispatchStall::ALU_FULL)];
+      return;
+    }
+    const uint32_t rob = static_cast<uint32_t>((head_ + rob_size_) %
+                                               rob_.size());
+    ++rob_size_;
+    rob_[rob] = {fetched.inst_idx, static_cast<uint32_t>(free),
+                 fetched.fetch_cycle, fetched.predicted_taken,
+                 false, false, false, 0, 0};
+    Station &station = stations_[free];
+    station = {true, Stage::WAITING, false, rob, {}, 0, 0};
+    constexpr Operand kUnused{true, 0, kNoTag};
+    switch (inst.instruction_op_) {
+    case InstructionOp::LOAD:
+      station.src[0] = ReadOperand(inst.rs_or_label_, state.registers);
+      station.src[1] = kUnused;
+      break;
+    case InstructionOp::STORE:
+      station.src[0] = ReadOperand(inst.rs_or_label_, state.registers);
+      station.src[1] = ReadOperand(inst.rd_, state.registers);
+      break;
+    case InstructionOp::ADD:
+    case InstructionOp::SUB:
+    case InstructionOp::MUL:
+    case InstructionOp::DIV:
+      station.src[0] = ReadOperand(inst.rs_or_label_, state.registers);
+      station.src[1] = ReadOperand(inst.rt_or_imm_, state.registers);
+      break;
+    case InstructionOp::ADDI:
+    case InstructionOp::SUBI:
+      station.src[0] = ReadOperand(inst.rs_or_label_, state.registers);
+      station.src[1] = {true, inst.rt_or_imm_, kNoTag};
+      break;
+    case InstructionOp::BEQZ:
+    case InstructionOp::BNEZ:
+      station.src[0] = ReadOperand(inst.rd_, state.registers);
+      station.src[1] = kUnused;
+      break;
+    }
+    // operands are read, now this entry is the youngest writer of rd
+    if (WritesRegister(inst)) {
+      rename_[inst.rd_] = rob;
+    }
+    if (inst.is_breakpoint_ && !state.reached_bp) {
+      state.reached_bp = true;
+      state.bp_inst_idx = fetched.inst_idx;
+    }
+    fetch_queue_.pop_front();
+  }
+}
+
+void TomasuloCore::Fetch(MachineState &state) {
+  const size_t inst_num = state.instructions->size();
+  while (fetch_queue_.size() < config_.width && state.pc < inst_num) {
+    FetchEntry fetched{static_cast<uint32_t>(state.pc), false, cycle_};
+    const Instruction &inst = (*state.instructions)[state.pc];
+    ++state.pc;
+    if (state.predictor != nullptr && IsBranch(inst)) {
+      fetched.predicted_taken = state.predictor->Predict(
+          fetched.inst_idx, inst.rs_or_label_, state.pc);
+    }
+    fetch_queue_.push_back(fetched);
+    if (fetched.predicted_taken) {
+      break;
+    }
+  }
+}
+
+void TomasuloCore::Print(std::ostream &out, const InstructionText &text) const {
+  static constexpr const char *kStageNames[] = {
+      "waiting", "executing", "address", "memory", "cdb", "store data"};
+  out << "Fetch\t";
+  if (fetch_queue_.empty()) {
+    out << "nop";
+  }
+  for (size_t idx = 0; idx < fetch_queue_.size(); ++idx) {
+    out << (idx == 0 ? "" : " | ") << text[fetch_queue_[idx].inst_idx];
+  }
+  out << "\nROB\t" << rob_size_ << '/' << rob_.size()
+      << " entries, oldest first\n";
+  for (size_t age = 0; age < rob_size_; ++age) {
+    const RobEntry &entry = rob_[(head_ + age) % rob_.size()];
+    const char *state =
+        entry.faulted ? "fault"
+        : entry.done
+            ? "done"
+            : kStageNames[static_cast<size_t>(stations_[entry.station].stage)];
+    out << '\t' << entry.inst_idx << '\t' << state << '\t'
+        << text[entry.inst_idx] << '\n';
+  }
+}
+
+void TomasuloCore::PrintStatistics(std::ostream &out) const {
+  static constexpr const char *kStallNames[kDispatchStalls] = {
+      "ROB full", "ALU stations full", "lw/sw stations full"};
+  const double cycles = static_cast<double>(std::max<size_t>(stats_.cycles, 1));
+  out << std::fixed << std::setprecision(3) << "Out-of-order core:\n"
+      << "\tROB: " << config_.rob_entries << " entries, "
+      << config_.alu_stations << " ALU and " << config_.memory_stations
+      << " lw/sw stations, CDB width " << config_.cdb_width << ", width "
+      << config_.width << "\n"
+      << "\tmul: latency " << units_[UnitKind::MUL].latency << ", interval "
+      << units_[UnitKind::MUL].interval << "; div: latency "
+      << units_[UnitKind::DIV].latency << ", interval "
+      << units_[UnitKind::DIV].interval << "\n"
+      << "\tIPC: " << stats_.committed / cycles << "\n"
+      << "\tROB occupancy: " << stats_.rob_occupancy / cycles
+      << " average, " << stats_.max_rob_occupancy << " max, full in "
+      << stats_.rob_full_cycles << " cycles\n"
+      << std::defaultfloat << "\tDispatch stalls:\n";
+  for (size_t stall = 0; stall < kDispatchStalls; ++stall) {
+    out << "\t\t" << kStallNames[stall] << ": "
+        << stats_.dispatch_stalls[stall] << '\n';
+  }
+  out << "\tStation cycles waiting for operands: " << stats_.operand_waits
+      << "\n"
+      << "\tStation cycles waiting for the CDB: " << stats_.cdb_waits << "\n"
+      << "\tStation cycles waiting for a mul/div unit: " << stats_.unit_waits
+      << "\n"
+      << "\tSquashed instructions: " << stats_.squashed << "\n"
+      << "\tLoads forwarded from a store: " << stats_.forwarded_loads << "\n";
+}
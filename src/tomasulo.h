@@ -0,0 +1,206 @@
+#pragma once
+
+#include "branch_predictor.h"
+#include "cache.h"
+#include "functional_unit.h"
+#include "instruction.h"
+#include "paged_memory.h"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Sizes of the out-of-order core.
+struct TomasuloConfig {
+  size_t rob_entries{16};
+  size_t alu_stations{4};    // addi, subi, add, sub, mul, div, beqz, bnez
+  size_t memory_stations{4}; // lw, sw
+  size_t cdb_width{1};       // results broadcast per cycle
+  size_t width{1};           // fetched, dispatched and committed per cycle
+};
+
+// Parse "rob[:alu stations[:memory stations[:cdb width[:width]]]]", e.g.
+// "32:8:4:2:2"; omitted fields keep their defaults. Return false and
+// describe the problem in error.
+bool ParseTomasuloConfig(std::string_view spec, TomasuloConfig &config,
+                         std::string &error);
+
+// why dispatch stopped before the width in a cycle
+enum class DispatchStall : uint8_t { ROB_FULL, ALU_FULL, MEMORY_FULL };
+constexpr size_t kDispatchStalls = 3;
+
+struct TomasuloStats {
+  size_t cycles{0};
+  size_t committed{0};
+  size_t rob_occupancy{0}; // summed over the cycles
+  size_t max_rob_occupancy{0};
+  size_t rob_full_cycles{0};
+  std::array<size_t, kDispatchStalls> dispatch_stalls{};
+  // station-cycles spent waiting for an operand, and with a result
+  // waiting for the CDB
+  size_t operand_waits{0};
+  size_t cdb_waits{0};
+  size_t unit_waits{0}; // station-cycles ready but the mul/div unit busy
+  size_t squashed{0}; // instructions dispatched or fetched down a wrong path
+  size_t forwarded_loads{0}; // lw that took the value of an older sw
+};
+
+// Out-of-order core after Tomasulo with a reorder buffer, an alternative
+// to the in-order pipeline for the same decoded program.
+//
+// Each cycle, oldest stage first:
+//   commit:   up to width finished instructions leave the ROB in program
+//             order; registers are written and sw writes memory only here,
+//             so the architectural state is always that of a prefix of the
+//             program and faults are precise
+//   complete: results are broadcast on the CDB, at most cdb_width, oldest
+//             first, waking the stations that wait for them; branches
+//             resolve, and a misprediction squashes everything younger
+//   execute:  stations whose operands are ready start, one cycle each; a
+//             lw first computes its address, then takes the single memory
+//             port once every older sw has its address, getting the value
+//             of the youngest older sw to the same word or else reading
+//             memory through the data cache
+//   dispatch: up to width fetched instructions are renamed into the ROB
+//             and a reservation station, reading operands from the
+//             register file or the ROB or else waiting for their tag
+//   fetch:    up to width instructions, stopping at a branch predicted
+//             taken
+// A result thus reaches a dependent instruction the cycle after it is
+// computed, as with forwarding, and a lw one cycle later. Every station has
+// its own functional unit, except that mul and div share one unit each,
+// with the latency and issue interval of functional_unit.h; the oldest
+// ready station gets it.
+class TomasuloCore {
+public:
+  using Register = long long;
+
+  // what the core reads and writes besides its own state; data_cache and
+  // predictor are nullptr when the simulator has none
+  struct MachineState {
+    const std::vector<Instruction> *instructions;
+    Register *registers;
+    PagedMemory *memory;
+    DataCache *data_cache;
+    BranchPredictor *predictor;
+    size_t pc; // next fetch, updated by the cycle
+    // outcome of the cycle
+    size_t committed{0};
+    // cycles the branches resolved this cycle fetched down a wrong path
+    size_t penalty_cycles{0};
+    // nothing committed because the oldest instruction waited for an
+    // operand, or for a cache miss
+    bool raw_stall{false};
+    bool memory_stall{false};
+    // ... or for its mul/div unit
+    bool structural_stall{false};
+    bool reached_bp{false}; // an instruction with a breakpoint dispatched
+    size_t bp_inst_idx{0};
+    bool faulted{false}; // the oldest instruction is a faulting lw/sw
+    size_t fault_inst_idx{0};
+    Register fault_address{0};
+  };
+
+  TomasuloCore(const TomasuloConfig &config,
+               const FunctionalUnitsConfig &units);
+
+  void Cycle(MachineState &state);
+  // nothing fetched or in flight
+  bool Empty() const {
+    return rob_size_ == 0 && fetch_queue_.empty() && commit_wait_ == 0;
+  }
+  // drop everything in flight and return the pc to fetch again from, the
+  // oldest instruction not committed, else pc
+  size_t Flush(size_t pc);
+
+  const TomasuloConfig &Config() const { return config_; }
+  const TomasuloStats &Stats() const { return stats_; }
+  void Print(std::ostream &out, const InstructionText &text) const;
+  void PrintStatistics(std::ostream &out) const;
+
+private:
+  static constexpr uint32_t kNoTag = UINT32_MAX;
+
+  enum class Stage : uint8_t {
+    WAITING,    // for operands
+    EXECUTING,  // ALU operation, branch or lw/sw address until finish
+    ADDRESSED,  // lw waiting for the memory port
+    ACCESSING,  // lw reading memory until finish
+    RESULT,     // waiting for the CDB
+    STORE_DATA, // sw with its address, waiting for the data
+  };
+
+  struct Operand {
+    bool ready;
+    Register value;
+    uint32_t tag; // ROB entry that produces it
+  };
+
+  struct Station {
+    bool busy;
+    Stage stage;
+    bool missed; // the lw missed in the data cache
+    uint32_t rob;
+    Operand src[2];
+    Register result;
+    uint64_t finish;
+  };
+
+  struct RobEntry {
+    uint32_t inst_idx;
+    uint32_t station;
+    uint64_t fetch_cycle;
+    bool predicted_taken;
+    bool done;
+    bool faulted;
+    bool address_ready; // lw/sw
+    Register value;     // result, store data or branch outcome
+    Register address;
+  };
+
+  struct FetchEntry {
+    uint32_t inst_idx;
+    bool predicted_taken;
+    uint64_t fetch_cycle;
+  };
+
+  size_t Age(uint32_t rob) const {
+    return (rob + rob_.size() - head_) % rob_.size();
+  }
+  Operand ReadOperand(size_t reg, const Register *registers) const;
+  void FreeStation(uint32_t station) { stations_[station].busy = false; }
+  void Broadcast(uint32_t rob, Register value);
+  // squash everything younger than the branch in rob, fetch from pc
+  void Recover(uint32_t rob, size_t pc, MachineState &state);
+
+  void Commit(MachineState &state);
+  void Complete(MachineState &state);
+  void Execute(MachineState &state);
+  void Dispatch(MachineState &state);
+  void Fetch(MachineState &state);
+
+  TomasuloConfig config_;
+  FunctionalUnitsConfig units_;
+  // first cycle each mul/div unit accepts another instruction
+  std::array<uint64_t, kUnitKinds> unit_free_{};
+  // stations [0, alu_stations) are the ALU's, the rest the memory's
+  std::vector<Station> stations_;
+  std::vector<RobEntry> rob_; // ring buffer
+  size_t head_{0};
+  size_t rob_size_{0};
+  // ROB entry of the youngest writer of each register, kNoTag: the
+  // register file is current
+  std::array<uint32_t, 32> rename_;
+  std::deque<FetchEntry> fetch_queue_;
+  // cycles commit still waits for the cache miss of a committed sw
+  size_t commit_wait_{0};
+  uint64_t cycle_{0};
+  TomasuloStats stats_;
+  // stations to visit in age order, reused by Complete and Execute
+  std::vector<uint32_t> by_age_;
+};
@@ -0,0 +1,310 @@
+#include "trace.h"
+
+#include "state_stream.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+// kind, cycle and seq varints, detail and inst_idx varint
+constexpr size_t kMaxEventBytes = 1 + 10 + 10 + 1 + 10;
+
+static char *PutVarint(char *out, uint64_t value) {
+  while (value >= 0x80) {
+    *out++ = static_cast<char>(value | 0x80);
+    value >>= 7;
+  }
+  *out++ = static_cast<char>(value);
+  return out;
+}
+
+static uint64_t ZigZag(int64_t value) {
+  return (static_cast<uint64_t>(value) << 1) ^
+         static_cast<uint64_t>(value >> 63);
+}
+
+static int64_t UnZigZag(uint64_t value) {
+  return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+}
+
+bool TraceWriter::Open(const std::string &path, const InstructionText &text) {
+  fout_.open(path, std::ios::binary | std::ios::trunc);
+  StateWriter header;
+  header.PutBytes(kTraceMagic, sizeof(kTraceMagic));
+  header.Put(kTraceVersion);
+  header.Put<uint64_t>(text.Size());
+  for (size_t inst_idx = 0; inst_idx < text.Size(); ++inst_idx) {
+    header.PutString(std::string(text[inst_idx]));
+  }
+  if (!fout_.write(header.Buffer().data(), header.Buffer().size())) {
+    std::cerr << "Cannot write trace: " << path << '\n';
+    fout_.close();
+    return false;
+  }
+  path_ = path;
+  buffer_.reserve(kBufferEvents);
+  thread_ = std::thread(&TraceWriter::WriterLoop, this);
+  return true;
+}
+
+bool TraceWriter::Close() {
+  if (!thread_.joinable()) {
+    return !failed_;
+  }
+  Record({end_cycle_, 0, 0, TraceEventKind::END, 0});
+  if (!buffer_.empty()) {
+    Flush();
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    closing_ = true;
+  }
+  work_cv_.notify_one();
+  thread_.join();
+  fout_.close();
+  if (failed_ || !fout_) {
+    std::cerr << "Cannot write trace: " << path_ << '\n';
+    failed_ = true;
+  }
+  return !failed_;
+}
+
+void TraceWriter::Flush() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  space_cv_.wait(lock, [this] { return queue_.size() < kMaxQueuedBuffers; });
+  queue_.push_back(std::move(buffer_));
+  if (free_buffers_.empty()) {
+    buffer_ = std::vector<TraceEvent>();
+    buffer_.reserve(kBufferEvents);
+  } else {
+    buffer_ = std::move(free_buffers_.back());
+    free_buffers_.pop_back();
+  }
+  lock.unlock();
+  work_cv_.notify_one();
+}
+
+void TraceWriter::WriterLoop() {
+  std::vector<char> encoded(kBufferEvents * kMaxEventBytes);
+  while (true) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    work_cv_.wait(lock, [this] { return !queue_.empty() || closing_; });
+    if (queue_.empty()) {
+      return;
+    }
+    std::vector<TraceEvent> events = std::move(queue_.front());
+    queue_.pop_front();
+    bool failed = failed_;
+    lock.unlock();
+    space_cv_.notify_one();
+
+    char *out = encoded.data();
+    for (const TraceEvent &event : events) {
+      *out++ = static_cast<char>(event.kind);
+      out = PutVarint(out, event.cycle - last_cycle_);
+      out = PutVarint(out,
+                      ZigZag(static_cast<int64_t>(event.seq - last_seq_)));
+      *out++ = static_cast<char>(event.detail);
+      if (event.kind == TraceEventKind::STAGE && event.detail == 0) {
+        out = PutVarint(out, event.inst_idx);
+      }
+      last_cycle_ = event.cycle;
+      last_seq_ = event.seq;
+    }
+    if (!failed && !fout_.write(encoded.data(), out - encoded.data())) {
+      failed = true;
+    }
+
+    events.clear();
+    lock.lock();
+    failed_ = failed;
+    free_buffers_.push_back(std::move(events));
+  }
+}
+
+bool TraceReader::Open(const std::string &path, std::string &error) {
+  fin_.open(path, std::ios::binary);
+  if (!fin_) {
+    error = "Cannot open trace: " + path;
+    return false;
+  }
+  char magic[sizeof(kTraceMagic)];
+  uint32_t version;
+  uint64_t instruction_num;
+  if (!fin_.read(magic, sizeof(magic)) ||
+      std::memcmp(magic, kTraceMagic, sizeof(magic)) != 0) {
+    error = "Not a trace: " + path;
+    return false;
+  }
+  if (!fin_.read(reinterpret_cast<char *>(&version), sizeof(version)) ||
+      version != kTraceVersion) {
+    error = "Trace " + path + " was written by another version";
+    return false;
+  }
+  if (!fin_.read(reinterpret_cast<char *>(&instruction_num),
+                 sizeof(instruction_num))) {
+    error = "Trace is truncated: " + path;
+    return false;
+  }
+  for (uint64_t inst_idx = 0; inst_idx < instruction_num; ++inst_idx) {
+    uint64_t size;
+    if (!fin_.read(reinterpret_cast<char *>(&size), sizeof(size)) ||
+        size > 4096) {
+      error = "Trace is truncated: " + path;
+      return false;
+    }
+    std::string text(size, '\0');
+    if (!fin_.read(&text[0], size)) {
+      error = "Trace is truncated: " + path;
+      return false;
+    }
+    texts_.push_back(std::move(text));
+  }
+  return true;
+}
+
+bool TraceReader::GetByte(uint8_t &byte) {
+  int value = fin_.rdbuf()->sbumpc();
+  if (value == std::char_traits<char>::eof()) {
+    return false;
+  }
+  byte = static_cast<uint8_t>(value);
+  return true;
+}
+
+bool TraceReader::GetVarint(uint64_t &value) {
+  value = 0;
+  for (int shift = 0; shift < 64; shift += 7) {
+    uint8_t byte;
+    if (!GetByte(byte)) {
+      return false;
+    }
+    value |= uint64_t{byte & 0x7fu} << shift;
+    if ((byte & 0x80) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool TraceReader::Read(TraceEvent &event) {
+  uint8_t kind;
+  uint64_t cycle_delta;
+  uint64_t seq_delta;
+  if (!GetByte(kind) || kind > static_cast<uint8_t>(TraceEventKind::END) ||
+      !GetVarint(cycle_delta) || !GetVarint(seq_delta) ||
+      !GetByte(event.detail)) {
+    return false;
+  }
+  event.kind = static_cast<TraceEventKind>(kind);
+  event.cycle = last_cycle_ += cycle_delta;
+  event.seq = last_seq_ += static_cast<uint64_t>(UnZigZag(seq_delta));
+  event.inst_idx = 0;
+  if (event.kind == TraceEventKind::STAGE && event.detail == 0) {
+    uint64_t inst_idx;
+    if (!GetVarint(inst_idx) || inst_idx >= texts_.size()) {
+      return false;
+    }
+    event.inst_idx = static_cast<uint32_t>(inst_idx);
+  } else if (event.kind == TraceEventKind::STAGE && event.detail > 4) {
+    return false;
+  }
+  return true;
+}
+
+void TraceReader::Advance(uint64_t cycle,
+                          const std::vector<TraceEvent> &events) {
+  bool frozen = std::any_of(events.begin(), events.end(),
+                            [](const TraceEvent &event) {
+                              return event.kind ==
+                                     TraceEventKind::MEMORY_STALL;
+                            });
+  size_t kept = 0;
+  for (InFlight inst : in_flight_) {
+    if (inst.stage == 4) {
+      // retired
+      continue;
+    }
+    bool held =
+        frozen ||
+        std::any_of(events.begin(), events.end(),
+                    [&inst](const TraceEvent &event) {
+                      return event.seq == inst.seq &&
+                             (event.kind == TraceEventKind::STAGE ||
+                              event.kind == TraceEventKind::RAW_STALL ||
+                              event.kind == TraceEventKind::STRUCTURAL_STALL);
+                    });
+    if (!held) {
+      ++inst.stage;
+      ready_.push_back(
+          {cycle, inst.seq, inst.inst_idx, TraceEventKind::STAGE, inst.stage});
+    }
+    in_flight_[kept++] = inst;
+  }
+  in_flight_.resize(kept);
+}
+
+bool TraceReader::ReadCycle() {
+  cycle_events_.clear();
+  if (!has_pending_ && !Read(pending_)) {
+    return false;
+  }
+  has_pending_ = false;
+  cycle_events_.push_back(pending_);
+  TraceEvent event;
+  while (Read(event)) {
+    if (event.cycle != cycle_events_.front().cycle) {
+      pending_ = event;
+      has_pending_ = true;
+      break;
+    }
+    cycle_events_.push_back(event);
+  }
+  uint64_t cycle = cycle_events_.front().cycle;
+  // nothing held the instructions in flight in the cycles without events
+  for (uint64_t step = cycle_ + 1; step < cycle && !in_flight_.empty();
+       ++step) {
+    Advance(step, {});
+  }
+  Advance(cycle, cycle_events_);
+  cycle_ = cycle;
+  for (const TraceEvent &event : cycle_events_) {
+    auto inst = std::find_if(
+        in_flight_.begin(), in_flight_.end(),
+        [&event](const InFlight &inst) { return inst.seq == event.seq; });
+    switch (event.kind) {
+    case TraceEventKind::STAGE:
+      if (inst != in_flight_.end()) {
+        // a hold, already applied
+        continue;
+      }
+      if (event.detail == 0) {
+        in_flight_.push_back({event.seq, event.inst_idx, 0});
+      }
+      break;
+    case TraceEventKind::SQUASH:
+      if (inst != in_flight_.end()) {
+        in_flight_.erase(inst);
+      }
+      break;
+    case TraceEventKind::END:
+      in_flight_.clear();
+      break;
+    default:
+      break;
+    }
+    ready_.push_back(event);
+  }
+  return true;
+}
+
+bool TraceReader::Next(TraceEvent &event) {
+  while (ready_.empty()) {
+    if (!ReadCycle()) {
+      return false;
+    }
+  }
+  event = ready_.front();
+  ready_.pop_front();
+  return true;
+}
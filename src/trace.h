@@ -0,0 +1,160 @@
+#pragma once
+
+#include "instruction.h"
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Pipeline trace: a stream of events per dynamic instruction, identified by
+// its fetch sequence number. An instruction in flight moves on one stage
+// every cycle and leaves after WB unless an event holds it, so the trace
+// records its fetch and the cycles it does not move rather than every
+// stage it enters: RAW and structural stalls hold it in IF, a STAGE event
+// for an instruction in flight holds it in that stage, and a cache miss
+// holds everything but WB. TraceReader expands this back into one STAGE
+// event per stage entered.
+//
+// File layout:
+//   char     magic[8]
+//   uint32_t version
+//   uint64_t instruction_num, then per instruction uint64_t size, char text[]
+//   events until the end of the file, each
+//     uint8_t  kind
+//     varint   cycle - cycle of the previous event
+//     varint   zigzag(seq - seq of the previous event)
+//     uint8_t  detail
+//     varint   inst_idx, only for STAGE events with detail IF
+// Events are written in cycle order; delta coding keeps a typical event at
+// about four bytes.
+
+constexpr char kTraceMagic[8] = {'M', 'I', 'P', 'S', 'T', 'R', 'C', 0};
+constexpr uint32_t kTraceVersion = 2;
+
+enum class TraceEventKind : uint8_t {
+  STAGE,            // entered stage detail (0 IF .. 4 WB); WB means retired
+  SQUASH,           // flushed from IF by a mispredicted branch
+  RAW_STALL,        // held in IF while ID waits for register detail
+  MEMORY_STALL,     // held in MEM by a cache miss
+  FORWARD,          // register detail & kForwardRegisterMask forwarded in ID
+  STRUCTURAL_STALL, // held in IF while ID waits for a mul/div unit
+  END, // whatever is in flight leaves the trace: the trace ends, or the
+       // pipeline was flushed for the functional engine
+};
+// FORWARD detail flag: the value came from MEM rather than EX
+constexpr uint8_t kForwardFromMem = 0x80;
+constexpr uint8_t kForwardRegisterMask = 0x7f;
+
+struct TraceEvent {
+  uint64_t cycle;
+  uint64_t seq;
+  uint32_t inst_idx;
+  TraceEventKind kind;
+  uint8_t detail;
+};
+
+// Buffered trace sink. The simulator appends events to a buffer; full
+// buffers are handed to a background thread that encodes and writes them,
+// so tracing costs the simulation little more than the appends. The
+// simulator only blocks when kMaxQueuedBuffers buffers are waiting.
+class TraceWriter {
+public:
+  static constexpr size_t kBufferEvents = size_t{1} << 16;
+  static constexpr size_t kMaxQueuedBuffers = 8;
+
+  TraceWriter() = default;
+  TraceWriter(const TraceWriter &) = delete;
+  TraceWriter &operator=(const TraceWriter &) = delete;
+  ~TraceWriter() { Close(); }
+
+  // write the header and start the writer thread
+  bool Open(const std::string &path, const InstructionText &text);
+  // write everything recorded and stop the writer thread; return false if
+  // any write failed
+  bool Close();
+
+  inline void Record(const TraceEvent &event) {
+    buffer_.push_back(event);
+    if (buffer_.size() == kBufferEvents) {
+      Flush();
+    }
+  }
+  // record the fetch of seq unless it was recorded in an earlier call
+  inline void Fetch(uint64_t seq, uint32_t inst_idx, uint64_t cycle) {
+    if (fetched_seq_ != seq) {
+      fetched_seq_ = seq;
+      Record({cycle, seq, inst_idx, TraceEventKind::STAGE, 0});
+    }
+  }
+  // the pipeline went through cycle; Close ends the trace after the last
+  inline void EndCycle(uint64_t cycle) { end_cycle_ = cycle; }
+
+private:
+  void Flush();
+  void WriterLoop();
+
+  std::string path_;
+  std::ofstream fout_;
+  std::thread thread_;
+  std::vector<TraceEvent> buffer_;
+  uint64_t fetched_seq_{UINT64_MAX};
+  uint64_t end_cycle_{0};
+  // guarded by mutex_
+  std::mutex mutex_;
+  std::condition_variable work_cv_;
+  std::condition_variable space_cv_;
+  std::deque<std::vector<TraceEvent>> queue_;
+  std::vector<std::vector<TraceEvent>> free_buffers_;
+  bool closing_{false};
+  bool failed_{false};
+  // writer thread only
+  uint64_t last_cycle_{0};
+  uint64_t last_seq_{0};
+};
+
+// sequential reader of a trace file, used by TraceConvert
+class TraceReader {
+public:
+  // read the header; false with a message in error if this is no trace
+  bool Open(const std::string &path, std::string &error);
+  const std::vector<std::string> &InstructionTexts() const { return texts_; }
+  // Next event with the stage entries filled in: a STAGE event for every
+  // stage an instruction enters, in cycle order, and no holds. False at
+  // the end of the trace or on a truncated event.
+  bool Next(TraceEvent &event);
+
+private:
+  struct InFlight {
+    uint64_t seq;
+    uint32_t inst_idx;
+    uint8_t stage;
+  };
+  bool GetByte(uint8_t &byte);
+  bool GetVarint(uint64_t &value);
+  // next event as stored
+  bool Read(TraceEvent &event);
+  // read the events of the next cycle and queue them behind the moves of
+  // the instructions in flight up to it; false at the end of the trace
+  bool ReadCycle();
+  // move on what is in flight in cycle, except the instructions held by
+  // the events of that cycle
+  void Advance(uint64_t cycle, const std::vector<TraceEvent> &events);
+
+  std::ifstream fin_;
+  std::vector<std::string> texts_;
+  uint64_t last_cycle_{0};
+  uint64_t last_seq_{0};
+  // read ahead: the first event of the next cycle
+  bool has_pending_{false};
+  TraceEvent pending_;
+  std::vector<TraceEvent> cycle_events_;
+  uint64_t cycle_{0}; // of the last cycle read
+  std::vector<InFlight> in_flight_; // oldest first
+  std::deque<TraceEvent> ready_;
+};
@@ -0,0 +1,270 @@
+// Trace converter: turn a binary pipeline trace written by Simulator --trace
+// into Chrome trace event JSON (chrome://tracing, ui.perfetto.dev), one
+// track per stage, or into a Konata pipeline diagram log.
+
+#include "trace.h"
+
+#include <iostream>
+#include <unordered_map>
+
+static const char *const kStageNames[5] = {"IF", "ID", "EX", "MEM", "WB"};
+
+static void PrintConvertUsage() {
+  std::cerr << "Usage: ./TraceConvert [trace file] [options]\n"
+            << "  --format <chrome|konata> output format (default: chrome)\n"
+            << "  --output <file>          write to a file instead of stdout\n";
+}
+
+// instruction text with tabs replaced, safe inside JSON strings and
+// tab-separated Konata fields
+static std::string CleanText(const std::string &text) {
+  std::string clean;
+  for (char ch : text) {
+    if (ch == '\t') {
+      clean.push_back(' ');
+    } else if (ch == '"' || ch == '\\') {
+      clean.push_back('\\');
+      clean.push_back(ch);
+    } else if (static_cast<unsigned char>(ch) >= 0x20) {
+      clean.push_back(ch);
+    }
+  }
+  return clean;
+}
+
+static std::string EventNote(const TraceEvent &event) {
+  switch (event.kind) {
+  case TraceEventKind::RAW_STALL:
+    return "RAW stall on r" + std::to_string(event.detail);
+  case TraceEventKind::MEMORY_STALL:
+    return "cache miss stall";
+  case TraceEventKind::STRUCTURAL_STALL:
+    return "structural stall";
+  case TraceEventKind::FORWARD:
+    return "r" + std::to_string(event.detail & kForwardRegisterMask) +
+           " forwarded from " +
+           ((event.detail & kForwardFromMem) != 0 ? "MEM" : "EX");
+  case TraceEventKind::SQUASH:
+    return "squashed";
+  default:
+    return "";
+  }
+}
+
+// stage occupied by an instruction still in flight
+struct InFlight {
+  uint32_t inst_idx;
+  uint8_t stage;
+  uint64_t stage_start;
+  uint64_t konata_id;
+};
+
+static void ConvertToChrome(TraceReader &reader, std::ostream &out) {
+  const std::vector<std::string> &texts = reader.InstructionTexts();
+  std::unordered_map<uint64_t, InFlight> in_flight;
+  bool first = true;
+  auto begin_event = [&]() -> std::ostream & {
+    out << (first ? "\n" : ",\n");
+    first = false;
+    return out;
+  };
+  auto end_stage = [&](uint64_t seq, const InFlight &inst, uint64_t end) {
+    begin_event() << "{\"name\":\"" << CleanText(texts[inst.inst_idx])
+                  << "\",\"cat\":\"stage\",\"ph\":\"X\",\"ts\":"
+                  << inst.stage_start << ",\"dur\":" << end - inst.stage_start
+                  << ",\"pid\":1,\"tid\":" << int{inst.stage}
+                  << ",\"args\":{\"seq\":" << seq
+                  << ",\"index\":" << inst.inst_idx << "}}";
+  };
+
+  out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+  for (uint8_t stage = 0; stage < 5; ++stage) {
+    begin_event() << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+                     "\"tid\":"
+                  << int{stage} << ",\"args\":{\"name\":\""
+                  << kStageNames[stage] << "\"}}";
+  }
+  TraceEvent event;
+  uint64_t last_cycle = 0;
+  while (reader.Next(event)) {
+    last_cycle = event.cycle;
+    if (event.kind == TraceEventKind::END) {
+      for (const auto &[seq, inst] : in_flight) {
+        end_stage(seq, inst, event.cycle + 1);
+      }
+      in_flight.clear();
+      continue;
+    }
+    auto it = in_flight.find(event.seq);
+    if (event.kind == TraceEventKind::STAGE) {
+      if (it == in_flight.end()) {
+        if (event.detail != 0) {
+          // entered the trace mid-pipeline, e.g. after a restore
+          continue;
+        }
+        in_flight.emplace(event.seq,
+                          InFlight{event.inst_idx, 0, event.cycle, 0});
+        continue;
+      }
+      end_stage(event.seq, it->second, event.cycle);
+      it->second.stage = event.detail;
+      it->second.stage_start = event.cycle;
+      if (event.detail == 4) {
+        end_stage(event.seq, it->second, event.cycle + 1);
+        in_flight.erase(it);
+      }
+      continue;
+    }
+    if (it == in_flight.end()) {
+      continue;
+    }
+    begin_event() << "{\"name\":\"" << EventNote(event)
+                  << "\",\"cat\":\"event\",\"ph\":\"i\",\"s\":\"t\",\"ts\":"
+                  << event.cycle << ",\"pid\":1,\"tid\":"
+                  << int{it->second.stage} << ",\"args\":{\"seq\":"
+                  << event.seq << "}}";
+    if (event.kind == TraceEventKind::SQUASH) {
+      end_stage(event.seq, it->second, event.cycle + 1);
+      in_flight.erase(it);
+    }
+  }
+  for (const auto &[seq, inst] : in_flight) {
+    end_stage(seq, inst, last_cycle + 1);
+  }
+  out << "\n]}\n";
+}
+
+static void ConvertToKonata(TraceReader &reader, std::ostream &out) {
+  const std::vector<std::string> &texts = reader.InstructionTexts();
+  std::unordered_map<uint64_t, InFlight> in_flight;
+  // instructions leaving the pipeline at the end of the current cycle
+  std::vector<std::pair<uint64_t, bool>> leaving; // konata id, squashed
+  uint64_t next_id = 0;
+  uint64_t retired = 0;
+  uint64_t cycle = 0;
+  bool started = false;
+  auto advance_to = [&](uint64_t new_cycle) {
+    if (!started) {
+      out << "C=\t" << new_cycle << '\n';
+      started = true;
+      cycle = new_cycle;
+      return;
+    }
+    if (new_cycle == cycle) {
+      return;
+    }
+    out << "C\t1\n";
+    for (const auto &[id, squashed] : leaving) {
+      out << "R\t" << id << '\t' << (squashed ? 0 : retired++) << '\t'
+          << (squashed ? 1 : 0) << '\n';
+    }
+    leaving.clear();
+    if (new_cycle - cycle > 1) {
+      out << "C\t" << new_cycle - cycle - 1 << '\n';
+    }
+    cycle = new_cycle;
+  };
+
+  out << "Kanata\t0004\n";
+  TraceEvent event;
+  while (reader.Next(event)) {
+    advance_to(event.cycle);
+    if (event.kind == TraceEventKind::END) {
+      // flushed, not retired
+      for (const auto &[seq, inst] : in_flight) {
+        leaving.emplace_back(inst.konata_id, true);
+      }
+      in_flight.clear();
+      continue;
+    }
+    auto it = in_flight.find(event.seq);
+    if (event.kind == TraceEventKind::STAGE) {
+      if (it == in_flight.end()) {
+        if (event.detail != 0) {
+          continue;
+        }
+        uint64_t id = next_id++;
+        in_flight.emplace(event.seq,
+                          InFlight{event.inst_idx, 0, event.cycle, id});
+        out << "I\t" << id << '\t' << event.seq << "\t0\n"
+            << "L\t" << id << "\t0\t" << CleanText(texts[event.inst_idx])
+            << '\n'
+            << "S\t" << id << "\t0\tIF\n";
+        continue;
+      }
+      out << "E\t" << it->second.konata_id << "\t0\t"
+          << kStageNames[it->second.stage] << '\n'
+          << "S\t" << it->second.konata_id << "\t0\t"
+          << kStageNames[event.detail] << '\n';
+      it->second.stage = event.detail;
+      if (event.detail == 4) {
+        leaving.emplace_back(it->second.konata_id, false);
+        in_flight.erase(it);
+      }
+      continue;
+    }
+    if (it == in_flight.end()) {
+      continue;
+    }
+    out << "L\t" << it->second.konata_id << "\t1\t" << event.cycle << ": "
+        << EventNote(event) << "; \n";
+    if (event.kind == TraceEventKind::SQUASH) {
+      leaving.emplace_back(it->second.konata_id, true);
+      in_flight.erase(it);
+    }
+  }
+  advance_to(cycle + 1);
+}
+
+int main(int argc, char **argv) {
+  const char *trace_path = nullptr;
+  const char *output_path = nullptr;
+  bool konata = false;
+  for (int arg_idx = 1; arg_idx < argc; ++arg_idx) {
+    std::string arg = argv[arg_idx];
+    bool has_value = arg_idx + 1 < argc;
+    if (arg == "--format" && has_value) {
+      std::string format = argv[++arg_idx];
+      if (format != "chrome" && format != "konata") {
+        std::cerr << "Unknown format: " << format << '\n';
+        PrintConvertUsage();
+        exit(-1);
+      }
+      konata = format == "konata";
+    } else if (arg == "--output" && has_value) {
+      output_path = argv[++arg_idx];
+    } else if (arg[0] != '-' && trace_path == nullptr) {
+      trace_path = argv[arg_idx];
+    } else {
+      std::cerr << "Unknown option: " << arg << '\n';
+      PrintConvertUsage();
+      exit(-1);
+    }
+  }
+  if (trace_path == nullptr) {
+    PrintConvertUsage();
+    exit(-1);
+  }
+
+  TraceReader reader;
+  std::string error;
+  if (!reader.Open(trace_path, error)) {
+    std::cerr << error << '\n';
+    exit(-1);
+  }
+  std::ofstream fout;
+  if (output_path != nullptr) {
+    fout.open(output_path, std::ios::trunc);
+    if (!fout) {
+      std::cerr << "Cannot write " << output_path << '\n';
+      exit(-1);
+    }
+  }
+  std::ostream &out = output_path != nullptr ? fout : std::cout;
+  if (konata) {
+    ConvertToKonata(reader, out);
+  } else {
+    ConvertToChrome(reader, out);
+  }
+  return 0;
+}
@@ -0,0 +1,128 @@
+#include "watch.h"
+
+#include <charconv>
+
+namespace {
+
+constexpr std::string_view kOperators[] = {"==", "!=", "<", "<=", ">", ">="};
+
+template <typename T> bool ParseNumber(std::string_view text, T &value) {
+  auto [end, ec] = std::from_chars(text.data(), text.data() + text.size(),
+                                   value);
+  return !text.empty() && ec == std::errc() &&
+         end == text.data() + text.size();
+}
+
+bool ParseRegister(std::string_view text, uint8_t &reg) {
+  unsigned number;
+  if (text.size() < 2 || text[0] != 'r' ||
+      !ParseNumber(text.substr(1), number) || number >= 32) {
+    return false;
+  }
+  reg = static_cast<uint8_t>(number);
+  return true;
+}
+
+bool ParseCondition(std::string_view text, RegisterCondition &condition) {
+  size_t op_pos = text.find_first_of("=!<>");
+  if (op_pos == std::string_view::npos ||
+      !ParseRegister(text.substr(0, op_pos), condition.reg)) {
+    return false;
+  }
+  // the two-character operators first, so that "<=" is not read as "<"
+  size_t op_len = text.size() > op_pos + 1 && text[op_pos + 1] == '=' ? 2 : 1;
+  std::string_view op = text.substr(op_pos, op_len);
+  size_t op_idx = 0;
+  while (op_idx < std::size(kOperators) && kOperators[op_idx] != op) {
+    ++op_idx;
+  }
+  if (op_idx == std::size(kOperators)) {
+    return false;
+  }
+  condition.op = static_cast<CompareOp>(op_idx);
+  std::string_view rhs = text.substr(op_pos + op_len);
+  uint8_t rhs_reg;
+  condition.rhs_is_register = ParseRegister(rhs, rhs_reg);
+  if (condition.rhs_is_register) {
+    condition.rhs = rhs_reg;
+    return true;
+  }
+  return ParseNumber(rhs, condition.rhs);
+}
+
+} // namespace
+
+bool ParseBreakpointSpec(std::string_view spec, BreakpointSpec &bp,
+                         std::string &error) {
+  size_t colon = spec.find(':');
+  BreakpointSpec parsed;
+  if (!ParseNumber(spec.substr(0, colon), parsed.inst_idx)) {
+    error = "expected an instruction index";
+    return false;
+  }
+  if (colon != std::string_view::npos) {
+    std::string_view rest = spec.substr(colon + 1);
+    size_t hits_colon = rest.find(':');
+    std::string_view condition = rest.substr(0, hits_colon);
+    if (!condition.empty()) {
+      if (!ParseCondition(condition, parsed.condition)) {
+        error = "expected a condition like r3==0 or r3<r4";
+        return false;
+      }
+      parsed.has_condition = true;
+    }
+    if (hits_colon != std::string_view::npos &&
+        (!ParseNumber(rest.substr(hits_colon + 1), parsed.hit_count) ||
+         parsed.hit_count == 0)) {
+      error = "the hit count must be a positive number";
+      return false;
+    }
+  }
+  bp = parsed;
+  return true;
+}
+
+bool ParseWatchSpec(std::string_view spec, Watch &watch, std::string &error) {
+  Watch parsed{};
+  if (!spec.empty() && spec[0] == 'r') {
+    parsed.kind = Watch::Kind::REGISTER;
+    if (!ParseRegister(spec, parsed.reg)) {
+      error = "expected a register r0 to r31";
+      return false;
+    }
+    watch = parsed;
+    return true;
+  }
+  parsed.kind = Watch::Kind::MEMORY;
+  size_t dash = spec.find('-');
+  if (!ParseNumber(spec.substr(0, dash), parsed.first)) {
+    error = "expected a register, an address or an address range first-last";
+    return false;
+  }
+  parsed.last = parsed.first;
+  if (dash != std::string_view::npos &&
+      (!ParseNumber(spec.substr(dash + 1), parsed.last) ||
+       parsed.last < parsed.first)) {
+    error = "expected an address range first-last with first <= last";
+    return false;
+  }
+  watch = parsed;
+  return true;
+}
+
+std::string DescribeCondition(const RegisterCondition &condition) {
+  return 'r' + std::to_string(condition.reg) +
+         std::string(kOperators[static_cast<size_t>(condition.op)]) +
+         (condition.rhs_is_register ? "r" : "") +
+         std::to_string(condition.rhs);
+}
+
+std::string DescribeWatch(const Watch &watch) {
+  if (watch.kind == Watch::Kind::REGISTER) {
+    return 'r' + std::to_string(watch.reg);
+  }
+  if (watch.first == watch.last) {
+    return std::to_string(watch.first);
+  }
+  return std::to_string(watch.first) + '-' + std::to_string(watch.last);
+}
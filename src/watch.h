@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+// Debugging stops beyond the plain breakpoint flag of Instruction:
+// conditional and hit-count breakpoints, and watchpoints on data memory and
+// registers. The pipeline only checks them in the instantiation compiled
+// with PipelinePolicy::watching, selected while any of them is set.
+
+enum class CompareOp : uint8_t { EQ, NE, LT, LE, GT, GE };
+
+// a register compared with a constant or another register, e.g. "r3==0"
+// or "r3<r4"
+struct RegisterCondition {
+  uint8_t reg;
+  CompareOp op;
+  bool rhs_is_register;
+  long long rhs; // the constant, or the register number
+};
+
+inline bool Compare(long long lhs, CompareOp op, long long rhs) {
+  switch (op) {
+  case CompareOp::EQ:
+    return lhs == rhs;
+  case CompareOp::NE:
+    return lhs != rhs;
+  case CompareOp::LT:
+    return lhs < rhs;
+  case CompareOp::LE:
+    return lhs <= rhs;
+  case CompareOp::GT:
+    return lhs > rhs;
+  case CompareOp::GE:
+    return lhs >= rhs;
+  }
+  return false;
+}
+
+// A breakpoint on inst_idx that counts the times it is reached with its
+// condition holding and stops from the hit_count-th of them on. A plain
+// breakpoint has no condition and a hit count of 1.
+struct BreakpointSpec {
+  size_t inst_idx{0};
+  bool has_condition{false};
+  RegisterCondition condition{};
+  uint64_t hit_count{1};
+
+  bool IsPlain() const { return !has_condition && hit_count == 1; }
+};
+
+// Parse "index[:condition[:hit count]]", e.g. "12", "12:r3==0",
+// "12:r3>=r4:5" or "12::100"; the condition operators are == != < <= > >=.
+// Return false and describe the problem in error.
+bool ParseBreakpointSpec(std::string_view spec, BreakpointSpec &bp,
+                         std::string &error);
+
+// Stop when a sw writes a word in [first, last] (MEMORY), or when a write
+// back changes the value of reg (REGISTER).
+struct Watch {
+  enum class Kind : uint8_t { MEMORY, REGISTER };
+  Kind kind;
+  uint8_t reg;
+  uint64_t first;
+  uint64_t last;
+};
+
+// Parse "rN", "address" or "first-last". Return false and describe the
+// problem in error.
+bool ParseWatchSpec(std::string_view spec, Watch &watch, std::string &error);
+
+// the spec the parsers accept, for listings
+std::string DescribeCondition(const RegisterCondition &condition);
+std::string DescribeWatch(const Watch &watch);
@@ -0,0 +1,125 @@
+#include "workload.h"
+
+#include <algorithm>
+#include <random>
+#include <sstream>
+
+// r1 outer counter, r2 data pointer, r3 inner counter, r8 constant 1,
+// r9 alternates 1/0 every iteration, r10..r17 generated values
+static constexpr size_t kFirstValueReg = 10;
+static constexpr size_t kValueRegs = 8;
+
+std::string GenerateWorkload(const WorkloadParams &params) {
+  std::mt19937_64 rng(params.seed);
+  std::uniform_real_distribution<double> chance(0.0, 1.0);
+  auto pick = [&rng](size_t bound) {
+    return std::uniform_int_distribution<size_t>(0, bound - 1)(rng);
+  };
+  const size_t trip_count = std::max<size_t>(params.trip_count, 1);
+  const size_t stride = std::max<size_t>(params.footprint / trip_count, 1);
+
+  std::ostringstream out;
+  out << "# generated workload " << params.name << "\n"
+      << ".data\n"
+      << "Base: 0\n"
+      << ".text\n"
+      << "\taddi\tr1,r0," << std::max<size_t>(params.passes, 1) << '\n'
+      << "\taddi\tr8,r0,1\n"
+      << "outer:\n"
+      << "\taddi\tr2,r0,0\n"
+      << "\taddi\tr3,r0," << trip_count << '\n'
+      << "inner:\n"
+      << "\tsub\tr9,r8,r9\n";
+
+  size_t last_written = kFirstValueReg;
+  size_t next_dest = 0;
+  auto source = [&]() {
+    if (chance(rng) < params.dependency) {
+      return last_written;
+    }
+    return kFirstValueReg + pick(kValueRegs);
+  };
+  size_t label_num = 0;
+  for (size_t slot = 0; slot < params.body_size; ++slot) {
+    size_t dest = kFirstValueReg + next_dest;
+    double kind = chance(rng);
+    if (kind < params.branch_rate && slot + 1 < params.body_size) {
+      // taken every other iteration, skipping one addi
+      out << "\t" << (pick(2) == 0 ? "beqz" : "bnez") << "\tr9,skip"
+          << label_num << '\n'
+          << "\taddi\tr" << dest << ",r" << source() << ',' << 1 + pick(7)
+          << '\n'
+          << "skip" << label_num << ":\n";
+      ++label_num;
+      ++slot;
+    } else if (kind < params.branch_rate + params.memory_rate) {
+      if (pick(2) == 0) {
+        out << "\tlw\tr" << dest << ",r2," << pick(stride) << '\n';
+      } else {
+        out << "\tsw\tr" << source() << ",r2," << pick(stride) << '\n';
+        continue;
+      }
+    } else if (kind < params.branch_rate + params.memory_rate +
+                          params.muldiv_rate) {
+      if (pick(2) == 0) {
+        out << "\tmul\tr" << dest << ",r" << source() << ','
+            << (pick(2) == 0 ? "r8" : "r9") << '\n';
+      } else {
+        out << "\tdiv\tr" << dest << ",r" << source() << ",r8\n";
+      }
+    } else {
+      static const char *const kSmallRegs[] = {"r8", "r9", "r3"};
+      switch (pick(4)) {
+      case 0:
+        out << "\taddi\tr" << dest << ",r" << source() << ',' << 1 + pick(15)
+            << '\n';
+        break;
+      case 1:
+        out << "\tsubi\tr" << dest << ",r" << source() << ',' << 1 + pick(15)
+            << '\n';
+        break;
+      case 2:
+        out << "\tadd\tr" << dest << ",r" << source() << ','
+            << kSmallRegs[pick(3)] << '\n';
+        break;
+      default:
+        out << "\tsub\tr" << dest << ",r" << source() << ','
+            << kSmallRegs[pick(3)] << '\n';
+        break;
+      }
+    }
+    last_written = dest;
+    next_dest = (next_dest + 1) % kValueRegs;
+  }
+
+  out << "\taddi\tr2,r2," << stride << '\n'
+      << "\tsubi\tr3,r3,1\n"
+      << "\tbnez\tr3,inner\n"
+      << "\tsubi\tr1,r1,1\n"
+      << "\tbnez\tr1,outer\n";
+  return out.str();
+}
+
+std::vector<WorkloadParams> StandardWorkloads(size_t scale) {
+  std::vector<WorkloadParams> workloads;
+  auto add = [&](const char *name, double dependency, double branch_rate,
+                 double memory_rate, size_t footprint, double muldiv_rate) {
+    WorkloadParams params;
+    params.name = name;
+    params.dependency = dependency;
+    params.branch_rate = branch_rate;
+    params.memory_rate = memory_rate;
+    params.muldiv_rate = muldiv_rate;
+    params.footprint = footprint;
+    params.passes = 512 * scale;
+    workloads.push_back(params);
+  };
+  add("alu-independent", 0.0, 0.0, 0.0, 1024, 0.0);
+  add("alu-chain", 0.9, 0.0, 0.0, 1024, 0.0);
+  add("branchy", 0.3, 0.3, 0.1, 1024, 0.0);
+  add("memory-small", 0.3, 0.0, 0.5, 256, 0.0);
+  add("memory-large", 0.3, 0.0, 0.5, 1 << 18, 0.0);
+  add("mixed", 0.5, 0.15, 0.25, 1 << 14, 0.0);
+  add("muldiv", 0.5, 0.0, 0.1, 1024, 0.2);
+  return workloads;
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Parameters of a synthetic workload: a loop nest whose body is a random
+// mix of ALU operations, mul/div, lw/sw and forward branches.
+struct WorkloadParams {
+  std::string name;
+  size_t body_size{16};    // generated instructions per inner iteration
+  double dependency{0.5};  // chance an operand is the previous result
+  double branch_rate{0.0}; // share of body slots that are branches
+  double memory_rate{0.2}; // share of body slots that are lw/sw
+  double muldiv_rate{0.0}; // share of body slots that are mul/div
+  size_t trip_count{256};  // inner loop iterations per pass
+  size_t footprint{1024};  // data words touched per pass
+  size_t passes{64};       // outer loop iterations
+  uint64_t seed{1};
+};
+
+// Generate the workload as assembly in the format of tests/*.S. The same
+// parameters always give the same program. Register values stay bounded:
+// two-source ALU operations take their second operand from small counters,
+// mul multiplies by 0 or 1 and div divides by 1, so long runs do not
+// overflow or divide by zero.
+std::string GenerateWorkload(const WorkloadParams &params);
+
+// the standard benchmark suite, about 2.5M instructions per workload times
+// scale
+std::vector<WorkloadParams> StandardWorkloads(size_t scale);
@@ -0,0 +1,33 @@
+# cmake -DSIMULATOR=<path> -DPROGRAM=<file> [-DENGINE=<options>] -P
+#   sample_total.cmake
+# Runs PROGRAM functionally and then sampled with ENGINE, and fails unless
+# the sampled run reports every instruction of the functional one.
+separate_arguments(engine_options UNIX_COMMAND "${ENGINE}")
+
+execute_process(COMMAND ${SIMULATOR} ${PROGRAM} --batch --functional
+                INPUT_FILE /dev/null
+                OUTPUT_VARIABLE plain_output
+                RESULT_VARIABLE plain_result)
+if(NOT plain_result EQUAL 0)
+  message(FATAL_ERROR "functional run failed:\n${plain_output}")
+endif()
+string(REGEX MATCH "([0-9]+) instructions fast-forwarded" plain_match
+       "${plain_output}")
+set(plain_total "${CMAKE_MATCH_1}")
+
+execute_process(COMMAND ${SIMULATOR} ${PROGRAM} --batch ${engine_options}
+                        --sample 400:50:100
+                INPUT_FILE /dev/null
+                OUTPUT_VARIABLE sampled_output
+                RESULT_VARIABLE sampled_result)
+if(NOT sampled_result EQUAL 0)
+  message(FATAL_ERROR "sampled run failed:\n${sampled_output}")
+endif()
+string(REGEX MATCH "Sampled simulation:\n\t([0-9]+) instructions"
+       sampled_match "${sampled_output}")
+set(sampled_total "${CMAKE_MATCH_1}")
+
+if(plain_total STREQUAL "" OR NOT plain_total STREQUAL sampled_total)
+  message(FATAL_ERROR "'${ENGINE}' --sample reports ${sampled_total} "
+                      "instructions, the functional run ${plain_total}")
+endif()